@@ -37,6 +37,12 @@ endif
 #     		        collector can run.
 # TOKUI_HARDSTACKTESTS => forces a reallocation of the stack at every point
 # 			  where the stack can be reallocated.
+# Alternative implementations:
+# TOKUI_SWISSTABLE => Use open addressing (Swiss table) for the hash part
+#                     of tables instead of the chained scatter table.
+# Optional features:
+# TOKU_USE_JIT => Compile hot functions into native code (only on x86-64
+#                 Linux, ignored elsewhere).
 # Recommended macro to define for debug builds
 # TOKU_USE_APICHECK => enables asserts in the API (consistency checks)
 
@@ -16,6 +16,7 @@
 #include "tdebug.h"
 #include "tfunction.h"
 #include "tgc.h"
+#include "tjit.h"
 #include "tlist.h"
 #include "tmarshal.h"
 #include "tmem.h"
@@ -27,6 +28,7 @@
 #include "tokudae.h"
 #include "tokudaelimits.h"
 #include "tprotected.h"
+#include "tshape.h"
 #include "treader.h"
 #include "tstate.h"
 #include "tstring.h"
@@ -373,11 +375,18 @@ TOKU_API int32_t toku_to_bool(toku_State *T, int32_t idx) {
 TOKU_API const char *toku_to_lstring(toku_State *T, int32_t idx,
                                                     size_t *plen) {
     const TValue *o = index2value(T, idx);
+    OString *s;
     if (!ttisstring(o)) /* not a string? */
         return NULL;
-    else if (plen != NULL)
-        *plen = getstrlen(strval(o)); 
-    return getstr(strval(o));
+    s = strval(o);
+    if (t_unlikely(strisrope(s))) { /* rope? */
+        toku_lock(T);
+        s = tokuS_flatten(T, s); /* (kept alive by the rope) */
+        toku_unlock(T);
+    }
+    if (plen != NULL)
+        *plen = getstrlen(s); 
+    return getstr(s);
 }
 
 
@@ -460,10 +469,23 @@ TOKU_API void toku_arith(toku_State *T, int32_t op) {
 }
 
 
+/* flatten rope 'o' (if any), so that it can be compared without 'T' */
+#define flatrope(T,o) \
+    { if (t_unlikely(ttisropestring(o))) tokuS_flatten(T, strval(o)); }
+
+
 TOKU_API int32_t toku_rawequal(toku_State *T, int32_t index1, int32_t index2) {
     const TValue *lhs = index2value(T, index1);
     const TValue *rhs = index2value(T, index2);
-    return (isvalid(T, lhs) && isvalid(T, rhs)) ? tokuV_raweq(lhs, rhs) : 0;
+    if (!(isvalid(T, lhs) && isvalid(T, rhs)))
+        return 0;
+    else if (ttisstring(lhs) && ttisstring(rhs)) {
+        toku_lock(T);
+        flatrope(T, lhs);
+        flatrope(T, rhs);
+        toku_unlock(T);
+    }
+    return tokuV_raweq(lhs, rhs);
 }
 
 
@@ -803,19 +825,18 @@ TOKU_API int32_t toku_get_cindex(toku_State *T, toku_Integer i) {
 }
 
 
-t_sinline Table *gettable(toku_State *T, int32_t idx) {
+t_sinline const TValue *getfields(toku_State *T, int32_t idx) {
     const TValue *o = index2value(T, idx);
-    switch (ttypetag(o)) {
-        case TOKU_VINSTANCE: return insval(o)->fields;
-        case TOKU_VTABLE: return tval(o); 
-        default:  {
-            api_check(T, 0, "instance/table expected");
-            return NULL; /* to avoid warnings */
-        }
-    }
+    api_check(T, ttisinstance(o) || ttistable(o), "instance/table expected");
+    return o;
 }
 
 
+/* get field 'k' of instance or table 'o' */
+#define fieldget(o,k,res,fins,ftab) \
+        (ttisinstance(o) ? fins(insval(o), k, res) : ftab(tval(o), k, res))
+
+
 t_sinline int32_t getfield(toku_State *T, uint8_t tag, TValue *value) {
     if (tagisempty(tag))
         setnilval(s2v(T->sp.p));
@@ -828,13 +849,14 @@ t_sinline int32_t getfield(toku_State *T, uint8_t tag, TValue *value) {
 
 
 TOKU_API int32_t toku_get_field(toku_State *T, int32_t idx) {
-    Table *t;
+    const TValue *o;
     uint8_t tag;
     TValue value;
     toku_lock(T);
     api_checknelems(T, 1); /* key */
-    t = gettable(T, idx);
-    tag = tokuH_get(t, s2v(T->sp.p - 1), &value);
+    o = getfields(T, idx);
+    tokuS_flatvalue(T, s2v(T->sp.p - 1)); /* (ropes are not keys) */
+    tag = fieldget(o, s2v(T->sp.p - 1), &value, tokuSH_get, tokuH_get);
     T->sp.p--; /* remove key */
     return getfield(T, tag, &value);
 }
@@ -842,21 +864,24 @@ TOKU_API int32_t toku_get_field(toku_State *T, int32_t idx) {
 
 TOKU_API int32_t toku_get_field_str(toku_State *T, int32_t idx,
                                                    const char *key) {
-    Table *t;
+    const TValue *o;
+    TValue value;
+    uint8_t tag;
     toku_lock(T);
-    t = gettable(T, idx);
-    return getfieldstr(T, t, key);
+    o = getfields(T, idx);
+    tag = fieldget(o, tokuS_new(T, key), &value, tokuSH_getstr, tokuH_getstr);
+    return getfield(T, tag, &value);
 }
 
 
 TOKU_API int32_t toku_get_field_int(toku_State *T, int32_t idx,
                                                    toku_Integer key) {
-    Table *t;
+    const TValue *o;
     TValue value;
     uint8_t tag;
     toku_lock(T);
-    t = gettable(T, idx);
-    tag = tokuH_getint(t, key, &value);
+    o = getfields(T, idx);
+    tag = fieldget(o, key, &value, tokuSH_getint, tokuH_getint);
     return getfield(T, tag, &value);
 }
 
@@ -1022,7 +1047,7 @@ TOKU_API void toku_get_fieldtable(toku_State *T, int32_t idx) {
     toku_lock(T);
     o = index2value(T, idx);
     api_check(T, ttisinstance(o), "instance expected");
-    settval2s(T, T->sp.p, insval(o)->fields);
+    settval2s(T, T->sp.p, tokuSH_todict(T, insval(o)));
     api_inctop(T);
     toku_unlock(T);
 }
@@ -1109,21 +1134,27 @@ TOKU_API void toku_set_cindex(toku_State *T, toku_Integer i) {
 
 
 TOKU_API void toku_set_field(toku_State *T, int32_t obj) {
-    int32_t hres;
-    Table *t;
+    const TValue *o;
     TValue *value, *key;
     toku_lock(T);
     api_checknelems(T, 2); /* key and value */
-    t = gettable(T, obj);
+    o = getfields(T, obj);
     key = s2v(T->sp.p - 2);
     value = s2v(T->sp.p - 1);
-    tokuV_fastset(t, key, value, hres, tokuH_pset);
-    if (hres == HOK)
-        tokuV_finishfastset(T, t, value);
+    tokuS_flatvalue(T, key); /* (ropes are not keys) */
+    if (ttisinstance(o))
+        tokuSH_set(T, insval(o), key, value);
     else {
-        tokuH_finishset(T, t, key, value, hres);
-        tokuG_barrierback(T, obj2gco(t), value);
-        invalidateTMcache(t);
+        Table *t = tval(o);
+        int32_t hres;
+        tokuV_fastset(t, key, value, hres, tokuH_pset);
+        if (hres == HOK)
+            tokuV_finishfastset(T, t, value);
+        else {
+            tokuH_finishset(T, t, key, value, hres);
+            tokuG_barrierback(T, obj2gco(t), value);
+            invalidateTMcache(t);
+        }
     }
     T->sp.p -= 2; /* remove key and value */
     toku_unlock(T);
@@ -1132,32 +1163,45 @@ TOKU_API void toku_set_field(toku_State *T, int32_t obj) {
 
 TOKU_API void toku_set_field_str(toku_State *T, int32_t idx,
                                                 const char *key) {
-    Table *t;
+    const TValue *o;
     toku_lock(T);
     api_checknelems(T, 1);
-    t = gettable(T, idx);
-    rawsetstr(T, t, key, s2v(T->sp.p - 1));
+    o = getfields(T, idx);
+    if (ttisinstance(o)) {
+        setstrval2s(T, T->sp.p, tokuS_new(T, key)); /* anchor key */
+        api_inctop(T);
+        tokuSH_setstr(T, insval(o), strval(s2v(T->sp.p - 1)),
+                                    s2v(T->sp.p - 2));
+        T->sp.p -= 2; /* remove key and value */
+        toku_unlock(T);
+    } else
+        rawsetstr(T, tval(o), key, s2v(T->sp.p - 1));
 }
 
 
 TOKU_API void toku_set_field_int(toku_State *T, int32_t idx,
                                                 toku_Integer key) {
-    int32_t hres;
-    Table *t;
+    const TValue *o;
     TValue *value;
     toku_lock(T);
     api_checknelems(T, 1); /* value */
-    t = gettable(T, idx);
+    o = getfields(T, idx);
     value = s2v(T->sp.p - 1);
-    tokuV_fastset(t, key, value, hres, tokuH_psetint);
-    if (hres == HOK)
-        tokuV_finishfastset(T, t, value);
+    if (ttisinstance(o))
+        tokuSH_setint(T, insval(o), key, value);
     else {
-        TValue k;
-        setival(&k, key);
-        tokuH_finishset(T, t, &k, value, hres);
-        tokuG_barrierback(T, obj2gco(t), value);
-        invalidateTMcache(t);
+        Table *t = tval(o);
+        int32_t hres;
+        tokuV_fastset(t, key, value, hres, tokuH_psetint);
+        if (hres == HOK)
+            tokuV_finishfastset(T, t, value);
+        else {
+            TValue k;
+            setival(&k, key);
+            tokuH_finishset(T, t, &k, value, hres);
+            tokuG_barrierback(T, obj2gco(t), value);
+            invalidateTMcache(t);
+        }
     }
     T->sp.p--; /* remove value */
     toku_unlock(T);
@@ -1270,8 +1314,7 @@ TOKU_API void toku_set_fieldtable(toku_State *T, int32_t idx) {
     api_check(T, ttisinstance(o), "instance expected");
     api_check(T, ttistable(s2v(T->sp.p - 1)), "table expected");
     t = tval(s2v(T->sp.p - 1));
-    insval(o)->fields = t;
-    tokuG_objbarrier(T, gcoval(o), t);
+    tokuSH_setdict(T, insval(o), t);
     T->sp.p--;
     toku_unlock(T);
 }
@@ -1293,6 +1336,7 @@ TOKU_API int32_t toku_error(toku_State *T) {
     toku_lock(T);
     api_checknelems(T, 1); /* errobj */
     errobj = s2v(T->sp.p - 1);
+    tokuS_flatvalue(T, errobj); /* (error messages are read without 'T') */
     if (ttisshrstring(errobj) && eqshrstr(strval(errobj), G(T)->memerror)) {
         tokuM_error(T); /* raise a memory error */
     } else
@@ -1394,6 +1438,53 @@ TOKU_API int32_t toku_load(toku_State *T, toku_Reader reader, void *userdata,
 }
 
 
+/* reader for 'toku_loadblob', giving the whole block once */
+static const char *blobreader(toku_State *T, void *data, size_t *szread) {
+    const char **b = cast(const char **, data);
+    const char *p = b[0];
+    UNUSED(T);
+    b[0] = NULL;
+    *szread = cast_sizet(b[1] - p);
+    return p;
+}
+
+
+/*
+** Load a chunk held in the string or full userdata at index 'idx'.
+** Functions of a binary chunk in the mapped format keep that value
+** alive and borrow their arrays from its memory instead of copying them
+** (see 'borrow_block'); the memory of a userdata must not change while
+** any of those functions is alive.
+*/
+TOKU_API int32_t toku_loadblob(toku_State *T, int32_t idx,
+                               const char *chunkname, const char *mode) {
+    BuffReader Z = {0};
+    const char *b[2];
+    const TValue *o;
+    int32_t status;
+    toku_lock(T);
+    o = index2value(T, idx);
+    api_check(T, ttisstring(o) || ttisfulluserdata(o),
+                 "string or full userdata expected");
+    if (ttisstring(o)) {
+        OString *s = tokuS_flat(T, strval(o));
+        b[0] = getstr(s);
+        b[1] = b[0] + getstrlen(s);
+    } else {
+        b[0] = getuserdatamem(udval(o));
+        b[1] = b[0] + udval(o)->size;
+    }
+    if (!chunkname) chunkname = "?";
+    tokuR_init(T, &Z, blobreader, b);
+    Z.owner = gcoval(o);
+    status = tokuPR_parse(T, &Z, chunkname, mode);
+    if (status == TOKU_STATUS_OK) /* no errors? */
+        posload(T);
+    toku_unlock(T);
+    return status;
+}
+
+
 #define FUNCTION        "(fn();)();\n"
 
 static const char *reader(toku_State *T, void *data, size_t *szread) {
@@ -1439,6 +1530,15 @@ TOKU_API int32_t toku_combine(toku_State *T, const char *chunkname,
 ** Dump a Tokudae function, calling 'fw' to write its parts. Ensure
 ** the stack returns with its original size.
 */
+/* compile the bodies skipped in lazy mode (see 'tokuP_compile') */
+static void compilelazy(toku_State *T, Proto *p) {
+    if (p->lazy != NULL && tokuPR_compile(T, p) != TOKU_STATUS_OK)
+        tokuD_errormsg(T);
+    for (int32_t i = 0; i < p->sizep; i++)
+        compilelazy(T, p->p[i]);
+}
+
+
 TOKU_API int32_t toku_dump(toku_State *T, toku_Writer fw, void *data,
                                                           int32_t strip) {
     int32_t status;
@@ -1447,6 +1547,7 @@ TOKU_API int32_t toku_dump(toku_State *T, toku_Writer fw, void *data,
     toku_lock(T);
     api_checknelems(T, 1); /* function */
     api_check(T, ttisTclosure(f), "Tokudae function expected");
+    compilelazy(T, clTval(f)->p);
     status = tokuZ_dump(T, clTval(f)->p, fw, data, strip);
     T->sp.p = restorestack(T, otop);  /* restore top */
     toku_unlock(T);
@@ -1535,6 +1636,49 @@ TOKU_API int32_t toku_gc(toku_State *T, int32_t option, ...) {
 /* }====================================================================== */
 
 
+/* {======================================================================
+** JIT compiler API
+** ======================================================================= */
+
+/*
+** Control the JIT compiler. When native code is not available (see
+** 'TOKU_JIT'), TOKU_JIT_ISRUNNING gives 0 and other options give -1.
+*/
+TOKU_API int32_t toku_jit(toku_State *T, int32_t option, ...) {
+    va_list argp;
+    int32_t res = 0;
+    GState *gs = G(T);
+    if (!TOKU_JIT) /* no native code? */
+        return (option == TOKU_JIT_ISRUNNING) ? 0 : -1;
+    toku_lock(T);
+    va_start(argp, option);
+    switch (option) {
+        case TOKU_JIT_STOP: /* stop running (and compiling) native code */
+            gs->jitstop = 1;
+            break;
+        case TOKU_JIT_RESTART: /* restart JIT */
+            gs->jitstop = 0;
+            break;
+        case TOKU_JIT_ISRUNNING: /* check if JIT is running */
+            res = !gs->jitstop;
+            break;
+        case TOKU_JIT_THRESHOLD: { /* set or get compile threshold */
+            int32_t value = va_arg(argp, int32_t);
+            res = gs->jitthreshold;
+            if (value > 0)
+                gs->jitthreshold = value;
+            break;
+        }
+        default: res = -1; /* invalid option */
+    }
+    va_end(argp);
+    toku_unlock(T);
+    return res;
+}
+
+/* }====================================================================== */
+
+
 /* {======================================================================
 ** Warning-related functions
 ** ======================================================================= */
@@ -1591,15 +1735,10 @@ TOKU_API toku_Unsigned toku_len(toku_State *T, int32_t idx) {
     const TValue *o = index2value(T, idx);
     switch (ttypetag(o)) {
         case TOKU_VSHRSTR: return strval(o)->shrlen;
-        case TOKU_VLNGSTR: return strval(o)->u.lnglen;
+        case TOKU_VLNGSTR: case TOKU_VROPESTR: return strval(o)->u.lnglen;
         case TOKU_VLIST: return cast_u32(listval(o)->len);
-        case TOKU_VTABLE:
-            t = tval(o);
-            goto tlen;
-        case TOKU_VINSTANCE:
-            t = insval(o)->fields;
-        tlen:
-            return cast_u32(tokuH_len(t));
+        case TOKU_VTABLE: return cast_u32(tokuH_len(tval(o)));
+        case TOKU_VINSTANCE: return cast_u32(tokuSH_len(insval(o)));
         case TOKU_VCLASS:
             t = classval(o)->methods;
             if (t) return cast_u32(tokuH_len(t));
@@ -1615,12 +1754,16 @@ TOKU_API size_t toku_lenudata(toku_State *T, int32_t idx) {
 
 
 TOKU_API int32_t toku_nextfield(toku_State *T, int32_t obj) {
-    Table *t;
+    const TValue *o;
     int32_t more;
     toku_lock(T);
     api_checknelems(T, 1); /* key */
-    t = gettable(T, obj);
-    more = tokuH_next(T, t, T->sp.p - 1);
+    o = getfields(T, obj);
+    tokuS_flatvalue(T, s2v(T->sp.p - 1)); /* (ropes are not keys) */
+    if (ttisinstance(o))
+        more = tokuSH_next(T, insval(o), T->sp.p - 1);
+    else
+        more = tokuH_next(T, tval(o), T->sp.p - 1);
     if (more) {
         api_inctop(T);
     } else
@@ -1724,6 +1867,19 @@ TOKU_API int32_t toku_stackinuse(toku_State *T) {
 }
 
 
+TOKU_API void toku_icstats(toku_State *T, toku_Unsigned *hits,
+                                          toku_Unsigned *misses,
+                                          int32_t reset) {
+    GState *gs = G(T);
+    toku_lock(T);
+    if (hits) *hits = cast(toku_Unsigned, gs->ichits);
+    if (misses) *misses = cast(toku_Unsigned, gs->icmisses);
+    if (reset)
+        gs->ichits = gs->icmisses = 0;
+    toku_unlock(T);
+}
+
+
 static const char *aux_upvalue(const TValue *func, int32_t n, TValue **val,
                                GCObject **owner) {
     switch (ttypetag(func)) {
@@ -1898,9 +2054,9 @@ static void fillopcode(toku_State *T, Proto *f, int32_t pc, toku_Opcode *opc) {
     fill_opcode_args(T, pi, opc);
     opc->line = tokuD_getfuncline(f, pc);
     opc->offset = pc;
-    opc->op = *pi;
+    opc->op = getopOrig(*pi); /* (quickened opcodes are not exposed) */
     if (TOKU_OPCNAMESIZE > 1) /* names enabled? */
-        strcpy(opc->name, opnames[*pi]);
+        strcpy(opc->name, opnames[opc->op]);
     else /* otherwise names are disabled */
         opc->name[0] = '\0';
     opc->f = f;
@@ -1968,7 +2124,8 @@ TOKU_API int32_t toku_getopcode_next(toku_State *T, toku_Opcode *opc) {
     api_check(T, f != NULL, "expected filled 'opc'");
     api_check(T, pc <= lastpc(f), "invalid 'opc->offset'");
     api_check(T, opc->op < NUM_OPCODES, "invalid 'opc->op'");
-    api_check(T, f->code[pc] == opc->op, "invalid 'opc->offset' or 'opc->op'");
+    api_check(T, getopOrig(f->code[pc]) == opc->op,
+                 "invalid 'opc->offset' or 'opc->op'");
     if (pc + getopSize(opc->op) <= lastpc(f)) { /* have next opcode? */
         fillopcode(T, f, cast_i32(pc+getopSize(opc->op)), opc);
         return 1;
@@ -2155,6 +2312,16 @@ static void DClosure(Proto *f, toku_Opdesc *opd, int32_t i) {
 
 #define DTable(opd,sz)      DX("*sptr++ = new_table(%d);", decodesize(sz));
 
+static void DListK(Proto *f, toku_Opdesc *opd, int32_t k) {
+    int32_t n = DX("*sptr++ = new_list(constants[%d]); ", k);
+    COMMENTX(n, "%d elements", listval(&f->k[k])->len);
+}
+
+static void DTableK(Proto *f, toku_Opdesc *opd, int32_t k) {
+    int32_t n = DX("*sptr++ = new_table(constants[%d]); ", k);
+    COMMENTX(n, "%d fields", listval(&f->k[k])->len / 2);
+}
+
 static void DClass(toku_Opdesc *opd, int32_t mask) {
     int32_t hasmt = mask & 0x80;
     int32_t nmethods = mask & 0x7f;
@@ -2257,6 +2424,12 @@ static void DTest(toku_Opdesc *opd, int32_t pc, int32_t cond, int32_t pop) {
 
 }
 
+static void DSwitch(toku_Opdesc *opd, int32_t pc, int32_t k, int32_t miss) {
+    int32_t n = DX("pc += (top in constant[%d]) ? constant[%d][top] : %d; ",
+                   k, k, miss);
+    COMMENTX(n, "otherwise jump to %d", jumptarget(pc, miss, OP_SWITCH));
+}
+
 static void DCall(toku_Opdesc *opd, int32_t func, int32_t nres) {
     int32_t n = DX("base[%d](stackrange(&base[%d], &top)); ", func, func+1);
     preCall(n, nres);
@@ -2321,6 +2494,21 @@ static void DIndexK(Proto *f, toku_Opdesc *opd, int32_t slot, int32_t k,
     setExtraK(f, opd, k);
 }
 
+static void DIndexUp(Proto *f, toku_Opdesc *opd, int32_t idx, int32_t k,
+                                                              int32_t get) {
+    if (get)
+        DX("*sptr++ = upvalues[%d][constant[%d]];", idx, k);
+    else
+        DX("upvalues[%d][constant[%d]] = *--sptr;", idx, k);
+    setExtraK(f, opd, k);
+}
+
+static void DGetMethod(Proto *f, toku_Opdesc *opd, int32_t k) {
+    int32_t n = DX("*sptr = top; top = top[constant[%d]]; sptr++; ", k);
+    COMMENT(n, "method and its receiver");
+    setExtraK(f, opd, k);
+}
+
 static void DIndexI(toku_Opdesc *opd, int32_t slot, int32_t imm, int32_t l) {
     imm = setExtraI(opd, imm, l);
     if (slot != NOARG)
@@ -2366,6 +2554,21 @@ static void DForLoop(toku_Opdesc *opd, int32_t slot, int32_t offset,
     DAX(n, " else { sptr -= %d; }", npop);
 }
 
+static void DForPrepI(toku_Opdesc *opd, int32_t slot, int32_t offset,
+                                                      int32_t nargs) {
+    int32_t n = DX("if (base[%d] != range) { base[%d](", slot, slot);
+    n += DAX(n, "&base[%d], %d); } ", slot + 1, nargs);
+    DAX(n, "pc += %d;", offset);
+}
+
+static void DForLoopI(toku_Opdesc *opd, int32_t slot, int32_t offset,
+                                                      int32_t npop) {
+    int32_t n = DX("if (base[%d]-- != 0) { base[%d] = base[%d] += base[%d]; ",
+                   slot+VAR_TBC, slot+VAR_N, slot+1, slot+2);
+    n += DAX(n, "pc -= %d; }", offset);
+    DAX(n, " else { sptr -= %d; }", npop);
+}
+
 static void DReturn(Proto *f, toku_Opdesc *opd, int32_t slot, int32_t nres,
                                                               int32_t close) {
     int32_t n = 0;
@@ -2400,6 +2603,8 @@ static void setdescription(toku_State *T, toku_Opdesc *opd,
         case OP_NEWLIST: DList(opd, opc->args[0]); break;
         case OP_NEWCLASS: DClass(opd, opc->args[0]); break;
         case OP_NEWTABLE: DTable(opd, opc->args[0]); break;
+        case OP_NEWLISTK: DListK(f, opd, opc->args[0]); break;
+        case OP_NEWTABLEK: DTableK(f, opd, opc->args[0]); break;
         case OP_METHOD: DClassProp(f, opd, opc->args[0], "methods"); break;
         case OP_SETTM: DTagMethod(T, opd, opc->args[0]); break;
         case OP_SETMT: DClassProp(f, opd, opc->args[0], "metatable"); break;
@@ -2421,11 +2626,12 @@ static void setdescription(toku_State *T, toku_Opdesc *opd,
         case OP_FORPREP: DForPrep(opd, opc->args[0], opc->args[1]); break;
         case OP_FORCALL: DForCall(opd, opc->args[0], opc->args[1]-1); break;
         case OP_TAILCALL:
-            DTailCall(opd, opc->args[0]+1, opc->args[1]-1, opc->args[2]);
+            DTailCall(opd, opc->args[0]+1, opc->args[1]-1,
+                           opc->args[2] & CALLCLOSE);
             break;
         case OP_SETLOCAL:
             get = 0; /* fall through */
-        case OP_LOAD: case OP_GETLOCAL:
+        case OP_LOAD: case OP_GETLOCAL: case OP_ARITHLL:
             DLocal(opd, opc->args[0], get);
             break;
         case OP_SETUVAL:
@@ -2462,9 +2668,18 @@ static void setdescription(toku_State *T, toku_Opdesc *opd,
         case OP_TEST:
             DTest(opd, opc->offset, opc->args[0], flag);
             break;
+        case OP_SWITCH:
+            DSwitch(opd, opc->offset, opc->args[0], opc->args[1]);
+            break;
         case OP_FORLOOP:
             DForLoop(opd, opc->args[0], opc->args[1], opc->args[2]);
             break;
+        case OP_FORPREPI:
+            DForPrepI(opd, opc->args[0], opc->args[1], opc->args[2]);
+            break;
+        case OP_FORLOOPI:
+            DForLoopI(opd, opc->args[0], opc->args[1], opc->args[2]);
+            break;
         case OP_RETURN:
             DReturn(f, opd, opc->args[0], opc->args[1]-1, opc->args[2]);
             break;
@@ -2478,6 +2693,7 @@ static void setdescription(toku_State *T, toku_Opdesc *opd,
         case OP_SETINDEXINT:
             DIndexI(opd, opc->args[0], opc->args[1], flag);
             break;
+        case OP_GETMETHOD: DGetMethod(f, opd, opc->args[0]); break;
         case OP_GETPROPERTY:
             flag = 1; /* fall through */
         case OP_GETINDEXSTR:
@@ -2488,6 +2704,11 @@ static void setdescription(toku_State *T, toku_Opdesc *opd,
         case OP_SETINDEXSTR:
             DIndexK(f, opd, opc->args[0], opc->args[1], flag);
             break;
+        case OP_SETINDEXUP:
+            get = 0; /* fall through */
+        case OP_GETINDEXUP:
+            DIndexUp(f, opd, opc->args[0], opc->args[1], get);
+            break;
         case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
             descOrdI(opd, opc->args[0], opc->op);
             break;
@@ -2551,6 +2772,8 @@ TOKU_API int32_t toku_getcompinfo(toku_State *T, int32_t idx, toku_Cinfo *ci) {
     api_check(T, ttisfunction(o), "function expected");
     if (ttisTclosure(o)) {
         ci->f = getproto(o);
+        if (ci->f->lazy && tokuPR_compile(T, ci->f) != TOKU_STATUS_OK)
+            T->sp.p--; /* remove error message (body has no code) */
         setcompileinfo(ci);
         return 1; /* true; got prototype information */
     }
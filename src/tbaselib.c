@@ -17,6 +17,7 @@
 #include "tokudaeaux.h"
 #include "tokudaelib.h"
 #include "tokudaelimits.h"
+#include "tstate.h"
 
 
 /* {=====================================================================
@@ -355,6 +356,36 @@ static int32_t b_gc(toku_State *T) {
 }
 
 
+static int32_t b_jit(toku_State *T) {
+    static const char *const opts[] = {"stop", "restart", "isrunning",
+        "threshold", NULL};
+    static const int32_t numopts[] = {TOKU_JIT_STOP, TOKU_JIT_RESTART,
+        TOKU_JIT_ISRUNNING, TOKU_JIT_THRESHOLD};
+    int32_t opt = numopts[tokuL_check_option(T, 0, "isrunning", opts)];
+    switch (opt) {
+        case TOKU_JIT_ISRUNNING: {
+            toku_push_bool(T, toku_jit(T, opt));
+            return 1;
+        }
+        case TOKU_JIT_THRESHOLD: {
+            int32_t value = cast_i32(tokuL_opt_integer(T, 1, 0));
+            int32_t old = toku_jit(T, opt, value);
+            checkres(old);
+            toku_push_integer(T, old);
+            return 1;
+        }
+        default: {
+            int32_t res = toku_jit(T, opt);
+            checkres(res);
+            toku_push_integer(T, res);
+            return 1;
+        }
+    }
+    tokuL_push_fail(T); /* JIT is not available */
+    return 1;
+}
+
+
 /* default mode for 'load' and 'loadfile' is "bt" (binary/text) */
 #define getmode(T,idx)      tokuL_opt_string(T, idx, "bt")
 
@@ -401,13 +432,12 @@ static int32_t auxload(toku_State *T, int32_t status, int32_t envidx) {
 
 static int32_t b_load(toku_State *T) {
     int32_t status;
-    size_t l;
-    const char *s = toku_to_lstring(T, 0, &l);
+    const char *s = toku_to_string(T, 0);
     const char *mode = getmode(T, 2);
     int32_t env = (!toku_is_none(T, 3) ? 3 : 0);
     if (s != NULL) { /* loading a string? */
         const char *chunkname = tokuL_opt_string(T, 1, s);
-        status = tokuL_loadbufferx(T, s, l, chunkname, mode);
+        status = toku_loadblob(T, 0, chunkname, mode);
     } else { /* loading from a reader function */
         const char *chunkname = tokuL_opt_string(T, 1, "=(load)");
         tokuL_check_type(T, 0, TOKU_T_FUNCTION); /* 'chunk' must be function */
@@ -981,6 +1011,7 @@ static const tokuL_Entry basic_funcs[] = {
     {"error", b_error},
     {"assert", b_assert},
     {"gc", b_gc},
+    {"jit", b_jit},
     {"load", b_load},
     {"loadfile", b_loadfile},
     {"runfile", b_runfile},
@@ -1068,6 +1099,10 @@ int32_t tokuopen_basic(toku_State *T) {
     /* open lib into global instance */
     toku_push_globaltable(T);
     tokuL_set_funcs(T, basic_funcs, 0);
+    /* 'foreach' loops can step over these without calling them */
+    tokuT_setiterator(T, ITER_FIELDS, b_nextfield);
+    tokuT_setiterator(T, ITER_INDICES, auxindices);
+    tokuT_setiterator(T, ITER_RANGE, b_range);
     /* set global __G */
     toku_push(T, -1); /* copy of global table */
     toku_set_field_str(T, -2, TOKU_GNAME);
@@ -10,6 +10,7 @@
 #include "tokudaeprefix.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "tcode.h"
 #include "tlexer.h"
@@ -22,6 +23,7 @@
 #include "tparser.h"
 #include "tgc.h"
 #include "tmem.h"
+#include "tstring.h"
 
 
 /* check if expression has jumps */
@@ -145,6 +147,7 @@ TOKUI_DEF const OpProperties tokuC_opproperties[NUM_OPCODES] = {
     { FormatIL, 0, 0, 0 }, /* OP_JMPS */
     { FormatIS, 0, 0, 0 }, /* OP_TEST */
     { FormatIS, 0, 1, 0 }, /* OP_TESTPOP */
+    { FormatILL, 0, 0, 0 }, /* OP_SWITCH */
     { FormatILLS, VD, 0, 1 }, /* OP_CALL */
     { FormatILLS, VD, 0, 1 }, /* OP_TAILCALL */
     { FormatIL, 0, 0, 0 }, /* OP_CLOSE */
@@ -152,26 +155,64 @@ TOKUI_DEF const OpProperties tokuC_opproperties[NUM_OPCODES] = {
     { FormatILL, VD, 0, 0 }, /* OP_CHECKADJ */
     { FormatIL, 1, 0, 0 }, /* OP_GETLOCAL */
     { FormatIL, 0, 1, 0 }, /* OP_SETLOCAL */
+    { FormatIL, 1, 0, 0 }, /* OP_ARITHLL */
     { FormatIL, 1, 0, 0 }, /* OP_GETUVAL */
     { FormatIL, 0, 1, 0 }, /* OP_SETUVAL */
     { FormatILLS, VD, 0, 0 }, /* OP_SETLIST */
-    { FormatILL, 0, 1, 0 }, /* OP_SETPROPERTY */
-    { FormatIL, 0, 0, 1 }, /* OP_GETPROPERTY */
+    { FormatILLL, 0, 1, 0 }, /* OP_SETPROPERTY */
+    { FormatILL, 0, 0, 1 }, /* OP_GETPROPERTY */
+    { FormatILL, 1, 0, 0 }, /* OP_GETMETHOD */
     { FormatI, 0, 1, 1 }, /* OP_GETINDEX */
     { FormatIL, 0, 1, 0 }, /* OP_SETINDEX */
-    { FormatIL, 0, 0, 1 }, /* OP_GETINDEXSTR */
-    { FormatILL, 0, 1, 0 }, /* OP_SETINDEXSTR */
+    { FormatILL, 0, 0, 1 }, /* OP_GETINDEXSTR */
+    { FormatILLL, 0, 1, 0 }, /* OP_SETINDEXSTR */
+    { FormatILLL, 1, 0, 0 }, /* OP_GETINDEXUP */
+    { FormatILLL, 0, 1, 0 }, /* OP_SETINDEXUP */
     { FormatIS, 0, 0, 1 }, /* OP_GETINDEXINT */
     { FormatIL, 0, 0, 1 }, /* OP_GETINDEXINTL */
     { FormatILS, 0, 1, 0 }, /* OP_SETINDEXINT */
     { FormatILL, 0, 1, 0 }, /* OP_SETINDEXINTL */
-    { FormatIL, 0, 0, 1 }, /* OP_GETSUP */
+    { FormatILL, 0, 0, 1 }, /* OP_GETSUP */
     { FormatI, 0, 1, 1 }, /* OP_GETSUPIDX */
     { FormatI, 0, 1, 0 }, /* OP_INHERIT */
     { FormatILL, 0, 0, 0 }, /* OP_FORPREP */
     { FormatILL, VD, 0, 0 }, /* OP_FORCALL */
     { FormatILLL, VD, 0, 0 }, /* OP_FORLOOP */
+    { FormatILLL, 0, 0, 0 }, /* OP_FORPREPI */
+    { FormatILLL, VD, 0, 0 }, /* OP_FORLOOPI */
     { FormatILLS, 0, 0, 0 }, /* OP_RETURN */
+    { FormatIL, 1, 0, 0 }, /* OP_NEWLISTK */
+    { FormatIL, 1, 0, 0 }, /* OP_NEWTABLEK */
+    { FormatIS, 0, 1, 1 }, /* OP_ADDII */
+    { FormatIS, 0, 1, 1 }, /* OP_ADDFF */
+    { FormatIS, 0, 1, 1 }, /* OP_SUBII */
+    { FormatIS, 0, 1, 1 }, /* OP_SUBFF */
+    { FormatIS, 0, 1, 1 }, /* OP_MULII */
+    { FormatIS, 0, 1, 1 }, /* OP_MULFF */
+    { FormatIS, 0, 1, 1 }, /* OP_LTII */
+    { FormatIS, 0, 1, 1 }, /* OP_LTFF */
+    { FormatIS, 0, 1, 1 }, /* OP_LEII */
+    { FormatIS, 0, 1, 1 }, /* OP_LEFF */
+    { FormatI, 0, 1, 1 }, /* OP_GETINDEXLIST */
+    { FormatIS, 0, 0, 1 }, /* OP_GETINDEXINTLIST */
+    { FormatILL, VD, 0, 0 }, /* OP_FORLIST */
+    { FormatILL, VD, 0, 0 }, /* OP_FORTABLE */
+};
+
+
+/*
+** Original opcodes of quickened opcodes.
+** "ORDER OP"
+*/
+TOKUI_DEF const uint8_t tokuC_quickorig[NUM_OPCODES - OP_NEWTABLEK - 1] = {
+    OP_ADD, OP_ADD, /* OP_ADDII, OP_ADDFF */
+    OP_SUB, OP_SUB, /* OP_SUBII, OP_SUBFF */
+    OP_MUL, OP_MUL, /* OP_MULII, OP_MULFF */
+    OP_LT, OP_LT, /* OP_LTII, OP_LTFF */
+    OP_LE, OP_LE, /* OP_LEII, OP_LEFF */
+    OP_GETINDEX, /* OP_GETINDEXLIST */
+    OP_GETINDEXINT, /* OP_GETINDEXINTLIST */
+    OP_FORCALL, OP_FORCALL, /* OP_FORLIST, OP_FORTABLE */
 };
 
 
@@ -242,7 +283,6 @@ static void removelastlineinfo(FunctionState *fs) {
     Proto *p = fs->p;
     int32_t pc = fs->prevpc;
     if (p->lineinfo[pc] != ABSLINEINFO) { /* relative line info? */
-        toku_assert(p->lineinfo[pc] >= 0); /* must have valid offset */
         fs->prevline -= p->lineinfo[pc]; /* fix last line saved */
         fs->iwthabs--; /* undo previous increment */
     } else { /* otherwise absolute line info */
@@ -285,6 +325,18 @@ void tokuC_removelastjump(FunctionState *fs) {
 }
 
 
+/*
+** Remove last opcode which must be a call with 'nargs' arguments,
+** leaving the function and its arguments on the stack.
+*/
+void tokuC_removelastcall(FunctionState *fs, int32_t nargs) {
+    toku_assert(*prevOP(fs) == OP_CALL);
+    toku_assert(GET_ARG_L(prevOP(fs), 0) == fs->sp);
+    removelastopcode(fs);
+    tokuC_reserveslots(fs, nargs + 1);
+}
+
+
 /*
 ** Change line information associated with current position, by removing
 ** previous info and adding it again with new line.
@@ -396,11 +448,12 @@ static int32_t emitILLS(FunctionState *fs, uint8_t i, int32_t a, int32_t b,
 }
 
 
-int32_t tokuC_call(FunctionState *fs, int32_t base, int32_t nres) {
+int32_t tokuC_call(FunctionState *fs, int32_t base, int32_t nres,
+                                                   int32_t self) {
     toku_assert(nres >= TOKU_MULTRET);
     freeslots(fs, fs->sp - base); /* call removes function and arguments */
     toku_assert(fs->sp == base);
-    return emitILLS(fs, OP_CALL, base, nres + 1, 0);
+    return emitILLS(fs, OP_CALL, base, nres + 1, self ? CALLSELF : 0);
 }
 
 
@@ -496,6 +549,14 @@ static int32_t intK(FunctionState *fs, toku_Integer i) {
 }
 
 
+/* key of non-zero float 'n' in 'kcache' (see 'fltK') */
+static toku_Number fltkey(toku_Number n) {
+    const int32_t nmb = t_floatatt(MANT_DIG); 
+    const toku_Number q = t_mathop(ldexp)(t_mathop(1.0), -nmb + 1);
+    return n * (1 + q);
+}
+
+
 /*
 ** Add a float to list of constants and return its index. Floats
 ** with integral values need a different key, to avoid collision
@@ -514,11 +575,8 @@ static int32_t fltK(FunctionState *fs, toku_Number n) {
         setpval(&kv, fs); /* use FunctionState as index */
         return k2proto(fs, &kv, &vn);/* cannot collide */
     } else {
-        const int32_t nmb = t_floatatt(MANT_DIG); 
-        const toku_Number q = t_mathop(ldexp)(t_mathop(1.0), -nmb + 1);
-        const toku_Number k = n * (1 + q); /* key */
         toku_Integer ik;
-        setfval(&kv, k);
+        setfval(&kv, fltkey(n));
         if (!tokuO_n2i(n, &ik, N2IEQ)) { /* not an integral value? */
             int32_t n = k2proto(fs, &kv, &vn); /* use key */
             if (tokuV_raweq(&fs->p->k[n], &vn)) /* correct value? */
@@ -806,6 +864,13 @@ static int32_t isnumIK(ExpInfo *e, int32_t *imm) {
 }
 
 
+/* get index of a new inline cache (see 'InlineCache') */
+static int32_t newcache(FunctionState *fs) {
+    tokuP_checklimit(fs, fs->nic, MAX_ARG_L, "inline caches");
+    return fs->nic++;
+}
+
+
 static int32_t setindexint(FunctionState *fs, ExpInfo *v, int32_t left) {
     int32_t imm = encodeimm(v->u.info);
     if (isIMM(v->u.info))
@@ -835,15 +900,21 @@ int32_t tokuC_storevar(FunctionState *fs, ExpInfo *var, int32_t left) {
             extra = 2;
             break;
         case EXP_INDEXSTR:
-            var->u.info = tokuC_emitILL(fs, OP_SETINDEXSTR, left+1, var->u.info);
+            var->u.info = tokuC_emitILLL(fs, OP_SETINDEXSTR, left+1, var->u.info,
+                                                              newcache(fs));
             extra = 1;
             break;
+        case EXP_INDEXUP:
+            var->u.info = tokuC_emitILLL(fs, OP_SETINDEXUP, var->u.iu.t,
+                                             var->u.iu.k, newcache(fs));
+            break;
         case EXP_INDEXINT:
             var->u.info = setindexint(fs, var, left+1);
             extra = 1;
             break;
         case EXP_DOT:
-            var->u.info = tokuC_emitILL(fs, OP_SETPROPERTY, left+1, var->u.info);
+            var->u.info = tokuC_emitILLL(fs, OP_SETPROPERTY, left+1, var->u.info,
+                                                              newcache(fs));
             extra = 1;
             break;
         case EXP_SUPER: case EXP_INDEXSUPER: case EXP_INDEXSUPERSTR:
@@ -977,6 +1048,39 @@ void tokuC_const2v(FunctionState *fs, ExpInfo *e, TValue *v) {
 }
 
 
+/*
+** If expression 'e' is a constant (without jumps), set its value
+** into 'v' and return true.
+*/
+int32_t tokuC_exp2const(FunctionState *fs, ExpInfo *e, TValue *v) {
+    if (!eisconstant(e) || hasjumps(e))
+        return 0;
+    tokuC_const2v(fs, e, v);
+    return 1;
+}
+
+
+/*
+** Convert compile-time constant 'e' (EXP_CONST) into the constant
+** expression of its value.
+*/
+void tokuC_const2exp(FunctionState *fs, ExpInfo *e) {
+    const TValue *v = &fs->lx->dyd->actlocals.arr[e->u.info].val;
+    switch (ttypetag(v)) {
+        case TOKU_VNIL: e->et = EXP_NIL; break;
+        case TOKU_VFALSE: e->et = EXP_FALSE; break;
+        case TOKU_VTRUE: e->et = EXP_TRUE; break;
+        case TOKU_VNUMINT: e->et = EXP_INT; e->u.i = ival(v); break;
+        case TOKU_VNUMFLT: e->et = EXP_FLT; e->u.n = fval(v); break;
+        case TOKU_VSHRSTR: case TOKU_VLNGSTR:
+            e->et = EXP_STRING;
+            e->u.str = strval(v);
+            break;
+        default: toku_assert(0); /* invalid compile-time constant */
+    }
+}
+
+
 /*
 ** Ensure expression 'v' is not a variable.
 ** This additionally reserves stack slot (if one is needed).
@@ -990,13 +1094,17 @@ int32_t tokuC_dischargevars(FunctionState *fs, ExpInfo *v) {
         case EXP_LOCAL:
             v->u.info = tokuC_emitIL(fs, OP_GETLOCAL, v->u.var.sidx);
             break;
+        case EXP_INDEXUP:
+            v->u.info = tokuC_emitILLL(fs, OP_GETINDEXUP, v->u.iu.t,
+                                           v->u.iu.k, newcache(fs));
+            break;
         case EXP_INDEXED:
             freeslots(fs, 2);
             v->u.info = tokuC_emitI(fs, OP_GETINDEX);
             break;
         case EXP_INDEXSTR:
             freeslots(fs, 1);
-            v->u.info = tokuC_emitIL(fs, OP_GETINDEXSTR, v->u.info);
+            v->u.info = tokuC_emitILL(fs, OP_GETINDEXSTR, v->u.info, newcache(fs));
             break;
         case EXP_INDEXINT:
             freeslots(fs, 1);
@@ -1008,11 +1116,11 @@ int32_t tokuC_dischargevars(FunctionState *fs, ExpInfo *v) {
             break;
         case EXP_DOTSUPER: case EXP_INDEXSUPERSTR:
             freeslots(fs, 1);
-            v->u.info = tokuC_emitIL(fs, OP_GETSUP, v->u.info);
+            v->u.info = tokuC_emitILL(fs, OP_GETSUP, v->u.info, newcache(fs));
             break;
         case EXP_DOT:
             freeslots(fs, 1);
-            v->u.info = tokuC_emitIL(fs, OP_GETPROPERTY, v->u.info);
+            v->u.info = tokuC_emitILL(fs, OP_GETPROPERTY, v->u.info, newcache(fs));
             break;
         case EXP_CALL: case EXP_VARARG:
             tokuC_setreturns(fs, v, 1); /* default is one value returned */
@@ -1021,6 +1129,9 @@ int32_t tokuC_dischargevars(FunctionState *fs, ExpInfo *v) {
         case EXP_SUPER:
             v->et = EXP_FINEXPR;
             return 1; /* done */
+        case EXP_CONST:
+            tokuC_const2exp(fs, v);
+            return 0; /* expression is now a constant */
         default: return 0; /* expression is not a variable */
     }
     tokuC_reserveslots(fs, 1);
@@ -1087,6 +1198,58 @@ void tokuC_settablesize(FunctionState *fs, int32_t pc, int32_t hsize) {
 }
 
 
+/*
+** Remove constants from index 'nk' up (used only by removed opcodes)
+** together with their entries in 'kcache' (see 'k2proto').
+*/
+static void removeK(FunctionState *fs, int32_t nk) {
+    toku_State *T = fs->lx->T;
+    Proto *p = fs->p;
+    while (fs->nk > nk) {
+        TValue *v = &p->k[--fs->nk];
+        TValue key, idx;
+        switch (ttypetag(v)) {
+            case TOKU_VNIL: settval(T, &key, fs->kcache); break;
+            case TOKU_VNUMFLT:
+                if (fval(v) == 0) {
+                    setpval(&key, fs); /* (see 'fltK') */
+                } else
+                    setfval(&key, fltkey(fval(v)));
+                break;
+            default: setobj(T, &key, v); break;
+        }
+        if (!tagisempty(tokuH_get(fs->kcache, &key, &idx)) &&
+                ival(&idx) == fs->nk) { /* entry of this constant? */
+            setnilval(&idx);
+            tokuH_set(T, fs->kcache, &key, &idx); /* remove it */
+        }
+        setnilval(v);
+    }
+}
+
+
+/*
+** Replace list or table constructor starting at 'pc' (OP_NEWLIST or
+** OP_NEWTABLE), whose elements are all constants, with a single
+** OP_NEWLISTK or OP_NEWTABLEK that creates it from 'elems'. All the
+** code after 'pc' loads and stores the elements, so it is removed,
+** together with the constants it added to 'constants' (from 'nk' up).
+*/
+void tokuC_constructorK(FunctionState *fs, int32_t pc, int32_t nk,
+                                           TValue *elems) {
+    Proto *p = fs->p;
+    uint8_t op = (p->code[pc] == OP_NEWLIST) ? OP_NEWLISTK : OP_NEWTABLEK;
+    int32_t nabs = fs->nabslineinfo;
+    toku_assert(p->code[pc] == OP_NEWLIST || p->code[pc] == OP_NEWTABLE);
+    while (currPC > pc)
+        removelastopcode(fs);
+    if (fs->nabslineinfo != nabs) /* removed absolute line info? */
+        fs->iwthabs = MAXOWTHABS + 1; /* 'prevline' may be off; reset it */
+    removeK(fs, nk);
+    tokuC_emitIL(fs, op, addK(fs, p, elems));
+}
+
+
 /*
 ** Ensure expression 'e' is on top of the stack, making 'e'
 ** a finalized expression.
@@ -1167,6 +1330,31 @@ void tokuC_getdotted(FunctionState *fs, ExpInfo *v, ExpInfo *key,
 }
 
 
+/*
+** Emit method lookup for a self call 'v.key(...)'; this leaves the
+** function and its receiver on the stack (see OP_GETMETHOD).
+*/
+void tokuC_getmethod(FunctionState *fs, ExpInfo *v) {
+    toku_assert(v->et == EXP_DOT);
+    v->u.info = tokuC_emitILL(fs, OP_GETMETHOD, v->u.info, newcache(fs));
+    tokuC_reserveslots(fs, 1); /* space for 'self' */
+    v->et = EXP_FINEXPR;
+}
+
+
+/*
+** Initialize upvalue 'var' indexed by string 'key' (global variable).
+*/
+void tokuC_indexup(FunctionState *fs, ExpInfo *var, ExpInfo *key) {
+    int32_t t = var->u.info;
+    toku_assert(var->et == EXP_UVAL && eisstring(key));
+    string2K(fs, key);
+    var->u.iu.t = t;
+    var->u.iu.k = key->u.info;
+    var->et = EXP_INDEXUP;
+}
+
+
 /* 
 ** Initialize '[]' indexed expression.
 */
@@ -1340,6 +1528,74 @@ int32_t tokuC_test(FunctionState *fs, OpCode optest, int32_t cond,
 }
 
 
+/*
+** Emit switch dispatch opcode; its jump table and the jump for values
+** that are not in it are set by 'tokuC_fixswitch'.
+*/
+int32_t tokuC_switch(FunctionState *fs) {
+    return tokuC_emitILL(fs, OP_SWITCH, 0, 0);
+}
+
+
+/* get offset from the switch dispatch opcode at 'pc' to 'target' */
+static int32_t switchoffset(FunctionState *fs, int32_t pc, int32_t target) {
+    int32_t offset = target - (pc + getopSize(OP_SWITCH));
+    toku_assert(offset >= 0);
+    if (t_unlikely(MAXJMP < offset))
+        tokuP_semerror(fs->lx, "control structure too long");
+    if (fs->lasttarget < target)
+        fs->lasttarget = target;
+    return offset;
+}
+
+
+/*
+** Fix switch dispatch opcode at 'pc'. The jump table maps each literal
+** in 'li' (of size 'n') that has a case body to the offset of that body
+** (the first literal wins if different literals are equal keys, as the
+** cases are tested in order). Values not in the table jump to 'miss'.
+*/
+void tokuC_fixswitch(FunctionState *fs, int32_t pc, const LiteralInfo *li,
+                                        int32_t n, int32_t miss) {
+    toku_State *T = fs->lx->T;
+    Proto *p = fs->p;
+    uint8_t *inst = &p->code[pc];
+    TValue key, val;
+    Table *t;
+    int32_t k;
+    toku_assert(*inst == OP_SWITCH);
+    setnilval(&key);
+    k = addK(fs, p, &key); /* reserve constant for the table */
+    t = tokuH_new(T);
+    settval(T, &p->k[k], t); /* anchor it */
+    tokuG_objbarrier(T, p, t);
+    for (int32_t i = 0; i < n; i++) {
+        if (li[i].pc == NOPC) /* not dispatched? */
+            continue; /* skip it */
+        switch (li[i].tt) {
+            case TOKU_VNUMINT: setival(&key, li[i].lit.i); break;
+            case TOKU_VNUMFLT: {
+                if (t_unlikely(tokui_numisnan(li[i].lit.n)))
+                    continue; /* never matches */
+                setfval(&key, li[i].lit.n);
+                break;
+            }
+            default:
+                toku_assert(li[i].tt == TOKU_VSHRSTR ||
+                            li[i].tt == TOKU_VLNGSTR);
+                setstrval(T, &key, li[i].lit.str);
+                break;
+        }
+        if (tagisempty(tokuH_get(t, &key, &val))) { /* first one? */
+            setival(&val, switchoffset(fs, pc, li[i].pc));
+            tokuH_set(T, t, &key, &val);
+        }
+    }
+    SET_ARG_L(inst, 0, k);
+    SET_ARG_L(inst, 1, switchoffset(fs, pc, miss));
+}
+
+
 /* code and/or logical operators */
 static int32_t codeAndOr(FunctionState *fs, ExpInfo *e, int32_t cond,
                                                         int32_t linenum) {
@@ -1634,6 +1890,48 @@ static uint8_t *previousopcode(FunctionState *fs) {
 }
 
 
+/*
+** Try to fold the concatenation of two string literals. 'e1' must be
+** the string pushed by the last opcode (which no jump targets), that
+** opcode is removed and 'e1' becomes the resulting string literal.
+*/
+static int32_t concatK(FunctionState *fs, ExpInfo *e1, ExpInfo *e2) {
+    uint8_t *inst = previousopcode(fs);
+    const TValue *k1;
+    OString *s1, *s2, *s;
+    size_t l1, l2;
+    if (!eisstring(e2) || hasjumps(e2) || e1->u.info != fs->prevpc ||
+            fs->lasttarget >= fs->prevpc)
+        return 0; /* not a literal or it is a jump target */
+    else if (*inst == OP_CONST)
+        k1 = &fs->p->k[GET_ARG_S(inst, 0)];
+    else if (*inst == OP_CONSTL)
+        k1 = &fs->p->k[GET_ARG_L(inst, 0)];
+    else
+        return 0; /* 'e1' is not a constant */
+    if (!ttisstring(k1)) return 0; /* 'e1' is not a string */
+    s1 = strval(k1); s2 = e2->u.str;
+    l1 = getstrlen(s1); l2 = getstrlen(s2);
+    if (l2 >= TOKU_MAXSIZE - sizeof(OString) - l1)
+        return 0; /* result is too long (leave error for runtime) */
+    if (l1 + l2 <= TOKUI_MAXSHORTLEN) { /* fits in a short string? */
+        char buff[TOKUI_MAXSHORTLEN];
+        memcpy(buff, getstr(s1), l1);
+        memcpy(buff + l1, getstr(s2), l2);
+        s = tokuS_newl(fs->lx->T, buff, l1 + l2);
+    } else { /* otherwise long string */
+        s = tokuS_newlngstrobj(fs->lx->T, l1 + l2);
+        memcpy(getstr(s), getstr(s1), l1);
+        memcpy(getstr(s) + l1, getstr(s2), l2);
+    }
+    removelastopcode(fs); /* remove 'e1' from the stack */
+    freeslots(fs, 1);
+    e1->et = EXP_STRING;
+    e1->u.str = tokuY_anchorstring(fs->lx, s);
+    return 1;
+}
+
+
 static void codeconcat(FunctionState *fs, ExpInfo *e1, ExpInfo *e2,
                                                        int32_t linenum) {
     uint8_t *inst = previousopcode(fs);
@@ -1690,6 +1988,8 @@ void tokuC_binary(FunctionState *fs, ExpInfo *e1, ExpInfo *e2,
             codebinIK(fs, e1, e2, opr, 0, 0, linenum);
             break;
         case OPR_CONCAT:
+            if (concatK(fs, e1, e2))
+                break; /* folded */
             tokuC_exp2stack(fs, e2); /* second operand must be on stack */
             codeconcat(fs, e1, e2, linenum);
             break;
@@ -1738,22 +2038,494 @@ static int32_t finaltarget(uint8_t *code, int32_t i) {
 }
 
 
+/* {======================================================================
+** Optimizer
+** ======================================================================= */
+
+/* marks of opcodes (see 'OptState') */
+#define OTARGET         1   /* opcode is a jump target */
+#define ODEAD           2   /* opcode is removed */
+#define OREACHED        4   /* opcode is reachable */
+
+
+/* state of the final optimization pass */
+typedef struct OptState {
+    FunctionState *fs;
+    Proto *p;
+    int32_t *newpc; /* new pc of each opcode (indexed by old pc) */
+    int32_t *aux; /* work list (one entry for each opcode) */
+    int32_t *line; /* line of each opcode (indexed by opcode number) */
+    uint8_t *mark; /* marks of each opcode (indexed by old pc) */
+    int32_t ncode; /* size of the code before optimizing */
+    int32_t nopc; /* number of opcodes before optimizing */
+} OptState;
+
+
+#define ismarked(os,pc,m)   ((os)->mark[pc] & (m))
+#define isremoved(os,pc)    ismarked(os, pc, ODEAD)
+#define setmark(os,pc,m)    ((os)->mark[pc] |= (m))
+
+#define istest(op)          ((op) == OP_TEST || (op) == OP_TESTPOP)
+
+
+/*
+** Check if opcodes 'first' to 'last' (indices into 'opcodepc') can be
+** removed without changing the events of line hooks. They must all be
+** on the line of the remaining opcode after them, or on the line of
+** the remaining opcode before them if that is the only way into them.
+*/
+static int32_t keeplines(OptState *os, int32_t first, int32_t last) {
+    Proto *p = os->p;
+    int32_t line = os->line[first];
+    int32_t prev = first - 1;
+    int32_t next = last + 1;
+    for (int32_t i = first + 1; i <= last; i++)
+        if (os->line[i] != line) return 0;
+    while (prev >= 0 && isremoved(os, p->opcodepc[prev])) prev--;
+    while (next < os->nopc && isremoved(os, p->opcodepc[next])) next++;
+    return (next < os->nopc && os->line[next] == line) ||
+           (prev >= 0 && os->line[prev] == line &&
+            !ismarked(os, p->opcodepc[first], OTARGET));
+}
+
+
+/* jump table of OP_SWITCH 'inst' */
+#define switchtable(p,inst)     tval(&(p)->k[GET_ARG_L(inst, 0)])
+
+/* number of slots in jump table 't' */
+#define switchsize(t)       ((t)->asize + cast_u32(allocsizenode(t)))
+
+
+/* get slot 'i' of jump table 't' (NULL if it is empty) */
+static TValue *switchslot(Table *t, uint32_t i) {
+    TValue *slot = (i < t->asize) ? &t->array[i]
+                                  : nodeval(htnode(t, i - t->asize));
+    return isempty(slot) ? NULL : slot;
+}
+
+
+/*
+** Get the argument of 'op' holding its jump offset (or -1 if 'op' does
+** not jump). Offsets are relative to the end of the opcode, 'back' is
+** set if the offset is subtracted.
+*/
+static int32_t jumparg(int32_t op, int32_t *back) {
+    *back = (op == OP_JMPS || op == OP_FORLOOP || op == OP_FORLOOPI);
+    switch (op) {
+        case OP_JMP: case OP_JMPS: return 0;
+        case OP_FORPREP: case OP_FORPREPI: case OP_FORLOOP:
+        case OP_FORLOOPI: case OP_SWITCH: return 1;
+        default: return -1;
+    }
+}
+
+
+/* get target of jump argument 'a' of opcode at 'pc' */
+static int32_t jumptarget(uint8_t *code, int32_t pc, int32_t a,
+                                                     int32_t back) {
+    int32_t offset = GET_ARG_L(&code[pc], a);
+    return pc + getopSize(code[pc]) + (back ? -offset : offset);
+}
+
+
+/* mark all jump targets */
+static void marktargets(OptState *os) {
+    Proto *p = os->p;
+    for (int32_t n = 0; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        uint8_t *inst = &p->code[pc];
+        int32_t next = pc + getopSize(*inst);
+        int32_t back;
+        int32_t a = jumparg(*inst, &back);
+        if (a >= 0)
+            setmark(os, jumptarget(p->code, pc, a, back), OTARGET);
+        if (*inst == OP_SWITCH) {
+            Table *t = switchtable(p, inst);
+            for (uint32_t i = 0; i < switchsize(t); i++) {
+                const TValue *slot = switchslot(t, i);
+                if (slot) setmark(os, next + cast_i32(ival(slot)), OTARGET);
+            }
+        } else if (istest(*inst)) /* opcode after the test jump? */
+            setmark(os, next + getopSize(OP_JMP), OTARGET);
+    }
+}
+
+
+/*
+** Check if opcode at 'pc' pushes a single constant value, if so set
+** 'istrue' to its truth value.
+*/
+static int32_t constvalue(Proto *p, int32_t pc, int32_t *istrue) {
+    uint8_t *inst = &p->code[pc];
+    *istrue = 1;
+    switch (*inst) {
+        case OP_FALSE: *istrue = 0; return 1;
+        case OP_NIL: *istrue = 0; return (GET_ARG_L(inst, 0) == 1);
+        case OP_CONST:
+            *istrue = !t_isfalse(&p->k[GET_ARG_S(inst, 0)]);
+            return 1;
+        case OP_CONSTL:
+            *istrue = !t_isfalse(&p->k[GET_ARG_L(inst, 0)]);
+            return 1;
+        case OP_TRUE: case OP_CONSTI: case OP_CONSTIL:
+        case OP_CONSTF: case OP_CONSTFL: return 1;
+        default: return 0;
+    }
+}
+
+
+/*
+** Fold tests of constant values. The test is removed together with
+** its jump (if the jump is never taken) and, for OP_TESTPOP, with the
+** constant.
+*/
+static void foldtests(OptState *os) {
+    Proto *p = os->p;
+    for (int32_t n = 1; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        int32_t prev = p->opcodepc[n - 1];
+        uint8_t *inst = &p->code[pc];
+        int32_t istrue;
+        if (istest(*inst) && !ismarked(os, pc, OTARGET) &&
+                !isremoved(os, prev) && constvalue(p, prev, &istrue)) {
+            int32_t nojump = (istrue != GET_ARG_S(inst, 0));
+            int32_t first = (*inst == OP_TESTPOP) ? n - 1 : n;
+            if (!keeplines(os, first, n + nojump))
+                continue; /* would change line events */
+            setmark(os, pc, ODEAD);
+            if (nojump) /* jump is never taken? */
+                setmark(os, pc + getopSize(*inst), ODEAD);
+            if (*inst == OP_TESTPOP)
+                setmark(os, prev, ODEAD);
+        }
+    }
+}
+
+
+/* number of values pushed by opcode at 'pc' (if that is all it does) */
+static int32_t purepush(Proto *p, int32_t pc) {
+    uint8_t *inst = &p->code[pc];
+    switch (*inst) {
+        case OP_NIL: return GET_ARG_L(inst, 0);
+        case OP_TRUE: case OP_FALSE: case OP_LOAD: case OP_CONST:
+        case OP_CONSTL: case OP_CONSTI: case OP_CONSTIL: case OP_CONSTF:
+        case OP_CONSTFL: case OP_CLOSURE: case OP_GETLOCAL: case OP_GETUVAL:
+            return 1;
+        default: return 0;
+    }
+}
+
+
+/*
+** Remove values pushed only to be popped by the next OP_POP. No jump
+** may land between the pushes and the OP_POP, as it would have a
+** different number of values to pop.
+*/
+static void removepushpop(OptState *os) {
+    Proto *p = os->p;
+    for (int32_t n = 1; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        uint8_t *inst = &p->code[pc];
+        if (*inst == OP_POP && !isremoved(os, pc)) {
+            int32_t npop = GET_ARG_L(inst, 0);
+            int32_t first = n; /* first removed push */
+            int32_t after = pc; /* opcode after the push */
+            int32_t nnil = 0; /* nils left in a partially removed OP_NIL */
+            int32_t last;
+            while (first > 0 && npop > 0) {
+                int32_t prev = p->opcodepc[first - 1];
+                int32_t npush = purepush(p, prev);
+                if (npush == 0 || isremoved(os, prev) ||
+                                  ismarked(os, after, OTARGET))
+                    break; /* cannot remove it */
+                else if (npush > npop) { /* remove only some nils? */
+                    nnil = npush - npop;
+                    npop = 0;
+                } else { /* remove whole push */
+                    npop -= npush;
+                    after = prev;
+                    first--;
+                }
+            }
+            last = n - (npop != 0); /* keep OP_POP if it still pops */
+            if (first > last || !keeplines(os, first, last))
+                continue; /* nothing to remove or would change lines */
+            for (int32_t i = first; i < n; i++)
+                setmark(os, p->opcodepc[i], ODEAD);
+            if (nnil > 0)
+                SET_ARG_L(&p->code[p->opcodepc[first - 1]], 0, nnil);
+            if (npop == 0)
+                setmark(os, pc, ODEAD);
+            else
+                SET_ARG_L(inst, 0, npop);
+        }
+    }
+}
+
+
+static void reach(OptState *os, int32_t pc, int32_t *n) {
+    if (pc < os->ncode && !ismarked(os, pc, OREACHED)) {
+        setmark(os, pc, OREACHED);
+        os->aux[(*n)++] = pc;
+    }
+}
+
+
+/*
+** Mark unreachable opcodes as removed. A run of unreachable opcodes
+** that changes the stack of the symbolic execution (see 'symbexec' in
+** 'tdebug.c') is kept, as it adjusts that stack for the code after it
+** (e.g., the OP_NIL after the jump of a 'break'). The jumps of a kept
+** run may target removed code up to the end of the function, so then
+** the last opcode (the final return) is also kept, to remain a valid
+** target.
+*/
+static void markdead(OptState *os) {
+    Proto *p = os->p;
+    int32_t symsp = p->arity - 1;
+    int32_t first = -1; /* first opcode of the current unreachable run */
+    int32_t firstsp = 0; /* 'symsp' before that run */
+    int32_t kept = 0; /* true if an unreachable run was kept */
+    for (int32_t n = 0; n <= os->nopc; n++) {
+        int32_t pc = (n < os->nopc) ? p->opcodepc[n] : os->ncode;
+        if (n < os->nopc && !ismarked(os, pc, OREACHED)) {
+            if (first < 0) { first = n; firstsp = symsp; }
+        } else if (first >= 0) { /* end of unreachable run? */
+            if (n == os->nopc) { /* run at the end? */
+                for (int32_t i = first; i < n - kept; i++)
+                    setmark(os, p->opcodepc[i], ODEAD);
+            } else if (symsp == firstsp) {
+                for (int32_t i = first; i < n; i++)
+                    setmark(os, p->opcodepc[i], ODEAD);
+            } else
+                kept = 1;
+            first = -1;
+        }
+        if (n < os->nopc && !isremoved(os, pc) &&
+                !(n == 0 && p->code[pc] == OP_VARARGPREP))
+            tokuD_symstep(&p->code[pc], &symsp, -1);
+    }
+}
+
+
+/* remove opcodes that are not reachable from the function entry */
+static void removedead(OptState *os) {
+    Proto *p = os->p;
+    int32_t n = 0;
+    reach(os, 0, &n);
+    while (n > 0) {
+        int32_t pc = os->aux[--n];
+        uint8_t *inst = &p->code[pc];
+        int32_t next = pc + getopSize(*inst);
+        int32_t back;
+        int32_t a = jumparg(*inst, &back);
+        if (isremoved(os, pc)) /* removed opcode? */
+            reach(os, next, &n); /* it does nothing */
+        else {
+            if (a >= 0)
+                reach(os, jumptarget(p->code, pc, a, back), &n);
+            if (*inst == OP_SWITCH) {
+                Table *t = switchtable(p, inst);
+                for (uint32_t i = 0; i < switchsize(t); i++) {
+                    const TValue *slot = switchslot(t, i);
+                    if (slot) reach(os, next + cast_i32(ival(slot)), &n);
+                }
+            } else if (istest(*inst)) {
+                reach(os, next, &n); /* test jump */
+                reach(os, next + getopSize(OP_JMP), &n); /* skipped jump */
+            } else if (*inst != OP_JMP && *inst != OP_JMPS &&
+                       *inst != OP_RETURN)
+                reach(os, next, &n);
+        }
+    }
+    markdead(os);
+}
+
+
+/* compute the new pc of each opcode */
+static void computenewpc(OptState *os) {
+    Proto *p = os->p;
+    int32_t newpc = 0;
+    for (int32_t n = 0; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        os->newpc[pc] = newpc; /* (removed opcodes get the next pc) */
+        if (!isremoved(os, pc))
+            newpc += getopSize(p->code[pc]);
+    }
+    os->newpc[os->ncode] = newpc;
+}
+
+
+/*
+** Remove jumps to the next opcode (except jumps of tests, as they
+** are skipped by the test). Returns true if any jump was removed.
+*/
+static int32_t removenopjumps(OptState *os) {
+    Proto *p = os->p;
+    int32_t removed = 0;
+    for (int32_t n = 0; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        uint8_t *inst = &p->code[pc];
+        if ((*inst == OP_JMP || *inst == OP_JMPS) && !isremoved(os, pc)) {
+            int32_t prev = (n > 0) ? p->opcodepc[n - 1] : NOPC;
+            int32_t target = jumptarget(p->code, pc, 0, *inst == OP_JMPS);
+            int32_t next = pc + getopSize(*inst);
+            if (prev != NOPC && istest(p->code[prev]) && !isremoved(os, prev))
+                continue; /* jump of a test */
+            if (os->newpc[target] == os->newpc[next] &&
+                    keeplines(os, n, n)) {
+                setmark(os, pc, ODEAD);
+                removed = 1;
+            }
+        }
+    }
+    return removed;
+}
+
+
+/* save line of each opcode into 'line' */
+static void savelines(OptState *os) {
+    Proto *p = os->p;
+    int32_t line = p->defline;
+    int32_t nabs = 0;
+    for (int32_t n = 0; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        if (p->lineinfo[pc] == ABSLINEINFO) {
+            toku_assert(p->abslineinfo[nabs].pc == pc);
+            line = p->abslineinfo[nabs++].line;
+        } else
+            line += p->lineinfo[pc];
+        os->line[n] = line;
+    }
+}
+
+
+/*
+** Move the remaining opcodes to their new positions, fixing their
+** jumps and rebuilding the line information and 'opcodepc'.
+*/
+static void relocate(OptState *os) {
+    FunctionState *fs = os->fs;
+    Proto *p = os->p;
+    uint8_t *code = p->code;
+    fs->nopcodepc = fs->nabslineinfo = 0;
+    fs->prevline = p->defline;
+    fs->iwthabs = 0;
+    for (int32_t n = 0; n < os->nopc; n++) {
+        int32_t pc = p->opcodepc[n];
+        int32_t size = getopSize(code[pc]);
+        int32_t newpc = os->newpc[pc];
+        int32_t back, a, target = 0;
+        if (isremoved(os, pc)) continue; /* removed */
+        a = jumparg(code[pc], &back);
+        if (a >= 0)
+            target = os->newpc[jumptarget(code, pc, a, back)];
+        if (code[pc] == OP_SWITCH) { /* fix jump table */
+            Table *t = switchtable(p, &code[pc]);
+            for (uint32_t i = 0; i < switchsize(t); i++) {
+                TValue *slot = switchslot(t, i);
+                if (slot) {
+                    int32_t old = pc + size + cast_i32(ival(slot));
+                    setival(slot, os->newpc[old] - (newpc + size));
+                }
+            }
+        }
+        memmove(&code[newpc], &code[pc], cast_sizet(size));
+        if (a >= 0) {
+            int32_t offset = target - (newpc + size);
+            if (code[newpc] == OP_JMP || code[newpc] == OP_JMPS)
+                code[newpc] = (offset < 0) ? OP_JMPS : OP_JMP;
+            toku_assert(code[newpc] == OP_JMP || code[newpc] == OP_JMPS ||
+                        (offset < 0) == back || offset == 0);
+            SET_ARG_L(&code[newpc], a, abs(offset));
+        }
+        p->opcodepc[fs->nopcodepc++] = fs->prevpc = newpc;
+        savelineinfo(fs, p, os->line[n]);
+    }
+    currPC = os->newpc[os->ncode];
+    for (int32_t i = 0; i < fs->nlocals; i++) {
+        p->locals[i].startpc = os->newpc[p->locals[i].startpc];
+        p->locals[i].endpc = os->newpc[p->locals[i].endpc];
+    }
+}
+
+
+static void optimize(FunctionState *fs, int32_t level) {
+    toku_State *T = fs->lx->T;
+    Proto *p = fs->p;
+    OptState os;
+    size_t size;
+    /* make room for all line information before getting memory */
+    tokuM_ensurearray(T, p->abslineinfo, p->sizeabslineinfo, 0,
+                      fs->nopcodepc, INT32_MAX, "lines", AbsLineInfo);
+    os.fs = fs;
+    os.p = p;
+    os.ncode = currPC;
+    os.nopc = fs->nopcodepc;
+    size = (cast_sizet(os.ncode) + 1u) * (sizeof(int32_t) + 1u) +
+           cast_sizet(os.nopc) * sizeof(int32_t) * 2u;
+    os.newpc = cast(int32_t *, tokuM_malloc_(T, size, 0));
+    os.aux = os.newpc + os.ncode + 1;
+    os.line = os.aux + os.nopc;
+    os.mark = cast(uint8_t *, os.line + os.nopc);
+    memset(os.mark, 0, cast_sizet(os.ncode) + 1u);
+    savelines(&os);
+    marktargets(&os);
+    foldtests(&os);
+    if (level >= 2)
+        removepushpop(&os);
+    removedead(&os);
+    do { computenewpc(&os); } while (removenopjumps(&os));
+    computenewpc(&os);
+    if (os.newpc[os.ncode] < os.ncode) /* removed something? */
+        relocate(&os);
+    tokuM_freemem(T, os.newpc, size);
+}
+
+
+/*
+** Fuse 'GETLOCAL; GETLOCAL; ADD/SUB/MUL; MBIN' on a single line into
+** OP_ARITHLL (only the first opcode changes, see 'tcode.h').
+*/
+static void fusearith(FunctionState *fs) {
+    Proto *p = fs->p;
+    for (int32_t n = 0; n + 3 < fs->nopcodepc; n++) {
+        uint8_t *inst = &p->code[p->opcodepc[n]];
+        int32_t pc2 = p->opcodepc[n + 1];
+        int32_t pc3 = p->opcodepc[n + 2];
+        int32_t pc4 = p->opcodepc[n + 3];
+        int32_t op = p->code[pc3];
+        if (*inst == OP_GETLOCAL && p->code[pc2] == OP_GETLOCAL &&
+                (op == OP_ADD || op == OP_SUB || op == OP_MUL) &&
+                p->code[pc4] == OP_MBIN && p->lineinfo[pc2] == 0 &&
+                p->lineinfo[pc3] == 0 && p->lineinfo[pc4] == 0)
+            *inst = OP_ARITHLL;
+    }
+}
+
+
 /*
 ** Perform a final pass performing small adjustments and
-** optimizations.
+** optimizations. Level 1 threads jumps, folds tests of constants and
+** removes unreachable code and jumps to the next opcode. Level 2 also
+** removes values that are popped right after being pushed and fuses
+** common opcode sequences.
 */
 void tokuC_finish(FunctionState *fs) {
     Proto *p = fs->p;
+    int32_t level = fs->lx->optlevel;
     uint8_t *pc;
     for (int32_t i = 0; i < currPC; i += getopSize(*pc)) {
         pc = &p->code[i];
         switch (*pc) {
             case OP_RETURN: case OP_TAILCALL:
-                if (fs->needclose)
-                    SET_ARG_LLS(pc, 1); /* set the flag */
+                if (fs->needclose) /* set the flag */
+                    SET_ARG_LLS(pc, GET_ARG_LLS(pc) | CALLCLOSE);
                 break;
             case OP_JMP: case OP_JMPS: { /* avoid jumps to jumps */
-                int32_t target = finaltarget(p->code, i);
+                int32_t target;
+                if (level < 1) break; /* no optimizations */
+                target = finaltarget(p->code, i);
                 if (*pc == OP_JMP && target < i)
                     *pc = OP_JMPS; /* jumps back */
                 else if (*pc == OP_JMPS && i < target)
@@ -1765,4 +2537,250 @@ void tokuC_finish(FunctionState *fs) {
             default: break;
         }
     }
+    if (level >= 1)
+        optimize(fs, level);
+    if (level >= 2)
+        fusearith(fs);
+}
+
+/* }====================================================================== */
+
+
+/* {======================================================================
+** Inliner
+** ======================================================================= */
+
+/* maximum size of code (in bytes) of a function that can be inlined */
+#if !defined(TOKUI_MAXINLINE)
+#define TOKUI_MAXINLINE     128
+#endif
+
+
+/*
+** Check if the calls of 'f', a function defined in 'fs', can be
+** inlined. That is the case for small functions without varargs,
+** nested functions, loops, to-be-closed variables or upvalue
+** assignments that return exactly one value on every return. 'self'
+** is the stack slot of the variable holding 'f' when 'f' can see it
+** (or -1), functions that refer to themselves are not inlined.
+*/
+int32_t tokuC_inlinable(FunctionState *fs, Proto *f, int32_t self) {
+    int32_t symsp = f->arity - 1;
+    if (fs->lx->optlevel < 2 || f->lazy || f->isvararg || f->sizep > 0 ||
+            f->sizecode > TOKUI_MAXINLINE || f->code[lastpc(f)] != OP_RETURN)
+        return 0;
+    for (int32_t i = 0; i < f->sizeupvals; i++) {
+        if (f->upvals[i].instack && f->upvals[i].idx == self)
+            return 0; /* recursive function */
+    }
+    for (int32_t pc = 0; pc < f->sizecode; pc += getopSize(f->code[pc])) {
+        const uint8_t *i = &f->code[pc];
+        switch (*i) {
+            case OP_RETURN: /* must return only the value on top */
+                if (GET_ARG_L(i, 0) != symsp || GET_ARG_L(i, 1) != 2 ||
+                        GET_ARG_LLS(i) != 0)
+                    return 0;
+                break;
+            case OP_GETINDEXUP: case OP_SETINDEXUP:
+                if (f->upvals[GET_ARG_L(i, 0)].instack)
+                    return 0; /* (no opcode indexes a local with a key) */
+                break;
+            case OP_VARARGPREP: case OP_VARARG: case OP_CLOSURE:
+            case OP_SETUVAL: case OP_SWITCH: case OP_TAILCALL:
+            case OP_CLOSE: case OP_TBC: case OP_FORPREP: case OP_FORCALL:
+            case OP_FORLOOP: case OP_FORPREPI: case OP_FORLOOPI:
+                return 0;
+            default: break;
+        }
+        tokuD_symstep(i, &symsp, -1);
+    }
+    return 1;
 }
+
+
+/* add constant 'v' (of another function) to 'constants' */
+static int32_t copyK(FunctionState *fs, const TValue *v) {
+    switch (ttypetag(v)) {
+        case TOKU_VNIL: return nilK(fs);
+        case TOKU_VFALSE: return falseK(fs);
+        case TOKU_VTRUE: return trueK(fs);
+        case TOKU_VNUMINT: return intK(fs, ival(v));
+        case TOKU_VNUMFLT: return fltK(fs, fval(v));
+        default: return stringK(fs, strval(v));
+    }
+}
+
+
+/* emit a copy of opcode 'i' (of another function) on line 'linenum' */
+static uint8_t *emitcopy(FunctionState *fs, const uint8_t *i,
+                                            int32_t linenum) {
+    Proto *p = fs->p;
+    int32_t size = getopSize(*i);
+    int32_t pc = currPC;
+    addopcodepc(fs);
+    tokuM_ensurearray(fs->lx->T, p->code, p->sizecode, currPC, size,
+                      INT32_MAX, "opcodes", uint8_t);
+    memcpy(&p->code[pc], i, cast_sizet(size));
+    currPC += size;
+    savelineinfo(fs, p, linenum);
+    return &p->code[pc];
+}
+
+
+/*
+** Each return of the inlined function moves its result to 'base' and
+** jumps to the end of the inlined code (unless it is the last opcode).
+** 'first' is the stack slot of the result in the inlined function.
+*/
+static void inlinereturn(FunctionState *fs, int32_t base, int32_t first,
+                                       int32_t *exits, int32_t linenum) {
+    if (first > 0) { /* result is not at 'base'? */
+        tokuC_emitIL(fs, OP_SETLOCAL, base);
+        tokuC_fixline(fs, linenum);
+        if (first > 1) { /* values between 'base' and the result? */
+            tokuC_emitIL(fs, OP_POP, first - 1);
+            tokuC_fixline(fs, linenum);
+        }
+    }
+    if (exits) { /* not the last return? */
+        tokuC_concatjl(fs, exits, tokuC_jmp(fs, OP_JMP));
+        tokuC_fixline(fs, linenum);
+        if (first != 1) { /* adjust stack for symbolic execution */
+            tokuC_emitIL(fs, (first > 1) ? OP_NIL : OP_POP, abs(first - 1));
+            tokuC_fixline(fs, linenum);
+        }
+    }
+}
+
+
+/* add debug information of a local variable of inlined code */
+static void inlinelocal(FunctionState *fs, OString *name, int32_t startpc,
+                                                          int32_t endpc) {
+    Proto *p = fs->p;
+    int32_t osz = p->sizelocals;
+    tokuM_growarray(fs->lx->T, p->locals, p->sizelocals, fs->nlocals, MAXVARS,
+                    "locals", LVarInfo);
+    while (osz < p->sizelocals)
+        p->locals[osz++].name = NULL;
+    p->locals[fs->nlocals].name = name;
+    p->locals[fs->nlocals].startpc = startpc;
+    p->locals[fs->nlocals++].endpc = endpc;
+    tokuG_objbarrier(fs->lx->T, p, name);
+}
+
+
+/* position in 'fs' of 'pc' of inlined function 'f' */
+#define inlinedpc(fs,f,newpc,fpc) \
+        (((fpc) < (f)->sizecode) ? (newpc)[fpc] : (fs)->pc)
+
+
+/*
+** Add the locals of 'f' inlined at 'base' to the debug information of
+** 'fs', active over the inlined code (from 'newpc[0]' up to 'currPC').
+** Locals are found by their order among the active locals, so the
+** temporaries of 'fs' between its 'nvars' variables and 'base' are
+** added first, under the same name 'debug.getlocal' gives them.
+*/
+static void inlinelocals(FunctionState *fs, Proto *f, const int32_t *newpc,
+                                            int32_t nvars, int32_t base) {
+    OString *temp = tokuY_newstring(fs->lx, "(temporary)",
+                                            LL("(temporary)"));
+    for (; nvars < base; nvars++)
+        inlinelocal(fs, temp, newpc[0], currPC);
+    for (int32_t i = 0; i < f->sizelocals; i++) {
+        LVarInfo *lv = &f->locals[i];
+        inlinelocal(fs, lv->name, inlinedpc(fs, f, newpc, lv->startpc),
+                                  inlinedpc(fs, f, newpc, lv->endpc));
+    }
+}
+
+
+/*
+** Inline the code of function 'f' (see 'tokuC_inlinable') called with
+** its arguments on the stack starting at 'base', above the 'nvars'
+** variables of 'fs'. The inlined code uses the stack from 'base' as the
+** frame of 'f', with its constants, upvalues and inline caches remapped
+** into 'fs', and leaves the result at 'base'. Opcodes keep the lines of
+** 'f' and its locals keep their names, so that errors and hooks point
+** to its source and variables.
+*/
+void tokuC_inline(FunctionState *fs, Proto *f, int32_t base, int32_t nvars) {
+    int32_t newpc[TOKUI_MAXINLINE];
+    int32_t exits = NOJMP;
+    int32_t last = cast_i32(lastpc(f));
+    toku_assert(fs->sp == base + f->arity && f->sizecode <= TOKUI_MAXINLINE);
+    tokuC_checkstack(fs, f->maxstack - f->arity);
+    for (int32_t pc = 0; pc < f->sizecode; pc += getopSize(f->code[pc])) {
+        const uint8_t *i = &f->code[pc];
+        int32_t linenum = tokuD_getfuncline(f, pc);
+        uint8_t *ni;
+        newpc[pc] = currPC;
+        switch (*i) {
+            case OP_RETURN:
+                inlinereturn(fs, base, GET_ARG_L(i, 0),
+                                 (pc < last) ? &exits : NULL, linenum);
+                continue;
+            case OP_CONST: case OP_CONSTL: {
+                int32_t idx = (*i == OP_CONST) ? GET_ARG_S(i, 0)
+                                               : GET_ARG_L(i, 0);
+                codeK(fs, copyK(fs, &f->k[idx]));
+                tokuC_fixline(fs, linenum);
+                continue;
+            }
+            case OP_GETUVAL: {
+                UpValInfo *uv = &f->upvals[GET_ARG_L(i, 0)];
+                if (uv->instack) /* upvalue is a local of 'fs'? */
+                    tokuC_emitIL(fs, OP_GETLOCAL, uv->idx);
+                else
+                    tokuC_emitIL(fs, OP_GETUVAL, uv->idx);
+                tokuC_fixline(fs, linenum);
+                continue;
+            }
+            default: break;
+        }
+        ni = emitcopy(fs, i, linenum);
+        switch (*i) {
+            case OP_ARITHLL: /* (fused again by 'fs') */
+                *ni = OP_GETLOCAL;
+                /* fall through */
+            case OP_GETLOCAL: case OP_SETLOCAL: case OP_LOAD: case OP_CALL:
+            case OP_CHECKADJ: case OP_SETLIST:
+                SET_ARG_L(ni, 0, base + GET_ARG_L(i, 0));
+                break;
+            case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK:
+            case OP_IDIVK: case OP_MODK: case OP_POWK: case OP_BSHLK:
+            case OP_BSHRK: case OP_BANDK: case OP_BORK: case OP_BXORK:
+            case OP_EQK: case OP_METHOD: case OP_SETMT:
+                SET_ARG_L(ni, 0, copyK(fs, &f->k[GET_ARG_L(i, 0)]));
+                break;
+            case OP_NEWLISTK: case OP_NEWTABLEK: /* (elements are shared) */
+                SET_ARG_L(ni, 0, addK(fs, fs->p, &f->k[GET_ARG_L(i, 0)]));
+                break;
+            case OP_GETPROPERTY: case OP_GETMETHOD: case OP_GETINDEXSTR:
+            case OP_GETSUP:
+                SET_ARG_L(ni, 0, copyK(fs, &f->k[GET_ARG_L(i, 0)]));
+                SET_ARG_L(ni, 1, newcache(fs));
+                break;
+            case OP_GETINDEXUP: case OP_SETINDEXUP:
+                SET_ARG_L(ni, 0, f->upvals[GET_ARG_L(i, 0)].idx);
+                /* fall through */
+            case OP_SETPROPERTY: case OP_SETINDEXSTR:
+                SET_ARG_L(ni, 1, copyK(fs, &f->k[GET_ARG_L(i, 1)]));
+                SET_ARG_L(ni, 2, newcache(fs));
+                break;
+            default: break;
+        }
+    }
+    /* relocate jumps of 'f' */
+    for (int32_t pc = 0; pc < f->sizecode; pc += getopSize(f->code[pc])) {
+        uint8_t *i = &f->code[pc];
+        if (*i == OP_JMP || *i == OP_JMPS)
+            fixjump(fs, newpc[pc], newpc[destinationpc(i, pc)]);
+    }
+    tokuC_patchtohere(fs, exits);
+    inlinelocals(fs, f, newpc, nvars, base);
+    freeslots(fs, f->arity); /* remove arguments... */
+    tokuC_reserveslots(fs, 1); /* ...and leave the result */
+}
+
+/* }====================================================================== */
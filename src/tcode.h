@@ -50,6 +50,7 @@
 /* get/set short parameter */
 #define GET_ARG_S(ip,o)         cast_u8(*GETPC_S(ip,o))
 #define SET_ARG_S(ip,o,v)       setbyte(GETPC_S(ip,0), o, v);
+#define GET_ARG_LLS(ip)         cast_u8(*(GET_ARG(ip) + 2u * SIZE_ARG_L))
 #define SET_ARG_LLS(ip,v)       setbyte(GET_ARG(ip), 2u * SIZE_ARG_L, v)
 
 
@@ -222,6 +223,8 @@ OP_JMPS,/*         L       'pc -= L'                                        */
 OP_TEST,/*         V S     'if (!t_isfalse(V) == S) dojump;'                */
 OP_TESTPOP,/*      V S     'if (!t_isfalse(V) == S) { dojump; } pop;'       */
 
+OP_SWITCH,/*       V L1 L2 'pc += (V in K{L1}) ? K{L1}[V] : L2'             */
+
 OP_CALL,/*  L1 L2 S 'V{L1},...,V{L1+L2-1} = V{L1}(V{L1+1},...,V{offtp-1})'  */
 OP_TAILCALL,/* L1 L2 S  '-||- (S is true if it needs close; it skips RET)   */
 
@@ -232,40 +235,145 @@ OP_CHECKADJ,/*     L           'adjust results after callcheck to L-1'      */
 
 OP_GETLOCAL,/*     L           'L{L}'                                       */
 OP_SETLOCAL,/*     V L         'L{L} = V'                                   */
+OP_ARITHLL,/*      L           'L{L}' (fused arithmetic, see below)         */
 
 OP_GETUVAL,/*      L           'U{L}'                                       */
 OP_SETUVAL,/*      V L         'U{L} = V'                                   */
 
 OP_SETLIST,/*      L1 L2 S     'V{L1}[L2+i] = V{-S+i}, 0 <= i < S           */
 
-OP_SETPROPERTY,/*  V L1 L2     'V{-L1}.K{L2}:string = V'                    */
-OP_GETPROPERTY,/*  V  L        'V.K{L}'                                     */
+OP_SETPROPERTY,/*  V L1 L2 L3  'V{-L1}.K{L2}:string = V'                    */
+OP_GETPROPERTY,/*  V L1 L2     'V.K{L1}'                                    */
+OP_GETMETHOD,/*    V L1 L2     'V.K{L1}, V' (method lookup for self call)   */
 
 OP_GETINDEX,/*     V1 V2       'V1[V2]'                                     */
 OP_SETINDEX,/*     V L         'V{-L}[V{-L + 1}] = V3'                      */
 
-OP_GETINDEXSTR,/*  V L         'V[K{L}:string]'                             */
-OP_SETINDEXSTR,/*  V L1 L2     'V{-L1}[K{L2}:string] = V'                   */
+OP_GETINDEXSTR,/*  V L1 L2     'V[K{L1}:string]'                            */
+OP_SETINDEXSTR,/*  V L1 L2 L3  'V{-L1}[K{L2}:string] = V'                   */
+
+OP_GETINDEXUP,/*   L1 L2 L3    'U{L1}[K{L2}:string]'                        */
+OP_SETINDEXUP,/*   V L1 L2 L3  'U{L1}[K{L2}:string] = V'                    */
 
 OP_GETINDEXINT,/*  V S         'V[I(S):integer]'                            */
 OP_GETINDEXINTL,/* V L         'V[I(L):integer]'                            */
 OP_SETINDEXINT,/*  V L S       'V{-L}[I(S):integer] = V'                    */
 OP_SETINDEXINTL,/* V L1 L2     'V{-L1}[I(L2):integer] = V'                  */
 
-OP_GETSUP,/*       V L         'V.class.superclass.methods.K{L}:string'     */
+OP_GETSUP,/*       V L1 L2     'V.class.superclass.methods.K{L1}:string'    */
 OP_GETSUPIDX,/*    V1 V2       'V1.class.superclass.methods[V2]'            */
 
 OP_INHERIT,/*     V1 V2        'V2 inherits V1'                             */
 OP_FORPREP,/*     L1 L2        'create upvalue V{L1+3}; pc += L2'           */
 OP_FORCALL,/*     L1 L2  'V{L1+4},...,V{L1+3+L2} = V{L1}(V{L1+1}, V{L1+2});'*/
 OP_FORLOOP,/*L1 L2 L3 'if V{L1+4}!=nil {V{L1}=V{L1+2}; pc-=L2} else pop(L3)'*/
+OP_FORPREPI,/*    L1 L2 L3     'V{L1}=count; V{L1+1}-=V{L1+2}; pc += L2'    */
+OP_FORLOOPI,/*L1 L2 L3 'if V{L1}--!=0 {V{L1+4}=V{L1+1}+=V{L1+2}; pc-=L2}'   */
 
 OP_RETURN,/*         L1 L2 S      'return V{L1}, ... ,V{L1+L2-2}'           */
+
+OP_NEWLISTK,/*     L          'create and load new list copy of K{L}'       */
+OP_NEWTABLEK,/*    L          'create and load new table from K{L}'         */
+
+/* quickened opcodes (see 'isquickop') */
+OP_ADDII,/*        V1 V2 S     'OP_ADD (V1 and V2 are integers)'            */
+OP_ADDFF,/*        V1 V2 S     'OP_ADD (V1 and V2 are floats)'              */
+OP_SUBII,/*        V1 V2 S     'OP_SUB (V1 and V2 are integers)'            */
+OP_SUBFF,/*        V1 V2 S     'OP_SUB (V1 and V2 are floats)'              */
+OP_MULII,/*        V1 V2 S     'OP_MUL (V1 and V2 are integers)'            */
+OP_MULFF,/*        V1 V2 S     'OP_MUL (V1 and V2 are floats)'              */
+OP_LTII,/*         V1 V2 S     'OP_LT (V1 and V2 are integers)'             */
+OP_LTFF,/*         V1 V2 S     'OP_LT (V1 and V2 are floats)'               */
+OP_LEII,/*         V1 V2 S     'OP_LE (V1 and V2 are integers)'             */
+OP_LEFF,/*         V1 V2 S     'OP_LE (V1 and V2 are floats)'               */
+OP_GETINDEXLIST,/* V1 V2       'OP_GETINDEX (V1 is list, V2 is integer)'    */
+OP_GETINDEXINTLIST,/* V S      'OP_GETINDEXINT (V is list)'                 */
+OP_FORLIST,/*     L1 L2        'OP_FORCALL (V{L1} is 'indices' iterator)'   */
+OP_FORTABLE,/*    L1 L2        'OP_FORCALL (V{L1} is 'fields' iterator)'    */
 } OpCode;
 
 
 /* number of 'OpCode's */
-#define NUM_OPCODES     (OP_RETURN + 1)
+#define NUM_OPCODES     (OP_FORTABLE + 1)
+
+
+/*
+** Quickened opcodes are never emitted by the code generator. The
+** interpreter rewrites an opcode in place into one of its quickened
+** variants once it observes the operand types (or the iterator) that
+** the variant is specialized for, and rewrites it back into the
+** original opcode when the guard of the variant fails, before doing
+** anything that could observe the code (metamethods, errors...).
+** Quickened variants have the same format and properties as their
+** original opcode; the debug interface and 'toku_dump' only ever see
+** original opcodes (see 'getopOrig').
+*/
+#define isquickop(op)       ((op) > OP_NEWTABLEK)
+
+/* get original opcode of 'op' */
+#define getopOrig(op) \
+        (isquickop(op) ? tokuC_quickorig[(op) - OP_NEWTABLEK - 1] : (op))
+
+TOKUI_DEC(const uint8_t tokuC_quickorig[NUM_OPCODES - OP_NEWTABLEK - 1];)
+
+#define isforcall(op)       (getopOrig(op) == OP_FORCALL)
+
+
+/*
+** OP_FORPREPI and OP_FORLOOPI implement 'foreach' loops over the call
+** of global 'range' with L3 (of OP_FORPREPI) arguments, which are kept
+** at V{L1+1}... If V{L1} is not the builtin 'range', OP_FORPREPI calls
+** it instead and both work as OP_FORPREP and OP_FORCALL + OP_FORLOOP.
+*/
+
+
+/*
+** OP_ARITHLL replaces the first opcode of the sequence 'GETLOCAL L1;
+** GETLOCAL L2; ADD/SUB/MUL S; MBIN' (see 'fusearith'). If both locals
+** are integers or both are floats, it performs the whole sequence,
+** otherwise it works as OP_GETLOCAL and the rest of the sequence runs
+** as usual.
+*/
+
+
+/*
+** OP_SWITCH dispatches a 'switch' statement on its value V (the switch
+** temporary). K{L1} is a table mapping the case literals to the offset
+** of their case body, all offsets are relative to the next opcode. If V
+** is not in the table it jumps by L2 (to the first case test, 'default'
+** or the end of the switch).
+*/
+
+
+/*
+** OP_NEWLISTK and OP_NEWTABLEK create list and table constructors whose
+** elements are all constants (see 'tokuC_constructorK'). K{L} is a list
+** holding the elements of the list (without holes), or holding the
+** keys and values of the table in pairs (in the order of the fields).
+** They are appended after OP_RETURN to keep the numbering of the other
+** opcodes in binary chunks.
+*/
+
+
+/* flags for 'S' argument of OP_CALL and OP_TAILCALL */
+#define CALLCLOSE   1   /* (OP_TAILCALL) needs to close upvalues */
+#define CALLSELF    2   /* function and 'self' are set by OP_GETMETHOD */
+
+
+/*
+** The last long argument of OP_SETPROPERTY, OP_GETPROPERTY, OP_GETMETHOD,
+** OP_GETINDEXSTR, OP_SETINDEXSTR, OP_GETINDEXUP, OP_SETINDEXUP and
+** OP_GETSUP is the index of the inline cache of that instruction (see
+** 'InlineCache').
+*/
+
+
+/*
+** OP_GETINDEXUP and OP_SETINDEXUP index an upvalue with a constant
+** string key without copying the upvalue on the stack. The code
+** generator emits them for global variables (fields of '__ENV' when
+** '__ENV' is an upvalue).
+*/
 
 
 /* opcode format */
@@ -338,10 +446,12 @@ TOKUI_FUNC int32_t tokuC_emitILL(FunctionState *fs, uint8_t i, int32_t a,
                                                                int32_t b);
 TOKUI_FUNC int32_t tokuC_emitILLL(FunctionState *fs, uint8_t i, int32_t a,
                                                      int32_t b, int32_t c);
-TOKUI_FUNC int32_t tokuC_call(FunctionState *fs, int32_t base, int32_t nres);
+TOKUI_FUNC int32_t tokuC_call(FunctionState *fs, int32_t base, int32_t nres,
+                                                            int32_t self);
 TOKUI_FUNC int32_t tokuC_vararg(FunctionState *fs, int32_t nres);
 TOKUI_FUNC void tokuC_fixline(FunctionState *fs, int32_t line);
 TOKUI_FUNC void tokuC_removelastjump(FunctionState *fs);
+TOKUI_FUNC void tokuC_removelastcall(FunctionState *fs, int32_t nargs);
 TOKUI_FUNC void tokuC_checkstack(FunctionState *fs, int32_t n);
 TOKUI_FUNC void tokuC_reserveslots(FunctionState *fs, int32_t n);
 TOKUI_FUNC void tokuC_setreturns(FunctionState *fs, ExpInfo *e, int32_t nret);
@@ -367,18 +477,28 @@ TOKUI_FUNC void tokuC_setlistsize(FunctionState *fs, int32_t pc, int32_t lsz);
 TOKUI_FUNC void tokuC_setlist(FunctionState *fs, int32_t base,
                               int32_t nelems, int32_t tostore);
 TOKUI_FUNC void tokuC_settablesize(FunctionState *fs, int32_t pc, int32_t hsz);
+TOKUI_FUNC void tokuC_constructorK(FunctionState *fs, int32_t pc, int32_t nk,
+                                   TValue *elems);
 TOKUI_FUNC void tokuC_const2v(FunctionState *fs, ExpInfo *e, TValue *v);
+TOKUI_FUNC int32_t tokuC_exp2const(FunctionState *fs, ExpInfo *e, TValue *v);
+TOKUI_FUNC void tokuC_const2exp(FunctionState *fs, ExpInfo *e);
 TOKUI_FUNC TValue *tokuC_getconstant(FunctionState *fs, ExpInfo *v);
 TOKUI_FUNC int32_t tokuC_dischargevars(FunctionState *fs, ExpInfo *e);
 TOKUI_FUNC void tokuC_exp2stack(FunctionState *fs, ExpInfo *e);
 TOKUI_FUNC void tokuC_exp2val(FunctionState *fs, ExpInfo *e);
+TOKUI_FUNC void tokuC_getmethod(FunctionState *fs, ExpInfo *e);
 TOKUI_FUNC void tokuC_getdotted(FunctionState *fs, ExpInfo *var, ExpInfo *key,
                                 int32_t issuper);
+TOKUI_FUNC void tokuC_indexup(FunctionState *fs, ExpInfo *var, ExpInfo *key);
 TOKUI_FUNC void tokuC_indexed(FunctionState *fs, ExpInfo *var, ExpInfo *key,
                               int32_t issuper);
 TOKUI_FUNC void tokuC_unary(FunctionState *fs, ExpInfo *e, Unopr op,
                             int32_t linenum);
 TOKUI_FUNC int32_t tokuC_jmp(FunctionState *fs, OpCode opJ);
+TOKUI_FUNC int32_t tokuC_switch(FunctionState *fs);
+TOKUI_FUNC void tokuC_fixswitch(FunctionState *fs, int32_t pc,
+                                const LiteralInfo *li, int32_t n,
+                                int32_t miss);
 TOKUI_FUNC int32_t tokuC_test(FunctionState *fs, OpCode opT, int32_t cond,
                               int32_t linenum);
 TOKUI_FUNC void tokuC_concatjl(FunctionState *fs, int32_t *l1, int32_t l2);
@@ -391,5 +511,8 @@ TOKUI_FUNC void tokuC_binary(FunctionState *fs, ExpInfo *e1, ExpInfo *e2,
 TOKUI_FUNC void tokuC_binimmediate(FunctionState *fs, ExpInfo *e1, int32_t imm,
                                    Binopr op, int32_t linenum);
 TOKUI_FUNC void tokuC_finish(FunctionState *fs);
+TOKUI_FUNC int32_t tokuC_inlinable(FunctionState *fs, Proto *f, int32_t self);
+TOKUI_FUNC void tokuC_inline(FunctionState *fs, Proto *f, int32_t base,
+                                                       int32_t nvars);
 
 #endif
@@ -443,6 +443,19 @@ static int32_t db_stackinuse(toku_State *T) {
 }
 
 
+static int32_t db_icstats(toku_State *T) {
+    toku_Unsigned hits, misses;
+    toku_icstats(T, &hits, &misses, toku_to_bool(T, 0));
+    toku_push_integer(T, cast(toku_Integer, hits));
+    toku_push_integer(T, cast(toku_Integer, misses));
+    if (hits + misses > 0)
+        toku_push_number(T, cast_num(hits) / cast_num(hits + misses));
+    else /* no cached accesses */
+        toku_push_number(T, 0.0);
+    return 3;
+}
+
+
 static void setdesc(toku_State *T, toku_Opcode *opc) {
     toku_Opdesc opd;
     toku_getopdesc(T, &opd, opc);
@@ -523,6 +536,7 @@ static const tokuL_Entry dblib[] = {
     {"setupvalue", db_setupvalue},
     {"traceback", db_traceback},
     {"stackinuse", db_stackinuse},
+    {"icstats", db_icstats},
     {"getcode", db_getcode},
     {"cstacklimit", NULL},
     {"maxstack", NULL},
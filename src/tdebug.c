@@ -231,6 +231,124 @@ static void getfuncinfo(Closure *cl, toku_Debug *ar) {
 #endif
 
 
+/*
+** Symbolically execute opcode 'i' updating the stack pointer 'symsp'.
+** Returns true if 'i' changed the stack slot 'sp'.
+*/
+int32_t tokuD_symstep(const uint8_t *i, int32_t *psymsp, int32_t sp) {
+    int32_t symsp = *psymsp;
+    int32_t change; /* true if current opcode changed 'sp' */
+    switch (getopOrig(*i)) {
+        case OP_CHECKADJ: {
+            int32_t stk = GET_ARG_L(i, 0);
+            int32_t nres = GET_ARG_L(i, 1);
+            change = (sp < stk && sp <= stk + nres);
+            symsp = stk + nres;
+            break;
+        }
+        case OP_RETURN: {
+            int32_t stk = GET_ARG_L(i, 0);
+            toku_assert(stk-1 <= symsp);
+            symsp = stk - 1; /* remove results */
+            change = 0;
+            break;
+        }
+        case OP_TAILCALL: case OP_CALL: {
+            int32_t stk = GET_ARG_L(i, 0);
+            int32_t nresults = GET_ARG_L(i, 1) - 1;
+            if (nresults == TOKU_MULTRET) nresults = 1;
+            toku_assert(stk <= symsp);
+            change = (stk <= sp);
+            symsp = stk + nresults - 1; /* 'symsp' points to last result */
+            break;
+        }
+        case OP_NIL: case OP_VARARG: {
+            int32_t n = GET_ARG_L(i, 0);
+            if (*i == OP_VARARG) {
+                if (--n == TOKU_MULTRET) n = 1;
+            }
+            change = (symsp < sp && sp <= symsp + n);
+            symsp += n;
+            break;
+        }
+        case OP_POP:
+            symsp -= GET_ARG_L(i, 0);
+            change = 0;
+            break;
+        case OP_CONCAT:
+            symsp -= GET_ARG_L(i, 0) - 1;
+            change = (symsp == sp);
+            break;
+        case OP_SETLIST:
+            symsp = GET_ARG_L(i, 0);
+            change = 0;
+            break;
+        case OP_MBIN: /* ignore */
+            change = 0;
+            break;
+        case OP_GETMETHOD: /* sets function and 'self' */
+            change = (symsp <= sp && sp <= symsp + 1);
+            symsp++;
+            break;
+        case OP_SETPROPERTY: case OP_SETINDEXSTR: case OP_SETINDEX:
+        case OP_SETINDEXINT: case OP_SETINDEXINTL:
+            change = (sp == symsp - GET_ARG_L(i, 0));
+            --symsp;
+            break;
+        case OP_FORPREP: {
+            int32_t off = GET_ARG_L(i, 1);
+            const uint8_t *ni = i + off + getopSize(*i);
+            int32_t nvars = check_exp(isforcall(*ni), GET_ARG_L(ni, 1));
+            symsp += nvars;
+            change = 0;
+            break;
+        }
+        case OP_FORCALL: {
+            int32_t stk = GET_ARG_L(i, 0);
+            int32_t nresults = GET_ARG_L(i, 1) - 1;
+            toku_assert(nresults >= 0); /* at least one result */
+            symsp = stk + VAR_N + nresults;
+            change = (stk + 2 <= sp);
+            break;
+        }
+        case OP_FORLOOP:
+            change = (GET_ARG_L(i, 0) == sp);
+            symsp -= GET_ARG_L(i, 2);
+            break;
+        case OP_FORPREPI: {
+            int32_t off = GET_ARG_L(i, 1);
+            const uint8_t *ni = i + off + getopSize(*i);
+            toku_assert(*ni == OP_FORLOOPI);
+            symsp += GET_ARG_L(ni, 2);
+            change = 0;
+            break;
+        }
+        case OP_FORLOOPI: { /* (locals are already removed) */
+            int32_t stk = GET_ARG_L(i, 0);
+            change = (stk < sp && sp < stk + VAR_N);
+            symsp = stk + VAR_N - 1;
+            break;
+        }
+        default: {
+            OpCode op = cast(OpCode, getopOrig(*i));
+            int32_t delta = getopDelta(op);
+            toku_assert(delta != VD); /* default case can't handle VD */
+            if (tokuC_opproperties[op].chgsp) { /* changes symsp? */
+                check_exp(delta <= 0, symsp += delta);
+                change = (sp == symsp);
+            } else {
+                int32_t npush = tokuC_opproperties[op].push;
+                change = npush && (symsp < sp && sp <= symsp + npush);
+                symsp += delta;
+            }
+            break;
+        }
+    }
+    *psymsp = symsp;
+    return change;
+}
+
+
 static int32_t symbexec(const Proto *p, int32_t lastpc, int32_t sp) {
     int32_t pc = 0; /* execute from start */
     int32_t symsp = p->arity - 1; /* initial stack pointer (-1 if no params) */
@@ -243,98 +361,9 @@ static int32_t symbexec(const Proto *p, int32_t lastpc, int32_t sp) {
         goto end; /* done; 'lastpc' is 'pc' */
     while (pc < lastpc) {
         const uint8_t *i = &code[pc];
-        int32_t change; /* true if current opcode changed 'sp' */
         traceSE("%d:%d:%-20s\t", tokuD_getfuncline(p, pc), pc, opnames(*i));
         toku_assert(-1 <= symsp && symsp <= p->maxstack);
-        switch (*i) {
-            case OP_CHECKADJ: {
-                int32_t stk = GET_ARG_L(i, 0);
-                int32_t nres = GET_ARG_L(i, 1);
-                change = (sp < stk && sp <= stk + nres);
-                symsp = stk + nres;
-                break;
-            }
-            case OP_RETURN: {
-                int32_t stk = GET_ARG_L(i, 0);
-                toku_assert(stk-1 <= symsp);
-                symsp = stk - 1; /* remove results */
-                change = 0;
-                break;
-            }
-            case OP_TAILCALL: case OP_CALL: {
-                int32_t stk = GET_ARG_L(i, 0);
-                int32_t nresults = GET_ARG_L(i, 1) - 1;
-                if (nresults == TOKU_MULTRET) nresults = 1;
-                toku_assert(stk <= symsp);
-                change = (stk <= sp);
-                symsp = stk + nresults - 1; /* 'symsp' points to last result */
-                break;
-            }
-            case OP_NIL: case OP_VARARG: {
-                int32_t n = GET_ARG_L(i, 0);
-                if (*i == OP_VARARG) {
-                    if (--n == TOKU_MULTRET) n = 1;
-                }
-                change = (symsp < sp && sp <= symsp + n);
-                symsp += n;
-                break;
-            }
-            case OP_POP:
-                symsp -= GET_ARG_L(i, 0);
-                change = 0;
-                break;
-            case OP_CONCAT:
-                symsp -= GET_ARG_L(i, 0) - 1;
-                change = (symsp == sp);
-                break;
-            case OP_SETLIST:
-                symsp = GET_ARG_L(i, 0);
-                change = 0;
-                break;
-            case OP_MBIN: /* ignore */
-                change = 0;
-                break;
-            case OP_SETPROPERTY: case OP_SETINDEXSTR: case OP_SETINDEX:
-            case OP_SETINDEXINT: case OP_SETINDEXINTL:
-                change = (sp == symsp - GET_ARG_L(i, 0));
-                --symsp;
-                break;
-            case OP_FORPREP: {
-                int32_t off = GET_ARG_L(i, 1);
-                const uint8_t *ni = i + off + getopSize(*i);
-                int32_t nvars = check_exp(*ni == OP_FORCALL, GET_ARG_L(ni, 1));
-                symsp += nvars;
-                change = 0;
-                break;
-            }
-            case OP_FORCALL: {
-                int32_t stk = GET_ARG_L(i, 0);
-                int32_t nresults = GET_ARG_L(i, 1) - 1;
-                toku_assert(nresults >= 0); /* at least one result */
-                symsp = stk + VAR_N + nresults;
-                change = (stk + 2 <= sp);
-                break;
-            }
-            case OP_FORLOOP:
-                change = (GET_ARG_L(i, 0) == sp);
-                symsp -= GET_ARG_L(i, 2);
-                break;
-            default: {
-                OpCode op = cast(OpCode, *i);
-                int32_t delta = getopDelta(op);
-                toku_assert(delta != VD); /* default case can't handle VD */
-                if (tokuC_opproperties[op].chgsp) { /* changes symsp? */
-                    check_exp(delta <= 0, symsp += delta);
-                    change = (sp == symsp);
-                } else {
-                    int32_t npush = tokuC_opproperties[op].push;
-                    change = npush && (symsp < sp && sp <= symsp + npush);
-                    symsp += delta;
-                }
-                break;
-            }
-        }
-        if (change) {
+        if (tokuD_symstep(i, &symsp, sp)) {
             pcsp = pc;
             traceSE("(change) symsp=%d, pcsp=%d [sp=%d]\n", symsp, pcsp, sp);
         } else {
@@ -386,8 +415,8 @@ static const char *basicgetobjname(const Proto *p, int32_t *ppc, int32_t sp,
     *ppc = pc = symbexec(p, pc, sp);
     if (pc != -1) { /* could find opcode? */
         uint8_t *i = &p->code[pc];
-        switch (*i) {
-            case OP_GETLOCAL: {
+        switch (getopOrig(*i)) {
+            case OP_GETLOCAL: case OP_ARITHLL: {
                 int32_t stk = GET_ARG_L(i, 0);
                 toku_assert(stk < sp);
                 const char *nam = basicgetobjname(p, ppc, stk, name);
@@ -424,12 +453,9 @@ static void stkname(const Proto *p, int32_t pc, int32_t c, const char **name) {
 */
 static const char *isEnv(const Proto *p, int32_t pc, int32_t t, int32_t isup) {
     const char *name; /* name of indexed variable */
-    if (isup) { /* is 't' an upvalue? */
-        toku_assert(0);
-        /* TODO: make OP_GETINDEXUP, which indexes upvalue these
-           opcodes would be fairly common for __ENV accesses. */
+    if (isup) /* is 't' an upvalue? */
         name = upvalname(p, t);
-    } else { /* 't' is a stack slot */
+    else { /* 't' is a stack slot */
         const char *what = basicgetobjname(p, &pc, t, &name);
         if (what != strlocal && what != strupval)
             what = NULL; /* cannot be the variable __ENV */
@@ -451,11 +477,15 @@ static const char *getobjname(const Proto *p, int32_t lastpc, int32_t sp,
         uint8_t *i = &p->code[lastpc];
         traceSE("! %s at pc %d modified stack slot %d !\n",
                  opnames(*i), lastpc, sp);
-        switch (*i) {
-            case OP_GETPROPERTY: case OP_GETINDEXSTR: {
+        switch (getopOrig(*i)) {
+            case OP_GETPROPERTY: case OP_GETINDEXSTR: case OP_GETMETHOD: {
                 kname(p, GET_ARG_L(i, 0), name);
                 return isEnv(p, lastpc, sp, 0);
             }
+            case OP_GETINDEXUP: {
+                kname(p, GET_ARG_L(i, 1), name);
+                return isEnv(p, lastpc, GET_ARG_L(i, 0), 1);
+            }
             case OP_GETINDEX: {
                 stkname(p, lastpc, sp, name); /* key */
                 return isEnv(p, lastpc, sp-1, 0);
@@ -485,18 +515,21 @@ static const char *funcnamefromcode(toku_State *T, const Proto *p, int32_t pc,
                                     const char **name) {
     int32_t event;
     uint8_t *i = &p->code[pc];
-    switch (*i) {
+    switch (getopOrig(*i)) {
         case OP_TAILCALL: case OP_CALL:
             return getobjname(p, pc, GET_ARG_L(i, 0), name);
-        case OP_FORCALL:
+        case OP_FORPREPI: /* (function is in a control variable) */
+            *name = "range";
+            return "global";
+        case OP_FORCALL: case OP_FORLOOPI:
             *name = "for iterator";
             return "for iterator";
         case OP_GETPROPERTY: case OP_GETINDEX: case OP_GETINDEXSTR:
-        case OP_GETINDEXINT:
+        case OP_GETINDEXINT: case OP_GETMETHOD: case OP_GETINDEXUP:
             event = TM_GETIDX;
             break;
         case OP_SETPROPERTY: case OP_SETINDEX: case OP_SETINDEXSTR:
-        case OP_SETINDEXINT:
+        case OP_SETINDEXINT: case OP_SETINDEXUP:
             event = TM_SETIDX;
             break;
         case OP_MBIN:
@@ -620,11 +653,14 @@ static void collectvalidlines(toku_State *T, Closure *f) {
         setnilval(s2v(T->sp.p));
         api_inctop(T);
     } else {
-        int32_t i;
+        int32_t i, currline;
         TValue v;
+        Table *t;
         const Proto *p = f->t.p;
-        int32_t currline = p->defline;
-        Table *t = tokuH_new(T); /* new table to store active lines */
+        if (p->lazy && tokuPR_compile(T, f->t.p) != TOKU_STATUS_OK)
+            T->sp.p--; /* remove error message (body has no lines) */
+        currline = p->defline;
+        t = tokuH_new(T); /* new table to store active lines */
         settval2s(T, T->sp.p, t); /* push it on stack */
         api_inctop(T);
         if (p->lineinfo != NULL) { /* have debug information? */
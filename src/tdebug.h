@@ -45,6 +45,8 @@
         tokuD_opinterror(C, v1, v2, "perform bitwise operation on")
 
 TOKUI_FUNC int32_t tokuD_getfuncline(const Proto *fn, int32_t pc);
+TOKUI_FUNC int32_t tokuD_symstep(const uint8_t *i, int32_t *psymsp,
+                                                   int32_t sp);
 TOKUI_FUNC const char *tokuD_findlocal(toku_State *T, CallFrame *cf,
                                        int32_t n, SPtr *pos);
 TOKUI_FUNC const char *tokuD_addinfo(toku_State *T, const char *msg,
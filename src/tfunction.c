@@ -14,6 +14,7 @@
 #include "tfunction.h"
 #include "tdebug.h"
 #include "tgc.h"
+#include "tjit.h"
 #include "tmem.h"
 #include "tmeta.h"
 #include "tobject.h"
@@ -33,6 +34,20 @@ Proto *tokuF_newproto(toku_State *T) {
 }
 
 
+/*
+** Allocate 'n' empty inline caches for 'p'. (Hint 0 is as good as any
+** other initial value, as hints are always checked before use.)
+*/
+void tokuF_newcaches(toku_State *T, Proto *p, int32_t n) {
+    toku_assert(p->ic == NULL && p->sizeic == 0);
+    if (n > 0) {
+        p->ic = tokuM_newarray(T, n, InlineCache);
+        p->sizeic = n;
+        memset(p->ic, 0, cast_sizet(n) * sizeof(InlineCache));
+    }
+}
+
+
 TClosure *tokuF_newTclosure(toku_State *T, int32_t nup) {
     GCObject *o = tokuG_new(T, sizeofTcl(nup), TOKU_VTCL);
     TClosure *cl = gco2clt(o);
@@ -303,11 +318,19 @@ SPtr tokuF_close(toku_State *T, SPtr level, int32_t status) {
 void tokuF_free(toku_State *T, Proto *p) {
     tokuM_freearray(T, p->p, cast_u32(p->sizep));
     tokuM_freearray(T, p->k, cast_u32(p->sizek));
-    tokuM_freearray(T, p->code, cast_u32(p->sizecode));
-    tokuM_freearray(T, p->lineinfo, cast_u32(p->sizelineinfo));
-    tokuM_freearray(T, p->abslineinfo, cast_u32(p->sizeabslineinfo));
-    tokuM_freearray(T, p->opcodepc, cast_u32(p->sizeopcodepc));
+    if (!(p->borrowed & BORROW_CODE))
+        tokuM_freearray(T, p->code, cast_u32(p->sizecode));
+    if (!(p->borrowed & BORROW_LINEINFO))
+        tokuM_freearray(T, p->lineinfo, cast_u32(p->sizelineinfo));
+    if (!(p->borrowed & BORROW_ABSLINEINFO))
+        tokuM_freearray(T, p->abslineinfo, cast_u32(p->sizeabslineinfo));
+    if (!(p->borrowed & BORROW_OPCODEPC))
+        tokuM_freearray(T, p->opcodepc, cast_u32(p->sizeopcodepc));
     tokuM_freearray(T, p->locals, cast_u32(p->sizelocals));
     tokuM_freearray(T, p->upvals, cast_u32(p->sizeupvals));
+    tokuM_freearray(T, p->ic, cast_u32(p->sizeic));
+    if (p->lazy)
+        tokuM_free(T, p->lazy);
+    tokuJ_free(T, p);
     tokuM_free(T, p);
 }
@@ -41,7 +41,19 @@
 #define CLOSEKTOP       (-1)
 
 
+/*
+** Bits in 'Proto.borrowed' for arrays that point into the memory of
+** 'Proto.blob' (see 'toku_loadblob'); these are not freed with the
+** prototype.
+*/
+#define BORROW_CODE         (1<<0)
+#define BORROW_LINEINFO     (1<<1)
+#define BORROW_ABSLINEINFO  (1<<2)
+#define BORROW_OPCODEPC     (1<<3)
+
+
 TOKUI_FUNC Proto *tokuF_newproto(toku_State *T);
+TOKUI_FUNC void tokuF_newcaches(toku_State *T, Proto *p, int32_t n);
 TOKUI_FUNC TClosure *tokuF_newTclosure(toku_State *T, int32_t nupvals);
 TOKUI_FUNC CClosure *tokuF_newCclosure(toku_State *T, int32_t nupvals);
 TOKUI_FUNC void tokuF_adjustvarargs(toku_State *T, int32_t arity,
@@ -22,6 +22,7 @@
 #include "tstring.h"
 #include "tvm.h"
 #include "tprotected.h"
+#include "tshape.h"
 
 
 /* mark object as current white */
@@ -162,6 +163,8 @@ static GCObject **getgclist(GCObject *o) {
         case TOKU_VTABLE: return &gco2ht(o)->gclist;
         case TOKU_VTHREAD: return &gco2th(o)->gclist;
         case TOKU_VUSERDATA: return &gco2u(o)->gclist;
+        case TOKU_VINSTANCE: return &gco2ins(o)->gclist;
+        case TOKU_VROPESTR: return &getrope(gco2str(o))->gclist;
         default: toku_assert(0); return NULL;
     }
 }
@@ -207,6 +210,27 @@ void tokuG_barrierback_(toku_State *T, GCObject *r) {
 ** Mark objects
 ** ======================================================================= */
 
+/*
+** Marks keys of all shapes in the shape tree rooted at 's'. Each shape
+** only adds its last key to the keys of its parent, so only that key
+** needs marking.
+*/
+static void markshapes(GState *gs, Shape *s) {
+    while (s != NULL) {
+        if (s->nkeys > 0)
+            markobject(gs, s->keys[s->nkeys - 1]);
+        if (s->child != NULL) /* have extensions? */
+            s = s->child; /* go down */
+        else { /* otherwise go to the next sibling of 's' or its parents */
+            while (s != NULL && s->sibling == NULL)
+                s = s->parent;
+            if (s != NULL)
+                s = s->sibling;
+        }
+    }
+}
+
+
 /*
 ** Marks white object 'o'.
 ** Some objects are directly marked as black, these
@@ -247,13 +271,6 @@ static void markobject_(GState *gs, GCObject *o) {
             markblack(um); /* nothing else to mark */
             break;
         }
-        case TOKU_VINSTANCE: {
-            Instance *ins = gco2ins(o);
-            markobject(gs, ins->oclass);
-            markobjectN(gs, ins->fields);
-            markblack(ins); /* nothing else to mark */
-            break;
-        }
         case TOKU_VLIST: {
             List *l = gco2list(o);
             if (l->len == 0) { /* no elements? */
@@ -268,6 +285,7 @@ static void markobject_(GState *gs, GCObject *o) {
             markobjectN(gs, cls->sclass);
             markobjectN(gs, cls->metatable);
             markobjectN(gs, cls->methods);
+            markshapes(gs, cls->shape);
             markblack(cls); /* nothing else to mark */
             break;
         }
@@ -282,7 +300,8 @@ static void markobject_(GState *gs, GCObject *o) {
         } /* fall through */
     linklist:
         case TOKU_VTABLE: case TOKU_VPROTO: case TOKU_VTCL:
-        case TOKU_VCCL: case TOKU_VTHREAD: {
+        case TOKU_VCCL: case TOKU_VTHREAD: case TOKU_VINSTANCE:
+        case TOKU_VROPESTR: {
             linkobjgclist(o, gs->graylist);
             break;
         }
@@ -308,6 +327,8 @@ static void clearkey(Node *n) {
 
 static t_mem marktable(GState *gs, Table *t) {
     Node *last = htnodelast(t);
+    for (uint32_t i = 0; i < t->asize; i++)
+        markvalue(gs, &t->array[i]);
     for (Node *n = htnode(t, 0); n < last; n++) {
         if (!isempty(nodeval(n))) { /* entry is not empty? */
             toku_assert(!keyisnil(n));
@@ -316,7 +337,8 @@ static t_mem marktable(GState *gs, Table *t) {
         } else
             clearkey(n);
     }
-    return 1 + cast_mem(htsize(t) * 2); /* table + key/value fields */
+    /* table + array slots + key/value fields */
+    return 1 + cast_mem(t->asize) + cast_mem(htsize(t) * 2);
 }
 
 
@@ -331,6 +353,9 @@ static t_mem markproto(GState *gs, Proto *p) {
         markobjectN(gs, p->locals[i].name);
     for (i = 0; i < p->sizeupvals; i++)
         markobjectN(gs, p->upvals[i].name);
+    if (p->lazy) /* body not compiled yet? */
+        markobject(gs, p->lazy->text); /* keep its source text */
+    markobjectN(gs, p->blob); /* keep memory of borrowed arrays */
     /* p + prototypes + constants + locals + upvalues */
     return 1 + p->sizep + p->sizek + p->sizelocals + p->sizeupvals;
 }
@@ -442,6 +467,19 @@ static t_mem markopenupvals(GState *gs) {
 }
 
 
+static t_mem markinstance(GState *gs, Instance *ins) {
+    int32_t n = 0;
+    markobject(gs, ins->oclass);
+    markobjectN(gs, ins->fields);
+    if (ins->shape != NULL) { /* have slots? */
+        n = ins->shape->nkeys;
+        for (int32_t i = 0; i < n; i++)
+            markvalue(gs, &ins->slots[i]);
+    }
+    return 1 + n; /* instance + slots */
+}
+
+
 static t_mem marklist(GState *gs, List *l) {
     toku_assert(0 < l->len);
     for (int32_t i = 0; i < l->len; i++)
@@ -450,6 +488,14 @@ static t_mem marklist(GState *gs, List *l) {
 }
 
 
+static t_mem markrope(GState *gs, OString *s) {
+    Rope *rope = getrope(s);
+    markobjectN(gs, rope->left);
+    markobject(gs, rope->right);
+    return 1;
+}
+
+
 /* 
 ** Traverse a single gray object turning it to black.
 */
@@ -465,7 +511,9 @@ static t_mem propagate(GState *gs) {
         case TOKU_VTCL: return markcsclosure(gs, gco2clt(o));
         case TOKU_VCCL: return markcclosure(gs, gco2clc(o));
         case TOKU_VLIST: return marklist(gs, gco2list(o));
+        case TOKU_VINSTANCE: return markinstance(gs, gco2ins(o));
         case TOKU_VTHREAD: return markthread(gs, gco2th(o));
+        case TOKU_VROPESTR: return markrope(gs, gco2str(o));
         default: toku_assert(0); return 0;
     }
 }
@@ -499,11 +547,16 @@ static void freeobject(toku_State *T, GCObject *o) {
         case TOKU_VUPVALUE: freeupval(T, gco2uv(o)); break;
         case TOKU_VLIST: tokuA_free(T, gco2list(o)); break;
         case TOKU_VTABLE: tokuH_free(T, gco2ht(o)); break;
-        case TOKU_VINSTANCE: tokuM_free(T, gco2ins(o)); break;
+        case TOKU_VINSTANCE: tokuSH_freeinstance(T, gco2ins(o)); break;
         case TOKU_VIMETHOD: tokuM_free(T, gco2im(o)); break;
         case TOKU_VUMETHOD: tokuM_free(T, gco2um(o)); break;
         case TOKU_VTHREAD: tokuT_free(T, gco2th(o)); break;
-        case TOKU_VCLASS: tokuM_free(T, gco2cls(o)); break;
+        case TOKU_VCLASS: {
+            OClass *cls = gco2cls(o);
+            tokuSH_freeshapes(T, cls);
+            tokuM_free(T, cls);
+            break;
+        }
         case TOKU_VSHRSTR: {
             OString *s = gco2str(o);
             tokuS_remove(T, s); /* remove it from the string table */
@@ -515,6 +568,10 @@ static void freeobject(toku_State *T, GCObject *o) {
             tokuM_freemem(T, s, sizeofstring(s->u.lnglen));
             break;
         }
+        case TOKU_VROPESTR: {
+            tokuM_freemem(T, gco2str(o), sizeofrope);
+            break;
+        }
         case TOKU_VTCL: {
             TClosure *cl = gco2clt(o);
             tokuM_freemem(T, cl, sizeofTcl(cl->nupvals));
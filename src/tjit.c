@@ -0,0 +1,1261 @@
+/*
+** tjit.c
+** Baseline JIT compiler
+** See Copyright Notice in tokudae.h
+*/
+
+#define tjit_c
+#define TOKU_CORE
+
+#define _DEFAULT_SOURCE     /* for 'MAP_ANONYMOUS' */
+
+#include "tokudaeprefix.h"
+
+#include "tjit.h"
+
+#if TOKU_JIT    /* { */
+
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "tcode.h"
+#include "tdebug.h"
+#include "tobject.h"
+#include "tstate.h"
+#include "tvm.h"
+
+
+/*
+** The JIT translates each opcode of a hot function into a template of
+** x86-64 machine code, with the opcode arguments (stack slots,
+** constants, immediates and jump targets) baked in as immediate
+** operands. Templates only cover the common cases: stack and upvalue
+** loads, number arithmetic and comparisons, indexing lists (and the
+** array part of tables) with integers, jumps and integer loops over
+** 'range'. Every other opcode, and every template whose guard fails,
+** is an exit: native code stores the stack pointer and returns the
+** offset of that opcode to the interpreter, which executes it (with
+** all of its metamethods, errors, allocations and hooks) and then
+** enters native code again at the next opcode (see 'jitenter' in
+** 'tvm.c'). Native code therefore never calls into the core, never
+** runs the collector and never raises errors; loop back-edges check
+** 'trap' so that hooks and signals still get served.
+**
+** Native code is a function with the following prototype (System V
+** ABI), where 'entry' is the code to jump to after the prologue:
+**
+**   int32_t f(SPtr base, SPtr *psp, CallFrame *cf, TClosure *cl,
+**             const void *entry);
+**
+** The whole function is kept in a single anonymous mapping together
+** with its 'JitCode' header; the mapping is made executable (and
+** read-only) before it is used and it is released with its 'Proto'.
+*/
+
+
+typedef int32_t (*NativeFunc)(SPtr base, SPtr *psp, CallFrame *cf,
+                              TClosure *cl, const void *entry);
+
+
+/* x86-64 registers */
+#define RAX     0
+#define RCX     1
+#define RDX     2
+#define RBX     3
+#define RSP     4
+#define RBP     5
+#define RSI     6
+#define RDI     7
+#define R8      8
+#define R12     12
+#define R13     13
+#define R14     14
+#define R15     15
+
+/* SSE registers */
+#define XMM0    0
+#define XMM1    1
+
+/* registers with fixed contents while running native code */
+#define RBASE   RBX     /* base of the function frame */
+#define RTOP    R12     /* stack pointer ('sp' of the interpreter) */
+#define RPSP    R13     /* where to store 'sp' on exit */
+#define RCF     R14     /* 'CallFrame' of the function */
+#define RCL     R15     /* closure of the function */
+
+
+/* condition codes */
+#define CC_B        0x2
+#define CC_AE       0x3
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_BE       0x6
+#define CC_A        0x7
+#define CC_P        0xA
+#define CC_NP       0xB
+#define CC_L        0xC
+#define CC_GE       0xD
+#define CC_LE       0xE
+#define CC_G        0xF
+#define CC_ALWAYS   (-1)
+
+
+/* opcodes of instructions with register and memory operands */
+#define I_ADD       0x03
+#define I_OR        0x0B
+#define I_AND       0x23
+#define I_SUB       0x2B
+#define I_XOR       0x33
+#define I_CMP       0x3B
+#define I_MOV       0x8B
+#define I_MOVST     0x89
+#define I_LEA       0x8D
+#define I_IMUL      0x0FAF
+#define I_MOVZXB    0x0FB6
+
+/* SSE opcodes (with their mandatory prefix) */
+#define SD          0xF2
+#define PD          0x66
+#define I_MOVSD     0x0F10
+#define I_MOVSDST   0x0F11
+#define I_CVTSI2SD  0x0F2A
+#define I_UCOMISD   0x0F2E
+#define I_ADDSD     0x0F58
+#define I_MULSD     0x0F59
+#define I_SUBSD     0x0F5C
+#define I_DIVSD     0x0F5E
+#define I_MOVQ      0x0F6E
+
+
+/* size of stack slots */
+#define SZ              cast_i32(sizeof(SValue))
+
+/* displacement of stack slot 'i' from 'base' */
+#define STKD(i)         (cast_i32(i) * SZ)
+
+/* displacement of value 'n' slots below the top from 'sp' */
+#define TOPD(n)         (-(cast_i32(n) + 1) * SZ)
+
+/* displacement of the type tag of a value */
+#define TT              cast_i32(offsetof(TValue, tt))
+
+
+/* maximum size of a single template (in bytes) */
+#define MAXTEMPLATE     512
+
+/* maximum number of jumps (fixups) in a single template */
+#define MAXFIXUPS       16
+
+/* maximum number of values a template sets to nil */
+#define MAXNILS         8
+
+/* size of exit stub ('mov eax, imm32' + 'jmp rel32') */
+#define EXITSIZE        10
+
+
+/* jump that needs its target patched once the target is known */
+typedef struct Fixup {
+    int32_t pos; /* position of the 'rel32' operand */
+    int32_t pc; /* target opcode */
+    int32_t isexit; /* true if jumping to the exit stub of 'pc' */
+} Fixup;
+
+
+typedef struct JitState {
+    toku_State *T;
+    const Proto *p;
+    uint8_t *buf; /* code buffer */
+    Fixup *fixups; /* pending jumps */
+    int32_t *label; /* native offset of each opcode */
+    int32_t *entry; /* idem, or -1 if opcode always exits */
+    int32_t *exits; /* native offset of exit stub of each opcode (or -1) */
+    size_t n; /* number of bytes in 'buf' */
+    size_t size; /* size of 'buf' */
+    int32_t nfixups; /* number of elements in 'fixups' */
+    int32_t sizefixups; /* size of 'fixups' */
+    int32_t exitlabel; /* native offset of the common exit code */
+} JitState;
+
+
+/* offset of native code from the start of 'JitCode' */
+#define codeoffset(sizecode) \
+        ((offsetof(JitCode, entry) + cast_sizet(sizecode)*sizeof(int32_t) \
+          + 15u) & ~cast_sizet(15u))
+
+/* native code of 'p' */
+#define codeptr(p)      (cast(uint8_t *, (p)->jit) + codeoffset((p)->sizecode))
+
+
+/*
+** Memory of the compiler itself goes directly through the allocator,
+** as compiling must not trigger a collection.
+*/
+static void *rawalloc(JitState *J, void *block, size_t osize, size_t nsize) {
+    GState *gs = G(J->T);
+    return (*gs->falloc)(block, gs->ud_alloc, osize, nsize);
+}
+
+
+/* {======================================================================
+** Code emission
+** ======================================================================= */
+
+/* make room for 'nbytes' more bytes and 'nfix' more fixups */
+static int32_t reserve(JitState *J, size_t nbytes, int32_t nfix) {
+    if (J->size - J->n < nbytes) {
+        size_t newsize = (J->size + nbytes) * 2;
+        uint8_t *newbuf = cast(uint8_t *, rawalloc(J, J->buf, J->size,
+                                                   newsize));
+        if (newbuf == NULL) return 0;
+        J->buf = newbuf;
+        J->size = newsize;
+    }
+    if (J->sizefixups - J->nfixups < nfix) {
+        int32_t newsize = (J->sizefixups + nfix) * 2;
+        Fixup *newf = cast(Fixup *, rawalloc(J, J->fixups,
+                cast_sizet(J->sizefixups) * sizeof(Fixup),
+                cast_sizet(newsize) * sizeof(Fixup)));
+        if (newf == NULL) return 0;
+        J->fixups = newf;
+        J->sizefixups = newsize;
+    }
+    return 1;
+}
+
+
+static void emit1(JitState *J, int32_t b) {
+    toku_assert(J->n < J->size);
+    J->buf[J->n++] = cast_u8(b & 0xFF);
+}
+
+
+static void emit4(JitState *J, int32_t x) {
+    uint32_t u = cast_u32(x);
+    for (int32_t i = 0; i < 4; i++, u >>= 8)
+        emit1(J, cast_i32(u & 0xFF));
+}
+
+
+static void emit8(JitState *J, uint64_t x) {
+    emit4(J, cast_i32(cast_u32(x & 0xFFFFFFFFu)));
+    emit4(J, cast_i32(cast_u32(x >> 32)));
+}
+
+
+static void patch4(JitState *J, int32_t pos, int32_t x) {
+    uint32_t u = cast_u32(x);
+    for (int32_t i = 0; i < 4; i++, u >>= 8)
+        J->buf[pos + i] = cast_u8(u & 0xFF);
+}
+
+
+#define here(J)         cast_i32((J)->n)
+
+
+/* REX prefix ('w' selects 64-bit operand size), if needed */
+static void rex(JitState *J, int32_t w, int32_t reg, int32_t rm) {
+    int32_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (r != 0x40)
+        emit1(J, r);
+}
+
+
+/* opcode ('op' might have 0x0F escape prefix) */
+static void opcode(JitState *J, int32_t op) {
+    if (op > 0xFF)
+        emit1(J, op >> 8);
+    emit1(J, op);
+}
+
+
+/* ModRM (and SIB) for 'reg' and memory operand 'base' + 'disp' */
+static void modrm_mem(JitState *J, int32_t reg, int32_t base, int32_t disp) {
+    int32_t mod;
+    if (disp == 0 && (base & 7) != RBP)
+        mod = 0;
+    else if (-128 <= disp && disp <= 127)
+        mod = 1;
+    else
+        mod = 2;
+    emit1(J, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) /* (RSP and R12 need a SIB byte) */
+        emit1(J, 0x24);
+    if (mod == 1)
+        emit1(J, disp);
+    else if (mod == 2)
+        emit4(J, disp);
+}
+
+
+/* instruction with register 'reg' and memory operand 'base' + 'disp' */
+static void insm(JitState *J, int32_t prefix, int32_t w, int32_t op,
+                 int32_t reg, int32_t base, int32_t disp) {
+    if (prefix) emit1(J, prefix);
+    rex(J, w, reg, base);
+    opcode(J, op);
+    modrm_mem(J, reg, base, disp);
+}
+
+
+/* instruction with register operands 'reg' and 'rm' */
+static void insr(JitState *J, int32_t prefix, int32_t w, int32_t op,
+                 int32_t reg, int32_t rm) {
+    if (prefix) emit1(J, prefix);
+    rex(J, w, reg, rm);
+    opcode(J, op);
+    emit1(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+#define load(J,r,b,d)       insm(J, 0, 1, I_MOV, r, b, d)
+#define store(J,b,d,r)      insm(J, 0, 1, I_MOVST, r, b, d)
+#define lea(J,r,b,d)        insm(J, 0, 1, I_LEA, r, b, d)
+#define opm(J,op,r,b,d)     insm(J, 0, 1, op, r, b, d)
+#define opr(J,op,r,r2)      insr(J, 0, 1, op, r, r2)
+#define sdm(J,op,x,b,d)     insm(J, SD, 0, op, x, b, d)
+#define sdr(J,op,x,x2)      insr(J, SD, 0, op, x, x2)
+
+/* 'tt' of value at 'b' + 'd' into 32-bit 'r' (zero extended) */
+#define loadtag(J,r,b,d)    insm(J, 0, 0, I_MOVZXB, r, b, (d) + TT)
+
+/* 'tt' of value at 'b' + 'd' from 'cl' or 'al' */
+#define storetag(J,b,d,r)   insm(J, 0, 0, 0x88, r, b, (d) + TT)
+
+
+/* set 'tt' of value at 'b' + 'd' to 'tag' */
+static void settag(JitState *J, int32_t b, int32_t d, int32_t tag) {
+    insm(J, 0, 0, 0xC6, 0, b, d + TT);
+    emit1(J, tag);
+}
+
+
+/* compare 'tt' of value at 'b' + 'd' with 'tag' */
+static void cmptag(JitState *J, int32_t b, int32_t d, int32_t tag) {
+    insm(J, 0, 0, 0x80, 7, b, d + TT);
+    emit1(J, tag);
+}
+
+
+/* compare 32-bit register 'r' with 'imm' */
+static void cmpri(JitState *J, int32_t r, int32_t imm) {
+    insr(J, 0, 0, 0x81, 7, r);
+    emit4(J, imm);
+}
+
+
+/* 64-bit 'r' <op>= 'imm' ('ext' selects the operation) */
+static void opri(JitState *J, int32_t ext, int32_t r, int32_t imm) {
+    insr(J, 0, 1, 0x81, ext, r);
+    emit4(J, imm);
+}
+
+
+/* mov 'r', 'imm' (64-bit) */
+static void movri(JitState *J, int32_t r, uint64_t imm) {
+    rex(J, 1, 0, r);
+    emit1(J, 0xB8 + (r & 7));
+    emit8(J, imm);
+}
+
+
+/* move bits of 'n' into SSE register 'x' (uses RAX) */
+static void movfi(JitState *J, int32_t x, toku_Number n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    movri(J, RAX, bits);
+    insr(J, PD, 1, I_MOVQ, x, RAX);
+}
+
+
+/* copy value at 'sb' + 'sd' to 'db' + 'dd' (uses RCX) */
+static void copyval(JitState *J, int32_t db, int32_t dd, int32_t sb,
+                                                         int32_t sd) {
+    load(J, RCX, sb, sd);
+    store(J, db, dd, RCX);
+    loadtag(J, RCX, sb, sd);
+    storetag(J, db, dd, RCX);
+}
+
+
+/* adjust stack pointer by 'n' slots */
+static void push(JitState *J, int32_t n) {
+    if (n != 0)
+        lea(J, RTOP, RTOP, n * SZ);
+}
+
+
+/* store boolean 'al' (0 or 1) as the type tag of value at 'b' + 'd' */
+static void booltag(JitState *J, int32_t b, int32_t d) {
+    emit1(J, 0xC0); emit1(J, 0xE0); emit1(J, 4); /* shl al, 4 */
+    emit1(J, 0x0C); emit1(J, TOKU_T_BOOL); /* or al, TOKU_T_BOOL */
+    storetag(J, b, d, RAX);
+}
+
+
+/* 'setcc al' */
+static void setcc(JitState *J, int32_t cc) {
+    insr(J, 0, 0, 0x0F90 | cc, 0, RAX);
+}
+
+
+/* emit jump with unknown target, returns position of its 'rel32' */
+static int32_t jump(JitState *J, int32_t cc) {
+    if (cc == CC_ALWAYS)
+        emit1(J, 0xE9);
+    else {
+        emit1(J, 0x0F);
+        emit1(J, 0x80 | cc);
+    }
+    emit4(J, 0);
+    return here(J) - 4;
+}
+
+
+/* set the target of jump at 'pos' to the current position */
+static void patchhere(JitState *J, int32_t pos) {
+    if (pos >= 0)
+        patch4(J, pos, here(J) - (pos + 4));
+}
+
+
+/* jump to the code of opcode 'pc' (or to its exit stub if 'isexit') */
+static void jumpto(JitState *J, int32_t cc, int32_t pc, int32_t isexit) {
+    Fixup *f;
+    toku_assert(J->nfixups < J->sizefixups);
+    f = &J->fixups[J->nfixups++];
+    f->pos = jump(J, cc);
+    f->pc = pc;
+    f->isexit = isexit;
+}
+
+#define jumppc(J,cc,pc)     jumpto(J, cc, pc, 0)
+#define jumpexit(J,cc,pc)   jumpto(J, cc, pc, 1)
+
+
+/* exit stub for opcode 'pc' */
+static void exitstub(JitState *J, int32_t pc) {
+    J->exits[pc] = here(J);
+    emit1(J, 0xB8); emit4(J, pc); /* mov eax, pc */
+    emit1(J, 0xE9); emit4(J, J->exitlabel - (here(J) + 4));
+}
+
+
+/* exit to the interpreter at 'pc' if 'trap' is set */
+static void checktrap(JitState *J, int32_t pc) {
+    insm(J, 0, 0, 0x83, 7, RCF, cast_i32(offsetof(CallFrame, t.trap)));
+    emit1(J, 0); /* cmp dword [cf->t.trap], 0 */
+    jumpexit(J, CC_NE, pc);
+}
+
+
+static void prologue(JitState *J) {
+    emit1(J, 0x53); /* push rbx */
+    emit1(J, 0x41); emit1(J, 0x54); /* push r12 */
+    emit1(J, 0x41); emit1(J, 0x55); /* push r13 */
+    emit1(J, 0x41); emit1(J, 0x56); /* push r14 */
+    emit1(J, 0x41); emit1(J, 0x57); /* push r15 */
+    insr(J, 0, 1, I_MOVST, RDI, RBASE);
+    insr(J, 0, 1, I_MOVST, RSI, RPSP);
+    load(J, RTOP, RSI, 0);
+    insr(J, 0, 1, I_MOVST, RDX, RCF);
+    insr(J, 0, 1, I_MOVST, RCX, RCL);
+    insr(J, 0, 0, 0xFF, 4, R8); /* jmp r8 */
+    /* common exit ('eax' holds the opcode offset) */
+    J->exitlabel = here(J);
+    store(J, RPSP, 0, RTOP);
+    emit1(J, 0x41); emit1(J, 0x5F); /* pop r15 */
+    emit1(J, 0x41); emit1(J, 0x5E); /* pop r14 */
+    emit1(J, 0x41); emit1(J, 0x5D); /* pop r13 */
+    emit1(J, 0x41); emit1(J, 0x5C); /* pop r12 */
+    emit1(J, 0x5B); /* pop rbx */
+    emit1(J, 0xC3); /* ret */
+}
+
+/* }====================================================================== */
+
+
+/* {======================================================================
+** Templates
+** ======================================================================= */
+
+/* load constant 'kv' */
+static void tconst(JitState *J, const TValue *kv) {
+    uint64_t bits;
+    memcpy(&bits, &kv->val, sizeof(bits));
+    movri(J, RAX, bits);
+    store(J, RTOP, 0, RAX);
+    settag(J, RTOP, 0, rawtt(kv));
+    push(J, 1);
+}
+
+
+static void tconsti(JitState *J, toku_Integer i) {
+    movri(J, RAX, t_castS2U(i));
+    store(J, RTOP, 0, RAX);
+    settag(J, RTOP, 0, TOKU_VNUMINT);
+    push(J, 1);
+}
+
+
+static void tconstf(JitState *J, toku_Number n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    movri(J, RAX, bits);
+    store(J, RTOP, 0, RAX);
+    settag(J, RTOP, 0, TOKU_VNUMFLT);
+    push(J, 1);
+}
+
+
+/*
+** Arithmetic with stack operands; only operands of the same number
+** type are handled here. On success this skips the following OP_MBIN.
+*/
+static int32_t tarith(JitState *J, const uint8_t *i, int32_t pc,
+                                   int32_t next, int32_t op) {
+    int32_t swap = GET_ARG_S(i, 0);
+    int32_t a = TOPD(swap ? 0 : 1); /* first operand */
+    int32_t b = TOPD(swap ? 1 : 0); /* second operand */
+    int32_t res = TOPD(1);
+    int32_t skip = next + getopSize(OP_MBIN);
+    int32_t iop, fop, lf;
+    switch (op) {
+        case OP_ADD: iop = I_ADD; fop = I_ADDSD; break;
+        case OP_SUB: iop = I_SUB; fop = I_SUBSD; break;
+        case OP_MUL: iop = I_IMUL; fop = I_MULSD; break;
+        case OP_DIV: iop = -1; fop = I_DIVSD; break;
+        case OP_BAND: iop = I_AND; fop = -1; break;
+        case OP_BOR: iop = I_OR; fop = -1; break;
+        case OP_BXOR: iop = I_XOR; fop = -1; break;
+        default: return 0;
+    }
+    toku_assert(J->p->code[next] == OP_MBIN);
+    loadtag(J, RAX, RTOP, a);
+    loadtag(J, RCX, RTOP, b);
+    insr(J, 0, 0, I_CMP, RAX, RCX);
+    jumpexit(J, CC_NE, pc); /* different types */
+    if (iop < 0) { /* division (always float) */
+        int32_t lj;
+        cmpri(J, RAX, TOKU_VNUMFLT);
+        lf = jump(J, CC_E);
+        cmpri(J, RAX, TOKU_VNUMINT);
+        jumpexit(J, CC_NE, pc);
+        insm(J, SD, 1, I_CVTSI2SD, XMM0, RTOP, a);
+        insm(J, SD, 1, I_CVTSI2SD, XMM1, RTOP, b);
+        sdr(J, fop, XMM0, XMM1);
+        lj = jump(J, CC_ALWAYS);
+        patchhere(J, lf);
+        sdm(J, I_MOVSD, XMM0, RTOP, a);
+        sdm(J, fop, XMM0, RTOP, b);
+        patchhere(J, lj);
+        sdm(J, I_MOVSDST, XMM0, RTOP, res);
+        settag(J, RTOP, res, TOKU_VNUMFLT);
+    } else {
+        cmpri(J, RAX, TOKU_VNUMINT);
+        if (fop < 0) /* bitwise? */
+            jumpexit(J, CC_NE, pc);
+        lf = (fop < 0) ? -1 : jump(J, CC_NE);
+        load(J, RAX, RTOP, a);
+        opm(J, iop, RAX, RTOP, b);
+        store(J, RTOP, res, RAX);
+        if (fop >= 0) {
+            push(J, -1);
+            jumppc(J, CC_ALWAYS, skip);
+            patchhere(J, lf);
+            cmpri(J, RAX, TOKU_VNUMFLT);
+            jumpexit(J, CC_NE, pc);
+            sdm(J, I_MOVSD, XMM0, RTOP, a);
+            sdm(J, fop, XMM0, RTOP, b);
+            sdm(J, I_MOVSDST, XMM0, RTOP, res);
+        }
+    }
+    push(J, -1);
+    jumppc(J, CC_ALWAYS, skip);
+    return 1;
+}
+
+
+/* float operation 'fop' of the value on top with 'n' */
+static void tarithf(JitState *J, int32_t pc, int32_t fop, toku_Number n) {
+    int32_t lf, lj;
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+    lf = jump(J, CC_E);
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    jumpexit(J, CC_NE, pc);
+    insm(J, SD, 1, I_CVTSI2SD, XMM0, RTOP, TOPD(0));
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    sdm(J, I_MOVSD, XMM0, RTOP, TOPD(0));
+    patchhere(J, lj);
+    movfi(J, XMM1, n);
+    sdr(J, fop, XMM0, XMM1);
+    sdm(J, I_MOVSDST, XMM0, RTOP, TOPD(0));
+    settag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+}
+
+
+/* operation of the value on top with integer 'i' (int or float) */
+static void tarithi(JitState *J, int32_t pc, int32_t iop, int32_t fop,
+                                 toku_Integer i) {
+    int32_t lf, lj = -1;
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    if (fop < 0) /* bitwise? */
+        jumpexit(J, CC_NE, pc);
+    lf = (fop < 0) ? -1 : jump(J, CC_NE);
+    movri(J, RCX, t_castS2U(i));
+    load(J, RAX, RTOP, TOPD(0));
+    opr(J, iop, RAX, RCX);
+    store(J, RTOP, TOPD(0), RAX);
+    if (fop >= 0) {
+        lj = jump(J, CC_ALWAYS);
+        patchhere(J, lf);
+        cmptag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+        jumpexit(J, CC_NE, pc);
+        sdm(J, I_MOVSD, XMM0, RTOP, TOPD(0));
+        movfi(J, XMM1, cast_num(i));
+        sdr(J, fop, XMM0, XMM1);
+        sdm(J, I_MOVSDST, XMM0, RTOP, TOPD(0));
+    }
+    patchhere(J, lj);
+}
+
+
+/* operation of the value on top with a constant or immediate operand */
+static int32_t tarithk(JitState *J, int32_t pc, int32_t op,
+                                    const TValue *kv) {
+    switch (op) {
+        case OP_ADDK: case OP_ADDI:
+            if (ttisint(kv)) tarithi(J, pc, I_ADD, I_ADDSD, ival(kv));
+            else tarithf(J, pc, I_ADDSD, fval(kv));
+            break;
+        case OP_SUBK: case OP_SUBI:
+            if (ttisint(kv)) tarithi(J, pc, I_SUB, I_SUBSD, ival(kv));
+            else tarithf(J, pc, I_SUBSD, fval(kv));
+            break;
+        case OP_MULK: case OP_MULI:
+            if (ttisint(kv)) tarithi(J, pc, I_IMUL, I_MULSD, ival(kv));
+            else tarithf(J, pc, I_MULSD, fval(kv));
+            break;
+        case OP_DIVK: case OP_DIVI:
+            tarithf(J, pc, I_DIVSD,
+                    ttisint(kv) ? cast_num(ival(kv)) : fval(kv));
+            break;
+        case OP_BANDK: case OP_BANDI:
+            if (!ttisint(kv)) return 0;
+            tarithi(J, pc, I_AND, -1, ival(kv));
+            break;
+        case OP_BORK: case OP_BORI:
+            if (!ttisint(kv)) return 0;
+            tarithi(J, pc, I_OR, -1, ival(kv));
+            break;
+        case OP_BXORK: case OP_BXORI:
+            if (!ttisint(kv)) return 0;
+            tarithi(J, pc, I_XOR, -1, ival(kv));
+            break;
+        default: return 0;
+    }
+    return 1;
+}
+
+
+/* OP_LT and OP_LE with operands of the same number type */
+static void torder(JitState *J, const uint8_t *i, int32_t pc, int32_t op) {
+    int32_t swap = GET_ARG_S(i, 0);
+    int32_t a = TOPD(swap ? 0 : 1); /* first operand */
+    int32_t b = TOPD(swap ? 1 : 0); /* second operand */
+    int32_t lf, lj;
+    loadtag(J, RAX, RTOP, a);
+    loadtag(J, RCX, RTOP, b);
+    insr(J, 0, 0, I_CMP, RAX, RCX);
+    jumpexit(J, CC_NE, pc);
+    cmpri(J, RAX, TOKU_VNUMINT);
+    lf = jump(J, CC_NE);
+    load(J, RAX, RTOP, a);
+    opm(J, I_CMP, RAX, RTOP, b);
+    setcc(J, (op == OP_LT) ? CC_L : CC_LE);
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    cmpri(J, RAX, TOKU_VNUMFLT);
+    jumpexit(J, CC_NE, pc);
+    sdm(J, I_MOVSD, XMM0, RTOP, b);
+    insm(J, PD, 0, I_UCOMISD, XMM0, RTOP, a); /* compare 'b' with 'a' */
+    setcc(J, (op == OP_LT) ? CC_A : CC_AE); /* (false if unordered) */
+    patchhere(J, lj);
+    booltag(J, RTOP, TOPD(1));
+    push(J, -1);
+}
+
+
+/* 'al' = (xmm0 == xmm1) or its negation (if '!eq') */
+static void fequal(JitState *J, int32_t eq) {
+    insr(J, PD, 0, I_UCOMISD, XMM0, XMM1);
+    setcc(J, eq ? CC_E : CC_NE);
+    insr(J, 0, 0, 0x0F90 | (eq ? CC_NP : CC_P), 0, RCX); /* setcc cl */
+    emit1(J, eq ? 0x20 : 0x08); emit1(J, 0xC8); /* and/or al, cl */
+}
+
+
+/* OP_EQ with operands of the same number type */
+static void teq(JitState *J, const uint8_t *i, int32_t pc) {
+    int32_t eq = GET_ARG_S(i, 0);
+    int32_t lf, lj;
+    loadtag(J, RAX, RTOP, TOPD(1));
+    loadtag(J, RCX, RTOP, TOPD(0));
+    insr(J, 0, 0, I_CMP, RAX, RCX);
+    jumpexit(J, CC_NE, pc);
+    cmpri(J, RAX, TOKU_VNUMINT);
+    lf = jump(J, CC_NE);
+    load(J, RAX, RTOP, TOPD(1));
+    opm(J, I_CMP, RAX, RTOP, TOPD(0));
+    setcc(J, eq ? CC_E : CC_NE);
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    cmpri(J, RAX, TOKU_VNUMFLT);
+    jumpexit(J, CC_NE, pc);
+    sdm(J, I_MOVSD, XMM0, RTOP, TOPD(1));
+    sdm(J, I_MOVSD, XMM1, RTOP, TOPD(0));
+    fequal(J, eq);
+    patchhere(J, lj);
+    booltag(J, RTOP, TOPD(1));
+    push(J, -1);
+}
+
+
+/* OP_LTI, OP_LEI, OP_GTI and OP_GEI */
+static void torderi(JitState *J, int32_t pc, int32_t op, int32_t imm) {
+    int32_t lf, lj, icc, fcc, swap;
+    switch (op) {
+        case OP_LTI: icc = CC_L; fcc = CC_A; swap = 1; break;
+        case OP_LEI: icc = CC_LE; fcc = CC_AE; swap = 1; break;
+        case OP_GTI: icc = CC_G; fcc = CC_A; swap = 0; break;
+        default: icc = CC_GE; fcc = CC_AE; swap = 0; break;
+    }
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    lf = jump(J, CC_NE);
+    load(J, RAX, RTOP, TOPD(0));
+    opri(J, 7, RAX, imm); /* cmp rax, imm */
+    setcc(J, icc);
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+    jumpexit(J, CC_NE, pc);
+    sdm(J, I_MOVSD, XMM0, RTOP, TOPD(0));
+    movfi(J, XMM1, cast_num(imm));
+    if (swap) /* compare 'imm' with the value (false if unordered) */
+        insr(J, PD, 0, I_UCOMISD, XMM1, XMM0);
+    else
+        insr(J, PD, 0, I_UCOMISD, XMM0, XMM1);
+    setcc(J, fcc);
+    patchhere(J, lj);
+    booltag(J, RTOP, TOPD(0));
+}
+
+
+/* OP_EQI (values that are not numbers are never equal) */
+static void teqi(JitState *J, int32_t imm, int32_t eq) {
+    int32_t lf, lo, lj1, lj2;
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    lf = jump(J, CC_NE);
+    load(J, RAX, RTOP, TOPD(0));
+    opri(J, 7, RAX, imm); /* cmp rax, imm */
+    setcc(J, CC_E);
+    lj1 = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+    lo = jump(J, CC_NE);
+    sdm(J, I_MOVSD, XMM0, RTOP, TOPD(0));
+    movfi(J, XMM1, cast_num(imm));
+    fequal(J, 1);
+    lj2 = jump(J, CC_ALWAYS);
+    patchhere(J, lo);
+    emit1(J, 0x31); emit1(J, 0xC0); /* xor eax, eax */
+    patchhere(J, lj1);
+    patchhere(J, lj2);
+    if (!eq) {
+        emit1(J, 0x34); emit1(J, 1); /* xor al, 1 */
+    }
+    booltag(J, RTOP, TOPD(0));
+}
+
+
+/* 'al' = true if value at 'sp' + 'd' is false or nil (uses 'ecx') */
+static void isfalse(JitState *J, int32_t d) {
+    loadtag(J, RAX, RTOP, d);
+    cmpri(J, RAX, TOKU_VFALSE);
+    insr(J, 0, 0, 0x0F90 | CC_E, 0, RCX); /* sete cl */
+    emit1(J, 0xA8); emit1(J, 0x0F); /* test al, 0x0F (nil?) */
+    setcc(J, CC_E);
+    emit1(J, 0x08); emit1(J, 0xC8); /* or al, cl */
+}
+
+
+static void tunm(JitState *J, int32_t pc) {
+    int32_t lf, lj;
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    lf = jump(J, CC_NE);
+    insm(J, 0, 1, 0xF7, 3, RTOP, TOPD(0)); /* neg */
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lf);
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMFLT);
+    jumpexit(J, CC_NE, pc);
+    insm(J, 0, 1, 0x0FBA, 7, RTOP, TOPD(0)); /* btc (flip sign bit) */
+    emit1(J, 63);
+    patchhere(J, lj);
+}
+
+
+/* OP_TEST and OP_TESTPOP (next opcode is the conditional jump) */
+static void ttest(JitState *J, const uint8_t *i, int32_t next, int32_t pop) {
+    int32_t cond = GET_ARG_S(i, 0);
+    int32_t skip = next + getopSize(OP_JMP);
+    int32_t lf;
+    toku_assert(getopSize(J->p->code[next]) == getopSize(OP_JMP));
+    isfalse(J, TOPD(0));
+    if (pop) push(J, -1);
+    emit1(J, 0x84); emit1(J, 0xC0); /* test al, al */
+    lf = jump(J, CC_NE);
+    jumppc(J, CC_ALWAYS, cond ? next : skip); /* value is true */
+    patchhere(J, lf);
+    if (cond) /* value is false */
+        jumppc(J, CC_ALWAYS, skip);
+    /* else fall through to the jump */
+}
+
+
+/*
+** Copy value at 'rax' + 'd' (an element of a list or a slot of the
+** array part of a table) into stack slot 'sp' + 'res'; empty slots
+** are loaded as nil. Jumps at positions 'lnil1' and 'lnil2' are
+** patched to load nil.
+*/
+static void tloadelem(JitState *J, int32_t d, int32_t res, int32_t lnil1,
+                                                           int32_t lnil2) {
+    int32_t lz, lj;
+    load(J, RCX, RAX, d);
+    store(J, RTOP, res, RCX);
+    loadtag(J, RCX, RAX, d);
+    emit1(J, 0xF6); emit1(J, 0xC1); emit1(J, 0x0F); /* test cl, 0x0F */
+    lz = jump(J, CC_E);
+    storetag(J, RTOP, res, RCX);
+    lj = jump(J, CC_ALWAYS);
+    patchhere(J, lz);
+    patchhere(J, lnil1);
+    patchhere(J, lnil2);
+    settag(J, RTOP, res, TOKU_VNIL);
+    patchhere(J, lj);
+}
+
+
+#define LISTARR     cast_i32(offsetof(List, arr))
+#define LISTLEN     cast_i32(offsetof(List, len))
+#define TABARRAY    cast_i32(offsetof(Table, array))
+#define TABASIZE    cast_i32(offsetof(Table, asize))
+
+
+/* OP_GETINDEX with an integer key */
+static void tgetindex(JitState *J, int32_t pc) {
+    int32_t lt, lnil, lj;
+    cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+    jumpexit(J, CC_NE, pc);
+    loadtag(J, RAX, RTOP, TOPD(1));
+    cmpri(J, RAX, ctb(TOKU_VLIST));
+    lt = jump(J, CC_NE);
+    /* list (indices out of bounds are nil) */
+    load(J, RAX, RTOP, TOPD(1));
+    load(J, RCX, RTOP, TOPD(0));
+    insm(J, 0, 0, I_MOV, RDX, RAX, LISTLEN); /* zero extends */
+    opr(J, I_CMP, RCX, RDX);
+    lnil = jump(J, CC_AE);
+    load(J, RAX, RAX, LISTARR);
+    lj = jump(J, CC_ALWAYS);
+    /* table (indices out of the array part go to the interpreter) */
+    patchhere(J, lt);
+    cmpri(J, RAX, ctb(TOKU_VTABLE));
+    jumpexit(J, CC_NE, pc);
+    load(J, RAX, RTOP, TOPD(1));
+    load(J, RCX, RTOP, TOPD(0));
+    insm(J, 0, 0, I_MOV, RDX, RAX, TABASIZE);
+    opr(J, I_CMP, RCX, RDX);
+    jumpexit(J, CC_AE, pc);
+    load(J, RAX, RAX, TABARRAY);
+    patchhere(J, lj);
+    insr(J, 0, 1, 0x69, RCX, RCX); /* imul rcx, rcx, sizeof(TValue) */
+    emit4(J, cast_i32(sizeof(TValue)));
+    opr(J, I_ADD, RAX, RCX);
+    tloadelem(J, 0, TOPD(1), lnil, -1);
+    push(J, -1);
+}
+
+
+/* OP_GETINDEXINT and OP_GETINDEXINTL */
+static void tgetindexint(JitState *J, int32_t pc, int32_t imm) {
+    int32_t lt, lnil, lj;
+    loadtag(J, RAX, RTOP, TOPD(0));
+    cmpri(J, RAX, ctb(TOKU_VLIST));
+    lt = jump(J, CC_NE);
+    /* list */
+    load(J, RAX, RTOP, TOPD(0));
+    if (imm < 0)
+        lnil = jump(J, CC_ALWAYS);
+    else {
+        insm(J, 0, 0, 0x81, 7, RAX, LISTLEN); /* cmp dword [len], imm */
+        emit4(J, imm);
+        lnil = jump(J, CC_BE);
+    }
+    load(J, RAX, RAX, LISTARR);
+    lj = jump(J, CC_ALWAYS);
+    /* table */
+    patchhere(J, lt);
+    cmpri(J, RAX, ctb(TOKU_VTABLE));
+    jumpexit(J, CC_NE, pc);
+    if (imm < 0)
+        jumpexit(J, CC_ALWAYS, pc);
+    else {
+        load(J, RAX, RTOP, TOPD(0));
+        insm(J, 0, 0, 0x81, 7, RAX, TABASIZE); /* cmp dword [asize], imm */
+        emit4(J, imm);
+        jumpexit(J, CC_BE, pc);
+        load(J, RAX, RAX, TABARRAY);
+    }
+    patchhere(J, lj);
+    tloadelem(J, (imm < 0) ? 0 : imm * cast_i32(sizeof(TValue)),
+                 TOPD(0), lnil, -1);
+}
+
+
+/* OP_FORLOOPI over the builtin 'range' (see 'forprepi') */
+static int32_t tforloopi(JitState *J, const uint8_t *i, int32_t pc,
+                                                      int32_t next) {
+    int32_t stk = GET_ARG_L(i, 0);
+    int32_t target = next - GET_ARG_L(i, 1);
+    int32_t nvars = GET_ARG_L(i, 2);
+    int32_t ldone;
+    if (nvars > MAXNILS) return 0;
+    checktrap(J, pc);
+    cmptag(J, RBASE, STKD(stk + VAR_TBC), TOKU_VNUMINT);
+    jumpexit(J, CC_NE, pc); /* not the builtin 'range' */
+    load(J, RAX, RBASE, STKD(stk + VAR_TBC));
+    opr(J, 0x85, RAX, RAX); /* test rax, rax */
+    ldone = jump(J, CC_E);
+    insr(J, 0, 1, 0x83, 5, RAX); emit1(J, 1); /* sub rax, 1 */
+    store(J, RBASE, STKD(stk + VAR_TBC), RAX);
+    load(J, RAX, RBASE, STKD(stk + 1));
+    opm(J, I_ADD, RAX, RBASE, STKD(stk + 2));
+    store(J, RBASE, STKD(stk + 1), RAX);
+    store(J, RBASE, STKD(stk + VAR_N), RAX);
+    settag(J, RBASE, STKD(stk + VAR_N), TOKU_VNUMINT);
+    for (int32_t v = 1; v < nvars; v++)
+        settag(J, RBASE, STKD(stk + VAR_N + v), TOKU_VNIL);
+    lea(J, RTOP, RBASE, STKD(stk + VAR_N + nvars));
+    jumppc(J, CC_ALWAYS, target);
+    patchhere(J, ldone); /* leave the loop */
+    lea(J, RTOP, RBASE, STKD(stk + VAR_N));
+    return 1;
+}
+
+
+/*
+** Emit template for opcode 'op' at 'pc' (with arguments at 'i').
+** Returns 0 if the opcode always exits to the interpreter (nothing
+** is emitted in that case).
+*/
+static int32_t optemplate(JitState *J, const uint8_t *i, int32_t pc,
+                                                      int32_t op) {
+    const Proto *p = J->p;
+    int32_t next = pc + getopSize(op);
+    switch (op) {
+        case OP_TRUE: case OP_FALSE: {
+            settag(J, RTOP, 0, (op == OP_TRUE) ? TOKU_VTRUE : TOKU_VFALSE);
+            push(J, 1);
+            break;
+        }
+        case OP_NIL: {
+            int32_t n = GET_ARG_L(i, 0);
+            if (n > MAXNILS) return 0;
+            for (int32_t v = 0; v < n; v++)
+                settag(J, RTOP, v * SZ, TOKU_VNIL);
+            push(J, n);
+            break;
+        }
+        case OP_POP: {
+            push(J, -GET_ARG_L(i, 0));
+            break;
+        }
+        case OP_LOAD: case OP_GETLOCAL: case OP_ARITHLL: {
+            copyval(J, RTOP, 0, RBASE, STKD(GET_ARG_L(i, 0)));
+            push(J, 1);
+            break;
+        }
+        case OP_SETLOCAL: {
+            copyval(J, RBASE, STKD(GET_ARG_L(i, 0)), RTOP, TOPD(0));
+            push(J, -1);
+            break;
+        }
+        case OP_CONST: {
+            tconst(J, &p->k[GET_ARG_S(i, 0)]);
+            break;
+        }
+        case OP_CONSTL: {
+            tconst(J, &p->k[GET_ARG_L(i, 0)]);
+            break;
+        }
+        case OP_CONSTI: {
+            tconsti(J, IMM(GET_ARG_S(i, 0)));
+            break;
+        }
+        case OP_CONSTIL: {
+            tconsti(J, IMML(GET_ARG_L(i, 0)));
+            break;
+        }
+        case OP_CONSTF: {
+            tconstf(J, cast_num(IMM(GET_ARG_S(i, 0))));
+            break;
+        }
+        case OP_CONSTFL: {
+            tconstf(J, cast_num(IMML(GET_ARG_L(i, 0))));
+            break;
+        }
+        case OP_GETUVAL: {
+            int32_t off = cast_i32(offsetof(TClosure, upvals)) +
+                          GET_ARG_L(i, 0) * cast_i32(sizeof(UpVal *));
+            load(J, RAX, RCL, off);
+            load(J, RAX, RAX, cast_i32(offsetof(UpVal, v.p)));
+            copyval(J, RTOP, 0, RAX, 0);
+            push(J, 1);
+            break;
+        }
+        case OP_CHECKADJ: {
+            int32_t nres = GET_ARG_L(i, 1) - 1;
+            lea(J, RTOP, RBASE, STKD(GET_ARG_L(i, 0) + nres));
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_BAND: case OP_BOR: case OP_BXOR: {
+            return tarith(J, i, pc, next, op);
+        }
+        case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK:
+        case OP_BANDK: case OP_BORK: case OP_BXORK: {
+            const TValue *kv = &p->k[GET_ARG_L(i, 0)];
+            if (!ttisnum(kv)) return 0;
+            return tarithk(J, pc, op, kv);
+        }
+        case OP_ADDI: case OP_SUBI: case OP_MULI: case OP_DIVI:
+        case OP_BANDI: case OP_BORI: case OP_BXORI: {
+            TValue imm;
+            setival(&imm, IMML(GET_ARG_L(i, 0)));
+            return tarithk(J, pc, op, &imm);
+        }
+        case OP_EQI: {
+            teqi(J, IMML(GET_ARG_L(i, 0)), GET_ARG_S(i, SIZE_ARG_L));
+            break;
+        }
+        case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+            torderi(J, pc, op, IMML(GET_ARG_L(i, 0)));
+            break;
+        }
+        case OP_EQ: {
+            teq(J, i, pc);
+            break;
+        }
+        case OP_LT: case OP_LE: {
+            torder(J, i, pc, op);
+            break;
+        }
+        case OP_NOT: {
+            isfalse(J, TOPD(0));
+            booltag(J, RTOP, TOPD(0));
+            break;
+        }
+        case OP_UNM: {
+            tunm(J, pc);
+            break;
+        }
+        case OP_BNOT: {
+            cmptag(J, RTOP, TOPD(0), TOKU_VNUMINT);
+            jumpexit(J, CC_NE, pc);
+            insm(J, 0, 1, 0xF7, 2, RTOP, TOPD(0)); /* not */
+            break;
+        }
+        case OP_JMP: {
+            jumppc(J, CC_ALWAYS, next + GET_ARG_L(i, 0));
+            break;
+        }
+        case OP_JMPS: {
+            int32_t target = next - GET_ARG_L(i, 0);
+            checktrap(J, target);
+            jumppc(J, CC_ALWAYS, target);
+            break;
+        }
+        case OP_TEST: case OP_TESTPOP: {
+            ttest(J, i, next, op == OP_TESTPOP);
+            break;
+        }
+        case OP_GETINDEX: {
+            tgetindex(J, pc);
+            break;
+        }
+        case OP_GETINDEXINT: {
+            tgetindexint(J, pc, IMM(GET_ARG_S(i, 0)));
+            break;
+        }
+        case OP_GETINDEXINTL: {
+            tgetindexint(J, pc, IMML(GET_ARG_L(i, 0)));
+            break;
+        }
+        case OP_FORLOOPI: {
+            return tforloopi(J, i, pc, next);
+        }
+        default: return 0;
+    }
+    return 1;
+}
+
+/* }====================================================================== */
+
+
+/* {======================================================================
+** Compiler interface
+** ======================================================================= */
+
+static void freestate(JitState *J) {
+    size_t n = cast_sizet(J->p->sizecode);
+    rawalloc(J, J->buf, J->size, 0);
+    rawalloc(J, J->fixups, cast_sizet(J->sizefixups) * sizeof(Fixup), 0);
+    rawalloc(J, J->label, 3 * n * sizeof(int32_t), 0);
+}
+
+
+/*
+** Check if 'pc' is the start of an opcode of 'J->p' (after all opcodes
+** are translated, as only those have labels).
+*/
+#define isopcode(J,pc) \
+        (0 <= (pc) && (pc) < (J)->p->sizecode && (J)->label[pc] >= 0)
+
+
+/*
+** Emit code for all opcodes of 'J->p'. Fails if a jump does not target
+** an opcode, so bad bytecode keeps running in the interpreter.
+*/
+static int32_t translate(JitState *J) {
+    const Proto *p = J->p;
+    if (!reserve(J, MAXTEMPLATE, 0)) return 0;
+    prologue(J);
+    for (int32_t pc = 0; pc < p->sizecode;) {
+        const uint8_t *i = &p->code[pc];
+        int32_t op = getopOrig(*i);
+        if (!reserve(J, MAXTEMPLATE, MAXFIXUPS)) return 0;
+        J->label[pc] = J->entry[pc] = here(J);
+        if (!optemplate(J, i, pc, op)) { /* opcode always exits? */
+            J->entry[pc] = -1;
+            exitstub(J, pc);
+        }
+        toku_assert(here(J) - J->label[pc] <= MAXTEMPLATE);
+        pc += getopSize(op);
+    }
+    for (int32_t f = 0; f < J->nfixups; f++) { /* emit missing exits */
+        const Fixup *fx = &J->fixups[f];
+        if (t_unlikely(!isopcode(J, fx->pc)))
+            return 0; /* invalid jump target */
+        else if (fx->isexit && J->exits[fx->pc] < 0) {
+            if (!reserve(J, EXITSIZE, 0)) return 0;
+            exitstub(J, fx->pc);
+        }
+    }
+    for (int32_t f = 0; f < J->nfixups; f++) { /* patch all jumps */
+        const Fixup *fx = &J->fixups[f];
+        int32_t target = (fx->isexit) ? J->exits[fx->pc] : J->label[fx->pc];
+        toku_assert(target >= 0);
+        patch4(J, fx->pos, target - (fx->pos + 4));
+    }
+    return 1;
+}
+
+
+/* copy translated code into an executable mapping */
+static JitCode *install(JitState *J) {
+    const Proto *p = J->p;
+    size_t off = codeoffset(p->sizecode);
+    size_t pagesize = cast_sizet(sysconf(_SC_PAGESIZE));
+    size_t size = (off + J->n + pagesize - 1) & ~(pagesize - 1);
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    JitCode *jc;
+    if (mem == MAP_FAILED) return NULL;
+    jc = cast(JitCode *, mem);
+    jc->size = size;
+    memcpy(jc->entry, J->entry, cast_sizet(p->sizecode) * sizeof(int32_t));
+    memcpy(cast(uint8_t *, mem) + off, J->buf, J->n);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return NULL;
+    }
+    return jc;
+}
+
+
+/*
+** Compile 'p' into native code; returns its entry map or NULL if 'p'
+** could not be compiled (in which case it is not tried again soon).
+*/
+const int32_t *tokuJ_compile(toku_State *T, Proto *p) {
+    JitState J;
+    size_t n = cast_sizet(p->sizecode);
+    JitCode *jc = NULL;
+    toku_assert(p->jit == NULL);
+    p->jitcount = 0;
+    if (G(T)->jitstop) /* JIT is stopped? */
+        return NULL;
+    J.T = T;
+    J.p = p;
+    J.buf = NULL;
+    J.fixups = NULL;
+    J.n = J.size = 0;
+    J.nfixups = J.sizefixups = 0;
+    J.label = cast(int32_t *, rawalloc(&J, NULL, 0, 3 * n * sizeof(int32_t)));
+    if (J.label != NULL) {
+        J.entry = J.label + n;
+        J.exits = J.entry + n;
+        for (size_t i = 0; i < 3 * n; i++) J.label[i] = -1;
+        if (translate(&J))
+            jc = install(&J);
+        freestate(&J);
+    }
+    if (jc == NULL) { /* failed? */
+        p->jitcount = INT32_MIN; /* do not try again soon */
+        return NULL;
+    }
+    p->jit = jc;
+    return jc->entry;
+}
+
+
+/*
+** Run native code of the function running in 'cf' from opcode at 'pc'
+** (which must have an entry). Returns the opcode where native code
+** stopped; '*psp' is updated.
+*/
+const uint8_t *tokuJ_execute(toku_State *T, CallFrame *cf,
+                             const uint8_t *pc, SPtr *psp) {
+    TClosure *cl = cf_func(cf);
+    Proto *p = cl->p;
+    uint8_t *code = codeptr(p);
+    int32_t off = p->jit->entry[pc - p->code];
+    NativeFunc f = cast(NativeFunc, cast(void *, code));
+    UNUSED(T);
+    toku_assert(off >= 0);
+    return p->code + f(cf->func.p + 1, psp, cf, cl, code + off);
+}
+
+
+void tokuJ_free(toku_State *T, Proto *p) {
+    UNUSED(T);
+    if (p->jit != NULL)
+        munmap(p->jit, p->jit->size);
+}
+
+/* }====================================================================== */
+
+#endif          /* } */
@@ -0,0 +1,61 @@
+/*
+** tjit.h
+** Baseline JIT compiler
+** See Copyright Notice in tokudae.h
+*/
+
+#ifndef tjit_h
+#define tjit_h
+
+
+#include "tobject.h"
+#include "tstate.h"
+
+
+/*
+** Native code is generated only on x86-64 Linux for the default number
+** types (64-bit integers and double floats) and only when the JIT is
+** enabled with TOKU_USE_JIT. Otherwise TOKU_JIT is 0 and the
+** interpreter runs everything.
+*/
+#if defined(TOKU_USE_JIT) && defined(__x86_64__) && defined(__linux__) && \
+    TOKU_INT_TYPE == TOKU_INT_64 && TOKU_FLOAT_TYPE == TOKU_FLOAT_DOUBLE
+#define TOKU_JIT        1
+#else
+#define TOKU_JIT        0
+#endif
+
+
+/* number of calls or loop iterations before a function gets compiled */
+#if !defined(TOKUI_JITTHRESHOLD)
+#define TOKUI_JITTHRESHOLD      100
+#endif
+
+
+/* native code of a function prototype */
+typedef struct JitCode {
+    size_t size; /* size of the mapping holding this code */
+    int32_t entry[1]; /* native offset of each opcode (or -1) */
+} JitCode;
+
+
+/*
+** Get the entry map of 'p' if it already has native code, otherwise
+** count this call (or loop iteration) and compile 'p' when it gets
+** hot. Returns NULL if 'p' has no native code (yet).
+*/
+#define tokuJ_entry(T,p) \
+    ((p)->jit != NULL ? (p)->jit->entry \
+     : (++(p)->jitcount < G(T)->jitthreshold) ? NULL : tokuJ_compile(T, p))
+
+
+#if TOKU_JIT
+TOKUI_FUNC const int32_t *tokuJ_compile(toku_State *T, Proto *p);
+TOKUI_FUNC const uint8_t *tokuJ_execute(toku_State *T, CallFrame *cf,
+                                        const uint8_t *pc, SPtr *psp);
+TOKUI_FUNC void tokuJ_free(toku_State *T, Proto *p);
+#else
+#define tokuJ_free(T,p)     ((void)(T), (void)(p))
+#endif
+
+#endif
@@ -94,6 +94,7 @@ static const void *const jmptable[NUM_OPCODES] = { /* "ORDER OP" */
     &&L_OP_JMPS,
     &&L_OP_TEST,
     &&L_OP_TESTPOP,
+    &&L_OP_SWITCH,
     &&L_OP_CALL,
     &&L_OP_TAILCALL,
     &&L_OP_CLOSE,
@@ -101,15 +102,19 @@ static const void *const jmptable[NUM_OPCODES] = { /* "ORDER OP" */
     &&L_OP_CHECKADJ,
     &&L_OP_GETLOCAL,
     &&L_OP_SETLOCAL,
+    &&L_OP_ARITHLL,
     &&L_OP_GETUVAL,
     &&L_OP_SETUVAL,
     &&L_OP_SETLIST,
     &&L_OP_SETPROPERTY,
     &&L_OP_GETPROPERTY,
+    &&L_OP_GETMETHOD,
     &&L_OP_GETINDEX,
     &&L_OP_SETINDEX,
     &&L_OP_GETINDEXSTR,
     &&L_OP_SETINDEXSTR,
+    &&L_OP_GETINDEXUP,
+    &&L_OP_SETINDEXUP,
     &&L_OP_GETINDEXINT,
     &&L_OP_GETINDEXINTL,
     &&L_OP_SETINDEXINT,
@@ -120,7 +125,25 @@ static const void *const jmptable[NUM_OPCODES] = { /* "ORDER OP" */
     &&L_OP_FORPREP,
     &&L_OP_FORCALL,
     &&L_OP_FORLOOP,
+    &&L_OP_FORPREPI,
+    &&L_OP_FORLOOPI,
     &&L_OP_RETURN,
+    &&L_OP_NEWLISTK,
+    &&L_OP_NEWTABLEK,
+    &&L_OP_ADDII,
+    &&L_OP_ADDFF,
+    &&L_OP_SUBII,
+    &&L_OP_SUBFF,
+    &&L_OP_MULII,
+    &&L_OP_MULFF,
+    &&L_OP_LTII,
+    &&L_OP_LTFF,
+    &&L_OP_LEII,
+    &&L_OP_LEFF,
+    &&L_OP_GETINDEXLIST,
+    &&L_OP_GETINDEXINTLIST,
+    &&L_OP_FORLIST,
+    &&L_OP_FORTABLE,
 };
 
 #endif
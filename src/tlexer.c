@@ -108,6 +108,156 @@ t_sinline void savec(Lexer *lx, int32_t c) {
 }
 
 
+/* pushes 'n' bytes from 's' into token buffer */
+static void savebytes(Lexer *lx, const char *s, size_t n) {
+    size_t len = tokuR_bufflen(lx->buff);
+    if (tokuR_buffsize(lx->buff) - len < n) { /* not enough space? */
+        size_t newsize = tokuR_buffsize(lx->buff);
+        if (n >= TOKU_MAXSIZE / 2 - len)
+            lexerror(lx, "lexical element too long", 0);
+        while (newsize - len < n)
+            newsize *= 2;
+        tokuR_buffresize(lx->T, lx->buff, newsize);
+    }
+    memcpy(tokuR_buff(lx->buff) + len, s, n);
+    tokuR_bufflen(lx->buff) += n;
+}
+
+
+/* {======================================================================
+** Spans
+** Runs of bytes of the same class (whitespace, name characters, digits,
+** bodies of comments and strings) are scanned directly in the buffer of
+** the reader, many bytes at a time, instead of one by one through
+** 'advance'. Spans never go past the buffer of the reader; whatever is
+** left after them is read as usual. Only ASCII bytes belong to the
+** classes of whitespace, name characters and digits; other bytes that
+** the current locale takes as letters are also read as usual.
+** ======================================================================= */
+
+/* classes of spans */
+#define SPSPACE     0 /* ' ', '\t', '\v' and '\f' */
+#define SPNAME      1 /* letters, digits and '_' */
+#define SPDIGIT     2 /* decimal digits */
+#define SPCOMMENT   3 /* anything except newlines */
+#define SPLCOMMENT  4 /* anything except newlines and '*' */
+#define SPSTRING    5 /* anything except newlines, '"' and '\\' */
+#define SPLSTRING   6 /* anything except newlines and ']' */
+
+
+#define inrange(c,lo,hi)    (cast_u32(c) - (lo) <= cast_u32((hi) - (lo)))
+
+/* check whether byte 'c' belongs to span class 'cls' */
+t_sinline int32_t inspan(int32_t c, int32_t cls) {
+    switch (cls) {
+        case SPSPACE: return (c == ' ' || c == '\t' || c == '\v' || c == '\f');
+        case SPNAME:
+            return (inrange(c | 0x20, 'a', 'z') || inrange(c, '0', '9') ||
+                    c == '_');
+        case SPDIGIT: return inrange(c, '0', '9');
+        case SPCOMMENT: return (c != '\n' && c != '\r');
+        case SPLCOMMENT: return (c != '\n' && c != '\r' && c != '*');
+        case SPSTRING:
+            return (c != '\n' && c != '\r' && c != '"' && c != '\\');
+        case SPLSTRING: return (c != '\n' && c != '\r' && c != ']');
+        default: toku_assert(0); return 0;
+    }
+}
+
+
+#if defined(__SSE2__)                                   /* { */
+
+#include <emmintrin.h>
+
+#if defined(__GNUC__) && !defined(TOKU_NOBUILTIN)
+#define lowbit(m)       cast_u32(__builtin_ctz(m))
+#else
+static uint32_t lowbit(uint32_t m) {
+    uint32_t i = 0;
+    toku_assert(m != 0);
+    while (!(m & 1u)) { m >>= 1; i++; }
+    return i;
+}
+#endif
+
+#define VBYTES      16
+
+#define veq(v,c)    _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+
+/* bytes of 'v' in [lo, hi] (as unsigned values) */
+#define vrange(v,lo,hi) \
+    _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8(lo)), \
+                                 _mm_set1_epi8(cast_char(0x80))), \
+                   _mm_set1_epi8(cast_char(0x80 + (hi) - (lo) + 1)))
+
+/* set bit 'i' of the result if byte 'i' of 'v' ends a span of 'cls' */
+t_sinline uint32_t spanend(__m128i v, int32_t cls) {
+    __m128i in, nl = _mm_or_si128(veq(v, '\n'), veq(v, '\r'));
+    switch (cls) {
+        case SPSPACE:
+            in = _mm_or_si128(_mm_or_si128(veq(v, ' '), veq(v, '\t')),
+                              _mm_or_si128(veq(v, '\v'), veq(v, '\f')));
+            break;
+        case SPNAME:
+            in = _mm_or_si128(vrange(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+                                     'a', 'z'),
+                              _mm_or_si128(vrange(v, '0', '9'), veq(v, '_')));
+            break;
+        case SPDIGIT: in = vrange(v, '0', '9'); break;
+        case SPCOMMENT: return cast_u32(_mm_movemask_epi8(nl));
+        case SPLCOMMENT:
+            return cast_u32(_mm_movemask_epi8(_mm_or_si128(nl, veq(v, '*'))));
+        case SPSTRING:
+            return cast_u32(_mm_movemask_epi8(
+                        _mm_or_si128(nl, _mm_or_si128(veq(v, '"'),
+                                                      veq(v, '\\')))));
+        case SPLSTRING:
+            return cast_u32(_mm_movemask_epi8(_mm_or_si128(nl, veq(v, ']'))));
+        default: toku_assert(0); return 0;
+    }
+    return cast_u32(_mm_movemask_epi8(in)) ^ 0xFFFFu;
+}
+
+#endif                                                  /* } */
+
+
+/* length of the span of class 'cls' at the start of 's' ('n' bytes) */
+t_sinline size_t spanlen(const char *s, size_t n, int32_t cls) {
+    size_t i = 0;
+#if defined(VBYTES)
+    for (; n - i >= VBYTES; i += VBYTES) {
+        __m128i v = _mm_loadu_si128(cast(const __m128i *, cast_voidp(s + i)));
+        uint32_t m = spanend(v, cls);
+        if (m != 0)
+            return i + lowbit(m);
+    }
+#endif
+    while (i < n && inspan(cast_u8(s[i]), cls))
+        i++;
+    return i;
+}
+
+
+/*
+** Skip the current character and the span of class 'cls' after it,
+** saving them into the token buffer if 'sv' is true, then read the
+** next character.
+*/
+t_sinline void skipspan(Lexer *lx, int32_t cls, int32_t sv) {
+    BuffReader *Z = lx->Z;
+    size_t n = spanlen(Z->p, Z->n, cls);
+    if (sv) {
+        save(lx);
+        savebytes(lx, Z->p, n);
+    }
+    Z->p += n;
+    Z->n -= n;
+    advance(lx);
+}
+
+/* }====================================================================== */
+
+
 /* if current char matches 'c' advance */
 t_sinline int32_t lxmatch(Lexer *lx, int32_t c) {
     if (c == lx->c) {
@@ -185,7 +335,8 @@ static void inclinenr(Lexer *lx) {
 }
 
 
-OString *anchorstring(Lexer *lx, OString *s) {
+/* anchor string 's' in the scanner table (so it is not collected) */
+OString *tokuY_anchorstring(Lexer *lx, OString *s) {
     toku_State *T = lx->T;
     TValue olds;
     uint8_t tag = tokuH_getstr(lx->tab, s, &olds);
@@ -204,7 +355,7 @@ OString *anchorstring(Lexer *lx, OString *s) {
 
 
 OString *tokuY_newstring(Lexer *lx, const char *str, size_t l) {
-    return anchorstring(lx, tokuS_newl(lx->T, str, l));
+    return tokuY_anchorstring(lx, tokuS_newl(lx->T, str, l));
 }
 
 
@@ -215,7 +366,7 @@ OString *tokuY_newstring(Lexer *lx, const char *str, size_t l) {
 /* read single line comment */
 static void read_comment(Lexer *lx) {
     while (!currIsEnd(lx) && !currIsNewline(lx))
-        advance(lx);
+        skipspan(lx, SPCOMMENT, 0);
 }
 
 
@@ -231,7 +382,7 @@ static void read_long_comment(Lexer *lx) {
                 if (lxmatch(lx, '/'))
                     return;
                 break;
-            default: advance(lx); break;
+            default: skipspan(lx, SPLCOMMENT, 0); break;
         }
     }
 }
@@ -416,7 +567,7 @@ static void read_long_string(Lexer *lx, Literal *k, size_t sep) {
                 savec(lx, '\n');
                 inclinenr(lx);
                 break;
-            default: save_and_advance(lx);
+            default: skipspan(lx, SPLSTRING, 1);
         }
     }
 endloop:
@@ -475,7 +626,7 @@ static void read_string(Lexer *lx, Literal *k) {
             no_save:
                 break;
             }
-            default: save_and_advance(lx);
+            default: skipspan(lx, SPSTRING, 1);
         }
     } /* while byte is not a delimiter */
     save_and_advance(lx); /* skip delimiter */
@@ -537,10 +688,92 @@ only_save:
 }
 
 
+/* maximum number of significant digits of a float in 'fastnum' */
+#define FASTDIGITS      15
+
+/* mantissa in 'fastnum' that cannot take another digit */
+#define MAXMANTISSA     ((TOKU_UNSIGNED_MAX - 9) / 10)
+
+
+#if TOKU_FLOAT_TYPE == TOKU_FLOAT_DOUBLE
+
+/* powers of 10 that are exact as doubles */
+static const double pow10tab[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#endif
+
+
+/*
+** Convert decimal numeral 's' ('l' bytes) directly, in the common cases
+** where the conversion is exact: integers that do not overflow and
+** (when floats are doubles) floats with at most FASTDIGITS significant
+** digits and a decimal exponent in [-22, 22], whose mantissa and power
+** of 10 are both exact, so a single rounding gives the correct result.
+** Return the kind of token or 0 if the numeral is left to 'tokuS_tonum'.
+*/
+static int32_t fastnum(const char *s, size_t l, Literal *k) {
+    const char *e = s + l;
+    toku_Unsigned m = 0; /* mantissa */
+    int32_t nd = 0; /* number of significant digits in 'm' */
+    int32_t exp = 0; /* decimal exponent */
+    int32_t isflt = 0;
+    if (l > 1 && s[0] == '0' && inrange(s[1], '0', '9'))
+        return 0; /* octal numeral */
+    for (; s < e && inrange(*s, '0', '9'); s++) {
+        if (m > MAXMANTISSA) return 0;
+        m = m * 10 + cast_u32(*s - '0');
+        nd += (m != 0);
+    }
+    if (s < e && *s == '.') {
+        isflt = 1;
+        for (s++; s < e && inrange(*s, '0', '9'); s++, exp--) {
+            if (m > MAXMANTISSA) return 0;
+            m = m * 10 + cast_u32(*s - '0');
+            nd += (m != 0);
+        }
+    }
+    if (s < e && (*s == 'e' || *s == 'E')) {
+        int32_t neg = 0, x = 0;
+        isflt = 1;
+        s++;
+        if (s < e && (*s == '-' || *s == '+'))
+            neg = (*s++ == '-');
+        if (s == e) return 0; /* no exponent digits */
+        for (; s < e && inrange(*s, '0', '9'); s++) {
+            if (x > 1000) return 0; /* too large */
+            x = x * 10 + (*s - '0');
+        }
+        exp += neg ? -x : x;
+    }
+    if (s != e) /* something else (or no digits at all)? */
+        return 0;
+    else if (!isflt) {
+        if (m > t_castS2U(TOKU_INTEGER_MAX)) /* does not fit? */
+            return 0;
+        k->i = t_castU2S(m);
+        return TK_INT;
+    }
+#if TOKU_FLOAT_TYPE == TOKU_FLOAT_DOUBLE
+    else if (nd <= FASTDIGITS && -22 <= exp && exp <= 22) {
+        double x = cast(double, m);
+        k->n = (exp < 0) ? x / pow10tab[-exp] : x * pow10tab[exp];
+        return TK_FLT;
+    }
+#endif
+    return 0;
+}
+
+
 /* convert lexer buffer bytes into number constant */
 static int32_t lexstr2num(Lexer *lx, Literal *k) {
     int32_t f; /* flag for float overflow; -1 underflow; 1 overflow; 0 ok */
+    int32_t tk;
     TValue o;
+    if ((tk = fastnum(tokuR_buff(lx->buff), tokuR_bufflen(lx->buff), k)))
+        return tk;
     savec(lx, '\0'); /* terminate */
     if (t_unlikely(tokuS_tonum(tokuR_buff(lx->buff), &o, &f) == 0))
         lexerror(lx, "malformed number", TK_FLT);
@@ -593,8 +826,14 @@ static int32_t read_digits(Lexer *lx, DigType dt, int32_t frac) {
             case DigBin: if (!isbdigit(lx->c)) return digits; break;
             default: toku_assert(0); /* invalid 'dt' */
         }
-        save_and_advance(lx);
-        digits++;
+        if (dt == DigDec) { /* decimal digits are read as a span */
+            size_t len = tokuR_bufflen(lx->buff);
+            skipspan(lx, SPDIGIT, 1);
+            digits += cast_i32(tokuR_bufflen(lx->buff) - len);
+        } else {
+            save_and_advance(lx);
+            digits++;
+        }
     }
 }
 
@@ -714,7 +953,7 @@ static int32_t scan(Lexer *lx, Literal *k) {
     for (;;) {
         switch (lx->c) {
             case ' ': case '\t': case '\f': case '\v':
-                advance(lx);
+                skipspan(lx, SPSPACE, 0);
                 break;
             case '\n': case '\r':
                 inclinenr(lx);
@@ -813,7 +1052,7 @@ static int32_t scan(Lexer *lx, Literal *k) {
                     return c;
                 } else {
                     do {
-                        save_and_advance(lx);
+                        skipspan(lx, SPNAME, 1);
                     } while (isalnum(lx->c) || lx->c == '_');
                     k->str = tokuY_newstring(lx, tokuR_buff(lx->buff),
                                                  tokuR_bufflen(lx->buff));
@@ -847,7 +1086,7 @@ void tokuY_scan(Lexer *lx) {
 /* fetch next token into 'tahead' */
 int32_t tokuY_scanahead(Lexer *lx) {
     toku_assert(lx->t.tk != TK_EOS);
-    lx->tahead.tk = scan(lx, &lx->t.lit);
+    lx->tahead.tk = scan(lx, &lx->tahead.lit);
     return lx->tahead.tk;
 }
 
@@ -72,6 +72,8 @@ typedef struct Lexer {
     struct DynData *dyd; /* dynamic data used by parser */
     OString *src; /* current source name */
     OString *envn; /* environment variable */
+    int32_t optlevel; /* optimization level (see 'tokuC_finish') */
+    OString *text; /* source text in lazy mode (or NULL) */
 } Lexer;
 
 
@@ -81,6 +83,7 @@ TOKUI_FUNC void tokuY_setinput(toku_State *T, Lexer *lx, BuffReader *Z,
                                OString *source, int32_t firstchar);
 TOKUI_FUNC void tokuY_init(toku_State *T);
 TOKUI_FUNC const char *tokuY_tok2str(Lexer *lx, int32_t t);
+TOKUI_FUNC OString *tokuY_anchorstring(Lexer *lx, OString *s);
 TOKUI_FUNC OString *tokuY_newstring(Lexer *lx, const char *str, size_t len);
 TOKUI_FUNC t_noret tokuY_syntaxerror(Lexer *lx, const char *err);
 TOKUI_FUNC void tokuY_scan(Lexer *lx);
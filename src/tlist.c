@@ -9,6 +9,8 @@
 
 #include "tokudaeprefix.h"
 
+#include <string.h>
+
 #include "tlist.h"
 #include "tokudaelimits.h"
 #include "tstring.h"
@@ -225,6 +227,27 @@ void tokuA_ensure(toku_State *T, List *l, int32_t len) {
 }
 
 
+/*
+** Set the elements of empty list 'l' to the 'n' non-nil values in 'v',
+** allocating its array at the final size in one step.
+*/
+void tokuA_fill(toku_State *T, List *l, const TValue *v, int32_t n) {
+    toku_assert(l->len == 0 && l->size == 0 && 0 <= n);
+    if (n > 0) {
+        uint32_t size = next_highest_pow2(cast_u32(n));
+        if (size < 4) size = 4;
+        l->arr = tokuM_newarraychecked(T, size, TValue);
+        l->size = cast_i32(size);
+        memcpy(l->arr, v, cast_sizet(n) * sizeof(TValue));
+        for (uint32_t i = cast_u32(n); i < size; i++)
+            setnilval(&l->arr[i]);
+        l->len = n;
+        if (isblack(l)) /* marked while allocating? */
+            tokuG_barrierback_(T, obj2gco(l));
+    }
+}
+
+
 void tokuA_free(toku_State *T, List *l) {
     tokuM_freearray(T, l->arr, cast_u32(l->size));
     tokuM_free(T, l);
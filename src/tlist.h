@@ -73,6 +73,7 @@ TOKUI_FUNC void tokuA_init(toku_State *T);
 TOKUI_FUNC List *tokuA_new(toku_State *T);
 TOKUI_FUNC int tokuA_shrink(toku_State *T, List *l);
 TOKUI_FUNC void tokuA_ensure(toku_State *T, List *l, int n);
+TOKUI_FUNC void tokuA_fill(toku_State *T, List *l, const TValue *v, int32_t n);
 TOKUI_FUNC void tokuA_free(toku_State *T, List *l);
 
 #endif
@@ -401,12 +401,276 @@ static int32_t check_load(toku_State *T, int32_t res, const char *filename) {
 }
 
 
+/* {======================================================================
+** Bytecode cache
+** ======================================================================= */
+
+/*
+** 't_mtime' returns the modification time of a file (or -1 if it cannot
+** be retrieved) and 't_procid' returns an identifier of the running
+** process, used in the names of temporary cache files. In ISO C, the
+** modification time is not available and the state address alone
+** identifies the writer.
+*/
+#if defined(TOKU_USE_POSIX)         /* { */
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define t_stat          stat
+#define t_procid()      cast(toku_Integer, getpid())
+
+#elif defined(TOKU_USE_WINDOWS)     /* }{ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <process.h>
+
+#define t_stat          _stat
+#define t_procid()      cast(toku_Integer, _getpid())
+
+#endif                              /* } */
+
+
+#if defined(t_stat)     /* { */
+
+static int64_t t_mtime(const char *fname) {
+    struct t_stat st;
+    if (t_stat(fname, &st) != 0) return -1;
+    return cast(int64_t, st.st_mtime);
+}
+
+#else                   /* }{ */
+
+#define t_mtime(fname)      (UNUSED(fname), 0)
+#define t_procid()          0
+
+#endif                  /* } */
+
+
+/* key for the cache counters in the ctable */
+static const char *const CACHESTATS = "__CACHESTATS";
+
+/* signature of cache files */
+#define CACHE_SIGNATURE     "\x1bTokudaeCache"
+
+/* suffix of cache files placed next to their source */
+#define CACHE_SUFFIX        "c"
+
+/* suffix of cache files in the cache directory */
+#define CACHE_DIRSUFFIX     ".tokuc"
+
+
+/* counters of cache hits and misses */
+typedef struct CacheStats {
+    toku_Integer hits;
+    toku_Integer misses;
+} CacheStats;
+
+
+/*
+** Header of a cache file, followed by the path of the source file and
+** the precompiled chunk. The cache file is valid only when the whole
+** header and the path match those of the source file.
+*/
+typedef struct CacheKey {
+    char signature[16];
+    uint64_t version; /* VM version */
+    int64_t mtime; /* modification time of the source */
+    uint64_t size; /* size of the source */
+    uint64_t hash; /* hash of the source */
+    uint64_t pathlen; /* length of the path that follows */
+} CacheKey;
+
+
+static CacheStats *getcachestats(toku_State *T) {
+    CacheStats *cs;
+    toku_get_cfield_str(T, CACHESTATS);
+    cs = cast(CacheStats *, toku_to_userdata(T, -1));
+    toku_pop(T, 1);
+    return cs;
+}
+
+
+/* FNV-1a hash of 'sz' bytes in 's' */
+static uint64_t hashbytes(const char *s, size_t sz) {
+    uint64_t h = 0xcbf29ce484222325u;
+    while (sz--) {
+        h ^= cast(unsigned char, *s++);
+        h *= 0x100000001b3u;
+    }
+    return h;
+}
+
+
+/*
+** Read the whole file 'fname' and push its contents. Return 0 (and
+** push nothing) if the file cannot be read.
+*/
+static int32_t readfile(toku_State *T, const char *fname) {
+    tokuL_Buffer b;
+    size_t nr;
+    int32_t ok;
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) return 0; /* cannot open file */
+    tokuL_buff_init(T, &b);
+    do { /* read file in chunks of TOKUL_BUFFERSIZE bytes */
+        char *p = tokuL_buff_prep(&b);
+        nr = fread(p, sizeof(char), TOKUL_BUFFERSIZE, f);
+        tokuL_buffadd(&b, nr);
+    } while (nr == TOKUL_BUFFERSIZE);
+    ok = !ferror(f);
+    fclose(f);
+    tokuL_buff_end(&b);
+    if (!ok) toku_pop(T, 1); /* remove partial contents */
+    return ok;
+}
+
+
+/*
+** Push the name of the cache file for source file 'fname'. An empty
+** 'dir' places the cache file next to the source file, otherwise it is
+** placed in 'dir' under a name derived from the hash of 'fname'.
+*/
+static const char *cachename(toku_State *T, const char *fname,
+                                            const char *dir) {
+    if (*dir == '\0') /* next to the source? */
+        return toku_push_fstring(T, "%s" CACHE_SUFFIX, fname);
+    else {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016" PRIx64,
+                      hashbytes(fname, strlen(fname)));
+        return toku_push_fstring(T, "%s" TOKU_DIRSEP "%s" CACHE_DIRSUFFIX,
+                                    dir, hex);
+    }
+}
+
+
+static int32_t cachewriter(toku_State *T, const void *b, size_t sz,
+                                          void *ud) {
+    UNUSED(T);
+    return (sz > 0 && fwrite(b, 1, sz, cast(FILE *, ud)) != sz);
+}
+
+
+/*
+** Write the function on top of the stack into the cache file 'cname'.
+** The chunk is first written into a temporary file which is then
+** renamed, so other processes never see a partial cache file.
+** Failures are ignored; the module just stays uncached.
+*/
+static void writecache(toku_State *T, const char *cname,
+                                      const CacheKey *k, const char *path) {
+    int32_t ok;
+    FILE *f;
+    const char *tmp = toku_push_fstring(T, "%s.%I-%p.tmp", cname,
+                                           t_procid(), cast(void *, T));
+    if ((f = fopen(tmp, "wb")) == NULL) { /* cannot create it? */
+        toku_pop(T, 1); /* remove 'tmp' */
+        return;
+    }
+    ok = (fwrite(k, sizeof(*k), 1, f) == 1 &&
+          fwrite(path, 1, cast_sizet(k->pathlen), f) == k->pathlen);
+    toku_push(T, -2); /* function to be dumped */
+    ok = (ok && toku_dump(T, cachewriter, f, 0) == 0);
+    toku_pop(T, 1); /* remove function */
+    ok = (fclose(f) == 0 && ok);
+    if (!ok || rename(tmp, cname) != 0)
+        remove(tmp);
+    toku_pop(T, 1); /* remove 'tmp' */
+}
+
+
+/*
+** Load Tokudae module 'fname' through the cache in directory 'dir'.
+** A valid cache file is loaded instead of the source; otherwise the
+** source is compiled and its precompiled chunk is written into the
+** cache. Either way, the result is the same as of 'tokuL_loadfile'.
+*/
+static int32_t loadcached(toku_State *T, const char *fname,
+                                         const char *dir) {
+    CacheStats *cs = getcachestats(T);
+    int32_t base = toku_getntop(T);
+    const char *chunkname, *cname, *src;
+    size_t srclen;
+    int32_t status;
+    CacheKey k;
+    if (!readfile(T, fname)) /* cannot read source? */
+        return tokuL_loadfile(T, fname); /* let it report the error */
+    src = toku_to_lstring(T, -1, &srclen);
+    if (srclen > 0 && *src == TOKU_SIGNATURE[0]) { /* binary chunk? */
+        toku_pop(T, 1); /* remove source */
+        return tokuL_loadfile(T, fname); /* no need to cache it */
+    }
+    memset(&k, 0, sizeof(k)); /* clear padding */
+    memcpy(k.signature, CACHE_SIGNATURE, sizeof(CACHE_SIGNATURE) - 1);
+    k.version = TOKU_VERSION_RELEASE_NUM;
+    k.mtime = t_mtime(fname);
+    k.size = srclen;
+    k.hash = hashbytes(src, srclen);
+    k.pathlen = strlen(fname);
+    chunkname = toku_push_fstring(T, "@%s", fname);
+    cname = cachename(T, fname, dir);
+    if (readfile(T, cname)) { /* have cache file? */
+        size_t hsz = sizeof(k) + cast_sizet(k.pathlen);
+        size_t clen;
+        const char *c = toku_to_lstring(T, -1, &clen);
+        if (clen > hsz && memcmp(c, &k, sizeof(k)) == 0 &&
+                memcmp(c + sizeof(k), fname, cast_sizet(k.pathlen)) == 0) {
+            status = tokuL_loadbufferx(T, c+hsz, clen-hsz, chunkname, "b");
+            if (status == TOKU_STATUS_OK) { /* valid chunk? */
+                cs->hits++;
+                goto done;
+            }
+            toku_pop(T, 1); /* remove error message */
+        }
+        toku_pop(T, 1); /* remove cache file contents */
+    }
+    cs->misses++;
+    status = tokuL_loadbufferx(T, src, srclen, chunkname, NULL);
+    if (status == TOKU_STATUS_OK)
+        writecache(T, cname, &k, fname);
+done:
+    toku_replace(T, base); /* move function (or error) to 'base' */
+    toku_setntop(T, base + 1); /* remove everything above it */
+    return status;
+}
+
+
+/*
+** Load Tokudae module 'fname', through the cache when
+** 'package.cachedir' is set.
+*/
+static int32_t loadmodule(toku_State *T, const char *fname) {
+    int32_t status;
+    const char *dir;
+    toku_get_field_str(T, toku_upvalueindex(0), "cachedir");
+    dir = toku_to_string(T, -1);
+    if (dir == NULL) /* cache disabled? */
+        status = tokuL_loadfile(T, fname);
+    else
+        status = loadcached(T, fname, dir);
+    toku_remove(T, -2); /* remove 'cachedir' */
+    return status;
+}
+
+
+static int32_t pkg_cachestats(toku_State *T) {
+    CacheStats *cs = getcachestats(T);
+    toku_push_integer(T, cs->hits);
+    toku_push_integer(T, cs->misses);
+    return 2;
+}
+
+/* }====================================================================== */
+
+
 static int32_t searcher_Tokudae(toku_State *T) {
     const char *filename;
     const char *name = tokuL_check_string(T, 0);
     filename = find_file(T, name, "path", TOKU_DIRSEP);
     if (filename == NULL) return 1; /* module not found in this path */
-    return check_load(T, (tokuL_loadfile(T, filename) == TOKU_STATUS_OK),
+    return check_load(T, (loadmodule(T, filename) == TOKU_STATUS_OK),
                          filename);
 }
 
@@ -414,11 +678,13 @@ static int32_t searcher_Tokudae(toku_State *T) {
 static const tokuL_Entry pkg_funcs[] = {
     {"loadlib", pkg_loadlib},
     {"searchpath", pkg_searchpath},
+    {"cachestats", pkg_cachestats},
     /* placeholders */
     {"preload", NULL},
     {"config", NULL},
     {"cpath", NULL},
     {"path", NULL},
+    {"cachedir", NULL},
     {"searchers", NULL},
     {"loaded", NULL},
     {NULL, NULL}
@@ -612,7 +878,8 @@ static void create_searchers_array(toku_State *T) {
 
 /*
 ** TOKU_PATH_VAR and TOKU_CPATH_VAR are the names of the environment
-** variables that Tokudae checks to set its paths.
+** variables that Tokudae checks to set its paths; TOKU_CACHEDIR_VAR
+** is the one it checks to set the bytecode cache directory.
 */
 #if !defined(TOKU_PATH_VAR)
 #define TOKU_PATH_VAR     "TOKU_PATH"
@@ -622,6 +889,10 @@ static void create_searchers_array(toku_State *T) {
 #define TOKU_CPATH_VAR    "TOKU_CPATH"
 #endif
 
+#if !defined(TOKU_CACHEDIR_VAR)
+#define TOKU_CACHEDIR_VAR "TOKU_CACHEDIR"
+#endif
+
 
 /*
 ** Return __G["TOKU_NOENV"] as a boolean.
@@ -669,14 +940,50 @@ static void setpath(toku_State *T, const char *fieldname, const char *envname,
 }
 
 
+/*
+** Set 'package.cachedir' from the environment variable TOKU_CACHEDIR
+** (if it is not defined, the cache stays disabled).
+*/
+static void setcachedir(toku_State *T) {
+    const char *nver = toku_push_fstring(T, "%s%s", TOKU_CACHEDIR_VAR,
+                                                    TOKU_VERSUFFIX);
+    const char *dir = getenv(nver); /* try versioned name */
+    if (dir == NULL) /* no versioned environment variable? */
+        dir = getenv(TOKU_CACHEDIR_VAR); /* try unversioned name */
+    if (dir != NULL && !noenv(T)) {
+        toku_push_string(T, dir);
+        toku_set_field_str(T, -3, "cachedir"); /* package.cachedir = dir */
+    }
+    toku_pop(T, 1); /* pop versioned variable name ('nver') */
+}
+
+
+/*
+** CACHESTATS is full userdata holding the counters of the bytecode
+** cache, set under key "__CACHESTATS" in the ctable.
+*/
+static void create_cachestats(toku_State *T) {
+    if (toku_get_cfield_str(T, CACHESTATS) != TOKU_T_USERDATA) {
+        CacheStats *cs = cast(CacheStats *,
+                              toku_push_userdata(T, sizeof(*cs), 0));
+        cs->hits = cs->misses = 0;
+        toku_set_cfield_str(T, CACHESTATS); /* ctable[CACHESTATS] = udata */
+    }
+    toku_pop(T, 1); /* pop value */
+}
+
+
 int32_t tokuopen_package(toku_State *T) {
     create_clibs_userdata(T); /* create clibs userdata */
+    create_cachestats(T); /* create cache counters */
     tokuL_push_lib(T, pkg_funcs); /* create 'package' table */
     create_searchers_array(T); /* set 'package.searchers' */
     /* 'package.path' */
     setpath(T, "path", TOKU_PATH_VAR, TOKU_PATH_DEFAULT);
     /* 'package.cpath' */
     setpath(T, "cpath", TOKU_CPATH_VAR, TOKU_CPATH_DEFAULT);
+    /* 'package.cachedir' */
+    setcachedir(T);
     /* set 'package.config' */
     toku_push_literal(T, TOKU_DIRSEP "\n" TOKU_PATH_SEP "\n" TOKU_PATH_MARK
                          "\n" TOKU_EXEC_DIR "\n" TOKU_IGMARK "\n");
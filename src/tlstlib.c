@@ -142,9 +142,17 @@ static void concatval(toku_State *T, tokuL_Buffer *b, toku_Integer i) {
         toku_numbertocstring(T, -1, numbuff); /* convert it to string */
         toku_push_string(T, numbuff); /* push it on stack */
         toku_replace(T, -2); /* and replace original value */
-    } else if (t != TOKU_T_STRING) /* value is not a string? */
+    } else if (t != TOKU_T_STRING) { /* value is not a string? */
+        const tokuL_StrBuilder *sb = cast(const tokuL_StrBuilder *,
+                tokuL_test_userdata(T, -1, TOKU_STRBUILDER));
+        if (sb != NULL) { /* string builder? */
+            toku_pop(T, 1); /* (builder is still in the list) */
+            tokuL_buff_push_lstring(b, sb->b, sb->n); /* add its contents */
+            return;
+        }
         tokuL_error(T, "cannot concat value (%s) at index %d",
                         toku_typename(T, t), i);
+    }
     tokuL_buff_push_stack(b);
 }
 
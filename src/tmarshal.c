@@ -11,6 +11,7 @@
 #include "tcode.h"
 #include "tfunction.h"
 #include "tgc.h"
+#include "tlist.h"
 #include "tmarshal.h"
 #include "tokudaelimits.h"
 #include "tprotected.h"
@@ -22,8 +23,26 @@
 /* encoded major/minor version in one byte, one nibble for each */
 #define TOKUC_VERSION   ((TOKU_VERSION_MAJOR_N << 4) | TOKU_VERSION_MINOR_N)
 
-/* this is the official format */
-#define TOKUC_FORMAT    0
+/*
+** Format of the first release, where each string is written where it
+** is first used; chunks in this format are still loaded, but no longer
+** produced.
+*/
+#define TOKUC_FORMAT_INLINE     0
+
+/*
+** This is the official format; all strings of the chunk are written
+** once in a string pool before the main function and the functions
+** refer to them by their index in the pool.
+*/
+#define TOKUC_FORMAT    1
+
+/*
+** Official format whose arrays of plain data (bytecode and line
+** information) are all aligned, so that they can be borrowed from the
+** chunk memory instead of being copied (see 'toku_loadblob').
+*/
+#define TOKUC_FORMAT_MAPPED     2
 
 /* data to catch conversion errors */
 #define TOKUC_DATA      "\x19\x93\r\n\x1a\n"
@@ -45,14 +64,17 @@ typedef struct MarshalState {
             toku_Writer writer; /* writer that dumps the chunk */
             void *data; /* data for writer */
             int32_t strip; /* if true, remove debug information */
+            int32_t mapped; /* if true, use the mapped format */
             int32_t status; /* status returned by writer */
         } d;
         struct { /* when loading */
             BuffReader *Z; /* buffered reader */
             const char *name; /* name of the chunk */
+            int32_t mapped; /* true if chunk is in the mapped format */
+            int32_t inline_; /* true if chunk has no string pool */
         } l;
     } u;
-    Table *h; /* list for string reuse; for tracking dumped strings */
+    Table *h; /* string pool; maps strings to indices and back */
     size_t offset; /* current position relative to beginning of dump */
     toku_Unsigned nstr; /* number of saved strings; strings in the list */
 } MarshalState;
@@ -139,7 +161,7 @@ static void dump_align(MarshalState *M, uint32_t align) {
 static void dump_header(MarshalState *M) {
     dump_literal(M, TOKU_SIGNATURE);
     dump_byte(M, TOKUC_VERSION);
-    dump_byte(M, TOKUC_FORMAT);
+    dump_byte(M, D(M).mapped ? TOKUC_FORMAT_MAPPED : TOKUC_FORMAT);
     dump_literal(M, TOKUC_DATA);
     dump_numinfo(M, int32_t, TOKUC_INT);
     dump_numinfo(M, uint8_t, TOKUC_OPCODE);
@@ -148,11 +170,26 @@ static void dump_header(MarshalState *M) {
 }
 
 
+/*
+** Dump bytecode of 'f', quickened opcodes are dumped as their original
+** opcode (see 'isquickop').
+*/
 static void dump_code(MarshalState *M, const Proto *f) {
+    const uint8_t *code = f->code;
+    uint32_t size = cast_u32(f->sizecode);
+    uint32_t start = 0; /* start of the opcodes not yet dumped */
     dump_int(M, f->sizecode);
     dump_align(M, sizeof(f->code[0])); /* bytecode */
-    toku_assert(f->code != NULL);
-    dump_vector(M, f->code, cast_u32(f->sizecode));
+    toku_assert(code != NULL);
+    for (uint32_t pc = 0; pc < size; pc += getopSize(code[pc])) {
+        if (isquickop(code[pc])) { /* quickened opcode? */
+            if (start < pc)
+                dump_vector(M, code + start, pc - start);
+            dump_byte(M, getopOrig(code[pc]));
+            start = pc + 1;
+        }
+    }
+    dump_vector(M, code + start, size - start);
 }
 
 
@@ -170,7 +207,7 @@ static void dump_number(MarshalState *M, toku_Number x) {
 */
 static void dump_integer(MarshalState *M, toku_Integer x) {
     toku_Unsigned cx = (x >= 0) ? 2u * t_castS2U(x)
-                                : (2u * ~t_castS2U(x)) - 1;
+                                : (2u * ~t_castS2U(x)) + 1;
     dump_varint(M, cx);
 }
 
@@ -180,25 +217,86 @@ static void dump_size(MarshalState *M, size_t sz) {
 }
 
 
+/*
+** Strings are dumped as their index in the string pool plus one,
+** 0 means no string.
+*/
 static void dump_string(MarshalState *M, OString *str) {
     if (str == NULL)
-        dump_size(M, 0); /* no string */
+        dump_varint(M, 0); /* no string */
     else {
         TValue idx;
         uint8_t tag = tokuH_getstr(M->h, str, &idx);
-        if (!tagisempty(tag)) { /* already saved? */
-            dump_size(M, 1); /* reuse a saved string */
-            dump_varint(M, t_castS2U(ival(&idx)));
-        } else { /* must write and save the string */
-            TValue val;
-            size_t size = getstrlen(str);
-            const char *s = getstr(str);
-            dump_size(M, size + 2); /* +2 to avoid size of 0 and 1 */
-            dump_vector(M, s, size + 1); /* +1 to include '\0' */
-            setival(&val, t_castU2S(M->nstr)); /* it's index is the value */
-            M->nstr++; /* one more saved string */
-            tokuH_setstr(M->T, M->h, str, &val); /* h[str] = nstr */
-            /* integer value does not need barrier */
+        UNUSED(tag);
+        toku_assert(!tagisempty(tag)); /* must be in the pool */
+        dump_varint(M, t_castS2U(ival(&idx)) + 1);
+    }
+}
+
+
+static void dump_switchkey(MarshalState *M, const TValue *key,
+                                           const TValue *off) {
+    int32_t tt = ttypetag(key);
+    dump_byte(M, tt);
+    switch (tt) {
+        case TOKU_VNUMFLT: dump_number(M, fval(key)); break;
+        case TOKU_VNUMINT: dump_integer(M, ival(key)); break;
+        default:
+            toku_assert(tt == TOKU_VLNGSTR || tt == TOKU_VSHRSTR);
+            dump_string(M, strval(key));
+            break;
+    }
+    dump_int(M, cast_i32(ival(off)));
+}
+
+
+/*
+** Dump switch jump table 't' (see 'tokuC_fixswitch'); its keys are
+** numbers or strings and its values are integer offsets.
+*/
+static void dump_switchtable(MarshalState *M, Table *t) {
+    TValue key;
+    int32_t n = 0;
+    for (uint32_t i = 0; i < t->asize; i++)
+        n += !isempty(&t->array[i]);
+    for (uint32_t i = 0; i < cast_u32(allocsizenode(t)); i++)
+        n += !isempty(nodeval(htnode(t, i)));
+    dump_int(M, n);
+    for (uint32_t i = 0; i < t->asize; i++) {
+        if (!isempty(&t->array[i])) {
+            setival(&key, cast_Integer(i));
+            dump_switchkey(M, &key, &t->array[i]);
+        }
+    }
+    for (uint32_t i = 0; i < cast_u32(allocsizenode(t)); i++) {
+        const Node *n = htnode(t, i);
+        if (!isempty(nodeval(n))) {
+            getnodekey(M->T, &key, n);
+            dump_switchkey(M, &key, nodeval(n));
+        }
+    }
+}
+
+
+/*
+** Dump constant list 'l' holding the elements of a constructor (see
+** OP_NEWLISTK); its elements are nil, booleans, numbers or strings.
+*/
+static void dump_constlist(MarshalState *M, const List *l) {
+    dump_int(M, l->len);
+    for (int32_t i = 0; i < l->len; i++) {
+        const TValue *v = &l->arr[i];
+        int32_t tt = ttypetag(v);
+        dump_byte(M, tt);
+        switch (tt) {
+            case TOKU_VNUMFLT: dump_number(M, fval(v)); break;
+            case TOKU_VNUMINT: dump_integer(M, ival(v)); break;
+            case TOKU_VLNGSTR: case TOKU_VSHRSTR:
+                dump_string(M, strval(v));
+                break;
+            default:
+                toku_assert(tt == TOKU_VTRUE || tt == TOKU_VFALSE ||
+                            tt == TOKU_VNIL);
         }
     }
 }
@@ -221,6 +319,12 @@ static void dump_constants(MarshalState *M, const Proto *f) {
             case TOKU_VLNGSTR: case TOKU_VSHRSTR:
                 dump_string(M, strval(k));
                 break;
+            case TOKU_VTABLE:
+                dump_switchtable(M, tval(k));
+                break;
+            case TOKU_VLIST:
+                dump_constlist(M, listval(k));
+                break;
             default:
                 toku_assert(tt == TOKU_VTRUE || tt == TOKU_VFALSE ||
                             tt == TOKU_VNIL);
@@ -267,8 +371,11 @@ static void dump_debug(MarshalState *M, const Proto *f) {
     }
     n = D(M).strip ? 0 : f->sizeopcodepc;
     dump_int(M, n);
-    if (n > 0)
+    if (n > 0) {
+        if (D(M).mapped)
+            dump_align(M, sizeof(int32_t));
         dump_vector(M, f->opcodepc, cast_u32(n));
+    }
     n = D(M).strip ? 0 : f->sizelocals;
     dump_int(M, n);
     for (int32_t i = 0; i < n; i++) {
@@ -283,12 +390,78 @@ static void dump_debug(MarshalState *M, const Proto *f) {
 }
 
 
+/* add 'str' (if any) to the string pool, unless it is already there */
+static void pool_string(MarshalState *M, OString *str) {
+    TValue val;
+    if (str == NULL || !tagisempty(tokuH_getstr(M->h, str, &val)))
+        return; /* no string or already in the pool */
+    setival(&val, t_castU2S(M->nstr));
+    tokuH_setstr(M->T, M->h, str, &val); /* h[str] = nstr */
+    /* integer value does not need barrier */
+    setstrval(M->T, &val, str);
+    tokuH_setint(M->T, M->h, t_castU2S(M->nstr), &val); /* h[nstr] = str */
+    /* 'str' is already a key of 'h', it needs no barrier either */
+    M->nstr++;
+}
+
+
+/* add all strings that 'dump_function' writes for 'f' to the pool */
+static void pool_strings(MarshalState *M, const Proto *f) {
+    for (int32_t i = 0; i < f->sizek; i++) {
+        const TValue *k = &f->k[i];
+        if (ttisstring(k))
+            pool_string(M, strval(k));
+        else if (ttistable(k)) { /* switch table? */
+            Table *t = tval(k);
+            for (uint32_t j = 0; j < cast_u32(allocsizenode(t)); j++) {
+                const Node *n = htnode(t, j);
+                TValue key;
+                getnodekey(M->T, &key, n);
+                if (!isempty(nodeval(n)) && ttisstring(&key))
+                    pool_string(M, strval(&key));
+            }
+        } else if (ttislist(k)) { /* constructor elements? */
+            List *l = listval(k);
+            for (int32_t j = 0; j < l->len; j++) {
+                if (ttisstring(&l->arr[j]))
+                    pool_string(M, strval(&l->arr[j]));
+            }
+        }
+    }
+    for (int32_t i = 0; i < f->sizep; i++)
+        pool_strings(M, f->p[i]);
+    if (!D(M).strip) { /* have debug information? */
+        pool_string(M, f->source);
+        for (int32_t i = 0; i < f->sizelocals; i++)
+            pool_string(M, f->locals[i].name);
+        for (int32_t i = 0; i < f->sizeupvals; i++)
+            pool_string(M, f->upvals[i].name);
+    }
+}
+
+
+/* dump the string pool of main function 'f' */
+static void dump_pool(MarshalState *M, const Proto *f) {
+    pool_strings(M, f);
+    dump_varint(M, M->nstr);
+    for (toku_Unsigned i = 0; i < M->nstr; i++) {
+        TValue sv;
+        OString *str;
+        tokuH_getint(M->h, t_castU2S(i), &sv);
+        str = strval(&sv);
+        dump_size(M, getstrlen(str));
+        dump_vector(M, getstr(str), getstrlen(str));
+    }
+}
+
+
 static void dump_function(MarshalState *M, const Proto *f) {
     dump_byte(M, f->isvararg);
     dump_int(M, f->defline);
     dump_int(M, f->deflastline);
     dump_int(M, f->arity);
     dump_int(M, f->maxstack);
+    dump_int(M, f->sizeic);
     dump_code(M, f);
     dump_constants(M, f);
     dump_upvalues(M, f);
@@ -301,13 +474,16 @@ int32_t tokuZ_dump(toku_State *T, const Proto *f, toku_Writer writer, void *data
                               int32_t strip) {
     MarshalState M = {
         .T = T,
-        .u = {.d = { .writer = writer, .data = data, .strip = strip }}
+        .u = {.d = { .writer = writer, .data = data,
+                     .strip = (strip & TOKU_DUMP_STRIP),
+                     .mapped = (strip & TOKU_DUMP_MAPPED) }}
     };
-    M.h = tokuH_new(T); /* aux. table  to keep strings already dumped */
+    M.h = tokuH_new(T); /* aux. table for the string pool */
     settval2s(T, T->sp.p, M.h); /* anchor it */
     T->sp.p++;
     dump_header(&M);
     dump_int(&M, f->sizeupvals);
+    dump_pool(&M, f);
     dump_function(&M, f);
     dump_block(&M, NULL, 0); /* signal end of dump */
     return D(&M).status;
@@ -391,8 +567,12 @@ static void check_header(MarshalState *M) {
     check_literal(M, &TOKU_SIGNATURE[1], "not a binary chunk");
     if (load_byte(M) != TOKUC_VERSION)
         error(M, "version mismatch");
-    if (load_byte(M) != TOKUC_FORMAT)
-        error(M, "format mismatch");
+    switch (load_byte(M)) {
+        case TOKUC_FORMAT_INLINE: L(M).inline_ = 1; break;
+        case TOKUC_FORMAT: break;
+        case TOKUC_FORMAT_MAPPED: L(M).mapped = 1; break;
+        default: error(M, "format mismatch");
+    }
     check_literal(M, TOKUC_DATA, "corrupted chunk");
     check_num(M, int32_t, TOKUC_INT, "int");
     check_num(M, uint8_t, TOKUC_OPCODE, "opcode");
@@ -420,12 +600,50 @@ static int32_t load_int(MarshalState *M) {
 }
 
 
+/*
+** Borrow the next 'size' bytes of a chunk in the mapped format, if the
+** chunk is kept in memory by an owner (see 'toku_loadblob') and those
+** bytes are aligned to 'align'; mark the array as borrowed ('bit') and
+** return it. Otherwise return NULL, and the array must be copied.
+** Bytecode is borrowed only from userdata, as the interpreter rewrites
+** opcodes in place (see 'isquickop') and strings must not change.
+*/
+static void *borrow_block(MarshalState *M, Proto *f, size_t size,
+                                          size_t align, int32_t bit) {
+    BuffReader *Z = L(M).Z;
+    const char *b = Z->p;
+    if (!L(M).mapped || Z->owner == NULL || Z->n < size ||
+            cast(uintptr_t, b) % align != 0 ||
+            (bit == BORROW_CODE && Z->owner->tt_ != TOKU_VUSERDATA))
+        return NULL;
+    Z->p += size;
+    Z->n -= size;
+    M->offset += size;
+    if (f->blob == NULL) { /* first borrowed array? */
+        f->blob = Z->owner;
+        tokuG_objbarrier(M->T, f, f->blob);
+    }
+    f->borrowed |= cast_u8(bit);
+    return cast(void *, b);
+}
+
+
+/*
+** Borrow or load array 'a' of 'n' elements of type 't'; its size 'sz'
+** is set before loading, so a truncated chunk frees it properly.
+*/
+#define load_array(M,f,a,sz,n,t,bit) { \
+        void *b_ = borrow_block(M, f, cast_sizet(n)*sizeof(t), \
+                                      sizeof(t) < 4 ? sizeof(t) : 4, bit); \
+        if (b_ != NULL) { (a) = cast(t *, b_); (sz) = n; } \
+        else { (a) = tokuM_newarraychecked(M->T, n, t); (sz) = n; \
+               load_vector(M, a, n); }}
+
+
 static void load_code(MarshalState *M, Proto *f) {
     int32_t n = load_int(M);
     load_align(M, sizeof(f->code[0]));
-    f->code = tokuM_newarraychecked(M->T, n, uint8_t);
-    f->sizecode = n;
-    load_vector(M, f->code, n);
+    load_array(M, f, f->code, f->sizecode, n, uint8_t, BORROW_CODE);
 }
 
 
@@ -452,12 +670,13 @@ static size_t load_size(MarshalState *M) {
 
 
 /*
-** Load a nullable string into slot 'sl' from prototype 'p'. The
+** Load a nullable string written where it is first used (format
+** TOKUC_FORMAT_INLINE) into slot 'sl' from prototype 'p'. The
 ** assignment to the slot and the barrier must be performed before any
 ** possible GC activity, to anchor the string. (Both 'load_vector' and
 ** 'tokuH_setint' can call the GC.)
 */
-static void load_string(MarshalState *M, Proto *p, OString **sl) {
+static void load_inlinestring(MarshalState *M, Proto *p, OString **sl) {
     toku_State *T = M->T;
     size_t size = load_size(M); /* get string size */
     OString *str;
@@ -492,6 +711,124 @@ static void load_string(MarshalState *M, Proto *p, OString **sl) {
 }
 
 
+/* load a nullable string from the pool into slot 'sl' from prototype 'p' */
+static void load_string(MarshalState *M, Proto *p, OString **sl) {
+    toku_Unsigned idx;
+    TValue stv;
+    if (L(M).inline_) {
+        load_inlinestring(M, p, sl);
+        return;
+    }
+    idx = load_varint(M, TOKU_UNSIGNED_MAX);
+    if (idx == 0) { /* no string? */
+        toku_assert(*sl == NULL); /* must be prefilled */
+        return; /* done */
+    } else if (idx > M->nstr)
+        error(M, "invalid string index");
+    tokuH_getint(M->h, t_castU2S(idx - 1), &stv);
+    *sl = strval(&stv);
+    tokuG_objbarrier(M->T, p, *sl);
+}
+
+
+/*
+** Load the string pool into 'M->h'. Short strings of the pool are all
+** interned in one pass, with the string table grown for all of them
+** up front.
+*/
+static void load_pool(MarshalState *M) {
+    toku_State *T = M->T;
+    int32_t n = load_int(M);
+    tokuS_reserve(T, n);
+    tokuH_resizeall(T, M->h, cast_u32(n), 0);
+    for (int32_t i = 0; i < n; i++) {
+        size_t size = load_size(M);
+        OString *str;
+        TValue sv;
+        if (size <= TOKUI_MAXSHORTLEN) { /* short string? */
+            char buff[TOKUI_MAXSHORTLEN];
+            load_vector(M, buff, size);
+            str = tokuS_newl(T, buff, size);
+            setstrval(T, &sv, str);
+            tokuH_setint(T, M->h, i, &sv);
+        } else { /* otherwise long string */
+            str = tokuS_newlngstrobj(T, size);
+            setstrval(T, &sv, str);
+            tokuH_setint(T, M->h, i, &sv); /* anchor it */
+            /* load directly into string 'bytes' */
+            load_vector(M, getlngstr(str), size);
+        }
+        tokuG_objbarrierback(T, obj2gco(M->h), str);
+        M->nstr++;
+    }
+}
+
+
+/* load switch jump table (anchored in 'o') */
+static void load_switchtable(MarshalState *M, Proto *f, TValue *o) {
+    toku_State *T = M->T;
+    int32_t n = load_int(M);
+    Table *t = tokuH_new(T);
+    TValue key, off;
+    settval(T, o, t); /* anchor it */
+    tokuG_objbarrier(T, f, t);
+    for (int32_t i = 0; i < n; i++) {
+        int32_t tt = load_byte(M);
+        switch (tt) {
+            case TOKU_VNUMFLT: setfval(&key, load_number(M)); break;
+            case TOKU_VNUMINT: setival(&key, load_integer(M)); break;
+            case TOKU_VLNGSTR: case TOKU_VSHRSTR: {
+                toku_assert(f->source == NULL);
+                load_string(M, f, &f->source); /* use 'source' as anchor */
+                if (f->source == NULL)
+                    error(M, "bad format for switch key");
+                setstrval(T, &key, f->source);
+                break;
+            }
+            default: error(M, "invalid switch key");
+        }
+        if (ttisflt(&key) && tokui_numisnan(fval(&key)))
+            error(M, "invalid switch key");
+        setival(&off, load_int(M));
+        tokuH_set(T, t, &key, &off); /* (key is anchored in 't') */
+        f->source = NULL;
+    }
+}
+
+
+/* load constant list of a constructor (anchored in 'o') */
+static void load_constlist(MarshalState *M, Proto *f, TValue *o) {
+    toku_State *T = M->T;
+    int32_t n = load_int(M);
+    List *l = tokuA_new(T);
+    setlistval(T, o, l); /* anchor it */
+    tokuG_objbarrier(T, f, l);
+    tokuA_ensure(T, l, n);
+    for (int32_t i = 0; i < n; i++) {
+        TValue *v = &l->arr[i];
+        int32_t tt = load_byte(M);
+        switch (tt) {
+            case TOKU_VTRUE: setbtval(v); break;
+            case TOKU_VFALSE: setbfval(v); break;
+            case TOKU_VNIL: setnilval(v); break;
+            case TOKU_VNUMFLT: setfval(v, load_number(M)); break;
+            case TOKU_VNUMINT: setival(v, load_integer(M)); break;
+            case TOKU_VLNGSTR: case TOKU_VSHRSTR: {
+                OString *str = NULL;
+                load_string(M, f, &str);
+                if (str == NULL)
+                    error(M, "bad format for constant string");
+                setstrval(T, v, str);
+                tokuG_objbarrierback(T, obj2gco(l), str);
+                break;
+            }
+            default: error(M, "invalid constant");
+        }
+        l->len = i + 1;
+    }
+}
+
+
 static void load_constants(MarshalState *M, Proto *f) {
     int32_t n = load_int(M);
     f->k = tokuM_newarraychecked(M->T, n, TValue);
@@ -516,6 +853,8 @@ static void load_constants(MarshalState *M, Proto *f) {
                 f->source = NULL;
                 break;
             }
+            case TOKU_VTABLE: load_switchtable(M, f, o); break;
+            case TOKU_VLIST: load_constlist(M, f, o); break;
             default: error(M, "invalid constant");
         }
     }
@@ -536,6 +875,14 @@ static void load_upvalues(MarshalState *M, Proto *f) {
 }
 
 
+/* inline caches are not dumped, only their number */
+static void load_caches(MarshalState *M, Proto *f) {
+    int32_t n = load_int(M);
+    tokuM_checksize(M->T, n, sizeof(InlineCache));
+    tokuF_newcaches(M->T, f, n);
+}
+
+
 static void load_function(MarshalState *M, Proto *f);
 
 static void load_protos(MarshalState *M, Proto *f) {
@@ -559,22 +906,21 @@ static void load_debug(MarshalState *M, Proto *f) {
     load_string(M, f, &f->source);
     n = load_int(M);
     if (n > 0) {
-        f->lineinfo = tokuM_newarraychecked(T, n, int8_t);
-        f->sizelineinfo = n;
+        load_array(M, f, f->lineinfo, f->sizelineinfo, n, int8_t,
+                         BORROW_LINEINFO);
     }
-    load_vector(M, f->lineinfo, n);
     n = load_int(M);
     if (n > 0) {
         load_align(M, sizeof(int32_t));
-        f->abslineinfo = tokuM_newarraychecked(T, n, AbsLineInfo);
-        f->sizeabslineinfo = n;
-        load_vector(M, f->abslineinfo, n);
+        load_array(M, f, f->abslineinfo, f->sizeabslineinfo, n, AbsLineInfo,
+                         BORROW_ABSLINEINFO);
     }
     n = load_int(M);
     if (n > 0) {
-        f->opcodepc = tokuM_newarraychecked(T, n, int32_t);
-        f->sizeopcodepc = n;
-        load_vector(M, f->opcodepc, n);
+        if (L(M).mapped)
+            load_align(M, sizeof(int32_t));
+        load_array(M, f, f->opcodepc, f->sizeopcodepc, n, int32_t,
+                         BORROW_OPCODEPC);
     }
     n = load_int(M);
     if (n > 0) {
@@ -604,6 +950,7 @@ static void load_function(MarshalState *M, Proto *f) {
     f->deflastline = load_int(M);
     f->arity = load_int(M);
     f->maxstack = load_int(M);
+    load_caches(M, f);
     load_code(M, f);
     load_constants(M, f);
     load_upvalues(M, f);
@@ -631,6 +978,8 @@ TClosure *tokuZ_undump(toku_State *T, BuffReader *Z, const char *name) {
     M.h = tokuH_new(T); /* create list of saved strings */
     settval2s(T, T->sp.p, M.h); /* anchor it */
     tokuT_incsp(T);
+    if (!L(&M).inline_)
+        load_pool(&M);
     cl->p = tokuF_newproto(T);
     tokuG_objbarrier(T, cl, cl->p);
     load_function(&M, cl->p);
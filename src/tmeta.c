@@ -22,6 +22,7 @@
 #include "tvm.h"
 #include "tmem.h"
 #include "tprotected.h"
+#include "tshape.h"
 
 
 TOKUI_DEF const char *const tokuO_typenames[TOKUI_TOTALTYPES] = {
@@ -52,21 +53,28 @@ void tokuTM_init(toku_State *T) {
 OClass *tokuTM_newclass(toku_State *T) {
     GCObject *o = tokuG_new(T, sizeof(OClass), TOKU_VCLASS);
     OClass *cls = gco2cls(o);
+    cls->nshapes = 0;
+    cls->nslots = 0;
     cls->sclass = NULL;
     cls->metatable = NULL;
     cls->methods = NULL;
+    cls->shape = NULL;
     return cls;
 }
 
 
 Instance *tokuTM_newinstance(toku_State *T, OClass *cls) {
-    GCObject *o = tokuG_new(T, sizeof(Instance), TOKU_VINSTANCE);
+    Shape *root = tokuSH_root(T, cls);
+    int32_t n = cls->nslots; /* expected number of fields */
+    GCObject *o = tokuG_new(T, sizeofinstance(n), TOKU_VINSTANCE);
     Instance *ins = gco2ins(o);
+    ins->ninline = cast_u8(n);
+    ins->sizeslots = n;
     ins->oclass = cls;
-    ins->fields = NULL; /* to not confuse GC */
-    setinsval2s(T, T->sp.p++, ins); /* anchor instance */
-    ins->fields = tokuH_new(T);
-    T->sp.p--; /* remove instance */
+    ins->shape = root;
+    ins->fields = NULL;
+    ins->slots = ins->inl;
+    ins->gclist = NULL;
     return ins;
 }
 
@@ -87,10 +95,18 @@ UserData *tokuTM_newuserdata(toku_State *T, size_t size, uint16_t nuv) {
 }
 
 
+/* methods are compared without 'T' (see 'tokuTM_eqim') */
+#define flatmethod(T,m) \
+    { if (t_unlikely(ttisropestring(m))) tokuS_flatten(T, strval(m)); }
+
+
 IMethod *tokuTM_newinsmethod(toku_State *T, Instance *ins,
                                             const TValue *method) {
-    GCObject *o = tokuG_new(T, sizeof(IMethod), TOKU_VIMETHOD);
-    IMethod *im = gco2im(o);
+    GCObject *o;
+    IMethod *im;
+    flatmethod(T, method);
+    o = tokuG_new(T, sizeof(IMethod), TOKU_VIMETHOD);
+    im = gco2im(o);
     im->ins = ins;
     setobj(T, &im->method, method);
     return im;
@@ -106,8 +122,11 @@ int32_t tokuTM_eqim(const IMethod *v1, const IMethod *v2) {
 
 UMethod *tokuTM_newudmethod(toku_State *T, UserData *ud,
                                            const TValue *method) {
-    GCObject *o = tokuG_new(T, sizeof(UMethod), TOKU_VUMETHOD);
-    UMethod *um = gco2um(o);
+    GCObject *o;
+    UMethod *um;
+    flatmethod(T, method);
+    o = tokuG_new(T, sizeof(UMethod), TOKU_VUMETHOD);
+    um = gco2um(o);
     um->ud = ud;
     setobj(T, &um->method, method);
     return um;
@@ -154,7 +173,7 @@ const char *tokuTM_objtypename(toku_State *T, const TValue *o) {
         (ttisfulluserdata(o) && (t = udval(o)->metatable))) {
         const TValue *v = tokuH_Hgetshortstr(t, tokuS_new(T, "__name"));
         if (ttisstring(v)) /* is '__name' a string? */
-            return getstr(strval(v)); /* use it as type name */
+            return getstr(tokuS_flat(T, strval(v))); /* use it as name */
     }
     return typename(ttype(o)); /* otherwise use standard type name */
 }
@@ -381,9 +381,17 @@ typedef union Node {
 typedef struct Table {
     ObjectHeader; /* internal only object */
     uint8_t flags; /* 1<<p means tagmethod(p) is not present */
-    uint8_t size; /* log2 of array size */
-    Node *node; /* memory block */
+    uint8_t size; /* log2 of hash size */
+    uint32_t asize; /* number of slots in 'array' */
+    int32_t nfields; /* number of fields (non-empty values) */
+    TValue *array; /* array part (integer keys 0..asize-1) */
+    Node *node; /* hash part */
+#if defined(TOKUI_SWISSTABLE)
+    uint8_t *ctrl; /* control bytes of 'node' */
+    uint32_t growthleft; /* number of keys that can still be inserted */
+#else
     Node *lastfree; /* any free position is before this position */
+#endif
     GCObject *gclist;
 } Table;
 
@@ -418,10 +426,12 @@ typedef struct Table {
 
 #define TOKU_VSHRSTR    makevariant(TOKU_T_STRING, 0) /* short string */
 #define TOKU_VLNGSTR    makevariant(TOKU_T_STRING, 1) /* long string */
+#define TOKU_VROPESTR   makevariant(TOKU_T_STRING, 2) /* rope */
 
 #define ttisstring(o)       checktype((o), TOKU_T_STRING)
 #define ttisshrstring(o)    checktag((o), ctb(TOKU_VSHRSTR))
 #define ttislngstring(o)    checktag((o), ctb(TOKU_VLNGSTR))
+#define ttisropestring(o)   checktag((o), ctb(TOKU_VROPESTR))
 
 #define strval(o)   check_exp(ttisstring(o), gco2str(val(o).gc))
 
@@ -451,12 +461,33 @@ typedef struct OString {
 #define strisshr(ts)    ((ts)->shrlen < 0xFF)
 
 
+/*
+** Ropes are long strings made by concatenation, whose contents are
+** copied only when they are needed. Instead of the contents, their
+** header is followed by 'Rope' holding the two parts of the string
+** ('u.lnglen' is the length of the whole string, as in long strings).
+** Once the rope is flattened (see 'tokuS_flatten'), 'left' is NULL and
+** 'right' is the long string with the contents.
+*/
+typedef struct Rope {
+    struct OString *left; /* left part (NULL if flattened) */
+    struct OString *right; /* right part or the flattened string */
+    GCObject *gclist;
+} Rope;
+
+
+#define strisrope(ts)   ((ts)->tt_ == TOKU_VROPESTR)
+
+#define getrope(os)     check_exp(strisrope(os), cast(Rope *, (os)->bytes))
+
+
 /*
 ** Get string bytes from 'OString'. (Both generic version and specialized
-** versions for long and short strings.)
+** versions for long and short strings.) Ropes have no bytes, they must
+** be flattened first.
 */
 #define getstr(os)      ((os)->bytes)
-#define getlngstr(os)   check_exp((os)->shrlen == 0xFF, (os)->bytes)
+#define getlngstr(os)   check_exp((os)->tt_ == TOKU_VLNGSTR, (os)->bytes)
 #define getshrstr(os)   check_exp((os)->shrlen != 0xFF, (os)->bytes)
 
 /* get string length from 'OString *s' */
@@ -485,9 +516,12 @@ typedef struct OString {
 
 typedef struct OClass {
     ObjectHeader;
+    int32_t nshapes; /* number of shapes in 'shape' tree */
+    int32_t nslots; /* number of slots allocated with new instances */
     struct OClass *sclass;
     Table *metatable;
     Table *methods;
+    struct Shape *shape; /* root of the shape tree (or NULL) */
 } OClass;
 
 /* }===================================================================== */
@@ -538,12 +572,38 @@ typedef struct AbsLineInfo {
 } AbsLineInfo;
 
 
+/*
+** Inline cache of an instruction that indexes a value with a constant
+** short string key. Each entry is a node index (hint) where the key
+** was last found, the hint is checked against the key on each use so
+** stale entries are harmless (see 'tvm.c').
+*/
+typedef struct InlineCache {
+    int32_t slot[2];    /* hints for the indexed table (or fields) */
+    int32_t mslot;      /* hint for the class 'methods' table */
+} InlineCache;
+
+
+/*
+** Function body skipped by the parser when loading a chunk in lazy
+** mode. It gets compiled from the source text on the first call of the
+** function (see 'tokuP_compile').
+*/
+typedef struct LazyBody {
+    OString *text;          /* source text of the whole chunk */
+    int32_t pos;            /* offset of the parameter list in 'text' */
+    int32_t line;           /* line of the parameter list */
+    int32_t optlevel;       /* optimization level of the chunk */
+} LazyBody;
+
+
 /*
 ** Function Prototypes.
 */
 typedef struct Proto {
     ObjectHeader;
     uint8_t isvararg;       /* true if this function accepts extra params */
+    uint8_t borrowed;       /* arrays borrowed from 'blob' (BORROW_*) */
     int32_t defline;        /* function definition line (debug) */
     int32_t deflastline;    /* function definition last line (debug) */
     int32_t arity;          /* number of fixed (named) function parameters */
@@ -556,10 +616,16 @@ typedef struct Proto {
     int32_t sizeabslineinfo;/* size of 'abslineinfo' */
     int32_t sizeopcodepc;   /* size of 'opcodepc' */
     int32_t sizelocals;     /* size of 'locals' */
+    int32_t sizeic;         /* size of 'ic' */
     uint8_t *code;          /* bytecode */
     TValue *k;              /* constant values */
     UpValInfo *upvals;      /* debug information for upvalues */
     struct Proto **p;       /* list of funcs defined inside of this function */
+    InlineCache *ic;        /* inline caches */
+    struct JitCode *jit;    /* native code (see 'tjit.c') */
+    int32_t jitcount;       /* calls and loop iterations before compiling */
+    LazyBody *lazy;         /* body not compiled yet (or NULL) */
+    GCObject *blob;         /* owner of borrowed arrays (or NULL) */
     /* debug information (can be stripped away when dumping) */
     OString *source;            /* source name */
     int8_t *lineinfo;           /* information about source lines */
@@ -591,10 +657,37 @@ typedef struct Proto {
 
 #define setinsval2s(T,o,ins)    setinsval(T,s2v(o),ins)
 
+/*
+** Layout of instance fields. Instances of the same class that got
+** the same fields in the same order share the same shape, so a field
+** is just an index into the instance 'slots'. Shapes form a tree
+** owned by the class, where each child adds one key to its parent.
+*/
+typedef struct Shape {
+    struct Shape *parent;
+    struct Shape *child; /* first shape that extends this one */
+    struct Shape *sibling; /* next shape that extends 'parent' */
+    int32_t nkeys; /* number of keys in 'keys' */
+    OString *keys[1]; /* keys in slot order */
+} Shape;
+
+
+/*
+** Instance fields are kept in 'slots' as described by 'shape', or in
+** the 'fields' table (dictionary mode) if 'shape' is NULL. Empty slot
+** is a removed field. First 'ninline' slots are allocated together
+** with the instance itself in 'inl'.
+*/
 typedef struct Instance {
     ObjectHeader;
+    uint8_t ninline; /* number of slots in 'inl' */
+    int32_t sizeslots; /* size of 'slots' */
     OClass *oclass;
-    Table *fields;
+    Shape *shape; /* layout of 'slots' (or NULL) */
+    Table *fields; /* fields table in dictionary mode (or NULL) */
+    TValue *slots;
+    GCObject *gclist;
+    TValue inl[1]; /* inline slots */
 } Instance;
 
 /* }===================================================================== */
@@ -22,11 +22,14 @@
 static int32_t dump = 1;                        /* dump bytecode? */
 static int32_t list = 0;                        /* list bytecode? */
 static int32_t strip = 0;                       /* strip debug info? */
+static int32_t mapped = 0;                      /* use mapped format? */
 static char verbosity = 0;                      /* verbosity level */
 static char showdesc = 0;                       /* show opcode description? */
 static const char *progname = TOKU_PROGNAMEC;   /* actual program name */
 static char doutput[] = { TOKU_OUTPUTC };       /* default output file name */
 static const char *output = doutput;            /* actual output file name */
+static char optmode[] = "bt0";                  /* mode with optimization */
+static const char *mode = NULL;                 /* mode for loading files */
 
 
 #define EQ(l,r)         (strcmp(l, r) == 0)
@@ -39,6 +42,8 @@ static void usage(void) {
     "   -l n        list opcodes according to 'n' (default 0, max 3)\n"
     "   -D          show opcode description in opcode listing ('-l')\n"
     "   -o name     output to file 'name' (default is \"%s\")\n"
+    "   -O n        optimization level 'n' (default 2, max 2)\n"
+    "   -m          dump in the mapped format (loaded without copying)\n"
     "   -p          parse only\n"
     "   -s          strip debug information\n"
     "   -v          show version information\n"
@@ -109,8 +114,17 @@ static int32_t cliargs(int32_t argc, char *argv[]) {
                     output = NULL;
                 break;
             }
+            case 'O': {
+                arg = getarg(argv, &i, j, "-O");
+                if (strlen(arg) > 1 || *arg < '0' || *arg > '2')
+                    fatalf("invalid 'n' ('%s') for '-O', expected [0, 2]",arg);
+                optmode[2] = *arg;
+                mode = optmode;
+                break;
+            }
             case 'D': showdesc = 1; checkrest(); break;
             case 'p': dump = 0; checkrest(); break;
+            case 'm': mapped = 1; checkrest(); break;
             case 's': strip = 1; checkrest(); break;
             case 'v': ++version; checkrest(); break;
             case 'h': {
@@ -209,6 +223,8 @@ static void printType(toku_State *T, int32_t t) {
         case TOKU_T_NIL: printf("N"); break;
         case TOKU_T_BOOL: printf("B"); break;
         case TOKU_T_STRING: printf("S"); break;
+        case TOKU_T_TABLE: printf("T"); break;
+        case TOKU_T_LIST: printf("L"); break;
         case TOKU_T_NUMBER: {
             if (toku_is_integer(T, -1)) /* number is integer? */
                 printf("I");
@@ -276,6 +292,32 @@ static void printConstant(toku_State *T, int32_t t) {
             printString(s, l);
             break;
         }
+        case TOKU_T_TABLE: { /* switch jump table */
+            const char *sep = "";
+            printf("{");
+            toku_push_nil(T);
+            while (toku_nextfield(T, -2)) {
+                toku_Integer off = toku_to_integer(T, -1);
+                toku_pop(T, 1); /* remove offset */
+                printf("%s", sep);
+                printConstant(T, toku_type(T, -1));
+                printf(": " TOKU_INTEGER_FMT, off);
+                sep = ", ";
+            }
+            printf("}");
+            break;
+        }
+        case TOKU_T_LIST: { /* constructor elements */
+            toku_Integer n = t_castU2S(toku_len(T, -1));
+            printf("[");
+            for (toku_Integer i = 0; i < n; i++) {
+                printf("%s", (i > 0) ? ", " : "");
+                printConstant(T, toku_get_index(T, -1, i));
+                toku_pop(T, 1);
+            }
+            printf("]");
+            break;
+        }
         default: toku_assert(0); /* unreachable */
     }
 }
@@ -352,7 +394,7 @@ static int32_t pmain(toku_State *T) {
     firstfunc = toku_getntop(T);
     for (int32_t i=0; i<argc; i++) { /* load all input files */
         const char* filename = EQ(argv[i], "-") ? NULL : argv[i];
-        if (tokuL_loadfile(T, filename) != TOKU_STATUS_OK)
+        if (tokuL_loadfilex(T, filename, mode) != TOKU_STATUS_OK)
             toku_error(T);
     }
     if (argc > 1) { /* more than one file loaded? */
@@ -366,7 +408,9 @@ static int32_t pmain(toku_State *T) {
         fp = (output == NULL) ? stdout : fopen(output, "wb");
         if (fp == NULL) errorfile("open");
         toku_lock(T);
-        toku_dump(T, writer, cast_voidp(fp), strip);
+        toku_dump(T, writer, cast_voidp(fp),
+                     (strip ? TOKU_DUMP_STRIP : 0) |
+                     (mapped ? TOKU_DUMP_MAPPED : 0));
         toku_unlock(T);
         if (ferror(fp)) errorfile("write");
         if (fclose(fp)) errorfile("close");
@@ -98,6 +98,8 @@ static void print_usage(const char *badopt) {
     "   -i          enter interactive mode after executing 'script'\n"
     "   -l mod      import library 'mod' into global 'mod'\n"
     "   -l g=mod    import library 'mod' into global 'g'\n"
+    "   -L          compile functions of 'script' on their first call\n"
+    "   -c          check 'script' for syntax errors without running it\n"
     "   -W          turn warnings on\n"
     "   -E          ignore environment variables\n"
     "   -v          show version information\n"
@@ -137,6 +139,8 @@ static int32_t report(toku_State *T, int32_t status) {
 #define arg_h           (1<<3) /* -h (show help) */
 #define arg_i           (1<<4) /* -i (interactive mode after script) */
 #define arg_E           (1<<5) /* -E (ignore env. vars) */
+#define arg_L           (1<<6) /* -L (lazy loading of script) */
+#define arg_c           (1<<7) /* -c (check script) */
 
 /*
 ** Traverses all arguments from 'argv', returning a mask with those
@@ -172,6 +176,16 @@ static int32_t collect_args(char **argv, int32_t *first) {
                     return arg_error;
                 args |= arg_E;
                 break;
+            case 'L': /* -L */
+                if (argv[i][2] != '\0')
+                    return arg_error;
+                args |= arg_L;
+                break;
+            case 'c': /* -c */
+                if (argv[i][2] != '\0')
+                    return arg_error;
+                args |= arg_c;
+                break;
             case 'i': /* -i */
                 args |= arg_i; /* (-i implies -v) */
                 /* fall through */
@@ -335,13 +349,22 @@ static int32_t pushargs(toku_State *T) {
 }
 
 
-static int32_t handle_script(toku_State *T, char **argv) {
+/*
+** Load and run the script. With option '-L' the function bodies are
+** compiled on their first call (lazy mode of 'load'); with option '-c'
+** the whole script is compiled, reporting any syntax error, but it is
+** not run.
+*/
+static int32_t handle_script(toku_State *T, char **argv, int32_t args) {
     int32_t status;
     const char *filename = argv[0];
+    const char *mode = (args & arg_L) && !(args & arg_c) ? "btl" : NULL;
     if (strcmp(filename, "-") == 0 && strcmp(argv[-1], "--") != 0)
         filename = NULL; /* stdin */
-    status = tokuL_loadfile(T, filename);
-    if (status == TOKU_STATUS_OK) {
+    status = tokuL_loadfilex(T, filename, mode);
+    if (status == TOKU_STATUS_OK && (args & arg_c))
+        toku_pop(T, 1); /* only check it */
+    else if (status == TOKU_STATUS_OK) {
         int32_t nargs = pushargs(T);
         status = docall(T, nargs, TOKU_MULTRET);
     }
@@ -725,7 +748,7 @@ static int32_t pmain(toku_State *T) {
     if (!run_args(T, argv, optlimit)) /* execute arguments -e and -l */
         return 0; /* something failed */
     if (script > 0) { /* execute main script (if there is one) */
-        if (handle_script(T, argv + script) != TOKU_STATUS_OK)
+        if (handle_script(T, argv + script, args) != TOKU_STATUS_OK)
             return 0; /* interrupt in case of error */
     }
     if (args & arg_i) /* '-i' option? */
@@ -270,10 +270,16 @@ TOKU_API int32_t toku_pcall(toku_State *T, int32_t nargs, int32_t nresults,
                                                           int32_t absmsgh); 
 TOKU_API int32_t toku_load(toku_State *T, toku_Reader freader, void *userdata,
                            const char *chunkname, const char *mode); 
+TOKU_API int32_t toku_loadblob(toku_State *T, int32_t idx,
+                               const char *chunkname, const char *mode);
 TOKU_API int32_t toku_combine(toku_State *T, const char *chunkname, int32_t n);
 TOKU_API int32_t toku_dump(toku_State *T, toku_Writer fw, void *data,
                                                           int32_t strip);
 
+/* options for 'toku_dump' (in 'strip') */
+#define TOKU_DUMP_STRIP         1 /* remove debug information */
+#define TOKU_DUMP_MAPPED        2 /* format that 'toku_loadblob' borrows */
+
 /* }{Garbage collector API================================================ */
 
 /* GC options (what) */
@@ -295,6 +301,16 @@ TOKU_API int32_t toku_dump(toku_State *T, toku_Writer fw, void *data,
 
 TOKU_API int32_t toku_gc(toku_State *T, int32_t what, ...); 
 
+/* }{JIT compiler API===================================================== */
+
+/* JIT options (what) */
+#define TOKU_JIT_STOP           0 /* stop JIT */
+#define TOKU_JIT_RESTART        1 /* restart JIT (start if stopped) */
+#define TOKU_JIT_ISRUNNING      2 /* test whether JIT is running */
+#define TOKU_JIT_THRESHOLD      3 /* set or get compile threshold */
+
+TOKU_API int32_t toku_jit(toku_State *T, int32_t what, ...);
+
 /* }{Warning-related functions============================================ */
 
 TOKU_API void toku_setwarnf(toku_State *T, toku_WarnFunction fwarn, void *ud); 
@@ -391,6 +407,8 @@ TOKU_API toku_Hook   toku_gethook(toku_State *T);
 TOKU_API int32_t     toku_gethookmask(toku_State *T);
 TOKU_API int32_t     toku_gethookcount(toku_State *T);
 TOKU_API int32_t     toku_stackinuse(toku_State *T);
+TOKU_API void        toku_icstats(toku_State *T, toku_Unsigned *hits,
+                                     toku_Unsigned *misses, int32_t reset);
 
 struct toku_Debug {
     int32_t event;
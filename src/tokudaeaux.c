@@ -361,6 +361,46 @@ static int32_t errorfile(toku_State *T, const char *what, int32_t fidx) {
 }
 
 
+/*
+** Position and value of the format byte of binary chunks in the mapped
+** format (it follows the signature and the version byte, see
+** 'TOKUC_FORMAT_MAPPED' in tmarshal.c).
+*/
+#define BINFMTPOS       (sizeof(TOKU_SIGNATURE) - 1 + 1)
+#define BINFMTMAPPED    2
+
+
+/*
+** Read the whole binary file 'f' (a chunk in the mapped format) into a
+** userdata and load the chunk from there, so that its functions can
+** borrow their arrays from that userdata (see 'toku_loadblob'). Return
+** -1 (and push nothing) if the size of the file cannot be determined.
+*/
+static int32_t loadbinfile(toku_State *T, FILE *f, const char *mode,
+                                          int32_t fidx) {
+    long sz;
+    size_t nr;
+    void *b;
+    int32_t status;
+    if (fseek(f, 0, SEEK_END) != 0 || (sz = ftell(f)) < 0 ||
+            fseek(f, 0, SEEK_SET) != 0)
+        return -1; /* not seekable */
+    b = toku_push_userdata(T, cast_sizet(sz), 0);
+    nr = fread(b, 1, cast_sizet(sz), f);
+    if (ferror(f) || nr != cast_sizet(sz)) {
+        toku_pop(T, 1); /* remove userdata */
+        status = errorfile(T, "read", fidx);
+        fclose(f);
+        return status;
+    }
+    fclose(f);
+    status = toku_loadblob(T, -1, toku_to_string(T, fidx), mode);
+    toku_remove(T, -2); /* remove userdata */
+    toku_remove(T, fidx); /* remove chunk name */
+    return status;
+}
+
+
 TOKULIB_API int32_t tokuL_loadfilex(toku_State *T, const char *fname,
                                                const char *mode) {
     LoadFile lf = {0};
@@ -392,9 +432,13 @@ TOKULIB_API int32_t tokuL_loadfilex(toku_State *T, const char *fname,
         lf.f = freopen(fname, "rb", lf.f); /* reopen in binary mode */
         if (lf.f == NULL)
             return errorfile(T, "reopen", filename_index);
-        getc(lf.f); /* read again TOKU_SIGNATURE[0] byte */
-    }
-    if (c != EOF)
+        /* pre-read the header up to the format byte */
+        lf.n = cast_i32(fread(lf.buff, 1, BINFMTPOS + 1, lf.f));
+        if (lf.n == BINFMTPOS + 1 && lf.buff[BINFMTPOS] == BINFMTMAPPED &&
+                (status = loadbinfile(T, lf.f, mode, filename_index)) >= 0)
+            return status; /* loaded from memory */
+        /* otherwise read the chunk through 'filereader' */
+    } else if (c != EOF)
         lf.buff[lf.n++] = cast_char(c); /* 'c' is the first character */
     status = toku_load(T, filereader, &lf, toku_to_string(T, -1), mode);
     readstatus = ferror(lf.f);
@@ -498,7 +542,7 @@ TOKULIB_API void *tokuL_test_userdata(toku_State *T, int32_t idx,
                                                      const char *tn) {
     void *p = tokuL_to_fulluserdata(T, idx);
     if (p != NULL) { /* 'idx' is full userdata? */
-        if (toku_get_metatable(T, 0)) { /* it has a metatable? */
+        if (toku_get_metatable(T, idx)) { /* it has a metatable? */
             tokuL_get_metatable(T, tn); /* get correct metatable */
             if (!toku_rawequal(T, -1, -2)) /* not the same? */
                 p = NULL;
@@ -235,6 +235,22 @@ typedef struct tokuL_Stream {
     toku_CFunction closef; /* to close stream (NULL for closed streams) */
 } tokuL_Stream;
 
+/* }{String builders====================================================== */
+
+/*
+** A string builder is a userdata with 'TOKU_STRBUILDER' metatable,
+** and initial structure 'tokuL_StrBuilder' (it may contain other fields
+** after that initial structure).
+*/
+
+#define TOKU_STRBUILDER   "StringBuilder"
+
+typedef struct tokuL_StrBuilder {
+    char *b; /* contents (NULL if nothing was allocated) */
+    size_t n; /* number of bytes in 'b' */
+    size_t sz; /* size of 'b' */
+} tokuL_StrBuilder;
+
 /* }}EOF================================================================== */
 
 #endif
@@ -496,6 +496,14 @@
 #define tokui_checkapi(T,e)       assert(e)
 #endif
 
+
+/*
+** @TOKU_USE_JIT enables the baseline JIT compiler, which translates
+** hot functions into native code. It is only available on x86-64
+** Linux with the default number types and ignored elsewhere.
+*/
+/* #define TOKU_USE_JIT */
+
 /* }====================================================================== */
 
 
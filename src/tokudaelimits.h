@@ -106,6 +106,17 @@ typedef ptrdiff_t       t_mem;
 #endif
 
 
+/*
+** Minimum length of the result of concatenation for making a rope
+** instead of copying the strings (see 'tokuV_concat'). This is also the
+** length under which the parts of ropes are merged together. (Must be
+** greater than TOKUI_MAXSHORTLEN.)
+*/
+#if !defined(TOKUI_MINROPELEN)
+#define TOKUI_MINROPELEN        256
+#endif
+
+
 /*
 ** Size of cache for strings in the API. 'N' is the number of
 ** sets (better be a prime) and "M" is the size of each set (M == 1
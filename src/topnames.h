@@ -85,6 +85,7 @@ static const char *const opnames[] = {
     "JMPS",
     "TEST",
     "TESTPOP",
+    "SWITCH",
     "CALL",
     "TAILCALL",
     "CLOSE",
@@ -92,15 +93,19 @@ static const char *const opnames[] = {
     "CHECKADJ",
     "GETLOCAL",
     "SETLOCAL",
+    "ARITHLL",
     "GETUVAL",
     "SETUVAL",
     "SETLIST",
     "SETPROPERTY",
     "GETPROPERTY",
+    "GETMETHOD",
     "GETINDEX",
     "SETINDEX",
     "GETINDEXSTR",
     "SETINDEXSTR",
+    "GETINDEXUP",
+    "SETINDEXUP",
     "GETINDEXINT",
     "GETINDEXINTL",
     "SETINDEXINT",
@@ -111,7 +116,25 @@ static const char *const opnames[] = {
     "FORPREP",
     "FORCALL",
     "FORLOOP",
+    "FORPREPI",
+    "FORLOOPI",
     "RETURN",
+    "NEWLISTK",
+    "NEWTABLEK",
+    "ADDII",
+    "ADDFF",
+    "SUBII",
+    "SUBFF",
+    "MULII",
+    "MULFF",
+    "LTII",
+    "LTFF",
+    "LEII",
+    "LEFF",
+    "GETINDEXLIST",
+    "GETINDEXINTLIST",
+    "FORLIST",
+    "FORTABLE",
     NULL,
 };
 
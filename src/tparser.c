@@ -15,6 +15,7 @@
 #include "tfunction.h"
 #include "tgc.h"
 #include "tlexer.h"
+#include "tlist.h"
 #include "tokudaelimits.h"
 #include "tmem.h"
 #include "tobject.h"
@@ -107,6 +108,7 @@ typedef struct FuncContext {
     int32_t nopcodepc;
     int32_t nlocals;
     int32_t nupvals;
+    int32_t nic;
     int32_t lasttarget;
     int32_t lastgoto; /* last pending goto in 'gt' */
     uint8_t ismethod;
@@ -131,6 +133,7 @@ static void storecontext(FunctionState *fs, FuncContext *ctx) {
     ctx->nopcodepc = fs->nopcodepc;
     ctx->nlocals = fs->nlocals;
     ctx->nupvals = fs->nupvals;
+    ctx->nic = fs->nic;
     ctx->lasttarget = fs->lasttarget;
     ctx->lastgoto = fs->lx->dyd->gt.len;
     ctx->ismethod = fs->ismethod;
@@ -155,6 +158,7 @@ static void loadcontext(FunctionState *fs, FuncContext *ctx) {
     fs->nopcodepc = ctx->nopcodepc;
     fs->nlocals = ctx->nlocals;
     fs->nupvals = ctx->nupvals;
+    fs->nic = ctx->nic;
     fs->lasttarget = ctx->lasttarget;
     fs->lx->dyd->gt.len = ctx->lastgoto;
     fs->ismethod = ctx->ismethod;
@@ -316,8 +320,11 @@ static LVarInfo *getlocalinfo(FunctionState *fs, int32_t vidx) {
 ** stack level.
 */
 static int32_t stacklevel(FunctionState *fs, int32_t nvar) {
-    if (nvar-- > 0) /* have at least one variable? */
-        return getlocalvar(fs, nvar)->s.sidx + 1;
+    while (nvar-- > 0) {
+        LVar *lv = getlocalvar(fs, nvar);
+        if (lv->s.kind != VARCTC) /* is in the stack? */
+            return lv->s.sidx + 1;
+    }
     return 0; /* no variables on stack */
 }
 
@@ -333,7 +340,8 @@ static int32_t nvarstack(FunctionState *fs) {
 
 static void contadjust(FunctionState *fs, int32_t push) {
     int32_t ncntl = isgenloop(&fs->ls->s) * VAR_N;
-    int32_t total = (fs->nactlocals - fs->ls->s.nactlocals - ncntl);
+    int32_t total = nvarstack(fs) - ncntl -
+                    stacklevel(fs, fs->ls->s.nactlocals);
     tokuC_adjuststack(fs, push ? -total : total);
 }
 
@@ -403,8 +411,10 @@ static int32_t newpendingjump(Lexer *lx, int32_t bk, int32_t close,
 static void removelocals(FunctionState *fs, int32_t tolevel) {
     fs->lx->dyd->actlocals.len -= fs->nactlocals - tolevel;
     toku_assert(fs->lx->dyd->actlocals.len >= 0);
-    while (fs->nactlocals > tolevel) /* set debug information */
-        getlocalinfo(fs, --fs->nactlocals)->endpc = currPC;
+    while (fs->nactlocals > tolevel) { /* set debug information */
+        if (getlocalvar(fs, --fs->nactlocals)->s.kind != VARCTC)
+            getlocalinfo(fs, fs->nactlocals)->endpc = currPC;
+    }
 }
 
 
@@ -518,7 +528,7 @@ static void enterscope(FunctionState *fs, Scope *s, int32_t mask) {
 static void leavescope(FunctionState *fs) {
     Scope *s = fs->scope;
     int32_t stklevel = stacklevel(fs, s->nactlocals);
-    int32_t nvalues = fs->nactlocals - s->nactlocals;
+    int32_t nvalues = nvarstack(fs) - stklevel;
     if (s->prev && s->haveupval) /* need a 'close'? */
         tokuC_emitIL(fs, OP_CLOSE, stklevel);
     removelocals(fs, s->nactlocals); /* remove scope locals */
@@ -582,9 +592,14 @@ static void close_func(Lexer *lx) {
     Proto *p = fs->p;
     toku_assert(fs->scope && !fs->scope->prev); /* this is the last scope */
     leavescope(fs); /* end final scope */
-    if (!stmIsReturn(fs)) /* function missing final return? */
-        tokuC_return(fs, nvarstack(fs), 0); /* add implicit return */
-    tokuC_finish(fs); /* final code adjustments */
+    if (p->lazy == NULL) { /* function body was compiled? */
+        if (!stmIsReturn(fs)) /* function missing final return? */
+            tokuC_return(fs, nvarstack(fs), 0); /* add implicit return */
+        tokuC_finish(fs); /* final code adjustments */
+    } else { /* only parameters; keep them visible (see 'skipbody') */
+        for (int32_t i = 0; i < fs->nlocals; i++)
+            p->locals[i].endpc = 1;
+    }
     /* shrink unused memory */
     tokuM_shrinkarray(T, p->p, p->sizep, fs->np, Proto *);
     tokuM_shrinkarray(T, p->k, p->sizek, fs->nk, TValue);
@@ -595,6 +610,7 @@ static void close_func(Lexer *lx) {
     tokuM_shrinkarray(T, p->opcodepc, p->sizeopcodepc, fs->nopcodepc, int32_t);
     tokuM_shrinkarray(T, p->locals, p->sizelocals, fs->nlocals, LVarInfo);
     tokuM_shrinkarray(T, p->upvals, p->sizeupvals, fs->nupvals, UpValInfo);
+    tokuF_newcaches(T, p, fs->nic);
     lx->fs = fs->prev; /* go back to enclosing function (if any) */
     T->sp.p--; /* pop kcache table */
     tokuG_checkGC(T); /* try to collect garbage memory */
@@ -629,6 +645,7 @@ static void setvararg(FunctionState *fs, int32_t arity) {
 
 /* forward declare (can be both part of statement and expression) */
 static void localstm(Lexer *lx);
+static void adjustassign(Lexer *lx, int32_t nvars, int32_t nexps, ExpInfo *e);
 static void funcbody(Lexer *lx, ExpInfo *v, int32_t linenum, int32_t ismethod,
                                                              int32_t del);
 
@@ -652,6 +669,7 @@ static int32_t addlocal(Lexer *lx, OString *name, int32_t linenum) {
     local->s.kind = VARREG;
     local->s.pidx = -1; /* mark uninitialized */
     local->s.linenum = linenum;
+    local->s.fidx = -1; /* not an inlined function */
     local->s.name = name;
     return dyd->actlocals.len - fs->firstlocal - 1;
 }
@@ -664,15 +682,19 @@ static int32_t addlocal(Lexer *lx, OString *name, int32_t linenum) {
 
 
 /*
-** Searches for local variable 'name'.
+** Searches for local variable 'name', returning its compiler index
+** or -1 if not found. Compile-time constants are set as EXP_CONST.
 */
 static int32_t searchlocal(FunctionState *fs, OString *name, ExpInfo *v,
                                                              int32_t lim) {
     for (int32_t i = fs->nactlocals - 1; 0 <= i && lim < i; i--) {
         LVar *lvar = getlocalvar(fs, i);
         if (eqstr(name, lvar->s.name)) { /* found? */
-            initvar(fs, v, i);
-            return EXP_LOCAL;
+            if (lvar->s.kind == VARCTC) /* compile-time constant? */
+                initexp(v, EXP_CONST, fs->firstlocal + i);
+            else
+                initvar(fs, v, i);
+            return i;
         }
     }
     return -1; /* not found */
@@ -732,8 +754,8 @@ static void varaux(FunctionState *fs, OString *name, ExpInfo *var,
     if (fs == NULL) /* last scope? */
         voidexp(var); /* not found */
     else { /* otherwise search locals/upvalues */
-        if (searchlocal(fs, name, var, -1) == EXP_LOCAL) { /* local found? */
-            if (!base) /* in recursive call to 'varaux'? */
+        if (searchlocal(fs, name, var, -1) >= 0) { /* local found? */
+            if (var->et == EXP_LOCAL && !base) /* local in enclosing func.? */
                 scopemarkupval(fs, var->u.var.vidx); /* use local as upvalue */
         } else { /* not found as local at current level; try upvalues */
             int32_t idx = searchupvalue(fs, fs->p->upvals, name);
@@ -763,9 +785,13 @@ static void var(Lexer *lx, OString *varname, ExpInfo *var) {
         ExpInfo key;
         varaux(fs, lx->envn, var, 1); /* get environment variable */
         toku_assert(var->et != EXP_VOID); /* this one must exist */
-        tokuC_exp2stack(fs, var); /* put env on stack */
         initstring(&key, varname); /* key is variable name */
-        tokuC_indexed(fs, var, &key, 0); /* env[varname] */
+        if (var->et == EXP_UVAL) /* environment is an upvalue? */
+            tokuC_indexup(fs, var, &key); /* env[varname] */
+        else {
+            tokuC_exp2stack(fs, var); /* put env on stack */
+            tokuC_indexed(fs, var, &key, 0); /* env[varname] */
+        }
     }
 }
 
@@ -850,21 +876,26 @@ static void primaryexp(Lexer *lx, ExpInfo *e) {
 }
 
 
-static void call(Lexer *lx, ExpInfo *e) {
+static void call(Lexer *lx, ExpInfo *e, int32_t self) {
     FunctionState *fs = lx->fs;
     int32_t linenum = lx->line;
-    int32_t base = fs->sp - 1;
+    int32_t base = fs->sp - 1 - self;
     tokuY_scan(lx); /* skip '(' */
     if (!check(lx, ')')) { /* have arguments? */
         explist(lx, e);
-        if (eismulret(e)) /* last argument is a call or vararg? */
+        if (eismulret(e)) { /* last argument is a call or vararg? */
             tokuC_setmulret(fs, e); /* it returns all values (finalize it) */
-        else /* otherwise... */
+            fs->callnargs = -1;
+        } else { /* otherwise... */
             tokuC_exp2stack(fs, e); /* put last argument value on stack */
-    } else /* otherwise no arguments */
+            fs->callnargs = fs->sp - base - 1 - self;
+        }
+    } else { /* otherwise no arguments */
         e->et = EXP_VOID;
+        fs->callnargs = 0;
+    }
     expectnext(lx, ')');
-    initexp(e, EXP_CALL, tokuC_call(fs, base, TOKU_MULTRET));
+    initexp(e, EXP_CALL, tokuC_call(fs, base, TOKU_MULTRET, self));
     tokuC_fixline(fs, linenum);
     linenum = lx->line;
     if (match(lx, '?')) /* call check? */
@@ -872,21 +903,82 @@ static void call(Lexer *lx, ExpInfo *e) {
 }
 
 
-static void suffixedexp(Lexer *lx, ExpInfo *e) {
+/* get the function called by 'e' if that call can be inlined */
+static Proto *getinline(FunctionState *fs, ExpInfo *e) {
+    if (e->et == EXP_LOCAL) {
+        int32_t fidx = getlocalvar(fs, e->u.var.vidx)->s.fidx;
+        if (fidx >= 0) return fs->p->p[fidx];
+    }
+    return NULL;
+}
+
+
+/*
+** Inline the call of 'f' (see 'tokuC_inline'), its arguments are
+** adjusted to the number of its parameters. As 'f' returns exactly one
+** value, call check ('?') only tests that value. Returns 2 if the call
+** has a check, otherwise 1.
+*/
+static int32_t inlinecall(Lexer *lx, ExpInfo *e, Proto *f) {
+    FunctionState *fs = lx->fs;
+    int32_t base = fs->sp;
+    int32_t nexps = 0;
+    int32_t linenum;
+    tokuY_scan(lx); /* skip '(' */
+    if (!check(lx, ')')) /* have arguments? */
+        nexps = explist(lx, e);
+    else
+        e->et = EXP_VOID;
+    expectnext(lx, ')');
+    adjustassign(lx, f->arity, nexps, e);
+    tokuC_inline(fs, f, base, nvarstack(fs));
+    initexp(e, EXP_FINEXPR, fs->prevpc);
+    linenum = lx->line;
+    if (match(lx, '?')) { /* call check? */
+        int32_t test;
+        tokuC_load(fs, base); /* load the result */
+        test = tokuC_test(fs, OP_TESTPOP, 1, linenum); /* jump if true */
+        tokuC_return(fs, base, 1);
+        tokuC_emitI(fs, OP_TRUE); /* adjustment for symbolic execution */
+        tokuC_patchtohere(fs, test);
+        return 2;
+    }
+    return 1;
+}
+
+
+/*
+** Returns 1 if the expression is an inlined call (2 if it also has
+** a call check), otherwise 0.
+*/
+static int32_t suffixedexp(Lexer *lx, ExpInfo *e) {
+    int32_t inlined = 0;
     primaryexp(lx, e);
     for (;;) {
         switch (lx->t.tk) {
             case '.':
                 getdotted(lx, e, 0);
+                inlined = 0;
                 break;
             case '[':
                 indexed(lx, e, 0);
+                inlined = 0;
                 break;
-            case '(':
-                tokuC_exp2stack(lx->fs, e);
-                call(lx, e);
+            case '(': {
+                int32_t self = (e->et == EXP_DOT);
+                Proto *f = getinline(lx->fs, e);
+                if (f != NULL) { /* call can be inlined? */
+                    inlined = inlinecall(lx, e, f);
+                    break;
+                } else if (self) /* 'v.name(...)'? */
+                    tokuC_getmethod(lx->fs, e); /* method and its receiver */
+                else
+                    tokuC_exp2stack(lx->fs, e);
+                call(lx, e, self);
+                inlined = 0;
                 break;
-            default: return;
+            }
+            default: return inlined;
         }
     }
 }
@@ -899,11 +991,51 @@ static void suffixedexp(Lexer *lx, ExpInfo *e) {
 typedef struct LConstructor {
     ExpInfo *l; /* list descriptor */
     ExpInfo v; /* last list item descriptor */
+    List *k; /* constant list elements (NULL if some are not constant) */
+    int32_t nk; /* number of constants before the constructor */
     int32_t narray; /* number of list elements already stored */
     int32_t tostore; /* number of list elements pending to be stored */
 } LConstructor;
 
 
+/*
+** Constructors whose elements are all constants are created by a single
+** opcode from a constant list holding their elements (see
+** 'tokuC_constructorK'). While parsing a constructor its elements are
+** also collected in that list, as long as they are all constants.
+*/
+static List *newconstelems(toku_State *T) {
+    List *l = tokuA_new(T);
+    setlistval2s(T, T->sp.p, l); /* anchor it */
+    tokuT_incsp(T);
+    return l;
+}
+
+
+static void addconstelem(toku_State *T, List *l, const TValue *v) {
+    tokuA_ensure(T, l, l->len + 1);
+    tokuA_fastset(T, l, l->len, v);
+    l->len++;
+}
+
+
+/*
+** Replace constructor at 'pc' (starting on line 'linenum') if all of its
+** elements are constants.
+*/
+static void endconstelems(FunctionState *fs, List *l, int32_t pc,
+                                          int32_t nk, int32_t linenum) {
+    toku_State *T = fs->lx->T;
+    if (l != NULL) { /* all elements are constants? */
+        TValue v;
+        setlistval(T, &v, l);
+        tokuC_constructorK(fs, pc, nk, &v);
+        tokuC_fixline(fs, linenum);
+    }
+    T->sp.p--; /* remove constant elements */
+}
+
+
 static void listfield(Lexer *lx, LConstructor *c) {
     expr(lx, &c->v);
     c->tostore++;
@@ -920,8 +1052,20 @@ static void checklistlimit(FunctionState *fs, LConstructor *c) {
 }
 
 
+/* collect last list item into the constant elements */
+static void listconstelem(FunctionState *fs, LConstructor *c) {
+    TValue v;
+    if (c->k == NULL) return; /* list is not constant */
+    else if (!tokuC_exp2const(fs, &c->v, &v))
+        c->k = NULL; /* item is not a constant */
+    else if (!ttisnil(&v) && c->k->len == c->narray + c->tostore - 1)
+        addconstelem(fs->lx->T, c->k, &v); /* (nil ends the elements) */
+}
+
+
 static void closelistfield(FunctionState *fs, LConstructor *c) {
     if (c->v.et == EXP_VOID) return; /* there is no list item */
+    listconstelem(fs, c);
     tokuC_exp2stack(fs, &c->v); /* put the item on stack */
     voidexp(&c->v); /* now empty */
     if (c->tostore == LISTFIELDS_PER_FLUSH) { /* flush? */
@@ -937,12 +1081,15 @@ static void lastlistfield(FunctionState *fs, LConstructor *c) {
     if (c->tostore == 0) return;
     checklistlimit(fs, c);
     if (eismulret(&c->v)) { /* last item has multiple returns? */
+        c->k = NULL; /* list is not constant */
         tokuC_setmulret(fs, &c->v);
         tokuC_setlist(fs, c->l->u.info, c->narray, TOKU_MULTRET);
         c->narray--; /* do not count last expression */
     } else {
-        if (c->v.et != EXP_VOID) /* have item? */
+        if (c->v.et != EXP_VOID) { /* have item? */
+            listconstelem(fs, c);
             tokuC_exp2stack(fs, &c->v); /* ensure it is on stack */
+        }
         tokuC_setlist(fs, c->l->u.info, c->narray, c->tostore);
     }
     c->narray += c->tostore;
@@ -953,7 +1100,8 @@ static void listdef(Lexer *lx, ExpInfo *l) {
     FunctionState *fs = lx->fs;
     int32_t linenum = lx->line;
     int32_t pc = tokuC_emitIS(fs, OP_NEWLIST, 0);
-    LConstructor c = { .l = l, .v = INIT_EXP };
+    LConstructor c = { .l = l, .v = INIT_EXP, .nk = fs->nk };
+    c.k = newconstelems(lx->T);
     initexp(l, EXP_FINEXPR, fs->sp); /* finalize list expression */
     tokuC_reserveslots(fs, 1); /* space for list */
     expectnext(lx, '[');
@@ -966,6 +1114,7 @@ static void listdef(Lexer *lx, ExpInfo *l) {
     expectmatch(lx, ']', '[', linenum);
     lastlistfield(fs, &c);
     tokuC_setlistsize(fs, pc, c.narray);
+    endconstelems(fs, (c.narray > 0) ? c.k : NULL, pc, c.nk, linenum);
 }
 
 /* }==================================================================== */
@@ -978,6 +1127,8 @@ static void listdef(Lexer *lx, ExpInfo *l) {
 typedef struct TConstructor {
     ExpInfo *t; /* table descriptor */
     ExpInfo v; /* last table item descriptor */
+    List *k; /* constant keys and values (NULL if some are not constant) */
+    int32_t nk; /* number of constants before the constructor */
     int32_t nhash; /* number of table elements */
 } TConstructor;
 
@@ -990,9 +1141,21 @@ static void tabindex(Lexer *lx, ExpInfo *e) {
 }
 
 
+/*
+** Check if 'k' is a constant key, valid in any table (not nil or NaN),
+** setting its value into 'kv'.
+*/
+static int32_t constkey(FunctionState *fs, ExpInfo *k, TValue *kv) {
+    return (tokuC_exp2const(fs, k, kv) && !ttisnil(kv) &&
+            !(ttisflt(kv) && tokui_numisnan(fval(kv))));
+}
+
+
 static void tabfield(Lexer *lx, TConstructor *c) {
     FunctionState *fs = lx->fs;
     ExpInfo t, k, v;
+    TValue kv, vv;
+    int32_t isconst;
     if (check(lx, TK_NAME)) {
         tokuP_checklimit(fs, c->nhash, INT32_MAX,
                              "fields in a table constructor");
@@ -1001,9 +1164,15 @@ static void tabfield(Lexer *lx, TConstructor *c) {
         tabindex(lx, &k);
     c->nhash++;
     expectnext(lx, '=');
+    isconst = (c->k != NULL && constkey(fs, &k, &kv));
     t = *c->t; /* copy of table descriptor */
     tokuC_indexed(fs, &t, &k, 0);
     expr(lx, &v);
+    if (isconst && tokuC_exp2const(fs, &v, &vv)) { /* constant field? */
+        addconstelem(lx->T, c->k, &kv);
+        addconstelem(lx->T, c->k, &vv);
+    } else
+        c->k = NULL; /* table is not constant */
     tokuC_exp2stack(fs, &v);
     tokuC_pop(fs, tokuC_store(fs, &t) - 1); /* -1 to keep table */
 }
@@ -1013,7 +1182,8 @@ static void tabledef(Lexer *lx, ExpInfo *t) {
     FunctionState *fs = lx->fs;
     int32_t linenum = lx->line;
     int32_t pc = tokuC_emitIS(fs, OP_NEWTABLE, 0);
-    TConstructor c = { .t = t, .v = INIT_EXP };
+    TConstructor c = { .t = t, .v = INIT_EXP, .nk = fs->nk };
+    c.k = newconstelems(lx->T);
     initexp(t, EXP_FINEXPR, fs->sp); /* finalize table expression */
     tokuC_reserveslots(fs, 1); /* space for table */
     expectnext(lx, '{');
@@ -1023,6 +1193,7 @@ static void tabledef(Lexer *lx, ExpInfo *t) {
     } while (match(lx, ',') || match(lx, ';'));
     expectmatch(lx, '}', '{', linenum);
     tokuC_settablesize(fs, pc, c.nhash);
+    endconstelems(fs, (c.nhash > 0) ? c.k : NULL, pc, c.nk, linenum);
 }
 
 /* }==================================================================== */
@@ -1196,7 +1367,11 @@ static void simpleexp(Lexer *lx, ExpInfo *e) {
             return;
         case '[': listdef(lx, e); return;
         case '{': tabledef(lx, e); return;
-        default: suffixedexp(lx, e); return;
+        default:
+            suffixedexp(lx, e);
+            if (e->et == EXP_CONST) /* compile-time constant? */
+                tokuC_const2exp(lx->fs, e); /* use its value */
+            return;
     }
     tokuY_scan(lx);
 }
@@ -1336,6 +1511,9 @@ static void checkreadonly(Lexer *lx, ExpInfo *var) {
                 varid = lv->s.name;
             break;
         }
+        case EXP_CONST:
+            varid = lx->dyd->actlocals.arr[var->u.info].s.name;
+            break;
         default: return; /* cannot be read-only */
     }
     if (varid) {
@@ -1481,11 +1659,14 @@ static int32_t ppmm(Lexer *lx, ExpInfo *v, Binopr op) {
 
 static void expstm(Lexer *lx) {
     struct LHS_assign v = { .v = INIT_EXP };
-    suffixedexp(lx, &v.v);
-    if (v.v.et == EXP_CALL) { /* call? */
-        if (t_unlikely(lx->fs->callcheck))
+    int32_t inlined = suffixedexp(lx, &v.v);
+    if (v.v.et == EXP_CALL || inlined) { /* call? */
+        if (t_unlikely(lx->fs->callcheck || inlined == 2))
             tokuP_semerror(lx, "can't use '?' on calls with no results");
-        tokuC_setreturns(lx->fs, &v.v, 0); /* call statement has no returns */
+        if (inlined) /* inlined call? */
+            tokuC_pop(lx->fs, 1); /* remove its result */
+        else /* otherwise call statement has no returns */
+            tokuC_setreturns(lx->fs, &v.v, 0);
     } else { /* otherwise it must be assignment */
         int32_t left = 0;
         if (check(lx, '=') || check(lx, ',')) {
@@ -1526,6 +1707,24 @@ static void expstm(Lexer *lx) {
 }
 
 
+/* true if 'e' is only the closure of the last defined function */
+static int32_t isclosure(FunctionState *fs, ExpInfo *e) {
+    return (e->et == EXP_FINEXPR && e->t == e->f && e->u.info == fs->prevpc &&
+            fs->p->code[e->u.info] == OP_CLOSURE);
+}
+
+
+/*
+** Calls of the final local variable 'vidx' holding the last defined
+** function get inlined if that function can be inlined. 'self' is
+** the stack slot of the variable if the function can see it.
+*/
+static void setinline(FunctionState *fs, int32_t vidx, int32_t self) {
+    if (tokuC_inlinable(fs, fs->p->p[fs->np - 1], self))
+        getlocalvar(fs, vidx)->s.fidx = fs->np - 1;
+}
+
+
 static int32_t getlocalattribute(Lexer *lx) {
     if (match(lx, '<')) {
         const char *astr = getstr(str_expectname(lx));
@@ -1546,8 +1745,9 @@ static void checkcollision(Lexer *lx, OString *name) {
     FunctionState *fs = lx->fs;
     int32_t limit = fs->scope->nactlocals - 1;
     ExpInfo var;
-    if (t_unlikely(0 <= searchlocal(fs, name, &var, limit))) {
-        LVar *lv = getlocalvar(fs, var.u.var.vidx);
+    int32_t vidx = searchlocal(fs, name, &var, limit);
+    if (t_unlikely(0 <= vidx)) {
+        LVar *lv = getlocalvar(fs, vidx);
         lx->line = lx->lastline; /* adjust line for error */
         tokuP_semerror(lx, tokuS_pushfstring(lx->T,
                     "redefinition of local variable '%s' defined on line %d",
@@ -1570,7 +1770,7 @@ static int32_t newlocalvarln(Lexer *lx, OString *name, int32_t ign,
 static void checkclose(FunctionState *fs, int32_t level) {
     if (level != -1) {
         scopemarkclose(fs);
-        tokuC_emitIL(fs, OP_TBC, level);
+        tokuC_emitIL(fs, OP_TBC, stacklevel(fs, level));
     }
 }
 
@@ -1582,11 +1782,12 @@ static void localstm(Lexer *lx) {
     int32_t kind, vidx;
     int32_t nexps;
     ExpInfo e = INIT_EXP;
+    LVar *lvar;
     do {
         vidx = newlocalvar(lx, str_expectname(lx), 1);
         kind = getlocalattribute(lx);
         getlocalvar(fs, vidx)->s.kind = cast_u8(kind);
-        if (kind & VARTBC) { /* to-be-closed? */
+        if (kind == VARTBC) { /* to-be-closed? */
             if (toclose != -1) /* one already present? */
                 tokuP_semerror(fs->lx,
                         "multiple to-be-closed variables in a local list");
@@ -1599,8 +1800,20 @@ static void localstm(Lexer *lx) {
     else
         nexps = 0;
     toku_assert((nexps == 0) == (e.et == EXP_VOID));
-    adjustassign(lx, nvars, nexps, &e);
-    adjustlocals(lx, nvars);
+    lvar = getlocalvar(fs, vidx); /* last variable */
+    if (nvars == nexps && lvar->s.kind == VARFINAL &&
+                          tokuC_exp2const(fs, &e, &lvar->val)) {
+        lvar->s.kind = VARCTC; /* variable is a compile-time constant */
+        adjustlocals(lx, nvars - 1); /* exclude last variable */
+        fs->nactlocals++; /* but count it */
+    } else {
+        int32_t isfunc = (nvars == 1 && lvar->s.kind == VARFINAL &&
+                          isclosure(fs, &e));
+        adjustassign(lx, nvars, nexps, &e);
+        adjustlocals(lx, nvars);
+        if (isfunc) /* final variable holding a new function? */
+            setinline(fs, vidx, -1);
+    }
     checkclose(fs, toclose);
 }
 
@@ -1609,11 +1822,18 @@ static void localfn(Lexer *lx) {
     ExpInfo e;
     FunctionState *fs = lx->fs;
     int32_t fvar = fs->nactlocals; /* function's variable index */
+    int32_t kind;
     newlocalvar(lx, str_expectname(lx), 0);
+    kind = getlocalattribute(lx);
+    if (t_unlikely(kind == VARTBC))
+        tokuP_semerror(lx, "local function cannot be a to-be-closed variable");
+    getlocalvar(fs, fvar)->s.kind = cast_u8(kind);
     adjustlocals(lx, 1);
     funcbody(lx, &e, 0, lx->line, '(');
     /* debug information will only see the variable after this point! */
     getlocalinfo(fs, fvar)->startpc = currPC;
+    if (kind == VARFINAL) /* function can not change? */
+        setinline(fs, fvar, getlocalvar(fs, fvar)->s.sidx);
 }
 
 
@@ -1671,35 +1891,139 @@ static void codeclosure(Lexer *lx, ExpInfo *e, int32_t linenum) {
 }
 
 
+/* parameter list and body of the current function */
+static void body(Lexer *lx, int32_t linenum, int32_t del) {
+    int32_t matchdel = (del == '(') ? ')' : '|';
+    expectnext(lx, del);
+    paramlist(lx, matchdel); /* get function parameters */
+    expectmatch(lx, matchdel, del, linenum);
+    match(lx, TK_DBCOLON); /* skip optional separator (if any) */
+    if (match(lx, '{')) {
+        int32_t curly_linenum = lx->line;
+        decl_list(lx, '}');
+        lx->fs->p->deflastline = lx->line;
+        expectmatch(lx, '}', '{', curly_linenum);
+    } else {
+        stm(lx);
+        lx->fs->p->deflastline = lx->line;
+    }
+}
+
+
+/* set lexer back to the token 'del' at offset 'pos' of the source text */
+static void rewindlexer(Lexer *lx, int32_t pos, int32_t line) {
+    const char *text = getstr(lx->text);
+    BuffReader *Z = lx->Z;
+    toku_assert(0 <= pos && cast_sizet(pos) + 1 < getstrlen(lx->text));
+    Z->p = text + pos + 2;
+    Z->n = getstrlen(lx->text) - cast_sizet(pos) - 2;
+    lx->c = cast_u8(text[pos + 1]);
+    lx->line = lx->lastline = line;
+    lx->t.tk = cast_u8(text[pos]);
+    lx->tahead.tk = TK_EOS; /* no lookahead token */
+}
+
+
+/* resolve 'name' used by a skipped body (creating its upvalue) */
+static expt skipname(FunctionState *fs, OString *name) {
+    ExpInfo v;
+    varaux(fs, name, &v, 1);
+    return v.et;
+}
+
+
+/*
+** In lazy mode (when the parser keeps the source text), skip the body
+** of the current function, matching only its braces and resolving the
+** names it uses, so that it gets all of its upvalues. The body is
+** compiled on the first call of the function (see 'tokuP_compile').
+** Parameters are still declared, so that they shadow enclosing
+** variables. Returns 0, with the lexer back at 'del', if the body must
+** be compiled right away: it is not a block, it refers to a
+** compile-time constant of an enclosing function, or it has unmatched
+** braces (so that the compiler reports the error).
+*/
+static int32_t skipbody(Lexer *lx, int32_t del) {
+    FunctionState *fs = lx->fs;
+    Proto *p = fs->p;
+    int32_t matchdel = (del == '(') ? ')' : '|';
+    int32_t pos, line, depth, prev;
+    int32_t global = 0; /* true if body uses global variables */
+    if (lx->text == NULL || lx->c == TEOF || lx->tahead.tk != TK_EOS)
+        return 0; /* not in lazy mode (or missing body) */
+    toku_assert(lx->t.tk == del);
+    pos = cast_i32(lx->Z->p - getstr(lx->text)) - 2; /* offset of 'del' */
+    line = lx->line;
+    tokuY_scan(lx); /* skip 'del' */
+    if (!check(lx, matchdel)) { /* have parameters? */
+        do {
+            if (check(lx, TK_NAME)) {
+                newlocalvar(lx, lx->t.lit.str, 1);
+                p->arity++;
+            } else if (check(lx, TK_DOTS))
+                p->isvararg = 1;
+            else
+                goto compile;
+            tokuY_scan(lx);
+        } while (!p->isvararg && match(lx, ','));
+    }
+    adjustlocals(lx, p->arity);
+    if (!match(lx, matchdel)) goto compile;
+    match(lx, TK_DBCOLON); /* skip optional separator (if any) */
+    if (!check(lx, '{')) goto compile;
+    depth = prev = 0;
+    do { /* body */
+        switch (lx->t.tk) {
+            case '{': depth++; break;
+            case '}': depth--; break;
+            case TK_NAME: /* variable (unless it is a field name) */
+                if (prev != '.') {
+                    expt et = skipname(fs, lx->t.lit.str);
+                    if (et == EXP_CONST) goto compile;
+                    global |= (et == EXP_VOID);
+                }
+                break;
+            case TK_EOS: goto compile;
+            default: break;
+        }
+        prev = lx->t.tk;
+        tokuY_scan(lx);
+    } while (depth > 0);
+    if (global && skipname(fs, lx->envn) == EXP_CONST) goto compile;
+    p->deflastline = lx->lastline;
+    p->lazy = tokuM_new(lx->T, LazyBody);
+    p->lazy->text = lx->text;
+    p->lazy->pos = pos;
+    p->lazy->line = line;
+    p->lazy->optlevel = lx->optlevel;
+    tokuG_objbarrier(lx->T, p, lx->text);
+    return 1;
+compile: /* undo parameters and upvalues and go back to 'del' */
+    lx->dyd->actlocals.len = fs->firstlocal;
+    fs->nactlocals = fs->nlocals = fs->nupvals = 0;
+    p->arity = p->isvararg = 0;
+    rewindlexer(lx, pos, line);
+    return 0;
+}
+
+
 static void funcbody(Lexer *lx, ExpInfo *v, int32_t ismethod, int32_t linenum,
                                                               int32_t del) {
     FunctionState newfs = {
         .p = addproto(lx),
         .ismethod = cast_u8(ismethod)
     };
-    int32_t matchdel = (del == '(') ? ')' : '|';
     Scope scope;
     newfs.p->defline = linenum;
     open_func(lx, &newfs, &scope);
-    expectnext(lx, del);
     if (ismethod) { /* is this method ? */
         toku_assert(newfs.prev->cs); /* enclosing func. must have ClassState */
         newfs.cs = newfs.prev->cs; /* set ClassState */
         addlocallitln(lx, "self", 1); /* create 'self' local  on line 1 */
         adjustlocals(lx, 1); /* 'paramlist()' reserves stack slots */
-    }
-    paramlist(lx, matchdel); /* get function parameters */
-    expectmatch(lx, matchdel, del, linenum);
-    match(lx, TK_DBCOLON); /* skip optional separator (if any) */
-    if (match(lx, '{')) {
-        int32_t curly_linenum = lx->line;
-        decl_list(lx, '}');
-        newfs.p->deflastline = lx->line;
-        expectmatch(lx, '}', '{', curly_linenum);
-    } else {
-        stm(lx);
-        newfs.p->deflastline = lx->line;
-    }
+        body(lx, linenum, del);
+    } else if (!skipbody(lx, del)) /* must compile the body now? */
+        body(lx, linenum, del);
     codeclosure(lx, v, linenum);
     toku_assert(ismethod == (newfs.cs != NULL && (newfs.cs == newfs.prev->cs)));
     newfs.cs = NULL; /* clear ClassState (if any) */
@@ -1755,8 +2079,12 @@ typedef struct {
     uint8_t havenil; /* if switch has 'nil' case */
     uint8_t havetrue; /* if switch has 'true' case */
     uint8_t havefalse; /* if switch has 'false' case */
+    uint8_t nonk; /* if some case is not in the jump table */
+    uint8_t nodispatch; /* if cases that follow cannot be dispatched */
     int32_t firstli; /* first literal value in parser state 'literals' array */
     int32_t jmp; /* jump that needs patch if 'case' expression is not 'CMATCH' */
+    int32_t pcswitch; /* pc of OP_SWITCH (or NOPC) */
+    int32_t pcdefault; /* pc of 'default' case body (or NOPC) */
     SwitchCase c; /* current case */
 } SwitchState;
 
@@ -1858,12 +2186,16 @@ static void checkK(Lexer *lx, ExpInfo *e, LiteralInfo *li, int32_t first,
 }
 
 
-/* check for duplicate literal otherwise fill the relevant info */
-static void checkduplicate(Lexer *lx, SwitchState *ss, ExpInfo *e,
-                           LiteralInfo *li) {
+/*
+** Check for duplicate literal otherwise fill the relevant info.
+** Returns true if 'li' was filled ('e' is not 'nil', 'true' or 'false').
+*/
+static int32_t checkduplicate(Lexer *lx, SwitchState *ss, ExpInfo *e,
+                              LiteralInfo *li) {
     int32_t extra = 0;
     const char *what = NULL;
-    if (!checkliteral(ss, e, &what))
+    int32_t isK = !checkliteral(ss, e, &what);
+    if (isK)
          checkK(lx, e, li, ss->firstli, &extra, &what);
     if (t_unlikely(what)) { /* have duplicate? */
         const char *msg = tokuS_pushfstring(lx->T,
@@ -1871,13 +2203,16 @@ static void checkduplicate(Lexer *lx, SwitchState *ss, ExpInfo *e,
                             what, (extra ? literal2text(lx->T, li) : ""));
         tokuP_semerror(lx, msg);
     }
+    return isK;
 }
 
 
 static void addliteralinfo(Lexer *lx, SwitchState *ss, ExpInfo *e) {
     DynData *dyd = lx->dyd;
     LiteralInfo li;
-    checkduplicate(lx, ss, e, &li);
+    li.pc = NOPC;
+    if (!checkduplicate(lx, ss, e, &li)) /* 'nil', 'true' or 'false'? */
+        return; /* nothing to remember */
     tokuP_checklimit(lx->fs, dyd->literals.len, MAX_CODE, "switch cases");
     tokuM_growarray(lx->T, dyd->literals.arr, dyd->literals.size,
                     dyd->literals.len, MAX_CODE, "switch literals",
@@ -1932,6 +2267,47 @@ static uint8_t codeconstexp(FunctionState *fs, ExpInfo *e) {
 }
 
 
+/* true if 'e' is a literal that has 'LiteralInfo' (see 'checkduplicate') */
+#define eisliteralK(e) \
+        ((e)->et == EXP_STRING || (e)->et == EXP_INT || (e)->et == EXP_FLT)
+
+
+/*
+** Remember the current pc as the start of the body of case 'e' for
+** the switch dispatch (see 'tokuC_fixswitch'). Cases are tested in
+** order, so a case that is not a constant prevents dispatching the
+** cases that follow it.
+*/
+static void casetarget(Lexer *lx, SwitchState *ss, ExpInfo *e) {
+    DynData *dyd = lx->dyd;
+    if (ss->pcswitch == NOPC) /* no dispatch? */
+        return; /* nothing to do */
+    else if (eisliteralK(e) && !ss->nodispatch)
+        dyd->literals.arr[dyd->literals.len - 1].pc = lx->fs->pc;
+    else {
+        ss->nonk = 1; /* this case must be tested */
+        if (!eisconstant(e))
+            ss->nodispatch = 1;
+    }
+}
+
+
+/* set the jump table of the switch dispatch (if any) */
+static void fixswitch(Lexer *lx, SwitchState *ss) {
+    FunctionState *fs = lx->fs;
+    DynData *dyd = lx->dyd;
+    int32_t miss;
+    if (ss->nonk) /* some case must be tested? */
+        miss = ss->pcswitch + getopSize(OP_SWITCH); /* test them in order */
+    else if (ss->havedefault)
+        miss = ss->pcdefault;
+    else /* no case matches */
+        miss = currPC;
+    tokuC_fixswitch(fs, ss->pcswitch, &dyd->literals.arr[ss->firstli],
+                        dyd->literals.len - ss->firstli, miss);
+}
+
+
 static void removeliterals(Lexer *lx, int32_t nliterals) {
     DynData *dyd = lx->dyd;
     if (dyd->literals.len < dyd->literals.size / 3) /* too many literals? */
@@ -1980,17 +2356,20 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
                     ss->c = CASE; /* regular case */
                     tokuC_emitI(fs, OP_EQPRESERVE); /* EQ but preserves lhs */
                     ss->jmp = tokuC_test(fs, OP_TESTPOP, 0, linenum);
+                    casetarget(lx, ss, &e);
                 }
             } else if (!ss->havedefault) { /* don't have 'default'? */
                 expectnext(lx, ':');
                 toku_assert(ftjmp == NOJMP);/* 'default' does not have ftjmp */
                 if (ss->nomatch) { /* all cases are resolved without match? */
                     ss->nomatch = 0; /* default is the match */
+                    ss->pcswitch = NOPC; /* (dispatch is removed too) */
                     loadcontext(fs, ctxbefore); /* remove them */
                 } else if (ss->c == CASE) /* have test jump? */
                     tokuC_patchtohere(fs, ss->jmp); /* fix it */
                 ss->havedefault = 1; /* now have 'default' */
                 ss->c = CDFLT;
+                ss->pcdefault = currPC;
                 storecontext(fs, &ctxdefault); /* store 'default' context */
             } else /* otherwise duplicate 'default' case */
                 tokuP_semerror(lx, "multiple default cases in switch");
@@ -2016,6 +2395,8 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
         tokuC_patchtohere(fs, ss->jmp); /* patch it */
     else if (ss->nomatch) /* compile-time no match? */
         loadcontext(fs, ctxbefore); /* remove the whole switch */
+    if (ss->pcswitch != NOPC && !ss->nomatch) /* have dispatch? */
+        fixswitch(lx, ss);
     removeliterals(lx, ss->firstli);
 }
 
@@ -2031,6 +2412,7 @@ static void switchstm(Lexer *lx) {
         .isconst = 0, .nomatch = 1,
         .firstli = lx->dyd->literals.len,
         .jmp = NOJMP,
+        .pcswitch = NOPC, .pcdefault = NOPC,
         .c = CNONE
     };
     enterscope(fs, &s, CFM_SWITCH);
@@ -2042,6 +2424,8 @@ static void switchstm(Lexer *lx) {
         tokuC_const2v(fs, &e, &ss.v); /* get its value */
     addlocallit(lx, "(switch)"); /* switch expression temporary */
     adjustlocals(lx, 1); /* register switch temporary */
+    if (!ss.isconst) /* value is known only at runtime? */
+        ss.pcswitch = tokuC_switch(fs); /* dispatch it */
     linenum = lx->line;
     expectnext(lx, '{');
     switchbody(lx, &ss, &ctxbefore);
@@ -2203,7 +2587,7 @@ static void dowhilestm(Lexer *lx) {
             tokuC_patch(fs, tokuC_jmp(fs, OP_JMPS), fs->pcdo); /* inf. loop */
         /* otherwise nothing else to be done; fall through */
     } else { /* otherwise condition is a variable */
-        int32_t nvars = fs->nactlocals - s.nactlocals;
+        int32_t nvars = nvarstack(fs) - stacklevel(fs, s.nactlocals);
         int32_t test = tokuC_test(fs, OP_TESTPOP, 0, linenum);
         //int32_t skip;
         leavescope(fs);
@@ -2253,13 +2637,50 @@ static int32_t forexplist(Lexer *lx, ExpInfo *e, int32_t limit) {
 }
 
 
+/* check if current token is the name of global 'range' being called */
+static int32_t israngecall(Lexer *lx) {
+    ExpInfo e;
+    if (!check(lx, TK_NAME) ||
+            lx->t.lit.str != tokuY_newstring(lx, "range", LL("range")))
+        return 0;
+    varaux(lx->fs, lx->t.lit.str, &e, 1);
+    return (e.et == EXP_VOID && tokuY_scanahead(lx) == '(');
+}
+
+
+/*
+** Check if 'e' (the only 'foreach' expression) is the call of 'range'
+** with 1 to 3 arguments, which was started by the code at 'pc' with
+** the function at 'base' ('range(...)(...)' also makes a call at 'base').
+*/
+static int32_t israngeloop(FunctionState *fs, ExpInfo *e, int32_t pc,
+                                                          int32_t base) {
+    int32_t ncalls = 0;
+    if (e->et != EXP_CALL || e->u.info != fs->prevpc || /* not last? */
+            !(1 <= fs->callnargs && fs->callnargs <= 3))
+        return 0;
+    for (; pc < currPC; pc += getopSize(fs->p->code[pc])) {
+        const uint8_t *i = &fs->p->code[pc];
+        ncalls += (*i == OP_CALL && GET_ARG_L(i, 0) == base);
+    }
+    return (ncalls == 1);
+}
+
+
+/*
+** Loops over 'range(...)' are integer loops: function and arguments
+** stay in the control variables and OP_FORPREPI/OP_FORLOOPI step the
+** loop without calling the function, unless it is not the builtin
+** 'range' (see 'tvm.c').
+*/
 static void foreachstm(Lexer *lx) {
     FunctionState *fs = lx->fs;
     struct LoopState ls;
     int32_t forend, prep;
     int32_t nvars = 1; /* number of results for interator */
     int32_t base = fs->sp;
-    int32_t linenum;
+    int32_t linenum, nexpr, pc, range;
+    int32_t nargs = -1; /* number of 'range' arguments (-1 if not range) */
     ExpInfo e = INIT_EXP;
     Scope s;
     enterloop(fs, &ls, CFM_GENLOOP); /* (scope for control variables) */
@@ -2276,11 +2697,25 @@ static void foreachstm(Lexer *lx) {
     }
     expectnext(lx, TK_IN);
     linenum = lx->line;
-    adjustassign(lx, VAR_N, forexplist(lx, &e, VAR_N), &e);
+    pc = currPC;
+    range = israngecall(lx);
+    nexpr = forexplist(lx, &e, VAR_N);
+    if (range && nexpr == 1 && israngeloop(fs, &e, pc, base))
+        nargs = fs->callnargs;
+    if (nargs >= 0) { /* integer loop? */
+        tokuC_removelastcall(fs, nargs); /* keep function and arguments */
+        if (nargs + 1 < VAR_N) /* missing arguments? */
+            tokuC_nil(fs, VAR_N - nargs - 1);
+    } else
+        adjustassign(lx, VAR_N, nexpr, &e);
     adjustlocals(lx, VAR_N); /* register control variables */
     scopemarkclose(fs); /* last control variable might get closed */
     tokuC_checkstack(fs, 3); /* extra space to call generator */
-    prep = tokuC_emitILL(fs, OP_FORPREP, base, 0);
+    if (nargs >= 0) {
+        prep = tokuC_emitILLL(fs, OP_FORPREPI, base, 0, nargs);
+        tokuC_fixline(fs, linenum);
+    } else
+        prep = tokuC_emitILL(fs, OP_FORPREP, base, 0);
     enterscope(fs, &s, 0); /* scope for declared locals */
     adjustlocals(lx, nvars); /* register delcared locals */
     tokuC_reserveslots(fs, nvars); /* space for declared locals */
@@ -2288,10 +2723,14 @@ static void foreachstm(Lexer *lx) {
     leavescope(fs); /* leave declared locals scope */
     patchforjmp(fs, prep, currPC, 0);
     fs->ls->pcloop = currPC; /* generic loop starts here */
-    tokuC_emitILL(fs, OP_FORCALL, base, nvars);
-    tokuC_fixline(fs, linenum);
-    forend = tokuC_emitILLL(fs, OP_FORLOOP, base, 0, nvars);
-    patchforjmp(fs, forend, prep + getopSize(OP_FORPREP), 1);
+    if (nargs >= 0)
+        forend = tokuC_emitILLL(fs, OP_FORLOOPI, base, 0, nvars);
+    else {
+        tokuC_emitILL(fs, OP_FORCALL, base, nvars);
+        tokuC_fixline(fs, linenum);
+        forend = tokuC_emitILLL(fs, OP_FORLOOP, base, 0, nvars);
+    }
+    patchforjmp(fs, forend, prep + getopSize(fs->p->code[prep]), 1);
     tokuC_fixline(fs, linenum);
     leaveloop(fs); /* leave loop (pops control variables) */
 }
@@ -2429,7 +2868,7 @@ static void continuestm(Lexer *lx) {
             do { /* get that scope */
                 curr = curr->prev;
             } while (s->depth+2 < curr->depth);
-            nvars = fs->nactlocals - curr->nactlocals;
+            nvars = nvarstack(fs) - stacklevel(fs, curr->nactlocals);
         }
         tokuC_adjuststack(fs, nvars);
     } else { /* otherwise some other loop */
@@ -2458,7 +2897,7 @@ static void breakstm(Lexer *lx) {
     tokuY_scan(lx); /* skip 'break' */
     if (t_unlikely(cfs == NULL)) /* no control flow scope? */
         tokuP_semerror(lx, "'break' outside of a loop or switch statement");
-    nvars = fs->nactlocals - cfs->nactlocals;
+    nvars = nvarstack(fs) - stacklevel(fs, cfs->nactlocals);
     newpendingjump(lx, 1, needtoclose(lx, cfs->prev), nvars);
     expectnext(lx, ';');
     /* adjust stack for compiler and symbolic execution */
@@ -2589,7 +3028,8 @@ static void mainfunc(FunctionState *fs, Lexer *lx) {
 
 
 TClosure *tokuP_parse(toku_State *T, BuffReader *Z, Buffer *buff,
-                      DynData *dyd, const char *name, int32_t firstchar) {
+                      DynData *dyd, const char *name, int32_t firstchar,
+                      int32_t optlevel, OString *text) {
     Lexer lx = {0};
     FunctionState fs = {0};
     TClosure *cl = tokuF_newTclosure(T, 1);
@@ -2604,7 +3044,9 @@ TClosure *tokuP_parse(toku_State *T, BuffReader *Z, Buffer *buff,
     tokuG_objbarrier(T, fs.p, fs.p->source);
     lx.buff = buff;
     lx.dyd = dyd;
+    lx.optlevel = optlevel;
     tokuY_setinput(T, &lx, Z, fs.p->source, firstchar);
+    lx.text = text;
     mainfunc(&fs, &lx);
     toku_assert(!fs.prev && fs.nupvals == 1 && !lx.fs);
     /* all scopes should be correctly finished */
@@ -2612,3 +3054,72 @@ TClosure *tokuP_parse(toku_State *T, BuffReader *Z, Buffer *buff,
     T->sp.p--; /* remove scanner table */
     return cl; /* (closure is also on the stack) */
 }
+
+
+/* exchange field 'fld' of prototypes 'p' and 'f' (using 'temp') */
+#define swapfield(fld) \
+        (temp.fld = p->fld, p->fld = f->fld, f->fld = temp.fld)
+
+/* exchange the compiled contents of prototypes 'p' and 'f' */
+static void swapbody(Proto *p, Proto *f) {
+    Proto temp;
+    swapfield(isvararg); swapfield(arity); swapfield(maxstack);
+    swapfield(deflastline);
+    swapfield(sizecode); swapfield(code);
+    swapfield(sizek); swapfield(k);
+    swapfield(sizeupvals); swapfield(upvals);
+    swapfield(sizep); swapfield(p);
+    swapfield(sizeic); swapfield(ic);
+    swapfield(sizelineinfo); swapfield(lineinfo);
+    swapfield(sizeabslineinfo); swapfield(abslineinfo);
+    swapfield(sizeopcodepc); swapfield(opcodepc);
+    swapfield(sizelocals); swapfield(locals);
+}
+
+#undef swapfield
+
+
+/*
+** Compile the body of function 'p' skipped in lazy mode (see
+** 'skipbody'). The body is compiled into a new prototype, with the
+** upvalues of 'p' as its only enclosing variables, and then moved
+** into 'p'. (So, if there is an error, 'p' is left unchanged.)
+*/
+void tokuP_compile(toku_State *T, Proto *p, BuffReader *Z, Buffer *buff,
+                                            DynData *dyd) {
+    LazyBody *lb = p->lazy;
+    Lexer lx = {0};
+    FunctionState fs = {0};
+    Scope s;
+    TClosure *cl = tokuF_newTclosure(T, 0);
+    toku_assert(lb != NULL);
+    setclTval2s(T, T->sp.p, cl); /* anchor closure of the new prototype */
+    tokuT_incsp(T);
+    lx.tab = tokuH_new(T); /* create table for scanner */
+    settval2s(T, T->sp.p, lx.tab); /* anchor it */
+    tokuT_incsp(T);
+    fs.p = cl->p = tokuF_newproto(T);
+    tokuG_objbarrier(T, cl, cl->p);
+    fs.p->defline = p->defline;
+    lx.buff = buff;
+    lx.dyd = dyd;
+    lx.optlevel = lb->optlevel;
+    tokuY_setinput(T, &lx, Z, p->source, TEOF);
+    lx.text = lb->text;
+    rewindlexer(&lx, lb->pos, lb->line);
+    open_func(&lx, &fs, &s);
+    for (int32_t i = 0; i < p->sizeupvals; i++) { /* same upvalues */
+        *newupvalue(&fs) = p->upvals[i];
+        tokuG_objbarrier(T, fs.p, p->upvals[i].name);
+    }
+    body(&lx, p->defline, lx.t.tk);
+    close_func(&lx);
+    toku_assert(fs.nupvals == p->sizeupvals && !lx.fs);
+    toku_assert(dyd->actlocals.len == 0 && dyd->gt.len == 0);
+    swapbody(p, fs.p);
+    tokuM_free(T, p->lazy);
+    p->lazy = NULL;
+    if (isblack(p)) /* 'p' already traversed by the collector? */
+        tokuG_barrierback_(T, obj2gco(p)); /* traverse it again */
+    T->sp.p -= 2; /* remove scanner table and closure */
+}
@@ -24,7 +24,7 @@
 
 
 /* check expression type */
-#define eisvar(e)       ((e)->et >= EXP_UVAL && (e)->et <= EXP_DOTSUPER)
+#define eisvar(e)       ((e)->et >= EXP_CONST && (e)->et <= EXP_DOTSUPER)
 #define eisconstant(e)  ((e)->et >= EXP_NIL && (e)->et <= EXP_K)
 #define eismulret(e)    ((e)->et == EXP_CALL || (e)->et == EXP_VARARG)
 #define eistrue(e)      ((e)->et >= EXP_TRUE && (e)->et <= EXP_K)
@@ -54,6 +54,9 @@ typedef enum expt {
     /* registered constant value;
      * 'info' = index in 'constants'; */
     EXP_K,
+    /* compile-time constant variable;
+     * 'info' = absolute index in 'actlocals'; */
+    EXP_CONST,
     /* upvalue variable;
      * 'info' = index of upvalue in 'upvals'; */
     EXP_UVAL,
@@ -61,6 +64,10 @@ typedef enum expt {
      * 'v.sidx' = stack index;
      * 'v.vidx' = compiler index; */
     EXP_LOCAL,
+    /* upvalue indexed with literal string (global variable);
+     * 'iu.t' = index of upvalue in 'upvals';
+     * 'iu.k' = index in 'constants'; */
+    EXP_INDEXUP,
     /* 'super' */
     EXP_SUPER,
     /* indexed variable; */
@@ -105,6 +112,10 @@ typedef struct ExpInfo {
             int32_t vidx; /* compiler index */
             int32_t sidx; /* stack slot index */
         } var; /* local var */
+        struct {
+            int32_t t; /* upvalue index */
+            int32_t k; /* key index in 'constants' */
+        } iu; /* indexed upvalue */
         int32_t info; /* pc or tome other generic information */
     } u;
     int32_t t; /* jmp to patch if true */
@@ -119,6 +130,7 @@ typedef struct ExpInfo {
 #define VARREG      0   /* regular */
 #define VARFINAL    1   /* final (immutable) */
 #define VARTBC      2   /* to-be-closed */
+#define VARCTC      3   /* compile-time constant */
 
 
 /* active local variable compiler information */
@@ -129,6 +141,7 @@ typedef union LVar {
         int32_t sidx; /* stack slot index holding the variable value */
         int32_t pidx; /* index of variable in Proto's 'locals' array */
         int32_t linenum; /* line where the local variable is declared */
+        int32_t fidx; /* index in 'p->p' of function to inline (or -1) */
         OString *name;
     } s;
     TValue val; /* constant value */
@@ -139,6 +152,7 @@ typedef union LVar {
 typedef struct LiteralInfo {
     Literal lit; /* constant */
     int32_t tt; /* type tag */
+    int32_t pc; /* start of the case body (NOPC if not dispatched) */
 } LiteralInfo;
 
 
@@ -211,7 +225,10 @@ typedef struct FunctionState {
     int32_t nopcodepc;          /* number of elements in 'opcodepc' */
     int32_t nlocals;            /* number of elements in 'locals' */
     int32_t nupvals;            /* number of elements in 'upvals' */
+    int32_t nic;                /* number of inline caches */
     int32_t lasttarget;         /* latest 'pc' that is jump target */
+    int32_t callnargs;          /* number of arguments of last call
+                                   (-1 if it has multiple results) */
     uint8_t ismethod;           /* if true, the function is a class method */
     uint8_t nonilmerge;         /* if true, no NIL opcode merging */
     uint8_t iwthabs;            /* opcodes issued since last abs. line info */
@@ -222,12 +239,24 @@ typedef struct FunctionState {
 } FunctionState;
 
 
+/* maximum optimization level (see 'tokuC_finish') */
+#define MAXOPTLEVEL     2
+
+/* default optimization level */
+#if !defined(TOKUI_OPTLEVEL)
+#define TOKUI_OPTLEVEL  MAXOPTLEVEL
+#endif
+
+
 TOKUI_FUNC t_noret tokuP_semerror(Lexer *lx, const char *err);
 TOKUI_FUNC void tokuP_checklimit(FunctionState *fs, int32_t n,
                                  int32_t limit, const char *what);
 TOKUI_FUNC TClosure *tokuP_parse(toku_State *T, BuffReader *Z, Buffer *buff,
                                  DynData *dyd, const char *name,
-                                 int32_t firstchar);
+                                 int32_t firstchar, int32_t optlevel,
+                                 OString *text);
+TOKUI_FUNC void tokuP_compile(toku_State *T, Proto *p, BuffReader *Z,
+                              Buffer *buff, DynData *dyd);
 
 
 #endif
@@ -229,6 +229,63 @@ static void checkmode(toku_State *T, const char *mode, const char *x) {
 }
 
 
+/*
+** Get the optimization level of text chunks, a digit in 'mode' (if
+** there is no digit it is TOKUI_OPTLEVEL).
+*/
+static int32_t optlevel(const char *mode) {
+    for (; *mode != '\0'; mode++) {
+        if ('0' <= *mode && *mode <= '0' + MAXOPTLEVEL)
+            return *mode - '0';
+    }
+    return TOKUI_OPTLEVEL;
+}
+
+
+/* reader for a chunk kept in a string, giving the whole string once */
+static const char *textreader(toku_State *T, void *userdata, size_t *size) {
+    OString **text = cast(OString **, userdata);
+    OString *s = *text;
+    UNUSED(T);
+    if (s == NULL) /* already read? */
+        return NULL;
+    *text = NULL;
+    *size = getstrlen(s);
+    return getstr(s);
+}
+
+
+/*
+** Read the rest of a text chunk (starting with character 'c') into a
+** string and push it on the stack. The string keeps the source text of
+** the functions skipped in lazy mode (see 'tokuP_compile').
+*/
+static OString *readtext(toku_State *T, BuffReader *Z, Buffer *b, int32_t c) {
+    OString *text;
+    size_t n = 0;
+    while (c != TEOF) {
+        size_t m = Z->n + 1; /* 'c' and the rest of the block */
+        if (b->size - n < m) { /* buffer too small? */
+            size_t newsize = b->size + m;
+            if (newsize < 2 * b->size)
+                newsize = 2 * b->size;
+            tokuR_buffresize(T, b, newsize);
+        }
+        b->str[n++] = cast_char(c);
+        memcpy(b->str + n, Z->p, Z->n);
+        n += Z->n;
+        Z->p += Z->n;
+        Z->n = 0;
+        c = tokuR_fill(Z); /* next block */
+    }
+    /* (buffer of an empty chunk may be NULL) */
+    text = (n > 0) ? tokuS_newl(T, b->str, n) : tokuS_new(T, "");
+    setstrval2s(T, T->sp.p, text); /* anchor it */
+    tokuT_incsp(T);
+    return text;
+}
+
+
 /* auxiliary function to call 'tokuP_pparse' in protected mode */
 static void pparse(toku_State *T, void *userdata) {
     TClosure *cl;
@@ -238,9 +295,20 @@ static void pparse(toku_State *T, void *userdata) {
     if (c == TOKU_SIGNATURE[0]) { /* binary chunk? */
         checkmode(T, mode, "binary");
         cl = tokuZ_undump(T, p->Z, p->name);
-    } else { /* otherwise text */
+    } else if (strchr(mode, 'l') == NULL) { /* text */
         checkmode(T, mode, "text");
-        cl = tokuP_parse(T, p->Z, &p->buff, &p->dyd, p->name, c);
+        cl = tokuP_parse(T, p->Z, &p->buff, &p->dyd, p->name, c,
+                              optlevel(mode), NULL);
+    } else { /* text in lazy mode */
+        BuffReader Z;
+        OString *text, *unread;
+        checkmode(T, mode, "text");
+        unread = text = readtext(T, p->Z, &p->buff, c);
+        tokuR_init(T, &Z, textreader, &unread);
+        cl = tokuP_parse(T, &Z, &p->buff, &p->dyd, p->name, zgetc(&Z),
+                              optlevel(mode), text);
+        setobjs2s(T, T->sp.p - 2, T->sp.p - 1); /* move closure over text */
+        T->sp.p--;
     }
     toku_assert(cl->nupvals == cl->p->sizeupvals);
     tokuF_initupvals(T, cl);
@@ -261,3 +329,36 @@ int32_t tokuPR_parse(toku_State *T, BuffReader *Z, const char *name,
     decnnyc(T);
     return status;
 }
+
+
+/* auxiliary structure to call 'tokuP_compile' in protected mode */
+struct PCompileData {
+    Proto *p;
+    Buffer buff;
+    DynData dyd;
+};
+
+
+/* auxiliary function to call 'tokuP_compile' in protected mode */
+static void pcompile(toku_State *T, void *userdata) {
+    struct PCompileData *cd = cast(struct PCompileData *, userdata);
+    OString *unread = NULL; /* body is read from the kept source text */
+    BuffReader Z;
+    tokuR_init(T, &Z, textreader, &unread);
+    tokuP_compile(T, cd->p, &Z, &cd->buff, &cd->dyd);
+}
+
+
+/* call 'tokuP_compile' in protected mode */
+int32_t tokuPR_compile(toku_State *T, Proto *p) {
+    int32_t status;
+    struct PCompileData cd = { .p = p };
+    incnnyc(T);
+    status = tokuPR_call(T, pcompile, &cd, savestack(T, T->sp.p), T->errfunc);
+    tokuR_freebuffer(T, &cd.buff);
+    tokuM_freearray(T, cd.dyd.actlocals.arr, cast_sizet(cd.dyd.actlocals.size));
+    tokuM_freearray(T, cd.dyd.literals.arr, cast_sizet(cd.dyd.literals.size));
+    tokuM_freearray(T, cd.dyd.gt.arr, cast_sizet(cd.dyd.gt.size));
+    decnnyc(T);
+    return status;
+}
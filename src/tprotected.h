@@ -61,5 +61,6 @@ TOKUI_FUNC int tokuPR_call(toku_State *T, ProtectedFn fn, void *ud,
 TOKUI_FUNC int tokuPR_close(toku_State *T, ptrdiff_t level, int status);
 TOKUI_FUNC int tokuPR_parse(toku_State *T, BuffReader *Z, const char *name,
                                                           const char *mode); 
+TOKUI_FUNC int tokuPR_compile(toku_State *T, Proto *p);
 
 #endif
@@ -22,6 +22,7 @@ void tokuR_init(toku_State *T, BuffReader *Z, toku_Reader freader, void *ud) {
     Z->reader = freader;
     Z->userdata = ud;
     Z->T = T;
+    Z->owner = NULL;
 }
 
 
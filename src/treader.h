@@ -26,6 +26,7 @@ typedef struct {
     toku_Reader reader; /* reader function */
     void* userdata; /* user data for 'reader' */
     toku_State* T; /* 'toku_State' for 'reader' */
+    struct GCObject *owner; /* owner of memory given by 'reader' (or NULL) */
 } BuffReader;
 
 
@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stddef.h>
 
 #include "tokudae.h"
@@ -34,64 +35,143 @@
 #define CAP_POSITION    (-2)
 
 
-typedef struct MatchState {
-    const char *srt_init; /* init of source string */
-    const char *srt_end; /* end ('\0') of source string */
-    const char *p_end; /* end ('\0') of pattern */
-    toku_State *T;
-    int32_t matchdepth; /* control for recursive depth (to avoid C stack overflow) */
-    uint8_t level; /* total number of captures (finished or unfinished) */
-    struct {
-        const char *init;
-        ptrdiff_t len;
-    } capture[TOKU_MAXCAPTURES];
-} MatchState;
+#define T_ESC           '%'
+#define SPECIALS        "^$*+?.([%-"
 
 
-/* recursive function */
-static const char *match(MatchState *ms, const char *s, const char *p);
+/*
+** Number of compiled patterns kept in the cache used by the library
+** functions when the pattern is given as a string.
+*/
+#if !defined(TOKU_PATTERNCACHE)
+#define TOKU_PATTERNCACHE               32
+#endif
 
 
-/* maximum recursion depth for 'match' */
-#if !defined(MAXCCALLS)
-#define MAXCCALLS       200
-#endif
+/* metatable name of compiled patterns */
+#define TOKU_PATTERN    "pattern"
 
 
-#define T_ESC           '%'
-#define SPECIALS        "^$*+?.([%-"
+/* {======================================================================
+** COMPILED PATTERNS
+** ======================================================================= */
 
+/*
+** Before matching, patterns are compiled into a sequence of items, one
+** for each single character class (with its optional suffix) or other
+** pattern item. Character classes and sets are resolved into bitmaps,
+** so matching does not need to interpret the pattern string again.
+** Malformed parts of the pattern compile into an error item, which
+** raises the error only when the matcher reaches it.
+*/
 
-static int32_t check_capture(MatchState *ms, int32_t l) {
-    l -= '1';
-    if (t_unlikely(l < 0 || l >= ms->level ||
-                   ms->capture[l].len == CAP_UNFINISHED))
-        return tokuL_error(ms->T, "invalid capture index %%%d", l + 1);
-    return l;
-}
+/* kinds of pattern items */
+enum PItemKind {
+    PI_END,         /* end of pattern */
+    PI_CHAR,        /* single character 'c' */
+    PI_ANY,         /* '.' */
+    PI_SET,         /* character class or set 'set' */
+    PI_OPEN,        /* '(' ('c' is the capture index) */
+    PI_POSITION,    /* '()' ('c' is the capture index) */
+    PI_CLOSE,       /* ')' ('c' is the index of capture it closes) */
+    PI_EOS,         /* '$' at the end of pattern */
+    PI_BALANCE,     /* '%b' with 'c' and 'e' */
+    PI_FRONTIER,    /* '%f' with set 'set' */
+    PI_BACKREF,     /* '%0'-'%9' ('c' is the digit) */
+    PI_ERROR        /* malformed pattern ('set' is the error) */
+};
 
 
-static int32_t capture_to_close(MatchState *ms) {
-    int32_t level = ms->level;
-    for (level--; level>=0; level--)
-        if (ms->capture[level].len == CAP_UNFINISHED) return level;
-    return tokuL_error(ms->T, "invalid pattern capture");
-}
+typedef struct PItem {
+    uint8_t kind; /* 'PItemKind' */
+    uint8_t suffix; /* '*', '+', '-', '?' or 0 */
+    uint8_t c; /* character */
+    uint8_t e; /* closing character of '%b' */
+    int32_t set; /* index of set */
+} PItem;
+
+
+/* set of characters */
+typedef struct CharSet {
+    uint8_t bits[(UCHAR_MAX + 1) / 8];
+} CharSet;
+
+
+#define inset(cs,c)     ((cs)->bits[(c) >> 3] & (1u << ((c) & 7)))
+#define addset(cs,c)    ((cs)->bits[(c) >> 3] |= cast_u8(1u << ((c) & 7)))
+
+
+/* errors of malformed patterns */
+enum PatternError { PE_ESC, PE_BRACKET, PE_BALANCE, PE_FRONTIER };
+
+static const char *const patterrors[] = {
+    "malformed pattern (ends with '%')",
+    "malformed pattern (missing ']')",
+    "malformed pattern (missing arguments to '%b')",
+    "missing '[' after '%f' in pattern"
+};
+
+
+/*
+** Compiled pattern (userdata with 'TOKU_PATTERN' metatable and the
+** pattern string as its user value). In memory it is followed by its
+** items, its sets and its literal prefix. Items starting at 'items[0]'
+** are the program used by 'find', 'match' and 'gsub' (without the
+** anchor); items starting at 'items[gstart]' are the program used by
+** 'gmatch', which does not treat '^' as an anchor.
+** If the pattern is not anchored, every match starts with 'prefix'
+** (the leading characters without suffix) or, if there is no prefix,
+** with a character of set 'first' (unless it is -1).
+** Patterns without '%b', '%f', back-references and malformed items are
+** 'linear': they can also be matched by the automaton, whose state
+** 'nfa' is allocated on first use (and kept as user value 1).
+*/
+typedef struct Pattern {
+    size_t lprefix; /* length of 'prefix' */
+    struct NFA *nfa; /* automaton state or NULL */
+    int32_t nitems; /* number of items */
+    int32_t nsets; /* number of sets */
+    int32_t gstart; /* first item of the program for 'gmatch' */
+    int32_t first; /* set of the first character of a match or -1 */
+    uint8_t anchor; /* true if pattern starts with '^' */
+    uint8_t linear; /* true if pattern can be matched by the automaton */
+    uint8_t ncap; /* number of captures (if 'linear') */
+} Pattern;
+
 
+#define pitems(pt)      cast(PItem *, (pt) + 1)
+#define psets(pt)       cast(CharSet *, pitems(pt) + (pt)->nitems)
+#define pprefix(pt)     cast_charp(psets(pt) + (pt)->nsets)
 
-static const char *class_end(MatchState *ms, const char *p) {
+
+typedef struct CompileState {
+    const char *p_end; /* end ('\0') of pattern */
+    PItem *items; /* compiled items (NULL when only counting them) */
+    CharSet *sets; /* compiled sets (NULL when only counting them) */
+    int32_t nitems; /* number of items */
+    int32_t nsets; /* number of sets */
+    PItem dummy; /* item used when only counting */
+} CompileState;
+
+
+static const char *class_end(CompileState *cs, const char *p,
+                             int32_t *err) {
     switch (*p++) {
         case T_ESC: {
-            if (t_unlikely(p == ms->p_end))
-                tokuL_error(ms->T, "malformed pattern (ends with '%%')");
+            if (t_unlikely(p == cs->p_end)) {
+                *err = PE_ESC;
+                return NULL;
+            }
             return p+1;
         }
         case '[': {
             if (*p == '^') p++;
             do { /* look for a ']' */
-                if (t_unlikely(p == ms->p_end))
-                    tokuL_error(ms->T, "malformed pattern (missing ']')");
-                if (*(p++) == T_ESC && p < ms->p_end)
+                if (t_unlikely(p == cs->p_end)) {
+                    *err = PE_BRACKET;
+                    return NULL;
+                }
+                if (*(p++) == T_ESC && p < cs->p_end)
                     p++; /* skip escapes (e.g. '%]') */
             } while (*p != ']');
             return p+1;
@@ -145,38 +225,400 @@ static int32_t match_bracket_class(int32_t c, const char *p, const char *ec) {
 }
 
 
-static int32_t single_match(MatchState *ms, const char *s, const char *p,
-                            const char *ep) {
+static PItem *newitem(CompileState *cs, uint8_t kind) {
+    PItem *pi = (cs->items != NULL) ? &cs->items[cs->nitems] : &cs->dummy;
+    cs->nitems++;
+    pi->kind = kind;
+    pi->suffix = pi->c = pi->e = 0;
+    pi->set = -1;
+    return pi;
+}
+
+
+/* add set of the class or set at 'p' (ending at 'ep') */
+static int32_t newset(CompileState *cs, const char *p, const char *ep) {
+    if (cs->sets != NULL) { /* not only counting? */
+        CharSet *set = &cs->sets[cs->nsets];
+        memset(set, 0, sizeof(*set));
+        for (int32_t c = 0; c <= UCHAR_MAX; c++) {
+            if (*p == '[' ? match_bracket_class(c, p, ep - 1)
+                          : match_class(c, uchar(*(p + 1))))
+                addset(set, c);
+        }
+    }
+    return cs->nsets++;
+}
+
+
+/* check if 'cl' (following '%') is a character class */
+static int32_t isclass(int32_t cl) {
+    switch (tolower(cl)) {
+        case 'a': case 'c': case 'd': case 'g': case 'l':
+        case 'p': case 's': case 'u': case 'w': case 'x': return 1;
+        default: return 0;
+    }
+}
+
+
+/* compile pattern 'p' (up to 'cs->p_end') */
+static void compile(CompileState *cs, const char *p) {
+    int32_t err;
+    while (p != cs->p_end) {
+        switch (*p) {
+            case '(': { /* start capture */
+                if (*(p + 1) == ')') { /* position capture? */
+                    newitem(cs, PI_POSITION);
+                    p += 2;
+                } else {
+                    newitem(cs, PI_OPEN);
+                    p++;
+                }
+                break;
+            }
+            case ')': { /* end capture */
+                newitem(cs, PI_CLOSE);
+                p++;
+                break;
+            }
+            case '$': {
+                if ((p + 1) != cs->p_end) /* is the '$' the last char in p? */
+                    goto dflt; /* no; go to default */
+                newitem(cs, PI_EOS);
+                p++;
+                break;
+            }
+            case T_ESC: { /* escaped seq. not in the format class[*+?-]? */
+                switch (*(p + 1)) {
+                    case 'b': { /* balanced string? */
+                        PItem *pi;
+                        if (t_unlikely(p + 2 >= cs->p_end - 1)) {
+                            err = PE_BALANCE;
+                            goto error;
+                        }
+                        pi = newitem(cs, PI_BALANCE);
+                        pi->c = uchar(*(p + 2));
+                        pi->e = uchar(*(p + 3));
+                        p += 4;
+                        break;
+                    }
+                    case 'f': { /* frontier? */
+                        const char *ep;
+                        p += 2;
+                        if (t_unlikely(*p != '[')) {
+                            err = PE_FRONTIER;
+                            goto error;
+                        }
+                        if ((ep = class_end(cs, p, &err)) == NULL)
+                            goto error;
+                        newitem(cs, PI_FRONTIER)->set = newset(cs, p, ep);
+                        p = ep;
+                        break;
+                    }
+                    case '0': case '1': case '2': case '3':
+                    case '4': case '5': case '6': case '7':
+                    case '8': case '9': { /* capture results (%0-%9)? */
+                        newitem(cs, PI_BACKREF)->c = uchar(*(p + 1));
+                        p += 2;
+                        break;
+                    }
+                    default: goto dflt;
+                }
+                break;
+            }
+            default: dflt: { /* pattern class plus optional suffix */
+                const char *ep = class_end(cs, p, &err);
+                PItem *pi;
+                if (ep == NULL)
+                    goto error;
+                else if (*p == '.')
+                    pi = newitem(cs, PI_ANY);
+                else if (*p == '[' || (*p == T_ESC && isclass(uchar(*(p+1))))) {
+                    pi = newitem(cs, PI_SET);
+                    pi->set = newset(cs, p, ep);
+                } else { /* single character (maybe escaped) */
+                    pi = newitem(cs, PI_CHAR);
+                    pi->c = uchar(*(ep - 1));
+                }
+                if (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?')
+                    pi->suffix = uchar(*ep++);
+                p = ep;
+                break;
+            }
+        }
+    }
+    newitem(cs, PI_END);
+    return;
+error:
+    newitem(cs, PI_ERROR)->set = err;
+}
+
+
+/* set the literal prefix or the set of first characters of 'pt' */
+static void setprefix(Pattern *pt) {
+    const PItem *pi = pitems(pt);
+    char *prefix = pprefix(pt);
+    size_t n = 0;
+    while (pi[n].kind == PI_CHAR && pi[n].suffix == 0) {
+        prefix[n] = cast_char(pi[n].c);
+        n++;
+    }
+    pt->lprefix = n;
+    if (n == 0 && pi->kind == PI_SET && (pi->suffix == 0 || pi->suffix == '+'))
+        pt->first = pi->set; /* match must start with a char. in the set */
+}
+
+
+/*
+** Set the capture indices of the items of program 'pi' and return true
+** if the program can be matched by the automaton. Indices are static
+** because every match goes through all items: each capture gets the
+** number of captures before it, and ')' closes the last capture that
+** is not closed yet. Patterns where a ')' has nothing to close or with
+** too many captures are left to the backtracking matcher, which reports
+** their errors.
+*/
+static int32_t setcaptures(PItem *pi, uint8_t *ncap) {
+    int32_t open[TOKU_MAXCAPTURES]; /* captures not closed yet */
+    int32_t nopen = 0;
+    int32_t n = 0;
+    for (;; pi++) {
+        switch (pi->kind) {
+            case PI_END: {
+                *ncap = cast_u8(n);
+                return 1;
+            }
+            case PI_OPEN: case PI_POSITION: {
+                if (n == TOKU_MAXCAPTURES)
+                    return 0; /* too many captures */
+                if (pi->kind == PI_OPEN)
+                    open[nopen++] = n;
+                pi->c = cast_u8(n++);
+                break;
+            }
+            case PI_CLOSE: {
+                if (nopen == 0)
+                    return 0; /* invalid pattern capture */
+                pi->c = cast_u8(open[--nopen]);
+                break;
+            }
+            case PI_BALANCE: case PI_FRONTIER:
+            case PI_BACKREF: case PI_ERROR: return 0;
+            default: break;
+        }
+    }
+}
+
+
+/*
+** Compile the pattern string at index 'arg' and push the compiled
+** pattern. Items and sets are first only counted, to allocate the
+** compiled pattern with its exact size.
+*/
+static Pattern *newpattern(toku_State *T, int32_t arg) {
+    size_t lp;
+    const char *p = toku_to_lstring(T, arg, &lp);
+    int32_t anchor = (*p == '^');
+    int32_t nmain; /* number of items of the main program */
+    CompileState cs;
+    Pattern *pt;
+    cs.p_end = p + lp;
+    cs.items = NULL; cs.sets = NULL; /* only count */
+    cs.nitems = cs.nsets = 0;
+    compile(&cs, p + anchor);
+    nmain = cs.nitems;
+    if (anchor) /* 'gmatch' needs its own program */
+        compile(&cs, p);
+    pt = cast(Pattern *, toku_push_userdata(T, sizeof(Pattern) +
+                                  cast_sizet(cs.nitems) * sizeof(PItem) +
+                                  cast_sizet(cs.nsets) * sizeof(CharSet) +
+                                  cast_sizet(nmain), 2));
+    pt->lprefix = 0;
+    pt->nfa = NULL;
+    pt->nitems = cs.nitems;
+    pt->nsets = cs.nsets;
+    pt->gstart = 0;
+    pt->first = -1;
+    pt->anchor = cast_u8(anchor);
+    cs.items = pitems(pt); cs.sets = psets(pt);
+    cs.nitems = cs.nsets = 0;
+    compile(&cs, p + anchor);
+    if (anchor) {
+        pt->gstart = cs.nitems;
+        compile(&cs, p);
+    } else /* prefix is used only for unanchored matches */
+        setprefix(pt);
+    toku_assert(cs.nitems == pt->nitems && cs.nsets == pt->nsets);
+    pt->linear = cast_u8(setcaptures(pitems(pt), &pt->ncap) &&
+                         setcaptures(pitems(pt) + pt->gstart, &pt->ncap));
+    toku_get_uservalue(T, toku_upvalueindex(0), TOKU_PATTERNCACHE);
+    toku_set_metatable(T, -2);
+    toku_push(T, arg);
+    toku_set_uservalue(T, -2, 0); /* keep the pattern string */
+    return pt;
+}
+
+
+/*
+** Cache of compiled patterns (upvalue of all functions of this
+** library). The compiled pattern of entry 'i' is kept as user value 'i'
+** of the cache, and it keeps alive the pattern string 'p' of the entry,
+** so another string at the same address has the same contents. User
+** value 'TOKU_PATTERNCACHE' is the metatable of compiled patterns.
+*/
+typedef struct PatternCache {
+    uint32_t clock; /* incremented on each access */
+    struct {
+        const char *p; /* pattern string */
+        size_t lp; /* length of 'p' */
+        const Pattern *pt; /* compiled pattern (NULL if entry is free) */
+        uint32_t stamp; /* time of last access */
+    } e[TOKU_PATTERNCACHE];
+} PatternCache;
+
+
+/* get compiled pattern at index 'arg' or raise an error */
+static Pattern *checkpattern(toku_State *T, int32_t arg) {
+    void *pt = NULL;
+    if (toku_type(T, arg) == TOKU_T_USERDATA && toku_get_metatable(T, arg)) {
+        toku_get_uservalue(T, toku_upvalueindex(0), TOKU_PATTERNCACHE);
+        if (toku_rawequal(T, -1, -2)) /* metatable of compiled patterns? */
+            pt = toku_to_userdata(T, arg);
+        toku_pop(T, 2); /* remove both metatables */
+    }
+    if (t_unlikely(pt == NULL))
+        tokuL_error_type(T, arg, TOKU_PATTERN);
+    return cast(Pattern *, pt);
+}
+
+
+/*
+** Get the compiled pattern for argument 'arg' (a compiled pattern or
+** a pattern string) and push it, so that it is kept alive while in
+** use. Pattern strings are compiled only when not found in the cache,
+** in which case they replace its least recently used entry.
+*/
+static const Pattern *getpattern(toku_State *T, int32_t arg) {
+    if (toku_type(T, arg) == TOKU_T_USERDATA) { /* compiled pattern? */
+        const Pattern *pt = checkpattern(T, arg);
+        toku_push(T, arg);
+        return pt;
+    } else {
+        size_t lp;
+        const char *p = tokuL_check_lstring(T, arg, &lp);
+        PatternCache *pc = cast(PatternCache *,
+                                toku_to_userdata(T, toku_upvalueindex(0)));
+        const Pattern *pt;
+        int32_t lru = 0;
+        for (int32_t i = 0; i < TOKU_PATTERNCACHE; i++) {
+            if (pc->e[i].pt != NULL && pc->e[i].lp == lp &&
+                    (pc->e[i].p == p || memcmp(pc->e[i].p, p, lp) == 0)) {
+                pc->e[i].stamp = ++pc->clock;
+                toku_get_uservalue(T, toku_upvalueindex(0), cast_u16(i));
+                return pc->e[i].pt;
+            } else if (pc->e[i].stamp < pc->e[lru].stamp)
+                lru = i;
+        }
+        pt = newpattern(T, arg);
+        toku_push(T, -1);
+        toku_set_uservalue(T, toku_upvalueindex(0), cast_u16(lru));
+        pc->e[lru].p = p;
+        pc->e[lru].lp = lp;
+        pc->e[lru].pt = pt;
+        pc->e[lru].stamp = ++pc->clock;
+        return pt;
+    }
+}
+
+/* }====================================================================== */
+
+
+typedef struct MatchState {
+    const char *srt_init; /* init of source string */
+    const char *srt_end; /* end ('\0') of source string */
+    const CharSet *sets; /* sets of the pattern */
+    toku_State *T;
+    ptrdiff_t budget; /* steps left for backtracking */
+    int32_t pattern; /* stack index of the compiled pattern */
+    int32_t matchdepth; /* control for recursive depth (to avoid C stack overflow) */
+    uint8_t level; /* total number of captures (finished or unfinished) */
+    struct {
+        const char *init;
+        ptrdiff_t len;
+    } capture[TOKU_MAXCAPTURES];
+} MatchState;
+
+
+/* recursive function */
+static const char *match(MatchState *ms, const char *s, const PItem *pi);
+
+
+/* maximum recursion depth for 'match' */
+#if !defined(MAXCCALLS)
+#define MAXCCALLS       200
+#endif
+
+
+/*
+** steps of the backtracking matcher per subject character and pattern
+** item before linear patterns switch to the automaton
+*/
+#if !defined(TOKU_BTSTEPS)
+#define TOKU_BTSTEPS    8
+#endif
+
+#if TOKU_BTSTEPS < 1
+#error 'TOKU_BTSTEPS' must be at least 1.
+#endif
+
+
+static int32_t check_capture(MatchState *ms, int32_t l) {
+    l -= '1';
+    if (t_unlikely(l < 0 || l >= ms->level ||
+                   ms->capture[l].len == CAP_UNFINISHED))
+        return tokuL_error(ms->T, "invalid capture index %%%d", l + 1);
+    return l;
+}
+
+
+static int32_t capture_to_close(MatchState *ms) {
+    int32_t level = ms->level;
+    for (level--; level>=0; level--)
+        if (ms->capture[level].len == CAP_UNFINISHED) return level;
+    return tokuL_error(ms->T, "invalid pattern capture");
+}
+
+
+static int32_t single_match(MatchState *ms, const char *s, const PItem *pi) {
     if (s >= ms->srt_end)
         return 0;
     else {
         int32_t c = uchar(*s);
-        switch (*p) {
-            case '.': return 1; /* matches any char */
-            case T_ESC: return match_class(c, uchar(*(p+1)));
-            case '[': return match_bracket_class(c, p, ep-1);
-            default:  return (uchar(*p) == c);
+        switch (pi->kind) {
+            case PI_CHAR: return (pi->c == c);
+            case PI_ANY: return 1; /* matches any char */
+            default: {
+                toku_assert(pi->kind == PI_SET);
+                return (inset(&ms->sets[pi->set], c) != 0);
+            }
         }
     }
 }
 
 
 static const char *match_balance(MatchState *ms, const char *s,
-                                 const char *p) {
-    if (t_unlikely(p >= ms->p_end - 1))
-        tokuL_error(ms->T, "malformed pattern (missing arguments to '%%b')");
-    if (*s != *p)
+                                 const PItem *pi) {
+    if (uchar(*s) != pi->c)
         return NULL;
     else {
-        int32_t b = *p;
-        int32_t e = *(p+1);
+        int32_t b = pi->c;
+        int32_t e = pi->e;
         int32_t cont = 1;
         while (++s < ms->srt_end) {
-            if (*s == e) {
+            if (uchar(*s) == e) {
                 if (--cont == 0)
                     return s+1;
             }
-            else if (*s == b) cont++;
+            else if (uchar(*s) == b) cont++;
         }
     }
     return NULL; /* string ends out of balance */
@@ -184,12 +626,16 @@ static const char *match_balance(MatchState *ms, const char *s,
 
 
 static const char *max_expand(MatchState *ms, const char *s,
-                              const char *p, const char *ep) {
+                              const PItem *pi) {
     ptrdiff_t i = 0; /* counts maximum expand for item */
-    while (single_match(ms, s + i, p, ep)) i++;
+    if (pi->kind == PI_ANY) /* matches the rest of the string? */
+        i = ms->srt_end - s;
+    else
+        while (single_match(ms, s + i, pi)) i++;
+    ms->budget -= i;
     /* keeps trying to match with the maximum repetitions */
-    while (i>=0) {
-        const char *res = match(ms, (s+i), ep+1);
+    while (i>=0 && ms->budget >= 0) {
+        const char *res = match(ms, (s+i), pi+1);
         if (res) return res;
         i--; /* else didn't match; reduce 1 repetition to try again */
     }
@@ -198,12 +644,14 @@ static const char *max_expand(MatchState *ms, const char *s,
 
 
 static const char *min_expand(MatchState *ms, const char *s,
-                              const char *p, const char *ep) {
+                              const PItem *pi) {
     for (;;) {
-        const char *res = match(ms, s, ep+1);
+        const char *res = match(ms, s, pi+1);
         if (res != NULL)
             return res;
-        else if (single_match(ms, s, p, ep))
+        else if (ms->budget < 0) /* gave up? */
+            return NULL;
+        else if (single_match(ms, s, pi))
             s++; /* try with one more repetition */
         else return NULL;
     }
@@ -211,7 +659,7 @@ static const char *min_expand(MatchState *ms, const char *s,
 
 
 static const char *start_capture(MatchState *ms, const char *s,
-                                 const char *p, int32_t what) {
+                                 const PItem *pi, int32_t what) {
     const char *res;
     int32_t level = ms->level;
     if (level >= TOKU_MAXCAPTURES)
@@ -219,17 +667,18 @@ static const char *start_capture(MatchState *ms, const char *s,
     ms->capture[level].init = s;
     ms->capture[level].len = what;
     ms->level = cast_u8(level+1);
-    if ((res=match(ms, s, p)) == NULL) /* match failed? */
+    if ((res=match(ms, s, pi)) == NULL) /* match failed? */
         ms->level--; /* undo capture */
     return res;
 }
 
 
-static const char *end_capture(MatchState *ms, const char *s, const char *p) {
+static const char *end_capture(MatchState *ms, const char *s,
+                               const PItem *pi) {
     int32_t l = capture_to_close(ms);
     const char *res;
     ms->capture[l].len = s - ms->capture[l].init; /* close capture */
-    if ((res = match(ms, s, p)) == NULL) /* match failed? */
+    if ((res = match(ms, s, pi)) == NULL) /* match failed? */
         ms->capture[l].len = CAP_UNFINISHED; /* undo capture */
     return res;
 }
@@ -247,102 +696,92 @@ static const char *match_capture(MatchState *ms, const char *s, int32_t l) {
 }
 
 
-static const char *match(MatchState *ms, const char *s, const char *p) {
+static const char *match(MatchState *ms, const char *s, const PItem *pi) {
     if (t_unlikely(ms->matchdepth-- == 0))
         tokuL_error(ms->T, "pattern too complex");
 init: /* using goto to optimize tail recursion */
-    if (p != ms->p_end) { /* not end of pattern? */
-        switch (*p) {
-            case '(': { /* start capture */
-                if (*(p + 1) == ')') /* position capture? */
-                    s = start_capture(ms, s, p + 2, CAP_POSITION);
-                else
-                    s = start_capture(ms, s, p + 1, CAP_UNFINISHED);
-                break;
-            }
-            case ')': { /* end capture */
-                s = end_capture(ms, s, p + 1);
-                break;
+    if (t_unlikely(--ms->budget < 0)) /* too much backtracking? */
+        s = NULL; /* give up (the automaton will do the search) */
+    else switch (pi->kind) {
+        case PI_END: break; /* end of pattern */
+        case PI_OPEN: { /* start capture */
+            s = start_capture(ms, s, pi + 1, CAP_UNFINISHED);
+            break;
+        }
+        case PI_POSITION: { /* position capture */
+            s = start_capture(ms, s, pi + 1, CAP_POSITION);
+            break;
+        }
+        case PI_CLOSE: { /* end capture */
+            s = end_capture(ms, s, pi + 1);
+            break;
+        }
+        case PI_EOS: {
+            s = (s == ms->srt_end) ? s : NULL; /* check end of string */
+            break;
+        }
+        case PI_BALANCE: { /* balanced string */
+            s = match_balance(ms, s, pi);
+            if (s != NULL) {
+                pi++; goto init; /* return match(ms, s, pi+1); */
+            } /* else fail (s == NULL) */
+            break;
+        }
+        case PI_FRONTIER: {
+            const CharSet *set = &ms->sets[pi->set];
+            int32_t prev = (s == ms->srt_init) ? '\0' : uchar(*(s - 1));
+            if (!inset(set, prev) && inset(set, uchar(*s))) {
+                pi++; goto init; /* return match(ms, s, pi+1); */
             }
-            case '$': {
-                if ((p + 1) != ms->p_end) /* is the '$' the last char in p? */
-                    goto dflt; /* no; go to default */
-                s = (s == ms->srt_end) ? s : NULL; /* check end of string */
-                break;
+            s = NULL; /* match failed */
+            break;
+        }
+        case PI_BACKREF: { /* capture results (%0-%9) */
+            s = match_capture(ms, s, pi->c);
+            if (s != NULL) {
+                pi++; goto init; /* return match(ms, s, pi+1) */
             }
-            case T_ESC: { /* escaped seq. not in the format class[*+?-]? */
-                switch (*(p + 1)) {
-                    case 'b': { /* balanced string? */
-                        s = match_balance(ms, s, p + 2);
-                        if (s != NULL) {
-                            p += 4; goto init; /* return match(ms, s, p+4); */
-                        } /* else fail (s == NULL) */
-                        break;
-                    }
-                    case 'f': { /* frontier? */
-                        const char *ep; char prev;
-                        p += 2;
-                        if (t_unlikely(*p != '['))
-                            tokuL_error(ms->T, "missing '[' after '%%f' in pattern");
-                        ep = class_end(ms, p); /* points to what is next */
-                        prev = (s == ms->srt_init) ? '\0' : *(s - 1);
-                        if (!match_bracket_class(uchar(prev), p, ep - 1) &&
-                                match_bracket_class(uchar(*s), p, ep - 1)) {
-                            p = ep; goto init; /* return match(ms, s, ep); */
+            break;
+        }
+        case PI_ERROR: {
+            tokuL_error(ms->T, "%s", patterrors[pi->set]);
+            break;
+        }
+        default: { /* single char class plus optional suffix */
+            /* does not match at least once? */
+            if (!single_match(ms, s, pi)) {
+                if (pi->suffix == '*' || pi->suffix == '?' ||
+                        pi->suffix == '-') { /* accept empty */
+                    pi++; goto init; /* return match(ms, s, pi+1); */
+                } else /* '+' or no suffix */
+                    s = NULL; /* fail */
+            } else { /* matched once */
+                switch (pi->suffix) { /* handle optional suffix */
+                    case '?': { /* optional */
+                        const char *res;
+                        if ((res = match(ms, s + 1, pi + 1)) != NULL)
+                            s = res;
+                        else {
+                            pi++;
+                            goto init; /* return match(ms, s, pi+1); */
                         }
-                        s = NULL; /* match failed */
                         break;
                     }
-                    case '0': case '1': case '2': case '3':
-                    case '4': case '5': case '6': case '7':
-                    case '8': case '9': { /* capture results (%0-%9)? */
-                        s = match_capture(ms, s, uchar(*(p + 1)));
-                        if (s != NULL) {
-                            p += 2; goto init; /* return match(ms, s, p+2) */
-                        }
+                    case '+': /* 1 or more repetitions */
+                        s++; /* 1 match already done */
+                        /* fall through */
+                    case '*': /* 0 or more repetitions */
+                        s = max_expand(ms, s, pi);
                         break;
-                    }
-                    default: goto dflt;
-                }
-                break;
-            }
-            default: dflt: { /* pattern class plus optional suffix */
-                const char *ep = class_end(ms, p); /* points to opt. suffix */
-                /* does not match at least once? */
-                if (!single_match(ms, s, p, ep)) {
-                    if (*ep == '*' || *ep == '?' || *ep == '-') {
-                        /* accept empty */
-                        p = ep + 1; goto init; /* return match(ms, s, ep+1); */
-                    } else /* '+' or no suffix */
-                        s = NULL; /* fail */
-                } else { /* matched once */
-                    switch (*ep) { /* handle optional suffix */
-                        case '?': { /* optional */
-                            const char *res;
-                            if ((res = match(ms, s + 1, ep + 1)) != NULL)
-                                s = res;
-                            else {
-                                p = ep + 1;
-                                goto init; /* return match(ms, s, ep+1); */
-                            }
-                            break;
-                        }
-                        case '+': /* 1 or more repetitions */
-                            s++; /* 1 match already done */
-                            /* fall through */
-                        case '*': /* 0 or more repetitions */
-                            s = max_expand(ms, s, p, ep);
-                            break;
-                        case '-': /* 0 or more repetitions (minimum) */
-                            s = min_expand(ms, s, p, ep);
-                            break;
-                        default: /* no suffix */
-                            s++; p = ep;
-                            goto init; /* return match(ms, s+1, ep); */
-                    }
+                    case '-': /* 0 or more repetitions (minimum) */
+                        s = min_expand(ms, s, pi);
+                        break;
+                    default: /* no suffix */
+                        s++; pi++;
+                        goto init; /* return match(ms, s+1, pi+1); */
                 }
-                break;
             }
+            break;
         }
     }
     ms->matchdepth++;
@@ -411,33 +850,351 @@ static int32_t nospecials(const char *p, size_t l) {
 }
 
 
-static void prep_state(MatchState *ms, toku_State *T,
-                       const char *s, size_t ls, const char *p, size_t lp) {
+/*
+** Prepare match state for subject 's' and compiled pattern 'pt' (at
+** stack index 'pattern'). The budget of the backtracking matcher is
+** for all the searches done with this state.
+*/
+static void prep_state(MatchState *ms, toku_State *T, const char *s,
+                       size_t ls, const Pattern *pt, int32_t pattern) {
     ms->T = T;
     ms->matchdepth = MAXCCALLS;
     ms->srt_init = s;
     ms->srt_end = s + ls;
-    ms->p_end = p + lp;
+    ms->sets = psets(pt);
+    ms->pattern = pattern;
+    if (pt->linear) { /* can switch to the automaton? */
+        size_t steps = cast_sizet(TOKU_BTSTEPS) * cast_sizet(pt->nitems);
+        if (ls < cast_sizet(PTRDIFF_MAX) / steps - 1)
+            ms->budget = cast(ptrdiff_t, (ls + 1) * steps);
+        else
+            ms->budget = PTRDIFF_MAX;
+    } else
+        ms->budget = PTRDIFF_MAX;
+}
+
+
+/*
+** Return the first position at or after 's' where a match of the
+** (unanchored) pattern 'pt' can start, or NULL if there is none.
+*/
+static const char *nextstart(MatchState *ms, const Pattern *pt,
+                             const char *s) {
+    if (pt->lprefix > 0)
+        return findstr(s, cast_diff2sz(ms->srt_end - s),
+                       pprefix(pt), pt->lprefix, 0);
+    else if (pt->first >= 0) {
+        const CharSet *set = &ms->sets[pt->first];
+        for (; s < ms->srt_end; s++)
+            if (inset(set, uchar(*s))) return s;
+        return NULL;
+    } else
+        return s;
 }
 
 
-static void re_prep_state(MatchState *ms) {
+/*
+** Try to match program 'pi' of pattern 'pt' at 's'. If the pattern has
+** a prefix, 's' is known to start with it.
+*/
+static const char *do_match(MatchState *ms, const Pattern *pt,
+                            const PItem *pi, const char *s) {
     ms->level = 0;
     toku_assert(ms->matchdepth == MAXCCALLS);
+    return match(ms, s + pt->lprefix, pi + pt->lprefix);
+}
+
+
+/* {======================================================================
+** LINEAR-TIME MATCHING
+** ======================================================================= */
+
+/*
+** Backtracking can take quadratic or exponential time on some subjects
+** (e.g. '.-x.-y' on a long string without 'x'). For linear patterns,
+** the backtracking matcher gets a budget of steps proportional to the
+** size of the subject times the size of the pattern; if it runs out of
+** it, the search continues with an automaton simulated in the style of
+** the Pike VM, which takes O(n*m) time. The automaton keeps its threads
+** in priority order (the order in which the backtracking matcher would
+** try them), so both find the same match with the same captures.
+**
+** The states of the automaton are the items of the program, with two
+** states per item, so that items with suffix '+' have a state for
+** their first repetition (state 2*k) and one for the others (2*k+1).
+** Threads stop at the states of single char items (waiting for the
+** next character) and at the end of the pattern (a match); all other
+** items are followed while adding a thread.
+*/
+
+/* list of threads at the same subject position */
+typedef struct ThreadList {
+    int32_t n; /* number of threads */
+    uint32_t gen; /* generation of this list (for 'NFA.mark') */
+    int32_t *pc; /* state of each thread */
+    const char **caps; /* captures of each thread ('ncaps' per thread) */
+} ThreadList;
+
+
+/* frame of the stack used to add threads */
+typedef struct NFAFrame {
+    int32_t pc; /* state to add */
+    int32_t slot; /* capture slot to restore or 'AddState'/'AddThread' */
+    const char *old; /* old value of 'slot' */
+} NFAFrame;
+
+#define AddState        (-1) /* add state 'pc' */
+#define AddThread       (-2) /* add thread at state 'pc' */
+
+
+/*
+** Automaton state of a pattern. Captures of a thread are kept in 'ncaps'
+** slots: slot 0 is the start of the match and capture 'i' uses slots
+** '2*i+1' (start) and '2*i+2' (end or NULL if not closed).
+*/
+typedef struct NFA {
+    int32_t ncaps; /* number of capture slots */
+    uint32_t gen; /* last generation */
+    uint32_t *mark; /* generation of the list where each state is */
+    NFAFrame *stack; /* stack for 'addthread' */
+    const char **wcaps; /* captures of the thread being added */
+    const char **mcaps; /* captures of the match */
+    ThreadList l[2]; /* current and next list of threads */
+} NFA;
+
+
+/* get automaton state of 'pt' (allocating it if needed) */
+static NFA *getnfa(MatchState *ms, const Pattern *pt) {
+    if (pt->nfa == NULL) {
+        size_t nstates = cast_sizet(pt->nitems) * 2;
+        size_t ncaps = cast_sizet(pt->ncap) * 2 + 1;
+        size_t nptr = (2 * nstates + 2) * ncaps; /* captures */
+        NFA *nfa = cast(NFA *, toku_push_userdata(ms->T, sizeof(NFA) +
+                        nptr * sizeof(const char *) +
+                        (2 * nstates + 1) * sizeof(NFAFrame) +
+                        3 * nstates * sizeof(int32_t), 0));
+        const char **caps = cast(const char **, nfa + 1);
+        nfa->stack = cast(NFAFrame *, caps + nptr);
+        nfa->mark = cast(uint32_t *, nfa->stack + (2 * nstates + 1));
+        nfa->l[0].pc = cast(int32_t *, nfa->mark + nstates);
+        nfa->l[1].pc = nfa->l[0].pc + nstates;
+        nfa->wcaps = caps;
+        nfa->mcaps = caps + ncaps;
+        nfa->l[0].caps = caps + 2 * ncaps;
+        nfa->l[1].caps = nfa->l[0].caps + nstates * ncaps;
+        nfa->ncaps = cast_i32(ncaps);
+        nfa->gen = 0;
+        memset(nfa->mark, 0, nstates * sizeof(uint32_t));
+        toku_set_uservalue(ms->T, ms->pattern, 1); /* keep it */
+        cast(Pattern *, pt)->nfa = nfa;
+    }
+    return pt->nfa;
+}
+
+
+/* start a new (empty) list of threads */
+static void newlist(NFA *nfa, ThreadList *l, int32_t nstates) {
+    if (t_unlikely(++nfa->gen == 0)) { /* wrapped around? */
+        memset(nfa->mark, 0, cast_sizet(nstates) * sizeof(uint32_t));
+        nfa->gen = 1;
+    }
+    l->gen = nfa->gen;
+    l->n = 0;
+}
+
+
+#define savecap(sp,i,v) \
+    ((sp)->pc = 0, (sp)->slot = (i), (sp)->old = nfa->wcaps[i], \
+     nfa->wcaps[i] = (v), (sp)++)
+
+#define pushstate(sp,s,what)    ((sp)->pc = (s), (sp)->slot = (what), (sp)++)
+
+/* state of the item after the item of state 'pc' */
+#define succ(pc)        (((pc) & ~1) + 2)
+
+
+/*
+** Add to list 'l' the thread at state 'pc' at subject position 's'
+** with captures 'nfa->wcaps', following all items that do not consume
+** characters. A stack of frames replaces recursion; frames pushed later
+** are done first, so alternatives with lower priority are pushed first.
+*/
+static void addthread(MatchState *ms, NFA *nfa, ThreadList *l,
+                      const PItem *prog, int32_t pc, const char *s) {
+    NFAFrame *sp = nfa->stack;
+    pushstate(sp, pc, AddState);
+    while (sp > nfa->stack) {
+        const PItem *pi;
+        sp--;
+        pc = sp->pc;
+        if (sp->slot >= 0) { /* restore capture slot? */
+            nfa->wcaps[sp->slot] = sp->old;
+            continue;
+        } else if (sp->slot == AddThread)
+            goto addthread;
+        else if (nfa->mark[pc] == l->gen) /* state already in the list? */
+            continue; /* (thread there has higher priority) */
+        nfa->mark[pc] = l->gen;
+        pi = &prog[pc >> 1];
+        switch (pi->kind) {
+            case PI_OPEN: case PI_POSITION: {
+                savecap(sp, 2*pi->c + 1, s);
+                pushstate(sp, succ(pc), AddState);
+                break;
+            }
+            case PI_CLOSE: {
+                savecap(sp, 2*pi->c + 2, s);
+                pushstate(sp, succ(pc), AddState);
+                break;
+            }
+            case PI_EOS: {
+                if (s == ms->srt_end)
+                    pushstate(sp, succ(pc), AddState);
+                break;
+            }
+            case PI_END: goto addthread;
+            default: { /* single char class plus optional suffix */
+                switch (pi->suffix) {
+                    case '-': /* try first to skip the item */
+                        pushstate(sp, pc, AddThread);
+                        pushstate(sp, succ(pc), AddState);
+                        continue;
+                    case '+':
+                        if ((pc & 1) == 0) /* first repetition? */
+                            break; /* must match a character */
+                        /* else fall through */
+                    case '*': case '?': /* try first to match the item */
+                        pushstate(sp, succ(pc), AddState);
+                        break;
+                    default: break; /* no suffix */
+                }
+            addthread:
+                l->pc[l->n] = pc;
+                memcpy(l->caps + cast_sizet(l->n) * cast_sizet(nfa->ncaps),
+                       nfa->wcaps, cast_sizet(nfa->ncaps)*sizeof(const char *));
+                l->n++;
+                break;
+            }
+        }
+    }
+}
+
+
+/* state after matching a character at state 'pc' (item 'pi') */
+static int32_t nextstate(const PItem *pi, int32_t pc) {
+    switch (pi->suffix) {
+        case '*': case '-': return pc; /* stay in the same state */
+        case '+': return pc | 1; /* repeat from the second repetition */
+        default: return succ(pc); /* go to the next item */
+    }
+}
+
+
+/*
+** Search for a match of program 'prog' of linear pattern 'pt' starting
+** at 's' (only at 's' if 'anchor'). Set the captures of 'ms' from the
+** match and return its end, or return NULL if there is no match.
+*/
+static const char *nfa_search(MatchState *ms, const Pattern *pt,
+                              const PItem *prog, const char *s,
+                              int32_t anchor, const char **start) {
+    NFA *nfa = getnfa(ms, pt);
+    int32_t nstates = pt->nitems * 2;
+    size_t ncaps = cast_sizet(nfa->ncaps);
+    ThreadList *cl = &nfa->l[0];
+    ThreadList *nl = &nfa->l[1];
+    const char *init = s;
+    const char *mend = NULL; /* end of match */
+    newlist(nfa, cl, nstates);
+    for (;;) {
+        if (mend == NULL && (!anchor || s == init)) {
+            /* add thread for a match starting at 's' (lowest priority) */
+            if (cl->n == 0 && !anchor && (s = nextstart(ms, pt, s)) == NULL)
+                break; /* pattern cannot match */
+            for (size_t i = 0; i < ncaps; i++)
+                nfa->wcaps[i] = NULL;
+            nfa->wcaps[0] = s;
+            addthread(ms, nfa, cl, prog, 0, s);
+        } else if (cl->n == 0)
+            break; /* no more threads */
+        newlist(nfa, nl, nstates);
+        for (int32_t i = 0; i < cl->n; i++) { /* step each thread */
+            int32_t pc = cl->pc[i];
+            const PItem *pi = &prog[pc >> 1];
+            const char **caps = cl->caps + cast_sizet(i) * ncaps;
+            if (pi->kind == PI_END) { /* match? */
+                mend = s;
+                memcpy(nfa->mcaps, caps, ncaps * sizeof(const char *));
+                break; /* cut off threads with lower priority */
+            } else if (single_match(ms, s, pi)) {
+                memcpy(nfa->wcaps, caps, ncaps * sizeof(const char *));
+                addthread(ms, nfa, nl, prog, nextstate(pi, pc), s + 1);
+            }
+        }
+        { ThreadList *aux = cl; cl = nl; nl = aux; } /* swap lists */
+        if (s++ == ms->srt_end)
+            break; /* end of subject */
+    }
+    if (mend != NULL) { /* set captures from the match */
+        const PItem *pi;
+        ms->level = pt->ncap;
+        for (pi = prog; pi->kind != PI_END; pi++) {
+            if (pi->kind == PI_OPEN || pi->kind == PI_POSITION) {
+                const char **cap = nfa->mcaps + 2*pi->c + 1;
+                ms->capture[pi->c].init = cap[0];
+                if (pi->kind == PI_POSITION)
+                    ms->capture[pi->c].len = CAP_POSITION;
+                else if (cap[1] == NULL)
+                    ms->capture[pi->c].len = CAP_UNFINISHED;
+                else
+                    ms->capture[pi->c].len = cap[1] - cap[0];
+            }
+        }
+        *start = nfa->mcaps[0];
+    }
+    return mend;
+}
+
+/* }====================================================================== */
+
+
+/*
+** Search for a match of program 'prog' of pattern 'pt' starting at 's'
+** (only at 's' if 'anchor'). Return the end of the match and set
+** '*start' to its start, or return NULL if there is no match. Once the
+** budget of the backtracking matcher is exhausted, all searches with
+** the same state are done by the automaton.
+*/
+static const char *search(MatchState *ms, const Pattern *pt,
+                          const PItem *prog, const char *s,
+                          int32_t anchor, const char **start) {
+    do {
+        const char *e;
+        if (!anchor && (s = nextstart(ms, pt, s)) == NULL)
+            break; /* pattern cannot match */
+        if ((e = do_match(ms, pt, prog, s)) != NULL) {
+            *start = s;
+            return e;
+        } else if (ms->budget < 0) /* too much backtracking? */
+            return nfa_search(ms, pt, prog, s, anchor, start);
+    } while (s++ < ms->srt_end && !anchor);
+    return NULL; /* not found */
 }
 
 
 static int32_t find_aux(toku_State *T, int32_t find) {
     size_t ls, lp;
     const char *s = tokuL_check_lstring(T, 0, &ls);
-    const char *p = tokuL_check_lstring(T, 1, &lp);
+    const char *p = (toku_type(T, 1) == TOKU_T_USERDATA)
+                  ? NULL /* compiled pattern */
+                  : tokuL_check_lstring(T, 1, &lp);
     size_t init = posrelStart(tokuL_opt_integer(T, 2, 0), ls);
     if (init > ls || (ls != 0 && init == ls)) { /* start after string's end? */
         tokuL_push_fail(T); /* cannot find anything */
         return 1;
     }
     /* explicit request or no special characters? */
-    if (find && (toku_to_bool(T, 3) || nospecials(p, lp))) {
+    if (find && p != NULL && (toku_to_bool(T, 3) || nospecials(p, lp))) {
         /* do a plain search */
         const char *s2 = findstr(s + init, ls - init, p, lp, 0);
         if (s2) {
@@ -447,24 +1204,19 @@ static int32_t find_aux(toku_State *T, int32_t find) {
         }
     } else {
         MatchState ms;
-        const char *s1 = s + init;
-        int32_t anchor = (*p == '^');
-        if (anchor) {
-            p++; lp--; /* skip anchor character */
+        const Pattern *pt = getpattern(T, 1);
+        const char *s1;
+        const char *res;
+        prep_state(&ms, T, s, ls, pt, toku_gettop(T));
+        res = search(&ms, pt, pitems(pt), s + init, pt->anchor, &s1);
+        if (res != NULL) { /* match? */
+            if (find) {
+                toku_push_integer(T, s1 - s); /* start */
+                toku_push_integer(T, (res - s) - 1); /* end */
+                return push_captures(&ms, NULL, 0) + 2;
+            } else
+                return push_captures(&ms, s1, res);
         }
-        prep_state(&ms, T, s, ls, p, lp);
-        do {
-            const char *res;
-            re_prep_state(&ms);
-            if ((res=match(&ms, s1, p)) != NULL) {
-                if (find) {
-                    toku_push_integer(T, s1 - s); /* start */
-                    toku_push_integer(T, (res - s) - 1); /* end */
-                    return push_captures(&ms, NULL, 0) + 2;
-                } else
-                    return push_captures(&ms, s1, res);
-            }
-        } while (s1++ < ms.srt_end && !anchor);
     }
     tokuL_push_fail(T); /* not found */
     return 1;
@@ -484,7 +1236,8 @@ static int32_t reg_match(toku_State *T) {
 /* state for 'reg_gmatch' */
 typedef struct GMatchState {
     const char *src; /* current position */
-    const char *p; /* pattern */
+    const Pattern *pt; /* pattern */
+    const PItem *p; /* program of the pattern */
     const char *lastmatch; /* end of last match */
     MatchState ms; /* match state */
 } GMatchState;
@@ -495,14 +1248,18 @@ typedef struct GMatchState {
 
 static int32_t gmatch_aux(toku_State *T) {
     GMatchState *gm = toGMS(toku_to_userdata(T, toku_upvalueindex(2)));
-    const char *src;
+    const char *src = gm->src;
     gm->ms.T = T;
-    for (src = gm->src; src <= gm->ms.srt_end; src++) {
-        const char *e;
-        re_prep_state(&gm->ms);
-        if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    while (src <= gm->ms.srt_end) {
+        const char *s1;
+        const char *e = search(&gm->ms, gm->pt, gm->p, src, 0, &s1);
+        if (e == NULL)
+            break; /* not found */
+        else if (e == gm->lastmatch) /* empty match after last match? */
+            src = s1 + 1; /* try again after it */
+        else {
             gm->src = gm->lastmatch = e;
-            return push_captures(&gm->ms, src, e);
+            return push_captures(&gm->ms, s1, e);
         }
     }
     return 0;  /* not found */
@@ -510,17 +1267,19 @@ static int32_t gmatch_aux(toku_State *T) {
 
 
 static int32_t reg_gmatch(toku_State *T) {
-    size_t ls, lp;
+    size_t ls;
     const char *s = tokuL_check_lstring(T, 0, &ls);
-    const char *p = tokuL_check_lstring(T, 1, &lp);
     size_t init = posrelStart(tokuL_opt_integer(T, 2, 0), ls);
+    const Pattern *pt = getpattern(T, 1);
     GMatchState *gm;
-    toku_setntop(T, 2); /* keep strings on closure to avoid being collected */
+    toku_replace(T, 1); /* compiled pattern replaces the pattern */
+    toku_setntop(T, 2); /* keep them on closure to avoid being collected */
     gm = toGMS(toku_push_userdata(T, sizeof(GMatchState), 0));
     if (init > ls) /* start after string's end? */
         init = ls + 1; /* avoid overflows in 's + init' */
-    prep_state(&gm->ms, T, s, ls, p, lp);
-    gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+    prep_state(&gm->ms, T, s, ls, pt, toku_upvalueindex(1));
+    gm->src = s + init; gm->pt = pt; gm->lastmatch = NULL;
+    gm->p = pitems(pt) + pt->gstart;
     toku_push_cclosure(T, gmatch_aux, 3);
     return 1;
 }
@@ -599,13 +1358,13 @@ static int32_t add_value(MatchState *ms, tokuL_Buffer *b, const char *s,
 
 
 static int32_t reg_gsub(toku_State *T) {
-    size_t srcl, lp;
+    size_t srcl;
     const char *src = tokuL_check_lstring(T, 0, &srcl); /* subject */
-    const char *p = tokuL_check_lstring(T, 1, &lp); /* pattern */
     const char *lastmatch = NULL; /* end of last match */
     int32_t tr = toku_type(T, 2); /* replacement type */
     toku_Integer max_s = tokuL_opt_integer(T, 3, cast_Integer(srcl + 1));
-    int32_t anchor = (*p == '^');
+    const Pattern *pt = getpattern(T, 1); /* pattern */
+    int32_t ipt = toku_gettop(T); /* index of 'pt' */
     toku_Integer n = 0; /* replacement count */
     int32_t changed = 0; /* change flag */
     MatchState ms;
@@ -615,20 +1374,22 @@ static int32_t reg_gsub(toku_State *T) {
                         tr == TOKU_T_LIST, 2,
                         "string/function/table/instance/list");
     tokuL_buff_init(T, &b);
-    if (anchor)
-        p++, lp--; /* skip anchor character */
-    prep_state(&ms, T, src, srcl, p, lp);
+    prep_state(&ms, T, src, srcl, pt, ipt);
     while (n < max_s) {
-        const char *e;
-        re_prep_state(&ms); /* (re)prepare state for new match */
-        if ((e = match(&ms, src, p)) != NULL && e != lastmatch) { /* match? */
+        const char *s1;
+        const char *e = search(&ms, pt, pitems(pt), src, pt->anchor, &s1);
+        if (e == NULL)
+            break; /* no more matches */
+        tokuL_buff_push_lstring(&b, src, cast_diff2sz(s1 - src));
+        src = s1; /* skip to the match */
+        if (e != lastmatch) { /* match? */
             n++;
             changed = add_value(&ms, &b, src, e, tr) | changed;
             src = lastmatch = e;
         } else if (src < ms.srt_end) /* otherwise, skip one character */
             tokuL_buff_push(&b, *src++);
         else break; /* end of subject */
-        if (anchor) break;
+        if (pt->anchor) break;
     }
     if (!changed) /* no changes? */
         toku_push(T, 0); /* return original string */
@@ -641,7 +1402,19 @@ static int32_t reg_gsub(toku_State *T) {
 }
 
 
+static int32_t reg_compile(toku_State *T) {
+    const Pattern *pt = getpattern(T, 0);
+    const PItem *pi = pitems(pt);
+    for (int32_t i = 0; i < pt->nitems; i++) {
+        if (pi[i].kind == PI_ERROR) /* malformed pattern? */
+            return tokuL_error(T, "%s", patterrors[pi[i].set]);
+    }
+    return 1; /* return compiled pattern */
+}
+
+
 static const tokuL_Entry reglib[] = {
+    {"compile", reg_compile},
     {"find", reg_find},
     {"match", reg_match},
     {"gmatch", reg_gmatch},
@@ -650,7 +1423,108 @@ static const tokuL_Entry reglib[] = {
 };
 
 
+/* {======================================================================
+** METHODS OF COMPILED PATTERNS
+** ======================================================================= */
+
+/*
+** Methods of compiled patterns take the subject after the pattern
+** ('self'); swap them so the arguments are in the order expected by
+** the library functions.
+*/
+static void swapself(toku_State *T) {
+    checkpattern(T, 0);
+    tokuL_check_string(T, 1);
+    toku_push(T, 0);
+    toku_copy(T, 1, 0);
+    toku_replace(T, 1);
+}
+
+
+static int32_t p_find(toku_State *T) {
+    swapself(T);
+    toku_setntop(T, 3); /* no 'plain' argument */
+    return find_aux(T, 1);
+}
+
+
+static int32_t p_match(toku_State *T) {
+    swapself(T);
+    return find_aux(T, 0);
+}
+
+
+static int32_t p_gmatch(toku_State *T) {
+    swapself(T);
+    return reg_gmatch(T);
+}
+
+
+static int32_t p_gsub(toku_State *T) {
+    swapself(T);
+    return reg_gsub(T);
+}
+
+
+static const tokuL_Entry p_methods[] = {
+    {"find", p_find},
+    {"match", p_match},
+    {"gmatch", p_gmatch},
+    {"gsub", p_gsub},
+    {NULL, NULL}
+};
+
+
+static int32_t p_getidx(toku_State *T) {
+    checkpattern(T, 0);
+    tokuL_get_metafield(T, 0, "__methods");
+    toku_push(T, 1); /* get index value */
+    if (toku_get_field(T, -2) != TOKU_T_NIL)
+        toku_push_boundmethod(T, 0);
+    return 1;
+}
+
+
+static int32_t p_tostring(toku_State *T) {
+    checkpattern(T, 0);
+    toku_get_uservalue(T, 0, 0); /* pattern string */
+    toku_push_fstring(T, "pattern (%s)", toku_to_string(T, -1));
+    return 1;
+}
+
+
+static const tokuL_Entry p_meta[] = {
+    {"__getidx", p_getidx},
+    {"__tostring", p_tostring},
+    {NULL, NULL}
+};
+
+
+/* create metatable for compiled patterns (cache is on the top) */
+static void create_metatable(toku_State *T) {
+    tokuL_new_metatable(T, TOKU_PATTERN); /* metatable for patterns */
+    toku_push(T, -1);
+    toku_set_uservalue(T, -3, TOKU_PATTERNCACHE); /* keep it in the cache */
+    toku_push(T, -2); /* cache */
+    tokuL_set_funcs(T, p_meta, 1); /* add metamethods to metatable */
+    tokuL_push_libtable(T, p_methods); /* create methods table */
+    toku_push(T, -3); /* cache */
+    tokuL_set_funcs(T, p_methods, 1); /* add methods to methods table */
+    toku_set_field_str(T, -2, "__methods"); /* metatable.__methods = m. tab. */
+    toku_pop(T, 1); /* remove metatable */
+}
+
+/* }====================================================================== */
+
+
 int32_t tokuopen_reg(toku_State *T) {
-    tokuL_push_lib(T, reglib);
+    PatternCache *pc;
+    tokuL_check_version(T);
+    tokuL_push_libtable(T, reglib);
+    pc = cast(PatternCache *, toku_push_userdata(T, sizeof(PatternCache),
+                                                 TOKU_PATTERNCACHE + 1));
+    memset(pc, 0, sizeof(*pc));
+    create_metatable(T);
+    tokuL_set_funcs(T, reglib, 1); /* cache is upvalue of the functions */
     return 1;
 }
@@ -0,0 +1,342 @@
+/*
+** tshape.c
+** Shapes (layout of instance fields)
+** See Copyright Notice in tokudae.h
+*/
+
+#define tshape_c
+#define TOKU_CORE
+
+#include "tokudaeprefix.h"
+
+#include <string.h>
+
+#include "tshape.h"
+#include "tdebug.h"
+#include "tgc.h"
+#include "tmem.h"
+#include "tobject.h"
+#include "tstate.h"
+#include "tstring.h"
+#include "ttable.h"
+
+
+/*
+** Instance fields keyed by short strings are stored in an array of
+** slots, while the class keeps the keys in a tree of shapes. Each
+** shape in the tree extends its parent by a single key, so instances
+** that got the same fields in the same order end up sharing a shape
+** and the same field is found at the same slot index for all of them.
+** Removing a field leaves an empty slot in place (the key stays in
+** the shape), so that traversals are not disturbed. Fields with other
+** keys or too many fields (or shapes) switch the instance into
+** dictionary mode, where fields live in a regular table.
+*/
+
+
+/* minimum size of the slots array */
+#define MINSLOTS        4
+
+
+static Shape *newshape(toku_State *T, OClass *cls, Shape *parent,
+                                                   OString *key) {
+    int32_t n = (parent != NULL) ? parent->nkeys + 1 : 0;
+    Shape *s = cast(Shape *, tokuM_malloc_(T, sizeofshape(n), 0u));
+    s->parent = parent;
+    s->child = NULL;
+    s->nkeys = n;
+    if (parent != NULL) { /* extends 'parent' with 'key'? */
+        memcpy(s->keys, parent->keys, cast_sizet(n - 1) * sizeof(OString*));
+        s->keys[n - 1] = key;
+        s->sibling = parent->child; /* link it into 'parent' */
+        parent->child = s;
+        tokuG_objbarrier(T, cls, key);
+    } else /* otherwise root (empty shape) */
+        s->sibling = NULL;
+    cls->nshapes++;
+    return s;
+}
+
+
+Shape *tokuSH_root(toku_State *T, OClass *cls) {
+    if (cls->shape == NULL)
+        cls->shape = newshape(T, cls, NULL, NULL);
+    return cls->shape;
+}
+
+
+static void freeshape(toku_State *T, Shape *s) {
+    Shape *child = s->child;
+    while (child != NULL) { /* free all shapes extending 's' */
+        Shape *next = child->sibling;
+        freeshape(T, child);
+        child = next;
+    }
+    tokuM_freemem(T, s, sizeofshape(s->nkeys));
+}
+
+
+void tokuSH_freeshapes(toku_State *T, OClass *cls) {
+    if (cls->shape != NULL)
+        freeshape(T, cls->shape);
+}
+
+
+/* get slot index of 'key' in 's' or -1 if 's' does not have it */
+int32_t tokuSH_find(const Shape *s, OString *key) {
+    for (int32_t i = s->nkeys - 1; i >= 0; i--) {
+        if (s->keys[i] == key)
+            return i;
+    }
+    return -1;
+}
+
+
+/* get shape that extends 's' with 'key' (if any) */
+static Shape *findchild(const Shape *s, OString *key) {
+    Shape *child = s->child;
+    while (child != NULL && child->keys[s->nkeys] != key)
+        child = child->sibling;
+    return child;
+}
+
+
+static void freeslots(toku_State *T, Instance *ins) {
+    if (ins->slots != ins->inl) { /* slots are not inline? */
+        tokuM_freearray(T, ins->slots, cast_sizet(ins->sizeslots));
+        ins->slots = ins->inl;
+        ins->sizeslots = ins->ninline;
+    }
+}
+
+
+void tokuSH_freeinstance(toku_State *T, Instance *ins) {
+    freeslots(T, ins);
+    tokuM_freemem(T, ins, sizeofinstance(ins->ninline));
+}
+
+
+/* grow slots of 'ins' so it can hold at least one more field */
+static void growslots(toku_State *T, Instance *ins) {
+    int32_t size = ins->sizeslots;
+    int32_t newsize = (size < MINSLOTS) ? MINSLOTS : size * 2;
+    TValue *slots;
+    if (newsize > TOKUI_MAXSHAPEKEYS)
+        newsize = TOKUI_MAXSHAPEKEYS;
+    toku_assert(size < newsize);
+    if (ins->slots == ins->inl) { /* slots are inline? */
+        slots = tokuM_newarray(T, newsize, TValue);
+        for (int32_t i = 0; i < size; i++)
+            setobj(T, &slots[i], &ins->inl[i]);
+    } else
+        slots = cast(TValue *, tokuM_saferealloc(T, ins->slots,
+                                    cast_sizet(size) * sizeof(TValue),
+                                    cast_sizet(newsize) * sizeof(TValue)));
+    ins->slots = slots;
+    ins->sizeslots = newsize;
+}
+
+
+/*
+** Add new field 'key' with value 'v' to 'ins' by moving it to the
+** shape that extends its current shape with 'key'. Returns 0 if the
+** field cannot be added this way.
+*/
+static int32_t addfield(toku_State *T, Instance *ins, OString *key,
+                                                      const TValue *v) {
+    OClass *cls = ins->oclass;
+    Shape *s = ins->shape;
+    Shape *child = findchild(s, key);
+    int32_t n = s->nkeys;
+    if (child == NULL) { /* no such transition yet? */
+        if (n >= TOKUI_MAXSHAPEKEYS || cls->nshapes >= TOKUI_MAXSHAPES)
+            return 0; /* too many fields or shapes */
+        child = newshape(T, cls, s, key);
+    }
+    if (n >= ins->sizeslots) /* no free slot? */
+        growslots(T, ins);
+    setobj(T, &ins->slots[n], v);
+    ins->shape = child;
+    tokuG_barrierback(T, obj2gco(ins), v);
+    if (cls->nslots < n + 1) /* more fields than expected? */
+        cls->nslots = n + 1; /* new instances will get more inline slots */
+    return 1;
+}
+
+
+/*
+** Switch 'ins' into dictionary mode (if not already) and return its
+** fields table.
+*/
+Table *tokuSH_todict(toku_State *T, Instance *ins) {
+    Shape *s = ins->shape;
+    if (s != NULL) { /* have shape? */
+        Table *t = tokuH_new(T);
+        ins->fields = t; /* (GC marks both fields and slots until done) */
+        tokuG_objbarrier(T, ins, t);
+        tokuH_resize(T, t, cast_u32(s->nkeys));
+        for (int32_t i = 0; i < s->nkeys; i++) {
+            const TValue *v = &ins->slots[i];
+            if (!isempty(v)) { /* field not removed? */
+                TValue k;
+                setstrval(T, &k, s->keys[i]);
+                tokuH_set(T, t, &k, v);
+                tokuG_barrierback(T, obj2gco(t), v);
+            }
+        }
+        ins->shape = NULL;
+        freeslots(T, ins);
+    }
+    return ins->fields;
+}
+
+
+/* set 't' as fields table of 'ins' (switching it into dictionary mode) */
+void tokuSH_setdict(toku_State *T, Instance *ins, Table *t) {
+    ins->fields = t;
+    ins->shape = NULL;
+    freeslots(T, ins);
+    tokuG_objbarrier(T, ins, t);
+}
+
+
+static void dictset(toku_State *T, Table *t, const TValue *key,
+                                             const TValue *v) {
+    tokuH_set(T, t, key, v);
+    tokuG_barrierback(T, obj2gco(t), v);
+    invalidateTMcache(t);
+}
+
+
+/* get slot of short string 'key' in shaped 'ins' (or NULL) */
+t_sinline const TValue *getslot(const Instance *ins, OString *key) {
+    int32_t i = tokuSH_find(ins->shape, key);
+    return (i >= 0) ? &ins->slots[i] : NULL;
+}
+
+
+t_sinline uint8_t finishget(const TValue *slot, TValue *res) {
+    if (slot == NULL || isempty(slot))
+        return TOKU_VABSTKEY;
+    setobj(cast(toku_State *, NULL), res, slot);
+    return ttypetag(slot);
+}
+
+
+uint8_t tokuSH_getstr(Instance *ins, OString *key, TValue *res) {
+    if (isdict(ins))
+        return tokuH_getstr(ins->fields, key, res);
+    else if (strisshr(key))
+        return finishget(getslot(ins, key), res);
+    else /* long strings are never in slots */
+        return TOKU_VABSTKEY;
+}
+
+
+uint8_t tokuSH_getint(Instance *ins, toku_Integer key, TValue *res) {
+    if (isdict(ins))
+        return tokuH_getint(ins->fields, key, res);
+    else /* integers are never in slots */
+        return TOKU_VABSTKEY;
+}
+
+
+uint8_t tokuSH_get(Instance *ins, const TValue *key, TValue *res) {
+    if (isdict(ins))
+        return tokuH_get(ins->fields, key, res);
+    else if (ttisshrstring(key))
+        return finishget(getslot(ins, strval(key)), res);
+    else
+        return TOKU_VABSTKEY;
+}
+
+
+/*
+** WARNING: unlike the table functions, these functions also take care
+** of the GC barrier.
+*/
+void tokuSH_setstr(toku_State *T, Instance *ins, OString *key,
+                                                 const TValue *v) {
+    if (!isdict(ins) && strisshr(key)) {
+        TValue *slot = cast(TValue *, getslot(ins, key));
+        if (slot != NULL) { /* existing (or removed) field? */
+            setobj(T, slot, v);
+            tokuG_barrierback(T, obj2gco(ins), v);
+            return;
+        } else if (ttisnil(v) || addfield(T, ins, key, v))
+            return; /* done */
+        /* else switch into dictionary mode */
+    }
+    {
+        TValue k;
+        setstrval(T, &k, key);
+        dictset(T, tokuSH_todict(T, ins), &k, v);
+    }
+}
+
+
+void tokuSH_setint(toku_State *T, Instance *ins, toku_Integer key,
+                                                 const TValue *v) {
+    TValue k;
+    setival(&k, key);
+    dictset(T, tokuSH_todict(T, ins), &k, v);
+}
+
+
+void tokuSH_set(toku_State *T, Instance *ins, const TValue *key,
+                                              const TValue *v) {
+    if (ttisstring(key))
+        tokuSH_setstr(T, ins, strval(key), v);
+    else
+        dictset(T, tokuSH_todict(T, ins), key, v);
+}
+
+
+/*
+** Traversal step over the fields of 'ins' (see 'tokuH_step'); for
+** instances with a shape, the cursor is the slot index following
+** 'key'.
+*/
+uint32_t tokuSH_step(toku_State *T, Instance *ins, SPtr key, uint32_t c) {
+    const Shape *s = ins->shape;
+    int32_t i = 0;
+    if (isdict(ins))
+        return tokuH_step(T, ins->fields, key, c);
+    else if (!ttisnil(s2v(key))) { /* not the first iteration? */
+        if (0 < c && c <= cast_u32(s->nkeys) && ttisstring(s2v(key)) &&
+                s->keys[c - 1] == strval(s2v(key)))
+            i = cast_i32(c); /* cursor is valid */
+        else {
+            if (t_unlikely(!ttisshrstring(s2v(key)) ||
+                           (i = tokuSH_find(s, strval(s2v(key)))) < 0))
+                tokuD_runerror(T, "invalid key passed to 'nextfield'");
+            i++; /* next slot */
+        }
+    }
+    for (; i < s->nkeys; i++) {
+        if (!isempty(&ins->slots[i])) {
+            setstrval2s(T, key, s->keys[i]);
+            setobj2s(T, key + 1, &ins->slots[i]);
+            return cast_u32(i) + 1;
+        }
+    }
+    return 0;
+}
+
+
+int32_t tokuSH_next(toku_State *T, Instance *ins, SPtr key) {
+    return (tokuSH_step(T, ins, key, 0) != 0);
+}
+
+
+/* number of fields in 'ins' */
+int32_t tokuSH_len(const Instance *ins) {
+    if (isdict(ins))
+        return tokuH_len(ins->fields);
+    else {
+        int32_t len = 0;
+        for (int32_t i = 0; i < ins->shape->nkeys; i++)
+            len += !isempty(&ins->slots[i]);
+        return len;
+    }
+}
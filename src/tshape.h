@@ -0,0 +1,64 @@
+/*
+** tshape.h
+** Shapes (layout of instance fields)
+** See Copyright Notice in tokudae.h
+*/
+
+#ifndef tshape_h
+#define tshape_h
+
+#include "tobject.h"
+#include "tstate.h"
+
+
+/*
+** Maximum number of fields kept in slots; instance getting more
+** fields than this switches to dictionary mode.
+*/
+#if !defined(TOKUI_MAXSHAPEKEYS)
+#define TOKUI_MAXSHAPEKEYS      64
+#endif
+
+
+/*
+** Maximum number of shapes per class; instances that would need
+** more shapes switch to dictionary mode.
+*/
+#if !defined(TOKUI_MAXSHAPES)
+#define TOKUI_MAXSHAPES         512
+#endif
+
+
+#define sizeofshape(n) \
+        (offsetof(Shape, keys) + (cast_sizet(n) * sizeof(OString*)))
+
+#define sizeofinstance(n) \
+        (offsetof(Instance, inl) + (cast_sizet(n) * sizeof(TValue)))
+
+
+/* test if instance 'ins' is in dictionary mode */
+#define isdict(ins)     ((ins)->shape == NULL)
+
+
+TOKUI_FUNC Shape *tokuSH_root(toku_State *T, OClass *cls);
+TOKUI_FUNC void tokuSH_freeshapes(toku_State *T, OClass *cls);
+TOKUI_FUNC int32_t tokuSH_find(const Shape *s, OString *key);
+TOKUI_FUNC void tokuSH_freeinstance(toku_State *T, Instance *ins);
+TOKUI_FUNC uint8_t tokuSH_get(Instance *ins, const TValue *key, TValue *res);
+TOKUI_FUNC uint8_t tokuSH_getstr(Instance *ins, OString *key, TValue *res);
+TOKUI_FUNC uint8_t tokuSH_getint(Instance *ins, toku_Integer key,
+                                 TValue *res);
+TOKUI_FUNC void tokuSH_set(toku_State *T, Instance *ins, const TValue *key,
+                                                         const TValue *v);
+TOKUI_FUNC void tokuSH_setstr(toku_State *T, Instance *ins, OString *key,
+                                                            const TValue *v);
+TOKUI_FUNC void tokuSH_setint(toku_State *T, Instance *ins, toku_Integer key,
+                                                            const TValue *v);
+TOKUI_FUNC int32_t tokuSH_next(toku_State *T, Instance *ins, SPtr key);
+TOKUI_FUNC uint32_t tokuSH_step(toku_State *T, Instance *ins, SPtr key,
+                                                          uint32_t c);
+TOKUI_FUNC int32_t tokuSH_len(const Instance *ins);
+TOKUI_FUNC Table *tokuSH_todict(toku_State *T, Instance *ins);
+TOKUI_FUNC void tokuSH_setdict(toku_State *T, Instance *ins, Table *t);
+
+#endif
@@ -18,6 +18,7 @@
 #include "tdebug.h"
 #include "tfunction.h"
 #include "tgc.h"
+#include "tjit.h"
 #include "tmem.h"
 #include "tmeta.h"
 #include "tobject.h"
@@ -211,6 +212,9 @@ TOKU_API toku_State *toku_newstate(toku_Alloc falloc, void *ud, uint32_t seed) {
     gs->gcstop = GCSTP; /* no GC while creating state */
     gs->gcemergency = 0;
     gs->gccheck = 0;
+    gs->ichits = gs->icmisses = 0;
+    gs->jitthreshold = TOKUI_JITTHRESHOLD;
+    gs->jitstop = 0;
     gs->sweeppos = NULL;
     gs->fixed = gs->fin = gs->tobefin = NULL;
     gs->graylist = gs->grayagain = NULL;
@@ -224,6 +228,7 @@ TOKU_API toku_State *toku_newstate(toku_Alloc falloc, void *ud, uint32_t seed) {
     gs->mainthread = T;
     gs->twups = NULL;
     gs->fwarn = NULL; gs->ud_warn = NULL;
+    for (int32_t i = 0; i < ITER_NUM; i++) gs->iterf[i] = NULL;
     toku_assert(gs->totalbytes == sizeof(XSG) && gs->gcdebt == 0);
     if (tokuPR_rawcall(T, f_newstate, NULL) != TOKU_STATUS_OK) {
         freestate(T);
@@ -478,7 +483,7 @@ void tokuT_warning(toku_State *T, const char *msg, int32_t cont) {
 void tokuT_warnerror(toku_State *T, const char *where) {
     TValue *errobj = s2v(T->sp.p - 1);
     const char *msg = (ttisstring(errobj))
-                      ? getstr(strval(errobj))
+                      ? getstr(tokuS_flat(T, strval(errobj)))
                       : "error object is not a string";
     tokuT_warning(T, "error in ", 1);
     tokuT_warning(T, where, 1);
@@ -488,6 +493,18 @@ void tokuT_warnerror(toku_State *T, const char *where) {
 }
 
 
+/*
+** Register light C function 'f' as the builtin iterator 'what'. It must
+** behave exactly as the corresponding function of the basic library, as
+** 'foreach' loops over it step over the values directly (or count in
+** place for 'range') without calling it; NULL unregisters it.
+*/
+void tokuT_setiterator(toku_State *T, int32_t what, toku_CFunction f) {
+    toku_assert(0 <= what && what < ITER_NUM);
+    G(T)->iterf[what] = f;
+}
+
+
 void tokuT_free(toku_State *T, toku_State *T1) {
     XS *xs = fromstate(T1);
     tokuF_closeupval(T1, T1->stack.p);  /* close all upvalues */
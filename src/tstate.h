@@ -72,6 +72,7 @@ typedef struct toku_longjmp toku_longjmp; /* defined in 'tprotected.c' */
 #define CFST_HOOKED     (1<<2) /* call is running a debug hook */
 #define CFST_FIN        (1<<3) /* function "called" a finalizer */
 #define CFST_TAIL       (1<<4) /* call was tail called */
+#define CFST_NOSELF     (1<<5) /* results go to the slot below 'func' */
 
 typedef struct CallFrame {
     SIndex func; /* function stack index */
@@ -117,6 +118,16 @@ typedef struct StringTable {
 } StringTable;
 
 
+/*
+** Builtin iterators of the basic library, 'foreach' loops over them do
+** not call them (see 'tokuT_setiterator').
+*/
+#define ITER_FIELDS     0 /* iterator returned by 'fields' */
+#define ITER_INDICES    1 /* iterator returned by 'indices' */
+#define ITER_RANGE      2 /* function 'range' */
+#define ITER_NUM        3 /* number of builtin iterators */
+
+
 typedef struct GState {
     toku_Alloc falloc; /* allocator */
     void *ud_alloc; /* userdata for 'falloc' */
@@ -135,6 +146,10 @@ typedef struct GState {
     uint8_t gcemergency; /* true if this is emergency collection */
     uint8_t gcparams[TOKU_GCP_NUM]; /* GC options */
     uint8_t gccheck; /* true if collection was triggered since last check */
+    t_umem ichits; /* number of inline cache hits */
+    t_umem icmisses; /* number of inline cache misses */
+    int32_t jitthreshold; /* calls or iterations before compiling function */
+    uint8_t jitstop; /* control whether JIT is running */
     GCObject *objects; /* list of all collectable objects */
     GCObject **sweeppos; /* current position of sweep in list */
     GCObject *fin; /* list of objects that have finalizer */
@@ -152,6 +167,7 @@ typedef struct GState {
     OString *strcache[TOKUI_STRCACHE_N][TOKUI_STRCACHE_M]; /* string cache */
     toku_WarnFunction fwarn; /* warning function */
     void *ud_warn; /* userdata for 'fwarn' */
+    toku_CFunction iterf[ITER_NUM]; /* builtin iterators */
 } GState;
 
 /* }====================================================================== */
@@ -285,6 +301,8 @@ TOKUI_FUNC void tokuT_checkCstack(toku_State *T);
 TOKUI_FUNC int32_t tokuT_resetthread(toku_State *T, int32_t status);
 TOKUI_FUNC void tokuT_warning(toku_State *T, const char *msg, int32_t cont);
 TOKUI_FUNC void tokuT_warnerror(toku_State *T, const char *where);
+TOKUI_FUNC void tokuT_setiterator(toku_State *T, int32_t what,
+                                                 toku_CFunction f);
 TOKUI_FUNC void tokuT_free(toku_State *T, toku_State *thread);
 
 #endif
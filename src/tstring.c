@@ -129,6 +129,22 @@ void tokuS_resize(toku_State *T, int32_t nsz) {
 }
 
 
+/*
+** Grow string table so that 'n' more strings can be interned without
+** growing it again (see 'growtable').
+*/
+void tokuS_reserve(toku_State *T, int32_t n) {
+    StringTable *tab = &G(T)->strtab;
+    int32_t nsz = tab->size;
+    if (n > MAXSTRTABLE - tab->nuse) /* too many? */
+        n = MAXSTRTABLE - tab->nuse; /* reserve what is possible */
+    while (nsz < tab->nuse + n && nsz <= MAXSTRTABLE / 2)
+        nsz *= 2;
+    if (nsz > tab->size)
+        tokuS_resize(T, nsz);
+}
+
+
 void tokuS_init(toku_State *T) {
     GState *gs = G(T);
     StringTable *tab = &gs->strtab;
@@ -165,6 +181,72 @@ OString *tokuS_newlngstrobj(toku_State *T, size_t len) {
 }
 
 
+/* parts of flattened ropes are their flattened strings */
+#define ropepart(s) \
+        ((strisrope(s) && getrope(s)->left == NULL) ? getrope(s)->right : (s))
+
+
+/* create new rope for the concatenation of 'l' and 'r' */
+OString *tokuS_newrope(toku_State *T, OString *l, OString *r) {
+    GCObject *o = tokuG_new(T, sizeofrope, TOKU_VROPESTR);
+    OString *s = gco2str(o);
+    Rope *rope = getrope(s);
+    toku_assert(getstrlen(l) + getstrlen(r) >= TOKUI_MINROPELEN);
+    s->extra = 0;
+    s->shrlen = 0xFF;
+    s->hash = 0;
+    s->u.lnglen = getstrlen(l) + getstrlen(r);
+    rope->left = ropepart(l);
+    rope->right = ropepart(r);
+    return s;
+}
+
+
+/*
+** Copy contents of 's' into 'buff'. Only the shorter part of each rope
+** is copied recursively, so the recursion depth is at most the base-2
+** logarithm of the length of 's'.
+*/
+static void copyrope(const OString *s, char *buff) {
+    while (strisrope(s)) {
+        const Rope *rope = getrope(s);
+        if (rope->left == NULL) /* flattened? */
+            s = rope->right;
+        else {
+            size_t ll = getstrlen(rope->left);
+            if (ll <= getstrlen(rope->right)) { /* left part is shorter? */
+                copyrope(rope->left, buff);
+                buff += ll;
+                s = rope->right;
+            } else {
+                copyrope(rope->right, buff + ll);
+                s = rope->left;
+            }
+        }
+    }
+    memcpy(buff, getstr(s), getstrlen(s) * sizeof(char));
+}
+
+
+/*
+** Flatten rope 's', returning the long string with its contents. This
+** is the only way of getting the contents of a rope, the string is kept
+** in the rope, so a rope is copied at most once. (Flattened ropes do not
+** need 'T'.)
+*/
+OString *tokuS_flatten(toku_State *T, OString *s) {
+    Rope *rope = getrope(s);
+    if (rope->left != NULL) { /* not yet flattened? */
+        OString *fs = tokuS_newlngstrobj(T, s->u.lnglen);
+        copyrope(s, getlngstr(fs));
+        rope->left = NULL; /* parts are no longer needed */
+        rope->right = fs;
+        tokuG_objbarrier(T, s, fs);
+    }
+    return rope->right;
+}
+
+
 void tokuS_remove(toku_State *T, OString *s) {
     StringTable *tab = &G(T)->strtab;
     OString **pp = &tab->hash[tmod(s->hash, cast_u32(tab->size))];
@@ -649,6 +731,7 @@ const char *tokuS_pushvfstring(toku_State *T, const char *fmt, va_list argp) {
     }
     buffaddstring(&buff, fmt, strlen(fmt));
     pushbuff(&buff);
+    tokuS_flatvalue(T, s2v(T->sp.p - 1)); /* (result might be a rope) */
     return getstr(strval(s2v(T->sp.p - 1)));
 }
 
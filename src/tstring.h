@@ -23,6 +23,21 @@
         (offsetof(OString, bytes) + ((l) + 1)*sizeof(char))
 
 
+/* size of 'OString' object of a rope */
+#define sizeofrope      (offsetof(OString, bytes) + sizeof(Rope))
+
+
+/* get string 's' with its contents (flattening it if it is a rope) */
+#define tokuS_flat(T,s)     (strisrope(s) ? tokuS_flatten(T, s) : (s))
+
+
+/* replace rope in value 'o' (if any) with its flattened string */
+#define tokuS_flatvalue(T,o) \
+    { TValue *fo_ = (o); \
+      if (t_unlikely(ttisropestring(fo_))) \
+          setstrval(T, fo_, tokuS_flatten(T, strval(fo_))); }
+
+
 /* create new string from literal 'lit' */
 #define tokuS_newlit(T, lit)    tokuS_newl(T, "" lit, t_arraysize(lit) - 1)
 
@@ -51,8 +66,11 @@ TOKUI_FUNC void tokuS_clearcache(GState *gs);
 TOKUI_FUNC uint32_t tokuS_hash(const char *str, size_t len, uint32_t seed);
 TOKUI_FUNC uint32_t tokuS_hashlngstr(OString *s);
 TOKUI_FUNC void tokuS_resize(toku_State *T, int32_t nsz);
+TOKUI_FUNC void tokuS_reserve(toku_State *T, int32_t n);
 TOKUI_FUNC void tokuS_init(toku_State *T);
 TOKUI_FUNC OString *tokuS_newlngstrobj(toku_State *T, size_t len);
+TOKUI_FUNC OString *tokuS_newrope(toku_State *T, OString *l, OString *r);
+TOKUI_FUNC OString *tokuS_flatten(toku_State *T, OString *s);
 TOKUI_FUNC void tokuS_remove(toku_State *T, OString *s);
 TOKUI_FUNC OString *tokuS_new(toku_State *T, const char *str);
 TOKUI_FUNC OString *tokuS_newl(toku_State *T, const char *str, size_t len);
@@ -258,12 +258,27 @@ static void auxjoinstr(tokuL_Buffer *B, const char *s, size_t l,
 }
 
 
+/* get contents of string or string builder at index 'idx' (or NULL) */
+static const char *tojoin(toku_State *T, int32_t idx, size_t *l) {
+    const char *s = toku_to_lstring(T, idx, l);
+    if (s == NULL && toku_type(T, idx) == TOKU_T_USERDATA) {
+        const tokuL_StrBuilder *sb = cast(const tokuL_StrBuilder *,
+                tokuL_test_userdata(T, idx, TOKU_STRBUILDER));
+        if (sb != NULL) { /* string builder? */
+            *l = sb->n;
+            s = sb->b;
+        }
+    }
+    return s;
+}
+
+
 static void joinfromtable(toku_State *T, tokuL_Buffer *B,
                           const char *sep, size_t lsep) {
     toku_push_nil(T);
     while (toku_nextfield(T, 1) != 0) {
         size_t l;
-        const char *s = toku_to_lstring(T, -1, &l);
+        const char *s = tojoin(T, -1, &l);
         int32_t pop = 1; /* value */
         if (s && l > 0) {
             toku_push(T, -3); /* push buffer */
@@ -281,7 +296,7 @@ static void joinfromlist(toku_State *T, tokuL_Buffer *B,
         size_t l;
         const char *s;
         toku_get_index(T, 1, i);
-        s = toku_to_lstring(T, -1, &l);
+        s = tojoin(T, -1, &l);
         toku_pop(T, 1);
         if (s && l > 0)
             auxjoinstr(B, s, l, sep, lsep);
@@ -554,9 +569,10 @@ static void addlenmod(char *form, const char *lenmod) {
 }
 
 
-static int32_t formatstr(toku_State *T, const char *fmt, size_t lfmt) {
+/* format values after index 'arg' with format 'fmt' ('arg' is its index) */
+static int32_t formatstr(toku_State *T, const char *fmt, size_t lfmt,
+                                        int32_t arg) {
     int32_t top = toku_gettop(T);
-    int32_t arg = 0;
     const char *efmt = fmt + lfmt;
     const char *flags;
     tokuL_Buffer B;
@@ -671,7 +687,7 @@ static int32_t s_fmt(toku_State *T) {
         toku_push_literal(T, "");
         return 1;
     }
-    return formatstr(T, fmt, lfmt);
+    return formatstr(T, fmt, lfmt, 0);
 }
 
 /* }====================================================== */
@@ -1076,7 +1092,9 @@ static int32_t writer(toku_State *T, const void *b, size_t size, void *ud) {
 
 static int32_t s_dump(toku_State *T) {
     struct s_Writer state;
-    int32_t strip = toku_to_bool(T, 1);
+    int32_t strip = toku_to_bool(T, 1) ? TOKU_DUMP_STRIP : 0;
+    if (toku_to_bool(T, 2)) /* mapped format? */
+        strip |= TOKU_DUMP_MAPPED;
     tokuL_check_arg(T, toku_type(T, 0) == TOKU_T_FUNCTION &&
                        !toku_is_cfunction(T, 0), 0,
                        "Tokudae function expected");
@@ -1552,9 +1570,261 @@ static int32_t s_unpack(toku_State *T) {
 
 /* }===================================================================== */
 
+/* {=====================================================================
+** STRING BUILDER
+** ====================================================================== */
+
+/*
+** String builders keep their contents in a block from the allocator of
+** the state, which grows at least by half of its size, so appending 'n'
+** bytes in total takes O(n) time. The string made from the contents is
+** kept as the user value of the builder and returned again while the
+** contents do not change.
+*/
+
+typedef struct StrBuilder {
+    tokuL_StrBuilder sb;
+    int32_t cached; /* true if user value is the string of the contents */
+} StrBuilder;
+
+
+/* minimum size of the contents block */
+#define SBMINSIZE       32
+
+
+#define checkbuilder(T,i) \
+        cast(StrBuilder *, tokuL_check_userdata(T, i, TOKU_STRBUILDER))
+
+
+static void sbresize(toku_State *T, tokuL_StrBuilder *sb, size_t newsz) {
+    void *ud;
+    toku_Alloc falloc = toku_getallocf(T, &ud);
+    void *newblock = falloc(sb->b, ud, sb->sz, newsz);
+    if (t_unlikely(newblock == NULL && newsz > 0)) {
+        toku_push_literal(T, "out of memory");
+        toku_error(T);
+    }
+    sb->b = cast_charp(newblock);
+    sb->sz = newsz;
+}
+
+
+/* return space for 'l' more bytes at the end of the contents of 'sb' */
+static char *sbprep(toku_State *T, StrBuilder *sb, size_t l) {
+    sb->cached = 0; /* contents will change */
+    if (sb->sb.sz - sb->sb.n < l) { /* not enough space? */
+        size_t newsz = (sb->sb.sz / 2) * 3; /* 1.5x size */
+        if (t_unlikely(TOKU_MAXSIZE - l < sb->sb.n)) /* would overflow? */
+            tokuL_error(T, "string builder too large");
+        if (newsz < sb->sb.n + l)
+            newsz = sb->sb.n + l;
+        if (newsz < SBMINSIZE)
+            newsz = SBMINSIZE;
+        sbresize(T, &sb->sb, newsz);
+    }
+    return sb->sb.b + sb->sb.n;
+}
+
+
+static void sbaddlstring(toku_State *T, StrBuilder *sb, const char *s,
+                                                        size_t l) {
+    if (l > 0) { /* avoid 'memcpy' with NULL */
+        memcpy(sbprep(T, sb, l), s, l * sizeof(char));
+        sb->sb.n += l;
+    }
+}
+
+
+/* append value at index 'arg' (string, number or string builder) */
+static void sbaddvalue(toku_State *T, StrBuilder *sb, int32_t arg) {
+    size_t l;
+    const char *s = toku_to_lstring(T, arg, &l);
+    if (s != NULL) /* string? */
+        sbaddlstring(T, sb, s, l);
+    else if (toku_type(T, arg) == TOKU_T_NUMBER) {
+        char numbuff[TOKU_N2SBUFFSZ];
+        l = toku_numbertocstring(T, arg, numbuff) - 1; /* (without '\0') */
+        sbaddlstring(T, sb, numbuff, l);
+    } else {
+        const tokuL_StrBuilder *o = cast(const tokuL_StrBuilder *,
+                tokuL_test_userdata(T, arg, TOKU_STRBUILDER));
+        tokuL_expect_arg(T, o != NULL, arg, "string/number/StringBuilder");
+        if ((l = o->n) > 0) {
+            char *p = sbprep(T, sb, l);
+            memcpy(p, o->b, l * sizeof(char)); /* ('o' may be 'sb') */
+            sb->sb.n += l;
+        }
+    }
+}
+
+
+static int32_t sb_append(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    int32_t top = toku_gettop(T);
+    for (int32_t i = 1; i <= top; i++)
+        sbaddvalue(T, sb, i);
+    toku_setntop(T, 1);
+    return 1; /* return builder */
+}
+
+
+static int32_t sb_appendf(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    size_t lfmt, l;
+    const char *fmt = tokuL_check_lstring(T, 1, &lfmt);
+    const char *s;
+    formatstr(T, fmt, lfmt, 1);
+    s = toku_to_lstring(T, -1, &l);
+    sbaddlstring(T, sb, s, l);
+    toku_setntop(T, 1);
+    return 1; /* return builder */
+}
+
+
+static int32_t sb_appendbytes(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    int32_t n = toku_gettop(T); /* number of bytes */
+    if (n > 0) {
+        char *p = sbprep(T, sb, cast_sizet(n));
+        for (int32_t i = 1; i <= n; i++) {
+            toku_Unsigned c = t_castS2U(tokuL_check_integer(T, i));
+            tokuL_check_arg(T, c <= cast_u32(UCHAR_MAX), i,
+                               "value out of range");
+            p[i - 1] = cast_char(uchar(c));
+        }
+        sb->sb.n += cast_sizet(n);
+    }
+    toku_setntop(T, 1);
+    return 1; /* return builder */
+}
+
+
+static int32_t sb_rep(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    size_t l, lsep;
+    const char *s = tokuL_check_lstring(T, 1, &l);
+    toku_Integer n = tokuL_check_integer(T, 2);
+    const char *sep = tokuL_opt_lstring(T, 3, "", &lsep);
+    if (n > 0) {
+        size_t totalsize;
+        char *p;
+        if (l + lsep < l || TOKU_MAXSIZE / cast_sizet(n) < l + lsep)
+            tokuL_error(T, "resulting string too large");
+        totalsize = (cast_sizet(n) * (l + lsep)) - lsep;
+        p = sbprep(T, sb, totalsize);
+        while (n-- > 1) {
+            memcpy(p, s, l * sizeof(char)); p += l;
+            if (lsep > 0) {
+                memcpy(p, sep, lsep * sizeof(char));
+                p += lsep;
+            }
+        }
+        memcpy(p, s, l * sizeof(char)); /* last copy without separator */
+        sb->sb.n += totalsize;
+    }
+    toku_setntop(T, 1);
+    return 1; /* return builder */
+}
+
+
+static int32_t sb_len(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    toku_push_integer(T, cast_Integer(sb->sb.n));
+    return 1;
+}
+
+
+static int32_t sb_clear(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    sb->sb.n = 0; /* (keep the block for new contents) */
+    sb->cached = 0;
+    toku_setntop(T, 1);
+    return 1; /* return builder */
+}
+
+
+static int32_t sb_tostring(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    if (!sb->cached) { /* contents changed? */
+        toku_push_lstring(T, (sb->sb.n > 0) ? sb->sb.b : "", sb->sb.n);
+        toku_set_uservalue(T, 0, 0);
+        sb->cached = 1;
+    }
+    toku_get_uservalue(T, 0, 0);
+    return 1;
+}
+
+
+static int32_t sb_gc(toku_State *T) {
+    StrBuilder *sb = checkbuilder(T, 0);
+    sbresize(T, &sb->sb, 0);
+    sb->sb.n = 0;
+    sb->cached = 0;
+    return 0;
+}
+
+
+static const tokuL_Entry sb_methods[] = {
+    {"append", sb_append},
+    {"appendf", sb_appendf},
+    {"appendbytes", sb_appendbytes},
+    {"rep", sb_rep},
+    {"len", sb_len},
+    {"clear", sb_clear},
+    {"tostring", sb_tostring},
+    {NULL, NULL}
+};
+
+
+static int32_t sb_getidx(toku_State *T) {
+    checkbuilder(T, 0);
+    tokuL_get_metafield(T, 0, "__methods");
+    toku_push(T, 1); /* get index value */
+    if (toku_get_field(T, -2) != TOKU_T_NIL)
+        toku_push_boundmethod(T, 0);
+    return 1;
+}
+
+
+static const tokuL_Entry sb_meta[] = {
+    {"__getidx", sb_getidx},
+    {"__gc", sb_gc},
+    {"__tostring", sb_tostring},
+    {NULL, NULL}
+};
+
+
+static int32_t s_builder(toku_State *T) {
+    toku_Integer size = tokuL_opt_integer(T, 0, 0);
+    StrBuilder *sb;
+    tokuL_check_arg(T, 0 <= size, 0, "negative size");
+    sb = cast(StrBuilder *, toku_push_userdata(T, sizeof(*sb), 1));
+    sb->sb.b = NULL;
+    sb->sb.n = sb->sb.sz = 0;
+    sb->cached = 0;
+    tokuL_set_metatable(T, TOKU_STRBUILDER);
+    if (size > 0) /* preallocate contents? */
+        sbresize(T, &sb->sb, cast_sizet(size));
+    return 1;
+}
+
+
+static void create_metatable(toku_State *T) {
+    tokuL_new_metatable(T, TOKU_STRBUILDER); /* metatable for builders */
+    tokuL_set_funcs(T, sb_meta, 0); /* add metamethods to metatable */
+    tokuL_push_libtable(T, sb_methods); /* create methods table */
+    tokuL_set_funcs(T, sb_methods, 0); /* add methods to methods table */
+    toku_set_field_str(T, -2, "__methods"); /* metatable.__methods = m. tab. */
+    toku_pop(T, 1); /* remove metatable */
+}
+
+/* }===================================================================== */
+
+
 static const tokuL_Entry strlib[] = {
     {"split", s_split},
     {"rsplit", s_rsplit},
+    {"builder", s_builder},
     {"startswith", s_startswith},
     {"reverse", s_reverse},
     {"repeat", s_repeat},
@@ -1622,5 +1892,6 @@ static void set_string_bytes(toku_State *T) {
 int32_t tokuopen_string(toku_State *T) {
     tokuL_push_lib(T, strlib);
     set_string_bytes(T);
+    create_metatable(T);
     return 1;
 }
@@ -13,6 +13,7 @@
 #endif
 
 
+#include <limits.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -36,42 +37,234 @@ static size_t posrelStart(toku_Integer pos, size_t len) {
 }
 
 
+/*
+** {======================================================================
+** SUBSTRING SEARCH
+** =======================================================================
+*/
+
+/*
+** Needles up to this length are found by filtering the positions where
+** both their first and last bytes match and comparing the rest; this
+** takes at most TOKU_SHORTNEEDLE steps per byte of the subject. Longer
+** needles use the Two-Way algorithm (Crochemore-Perrin), which takes
+** linear time in the worst case and usually skips most of the subject.
+** Both search in either direction.
+*/
+#if !defined(TOKU_SHORTNEEDLE)
+#define TOKU_SHORTNEEDLE    32
+#endif
+
+
+#if defined(__SSE2__)                                   /* { */
+
+#include <emmintrin.h>
+
+#if defined(__GNUC__) && !defined(TOKU_NOBUILTIN)
+#define lowbit(m)       cast_u32(__builtin_ctz(m))
+#define highbit(m)      cast_u32(31 - __builtin_clz(m))
+#else
+static uint32_t lowbit(uint32_t m) {
+    uint32_t i = 0;
+    toku_assert(m != 0);
+    while (!(m & 1u)) { m >>= 1; i++; }
+    return i;
+}
+
+static uint32_t highbit(uint32_t m) {
+    uint32_t i = 0;
+    toku_assert(m != 0);
+    while (m >>= 1) i++;
+    return i;
+}
+#endif
+
+#define VBYTES      16
+
+/*
+** Set bit 'i' of the result if the needle with first byte 'f' and last
+** byte 'l' (length 'lp') can start at 's + i'.
+*/
+t_sinline uint32_t candidates(const char *s, size_t lp, __m128i f,
+                              __m128i l) {
+    __m128i bf = _mm_loadu_si128(cast(const __m128i *, cast_voidp(s)));
+    __m128i bl = _mm_loadu_si128(cast(const __m128i *,
+                                      cast_voidp(s + lp - 1)));
+    return cast_u32(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, f),
+                                                    _mm_cmpeq_epi8(bl, l))));
+}
+
+#endif                                                  /* } */
+
+
+/* check whether 'p' (of length 'lp') is at 's' ('s' ends as 'p' ends) */
+#define restmatch(s,p,lp) \
+    ((lp) <= 2 || memcmp((s) + 1, (p) + 1, (lp) - 2) == 0)
+
+
+/* find first occurrence of short needle 'p' in 's' */
 static const char *sfind(const char *s, size_t l, const char *p, size_t lp) {
+    size_t n = l - lp + 1; /* number of positions where 'p' can start */
+    int32_t last = uchar(p[lp - 1]);
     const char *aux;
-    lp--; /* 'memchr' checks the first char */
-    l -= lp; /* 'p' cannot be found after that */
-    while (l > 0 && (aux = (const char *)memchr(s, *p, l)) != NULL) {
-        aux++; /* skip first char (already checked) */
-        if (memcmp(aux, p+1, lp) == 0)
-            return aux-1; /* found */
-        else {
-            l -= cast_diff2sz(aux-s);
-            s = aux;
+#if defined(VBYTES)
+    __m128i vf = _mm_set1_epi8(p[0]);
+    __m128i vl = _mm_set1_epi8(p[lp - 1]);
+    for (; n >= VBYTES; n -= VBYTES, s += VBYTES) {
+        uint32_t m = candidates(s, lp, vf, vl);
+        for (; m != 0; m &= m - 1) {
+            aux = s + lowbit(m);
+            if (restmatch(aux, p, lp))
+                return aux; /* found */
         }
     }
+#endif
+    while (n > 0 && (aux = cast(const char *, memchr(s, *p, n))) != NULL) {
+        if (uchar(aux[lp - 1]) == last && restmatch(aux, p, lp))
+            return aux; /* found */
+        n -= cast_diff2sz(aux - s) + 1;
+        s = aux + 1;
+    }
     return NULL; /* not found */
 }
 
 
-static const char *rsfind(const char *s, size_t l, const char *p, size_t lp) {
-    const char *start = (s + l) - lp;
-    lp--; /* first char is checked */
-    while (start >= s) {
-        if (*start == *p && memcmp(start + 1, p + 1, lp) == 0)
-            return start;
-        start--;
+/* find last occurrence of short needle 'p' in 's' */
+static const char *rsfind(const char *s, size_t l, const char *p,
+                          size_t lp) {
+    size_t n = l - lp + 1; /* number of positions where 'p' can start */
+    int32_t first = uchar(p[0]);
+    int32_t last = uchar(p[lp - 1]);
+#if defined(VBYTES)
+    __m128i vf = _mm_set1_epi8(p[0]);
+    __m128i vl = _mm_set1_epi8(p[lp - 1]);
+    for (; n >= VBYTES; n -= VBYTES) {
+        const char *b = s + (n - VBYTES);
+        uint32_t m = candidates(b, lp, vf, vl);
+        for (; m != 0; m &= ~(1u << highbit(m))) {
+            const char *aux = b + highbit(m);
+            if (restmatch(aux, p, lp))
+                return aux; /* found */
+        }
+    }
+#endif
+    while (n > 0) {
+        const char *aux = s + --n;
+        if (uchar(*aux) == first && uchar(aux[lp - 1]) == last &&
+                restmatch(aux, p, lp))
+            return aux; /* found */
+    }
+    return NULL; /* not found */
+}
+
+
+/*
+** Byte 'i' of 'x' (of length 'n') in the direction of the search; the
+** reverse search is a forward search over the reversed subject and
+** needle.
+*/
+#define at(x,n,i)       uchar(rev ? (x)[(n) - 1 - (i)] : (x)[i])
+
+
+/*
+** Compute the critical position of needle 'p' (where its maximal suffix
+** starts) for the byte order given by 'inv' and set '*per' to the
+** period of that suffix.
+*/
+t_sinline size_t maxsuffix(const char *p, size_t lp, int32_t rev,
+                           int32_t inv, size_t *per) {
+    size_t ip = ~cast_sizet(0); /* suffix starts at 'ip + 1' (wraps) */
+    size_t jp = 0; /* candidate suffix starts at 'jp + 1' */
+    size_t k = 1;
+    *per = 1;
+    while (jp + k < lp) {
+        int32_t a = at(p, lp, ip + k);
+        int32_t b = at(p, lp, jp + k);
+        if (a == b) {
+            if (k == *per) { jp += *per; k = 1; }
+            else k++;
+        } else if (inv ? (a < b) : (a > b)) {
+            jp += k; k = 1;
+            *per = jp - ip;
+        } else {
+            ip = jp++;
+            k = *per = 1;
+        }
+    }
+    return ip + 1;
+}
+
+
+/*
+** Find first occurrence (last, if 'rev') of needle 'p' in 's' with the
+** Two-Way algorithm. The needle is split at its critical position: the
+** right part is compared first, and a mismatch there shifts the window
+** past it; a mismatch in the left part shifts the window by the period
+** of the needle. For periodic needles, the part that is known to match
+** after a shift ('mem') is not compared again. While nothing is known,
+** the last byte of the window also shifts it as in Horspool.
+*/
+t_sinline const char *twoway(const char *s, size_t l, const char *p,
+                             size_t lp, int32_t rev) {
+    uint8_t skip[UCHAR_MAX + 1]; /* shift for the last byte of window */
+    size_t per, per2, mem0, mem = 0;
+    size_t crit = maxsuffix(p, lp, rev, 0, &per);
+    size_t crit2 = maxsuffix(p, lp, rev, 1, &per2);
+    size_t h = 0; /* window position */
+    size_t i;
+    if (crit2 > crit) { crit = crit2; per = per2; }
+    for (i = 0; i < crit && at(p, lp, i) == at(p, lp, i + per); i++);
+    if (i == crit) /* left part repeats with the period? (periodic) */
+        mem0 = lp - per;
+    else {
+        mem0 = 0;
+        per = ((crit - 1 > lp - crit) ? crit - 1 : lp - crit) + 1;
+    }
+    memset(skip, cast_i32(lp < UCHAR_MAX ? lp : UCHAR_MAX), sizeof(skip));
+    for (i = 0; i < lp; i++) {
+        size_t d = lp - 1 - i;
+        skip[at(p, lp, i)] = cast_u8(d < UCHAR_MAX ? d : UCHAR_MAX);
+    }
+    while (h <= l - lp) {
+        size_t k;
+        if (mem == 0 && (k = skip[at(s, l, h + lp - 1)]) != 0) {
+            h += k; /* last byte does not match */
+            continue;
+        }
+        for (k = (crit > mem) ? crit : mem;
+             k < lp && at(p, lp, k) == at(s, l, h + k); k++);
+        if (k < lp) { /* mismatch in the right part? */
+            h += k - crit + 1;
+            mem = 0;
+            continue;
+        }
+        for (k = crit; k > mem && at(p, lp, k - 1) == at(s, l, h + k - 1);
+             k--);
+        if (k <= mem) /* left part matches too? */
+            return rev ? s + (l - h - lp) : s + h; /* found */
+        h += per;
+        mem = mem0;
     }
     return NULL; /* not found */
 }
 
+#undef at
+
 
-/* find pattern 'pat' in 's' */
+/* find pattern 'pat' in 's' (last occurrence, if 'rev') */
 static const char *findstr(const char *s, size_t l,
                            const char *pat, size_t lpat, int rev) {
     if (lpat == 0) return s; /* empty strings match everything */
     else if (l < lpat) return NULL; /* avoid negative 'l' */
-    else return (!rev) ? sfind(s, l, pat, lpat) : rsfind(s, l, pat, lpat);
+    else if (lpat <= TOKU_SHORTNEEDLE)
+        return (!rev) ? sfind(s, l, pat, lpat) : rsfind(s, l, pat, lpat);
+    else if (!rev)
+        return twoway(s, l, pat, lpat, 0);
+    else
+        return twoway(s, l, pat, lpat, 1);
 }
 
+/* }====================================================================== */
+
 
 #endif
@@ -10,6 +10,7 @@
 #include "tokudaeprefix.h"
 
 #include <math.h>
+#include <string.h>
 
 #include "tstring.h"
 #include "ttable.h"
@@ -21,6 +22,7 @@
 #include "tdebug.h"
 #include "tobject.h"
 #include "tobject.h"
+#include "tprotected.h"
 #include "tstate.h"
 
 
@@ -34,36 +36,35 @@
 /*
 ** MAXHSIZE is the maximum size of the hash array. It is the minimum
 ** between 2^MAXHBITS and the maximum size such that, measured in bytes,
-** it fits in a 'size_t'.
+** it fits in a 'size_t'. (Open-addressing hash part also has a control
+** byte for each node, so it takes only half of that.)
 */
+#if defined(TOKUI_SWISSTABLE)
+#define MAXHSIZE        (cast_sizet(tokuM_limitN(1 << MAXHBITS, Node)) / 2)
+#else
 #define MAXHSIZE        cast_sizet(tokuM_limitN(1 << MAXHBITS, Node))
+#endif
 
 
 /*
-** MINHSIZE is the minimum size for the hash array.
+** MAXABITS is the largest integer such that 2^MAXABITS fits in a
+** signed int32_t.
 */
-#define MINHSIZE        4
+#define MAXABITS        cast_i32(sizeof(int32_t) * CHAR_BIT - 2)
 
 
 /*
-** When the original hash value is good, hashing by a power of 2
-** avoids the cost of '%'.
+** MAXASIZE is the maximum size of the array part. It is the minimum
+** between 2^MAXABITS and the maximum size that, measured in bytes,
+** fits in a 'size_t'.
 */
-#define hashpow2(t,h)       htnode(t, tmod(h, htsize(t)))
+#define MAXASIZE        cast_u32(tokuM_limitN(1 << MAXABITS, TValue))
 
 
 /*
-** For other types, it is better to avoid modulo by power of 2, as
-** they can have many 2 factors.
+** MINHSIZE is the minimum size for the hash array.
 */
-#define hashmod(t,n)        (htnode(t, ((n) % ((htsize(t)-1u)|1u))))
-
-
-#define hashstr(t,s)       hashpow2(t, (s)->hash)
-#define hashboolean(t,b)   hashpow2(t, b)
-
-
-#define hashpointer(t,p)   hashmod(t, pointer2u32(p))
+#define MINHSIZE        4
 
 
 /*
@@ -91,21 +92,6 @@ static const Node dummynode_ = {
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
-/*
-** Hash for integers. To allow a good hash, use the remainder operator
-** ('%'). If integer fits as a non-negative int32_t, compute an int32_t
-** remainder, which is faster. Otherwise, use an unsigned-integer
-** remainder, which uses all bits and ensures a non-negative result.
-*/
-static Node *hashint(const Table *t, toku_Integer i) {
-    toku_Unsigned ui = t_castS2U(i);
-    if (ui <= cast_Unsigned(INT_MAX))
-        return htnode(t, cast_i32(ui) % cast_i32((htsize(t)-1) | 1));
-    else
-        return hashmod(t, ui);
-}
-
-
 /*
 ** Hash for floating-point numbers.
 ** The main computation should be just
@@ -134,6 +120,444 @@ static uint32_t t_hashfloat(toku_Number n) {
 #endif
 
 
+/*
+** Check whether key 'k' is equal to the key in node 'n'. This
+** equality is raw, so there are no metamethods. Floats with integer
+** values have been normalized, so integers cannot be equal to
+** floats. It is assumed that 'eqshrstr' is simply pointer equality, so
+** that short strings are handled in the default case.
+** A true 'deadok' means to accept dead keys as equal to their original
+** values. All dead keys are compared in the default case, by pointer
+** identity. (Only collectable objects can produce dead keys.) Note that
+** dead long strings are also compared by identity.
+** Once a key is dead, its corresponding value may be collected, and
+** then another value can be created with the same address. If this
+** other value is given to 'next', 'eqkey' will signal a false
+** positive. In a regular traversal, this situation should never happen,
+** as all keys given to 'next' came from the table itself, and therefore
+** could not have been collected. Outside a regular traversal, we
+** have garbage in, garbage out. What is relevant is that this false
+** positive does not break anything. (In particular, 'next' will return
+** some other valid item on the table or nil.)
+*/
+static int32_t eqkey(const TValue *k, const Node *n, int32_t deadok) {
+    if ((rawtt(k) != keytt(n)) && /* not the same variant? */
+            !(deadok && keyisdead(n) && iscollectable(k)))
+        return 0;
+    else if (keyisdead(n)) /* dead key (its object may be already gone)? */
+        return (gcoval(k) == keygcoval(n));
+    switch (ttypetag(k)) {
+        case TOKU_VNIL: case TOKU_VTRUE: case TOKU_VFALSE:
+            return 1;
+        case TOKU_VNUMINT:
+            return (ival(k) == keyival(n));
+        case TOKU_VNUMFLT:
+            return tokui_numeq(fval(k), keyfval(n));
+        case TOKU_VLIGHTUSERDATA:
+            return (pval(k) == keypval(n));
+        case TOKU_VLCF:
+            return (lcfval(k) == keycfval(n));
+        case TOKU_VSHRSTR:
+            return eqshrstr(strval(k), keystrval(n));
+        case TOKU_VLNGSTR:
+            return tokuS_eqlngstr(strval(k), keystrval(n));
+        default: /* rest of the objects are compared by pointer identity */
+            toku_assert(iscollectable(k));
+            return (gcoval(k) == keygcoval(n));
+    }
+}
+
+
+t_sinline void initnode(Node *n) {
+    nodenext(n) = 0;
+    setnilkey(n);
+    setemptyval(nodeval(n));
+}
+
+
+#if defined(TOKUI_SWISSTABLE)                           /* { */
+
+/*
+** {=============================================================
+** Hash part (open addressing)
+** ==============================================================
+*/
+
+/*
+** The hash part is an array of nodes followed by an array of control
+** bytes, one for each node. The control byte of a node that never held
+** a key is CTRL_EMPTY, otherwise it holds the low 7 bits of the key
+** hash (H2). Nodes are probed in groups of GROUPWIDTH control bytes,
+** which are compared against H2 all at once (using SSE2, NEON or a
+** plain 64-bit word), so that nodes whose keys cannot match are never
+** touched. The rest of the hash (H1) selects the first group; other
+** groups are visited in triangular steps (which visits every group)
+** until a group with an empty node is found. Removed fields keep their
+** keys, so that traversals can go on past them, and act as tombstones:
+** their nodes stay taken until the next rehash drops them. When the
+** hash part is smaller than a group, control bytes past its end are
+** CTRL_PAD, which never matches H2 nor CTRL_EMPTY.
+*/
+
+#define CTRL_EMPTY      0x80
+#define CTRL_PAD        0xFF
+
+#define hashh1(h)       ((h) >> 7)
+#define hashh2(h)       cast_u8((h) & 0x7f)
+
+
+#if defined(__GNUC__) && !defined(TOKU_NOBUILTIN)
+#define lowbit(m)       cast_u32(__builtin_ctzll(m))
+#else
+static uint32_t lowbit(uint64_t m) {
+    uint32_t i = 0;
+    toku_assert(m != 0);
+    while (!(m & 1u)) { m >>= 1; i++; }
+    return i;
+}
+#endif
+
+
+#if defined(__SSE2__)                                   /* { */
+
+#include <emmintrin.h>
+
+#define GROUPBITS       4
+
+typedef uint32_t GroupMask;
+
+/* set bit 'i' of the result if control byte 'i' in group 'g' is 'b' */
+t_sinline GroupMask matchbyte(const uint8_t *g, uint8_t b) {
+    __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, cast_voidp(g)));
+    __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, b)));
+    return cast_u32(_mm_movemask_epi8(eq));
+}
+
+#define matchempty(g)   matchbyte(g, CTRL_EMPTY)
+
+/* index of the first matching control byte in mask 'm' */
+#define maskslot(m)     lowbit(m)
+
+#else                                                   /* }{ */
+
+#define GROUPBITS       3
+
+#define LSBS            UINT64_C(0x0101010101010101)
+#define MSBS            UINT64_C(0x8080808080808080)
+
+typedef uint64_t GroupMask;
+
+#if defined(__ARM_NEON) && defined(__BYTE_ORDER__) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)         /* { */
+
+#include <arm_neon.h>
+
+/* set bit 7 of byte 'i' of the result if control byte 'i' is 'b' */
+t_sinline GroupMask matchbyte(const uint8_t *g, uint8_t b) {
+    uint8x8_t eq = vceq_u8(vld1_u8(g), vdup_n_u8(b));
+    return vget_lane_u64(vreinterpret_u64_u8(eq), 0) & MSBS;
+}
+
+#define matchempty(g)   matchbyte(g, CTRL_EMPTY)
+
+#else                                                   /* }{ */
+
+t_sinline uint64_t loadgroup(const uint8_t *g) {
+    return cast(uint64_t, g[0])       | cast(uint64_t, g[1]) << 8  |
+           cast(uint64_t, g[2]) << 16 | cast(uint64_t, g[3]) << 24 |
+           cast(uint64_t, g[4]) << 32 | cast(uint64_t, g[5]) << 40 |
+           cast(uint64_t, g[6]) << 48 | cast(uint64_t, g[7]) << 56;
+}
+
+
+/*
+** Set bit 7 of byte 'i' of the result if control byte 'i' is 'b'.
+** This can also set the bit of a byte right after a matching one
+** (when it differs from 'b' only in its lowest bit); that byte then
+** holds H2 of some key and the false match is rejected when the keys
+** are compared.
+*/
+t_sinline GroupMask matchbyte(const uint8_t *g, uint8_t b) {
+    uint64_t x = loadgroup(g) ^ (LSBS * b);
+    return (x - LSBS) & ~x & MSBS;
+}
+
+
+/* bytes with bit 7 set and bit 1 clear (this is only CTRL_EMPTY) */
+t_sinline GroupMask matchempty(const uint8_t *g) {
+    uint64_t x = loadgroup(g);
+    return x & ~(x << 6) & MSBS;
+}
+
+#endif                                                  /* } */
+
+#define maskslot(m)     (lowbit(m) >> 3)
+
+#endif                                                  /* } */
+
+
+#define GROUPWIDTH      (1u << GROUPBITS)
+
+/* clear the first match in mask 'm' */
+#define masknext(m)     ((m) & ((m) - 1))
+
+/* number of control bytes for a hash part of size 'sz' */
+#define ctrlsize(sz)    ((sz) < GROUPWIDTH ? GROUPWIDTH : (sz))
+
+/* number of bytes for a hash part of size 'sz' */
+#define hashbytes(sz) \
+        (cast_sizet(sz) * sizeof(Node) + cast_sizet(ctrlsize(sz)))
+
+/* number of groups in the hash part of 't' */
+#define htgroups(t) \
+        ((t)->size > GROUPBITS ? twoto((t)->size - GROUPBITS) : 1u)
+
+/* control bytes of group 'g' in 't' */
+#define htgroup(t,g)    (&(t)->ctrl[(g) << GROUPBITS])
+
+/*
+** Number of keys that can be inserted in a hash part of size 'sz'
+** (keeping at least one of its nodes empty, so that probes end).
+*/
+#define maxgrowth(sz)   ((sz) - ((sz) > 8 ? (sz) >> 3 : 1))
+
+
+/* control bytes for the common 'dummynode' */
+static const uint8_t dummyctrl[16] = {
+    CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+    CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+    CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+    CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY
+};
+
+
+/* mix the bits of hash 'h' (finalizer of MurmurHash3) */
+t_sinline uint32_t mixhash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
+t_sinline uint32_t hashint(toku_Integer i) {
+    toku_Unsigned ui = t_castS2U(i);
+    return mixhash(cast_u32(ui) ^ cast_u32((ui >> 31) >> 1));
+}
+
+
+/* hash of key 'k' (strings already have good hashes) */
+static uint32_t hashkey(const TValue *k) {
+    switch (ttypetag(k)) {
+        case TOKU_VTRUE: return mixhash(1);
+        case TOKU_VFALSE: return mixhash(0);
+        case TOKU_VSHRSTR: return strval(k)->hash;
+        case TOKU_VLNGSTR: return tokuS_hashlngstr(strval(k));
+        case TOKU_VNUMINT: return hashint(ival(k));
+        case TOKU_VNUMFLT: return mixhash(t_hashfloat(fval(k)));
+        case TOKU_VLIGHTUSERDATA: return mixhash(pointer2u32(pval(k)));
+        case TOKU_VLCF: return mixhash(pointer2u32(lcfval(k)));
+        default: return mixhash(pointer2u32(gcoval(k)));
+    }
+}
+
+
+/*
+** Search for the node with hash 'h' that satisfies 'eq' (in which 'n'
+** is the candidate node), returning its value or 'absentkey'.
+*/
+#define probe(t,h,n,eq) { \
+    uint32_t mask_ = htgroups(t) - 1; \
+    uint32_t g_ = hashh1(h) & mask_; \
+    uint32_t step_ = 0; \
+    for (;;) { \
+        const uint8_t *ctrl_ = htgroup(t, g_); \
+        GroupMask m_ = matchbyte(ctrl_, hashh2(h)); \
+        for (; m_ != 0; m_ = masknext(m_)) { \
+            const Node *n = htnode(t, (g_ << GROUPBITS) + maskslot(m_)); \
+            if (eq) return nodeval(n); \
+        } \
+        if (matchempty(ctrl_)) return &absentkey; \
+        g_ = (g_ + ++step_) & mask_; }}
+
+
+static const TValue *getgeneric(Table *t, const TValue *key, int32_t deadok) {
+    uint32_t h = hashkey(key);
+    probe(t, h, n, eqkey(key, n, deadok));
+}
+
+
+/*
+** Inserts a new key into a hash table. If the key is dead in some node
+** of its probe sequence (it was removed and then collected), its node
+** is reused, so that traversals never see the key twice; otherwise the
+** key goes into the first empty node of the sequence. Return 0 if could
+** not insert key (no free node left).
+*/
+static int32_t insertkey(Table *t, const TValue *key, const TValue *value) {
+    uint32_t h = hashkey(key);
+    uint32_t mask = htgroups(t) - 1;
+    uint32_t g = hashh1(h) & mask;
+    uint32_t step = 0;
+    Node *n;
+    toku_assert(isabstkey(getgeneric(t, key, 0)));
+    toku_assert(!ttisint(key) || !arraykey(t, ival(key)));
+    for (;;) {
+        const uint8_t *ctrl = htgroup(t, g);
+        GroupMask m = matchbyte(ctrl, hashh2(h));
+        for (; m != 0; m = masknext(m)) {
+            n = htnode(t, (g << GROUPBITS) + maskslot(m));
+            if (isempty(nodeval(n)) && eqkey(key, n, 1)) /* dead 'key'? */
+                goto setnode; /* reuse its node */
+        }
+        if ((m = matchempty(ctrl)) != 0) { /* group has an empty node? */
+            uint32_t i = (g << GROUPBITS) + maskslot(m);
+            if (t->growthleft == 0) /* no free position? */
+                return 0;
+            toku_assert(i < htsize(t));
+            t->ctrl[i] = hashh2(h);
+            t->growthleft--;
+            n = htnode(t, i);
+            break;
+        }
+        g = (g + ++step) & mask;
+    }
+setnode:
+    setnodekey(cast(toku_State *, 0), n, key); /* set key */
+    toku_assert(isempty(nodeval(n))); /* value slot must be empty */
+    setobj(cast(toku_State *, 0), nodeval(n), value); /* set value */
+    return 1;
+}
+
+
+const TValue *tokuH_Hgetshortstr(Table *t, OString *key) {
+    toku_assert(strisshr(key));
+    probe(t, key->hash, n, keyisshrstr(n) && eqshrstr(key, keystrval(n)));
+}
+
+
+/* search integer 'key' in the hash part of 't' */
+static const TValue *hashgetint(Table *t, toku_Integer key) {
+    uint32_t h = hashint(key);
+    probe(t, h, n, keyisint(n) && keyival(n) == key);
+}
+
+
+/* allocate hash array */
+static void newhasharray(toku_State *T, Table *t, uint32_t size) {
+    if (size == 0) { /* no elements? */
+        t->node = cast(Node *, dummynode); /* use common 'dummynode' */
+        t->ctrl = cast(uint8_t *, dummyctrl);
+        t->size = 0;
+        t->growthleft = 0;
+        setdummy(t); /* signal that it is using dummy node */
+    } else {
+        Node *n;
+        int32_t nbits;
+        uint32_t nsize;
+        size = (MINHSIZE <= size) ? size : MINHSIZE;
+        nbits = tokuO_ceillog2(size);
+        if (maxgrowth(twoto(nbits)) < size) /* over maximum load? */
+            nbits++; /* double the size */
+        nsize = twoto(nbits);
+        if (t_unlikely(MAXHBITS < nbits || cast_u32(MAXHSIZE) < nsize))
+            tokuD_runerror(T, "table overflow");
+        t->node = cast(Node *, tokuM_malloc_(T, hashbytes(nsize), 0u));
+        t->ctrl = cast(uint8_t *, t->node + nsize);
+        t->size = cast_u8(nbits);
+        t->growthleft = maxgrowth(nsize);
+        setnodummy(t);
+        toku_assert(tablesize_invariant(t, nsize));
+        memset(t->ctrl, CTRL_EMPTY, nsize);
+        memset(t->ctrl + nsize, CTRL_PAD, ctrlsize(nsize) - nsize);
+        n = htnode(t, 0);
+        for (uint32_t i = 0; i < nsize; i += 4) { /* unroll */
+            initnode(n++);
+            initnode(n++);
+            initnode(n++);
+            initnode(n++);
+        }
+    }
+}
+
+
+static inline void freehash(toku_State *T, Table *t) {
+    if (!isdummy(t))
+        tokuM_freemem(T, t->node, hashbytes(htsize(t)));
+}
+
+
+/*
+** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
+** dummy bit must be exchanged: The metamethod bits do not change
+** during a resize, so the "real" table can keep their values.)
+*/
+static void exchangehashes(Table *t1, Table *t2) {
+    uint8_t sz = t1->size;
+    Node *node = t1->node;
+    uint8_t *ctrl = t1->ctrl;
+    uint32_t growthleft = t1->growthleft;
+    uint8_t bitdummy1 = t1->flags & BITDUMMY;
+    t1->size = t2->size;
+    t1->node = t2->node;
+    t1->ctrl = t2->ctrl;
+    t1->growthleft = t2->growthleft;
+    t1->flags = cast_u8((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
+    t2->size = sz;
+    t2->node = node;
+    t2->ctrl = ctrl;
+    t2->growthleft = growthleft;
+    t2->flags = cast_u8((t2->flags & NOTBITDUMMY) | bitdummy1);
+}
+
+/* }============================================================= */
+
+#else                                                   /* }{ */
+
+/*
+** {=============================================================
+** Hash part (chained scatter table)
+** ==============================================================
+*/
+
+/*
+** When the original hash value is good, hashing by a power of 2
+** avoids the cost of '%'.
+*/
+#define hashpow2(t,h)       htnode(t, tmod(h, htsize(t)))
+
+
+/*
+** For other types, it is better to avoid modulo by power of 2, as
+** they can have many 2 factors.
+*/
+#define hashmod(t,n)        (htnode(t, ((n) % ((htsize(t)-1u)|1u))))
+
+
+#define hashstr(t,s)       hashpow2(t, (s)->hash)
+#define hashboolean(t,b)   hashpow2(t, b)
+
+
+#define hashpointer(t,p)   hashmod(t, pointer2u32(p))
+
+
+/*
+** Hash for integers. To allow a good hash, use the remainder operator
+** ('%'). If integer fits as a non-negative int32_t, compute an int32_t
+** remainder, which is faster. Otherwise, use an unsigned-integer
+** remainder, which uses all bits and ensures a non-negative result.
+*/
+static Node *hashint(const Table *t, toku_Integer i) {
+    toku_Unsigned ui = t_castS2U(i);
+    if (ui <= cast_Unsigned(INT_MAX))
+        return htnode(t, cast_i32(ui) % cast_i32((htsize(t)-1) | 1));
+    else
+        return hashmod(t, ui);
+}
+
+
 /*
 ** Find the main position (slot) for key 'k' inside
 ** the hash array.
@@ -178,62 +602,16 @@ static inline Node *mainposfromnode(Table *t, Node *mp) {
     TValue key;
     getnodekey(cast(toku_State *, NULL), &key, mp);
     return mainposition(t, &key);
-}
-
-
-static Node *getfreepos(Table *t) {
-    while (t->lastfree > t->node) {
-        t->lastfree--;
-        if (keyisnil(t->lastfree))
-            return t->lastfree;
-    }
-    return NULL; /* no free position */
-}
-
-
-/*
-** Check whether key 'k' is equal to the key in node 'n'. This
-** equality is raw, so there are no metamethods. Floats with integer
-** values have been normalized, so integers cannot be equal to
-** floats. It is assumed that 'eqshrstr' is simply pointer equality, so
-** that short strings are handled in the default case.
-** A true 'deadok' means to accept dead keys as equal to their original
-** values. All dead keys are compared in the default case, by pointer
-** identity. (Only collectable objects can produce dead keys.) Note that
-** dead long strings are also compared by identity.
-** Once a key is dead, its corresponding value may be collected, and
-** then another value can be created with the same address. If this
-** other value is given to 'next', 'eqkey' will signal a false
-** positive. In a regular traversal, this situation should never happen,
-** as all keys given to 'next' came from the table itself, and therefore
-** could not have been collected. Outside a regular traversal, we
-** have garbage in, garbage out. What is relevant is that this false
-** positive does not break anything. (In particular, 'next' will return
-** some other valid item on the table or nil.)
-*/
-static int32_t eqkey(const TValue *k, const Node *n, int32_t deadok) {
-    if ((rawtt(k) != keytt(n)) && /* not the same variant? */
-            !(deadok && keyisdead(n) && iscollectable(k)))
-        return 0;
-    switch (ttypetag(k)) {
-        case TOKU_VNIL: case TOKU_VTRUE: case TOKU_VFALSE:
-            return 1;
-        case TOKU_VNUMINT:
-            return (ival(k) == keyival(n));
-        case TOKU_VNUMFLT:
-            return tokui_numeq(fval(k), keyfval(n));
-        case TOKU_VLIGHTUSERDATA:
-            return (pval(k) == keypval(n));
-        case TOKU_VLCF:
-            return (lcfval(k) == keycfval(n));
-        case TOKU_VSHRSTR:
-            return eqshrstr(strval(k), keystrval(n));
-        case TOKU_VLNGSTR:
-            return tokuS_eqlngstr(strval(k), keystrval(n));
-        default: /* rest of the objects are compared by pointer identity */
-            toku_assert(iscollectable(k));
-            return (gcoval(k) == keygcoval(n));
+}
+
+
+static Node *getfreepos(Table *t) {
+    while (t->lastfree > t->node) {
+        t->lastfree--;
+        if (keyisnil(t->lastfree))
+            return t->lastfree;
     }
+    return NULL; /* no free position */
 }
 
 
@@ -263,6 +641,7 @@ static const TValue *getgeneric(Table *t, const TValue *key, int32_t deadok) {
 static int32_t insertkey(Table *t, const TValue *key, const TValue *value) {
     Node *mp = mainposition(t, key); /* get main position for 'key' */
     toku_assert(isabstkey(getgeneric(t, key, 0)));
+    toku_assert(!ttisint(key) || !arraykey(t, ival(key)));
     if (!isempty(nodeval(mp)) || isdummy(t)) { /* mainposition taken? */
         Node *othern;
         Node *f = getfreepos(t); /* get next free position */
@@ -297,26 +676,220 @@ static int32_t insertkey(Table *t, const TValue *key, const TValue *value) {
 }
 
 
-static void rehash(toku_State *T, Table *t) {
-    uint32_t nhash = 0;
-    if (!isdummy(t)) {
-        uint32_t size = htsize(t);
+const TValue *tokuH_Hgetshortstr(Table *t, OString *key) {
+    Node *n = hashstr(t, key);
+    toku_assert(strisshr(key));
+    for (;;) {
+        if (keyisshrstr(n) && eqshrstr(key, keystrval(n)))
+            return nodeval(n);
+        else {
+            int32_t next = nodenext(n);
+            if (next == 0) break;
+            n += next;
+        }
+    }
+    return &absentkey; /* not found */
+}
+
+
+/* search integer 'key' in the hash part of 't' */
+static const TValue *hashgetint(Table *t, toku_Integer key) {
+    Node *n = hashint(t, key);
+    for (;;) {
+        if (keyisint(n) && keyival(n) == key)
+            return nodeval(n);
+        else {
+            int32_t next = nodenext(n);
+            if (next == 0)
+                return &absentkey;
+            n += next;
+        }
+    }
+}
+
+
+/* allocate hash array */
+static void newhasharray(toku_State *cr, Table *t, uint32_t size) {
+    if (size == 0) { /* no elements? */
+        t->node = cast(Node *, dummynode); /* use common 'dummynode' */
+        t->size = 0;
+        t->lastfree = NULL;
+        setdummy(t); /* signal that it is using dummy node */
+    } else {
+        Node *n;
+        int32_t nbits;
+        size = (MINHSIZE <= size) ? size : MINHSIZE;
+        nbits = tokuO_ceillog2(size);
+        if (t_unlikely(MAXHBITS < nbits || cast_u32(MAXHSIZE) < twoto(nbits)))
+            tokuD_runerror(cr, "table overflow");
+        size = twoto(nbits);
+        t->node = tokuM_newarray(cr, size, Node);
+        t->size = cast_u8(nbits);
+        t->lastfree = htnode(t, size);
+        setnodummy(t);
         toku_assert(tablesize_invariant(t, size));
-        const Node *n = htnode(t, 0);
-        uint32_t i;
-        for (i = 0; i < size; i += 4) { /* unroll */
-            nhash += !isempty(nodeval(n)); n++;
-            nhash += !isempty(nodeval(n)); n++;
-            nhash += !isempty(nodeval(n)); n++;
-            nhash += !isempty(nodeval(n)); n++;
+        n = htnode(t, 0);
+        for (uint32_t i = 0; i < size; i += 4) { /* unroll */
+            initnode(n++);
+            initnode(n++);
+            initnode(n++);
+            initnode(n++);
         }
-        toku_assert(i == size);
     }
-    nhash++; /* +1 for extra key being inserted */
-    tokuH_resize(T, t, nhash);
 }
 
 
+static inline void freehash(toku_State *T, Table *t) {
+    if (!isdummy(t))
+        tokuM_freearray(T, t->node, htsize(t));
+}
+
+
+/*
+** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
+** dummy bit must be exchanged: The metamethod bits do not change
+** during a resize, so the "real" table can keep their values.)
+*/
+static void exchangehashes(Table *t1, Table *t2) {
+    uint8_t sz = t1->size;
+    Node *node = t1->node;
+    Node *lastfree = t1->lastfree;
+    uint8_t bitdummy1 = t1->flags & BITDUMMY;
+    t1->size = t2->size;
+    t1->node = t2->node;
+    t1->lastfree = t2->lastfree;
+    t1->flags = cast_u8((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
+    t2->size = sz;
+    t2->node = node;
+    t2->lastfree = lastfree;
+    t2->flags = cast_u8((t2->flags & NOTBITDUMMY) | bitdummy1);
+}
+
+/* }============================================================= */
+
+#endif                                                  /* } */
+
+
+/*
+** {=============================================================
+** Rehash
+** ==============================================================
+*/
+
+/*
+** Compute the optimal size for the array part of table 't'. 'nums' is
+** a "count array" where 'nums[i]' is the number of integers in the
+** table between 2^(i - 1) + 1 and 2^i (here integer 'k' is counted as
+** 'k + 1', as the array part holds keys from 0). 'pna' enters with the
+** total number of integer keys in the table and leaves with the number
+** of keys that will go to the array part; return the optimal size.
+** (The condition 'twotoi > 0' in the for loop stops the loop if
+** 'twotoi' overflows.)
+*/
+static uint32_t computesizes(uint32_t nums[], uint32_t *pna) {
+    int32_t i;
+    uint32_t twotoi; /* 2^i (candidate for optimal size) */
+    uint32_t a = 0; /* number of elements smaller than 2^i */
+    uint32_t na = 0; /* number of elements to go to array part */
+    uint32_t optimal = 0; /* optimal size for array part */
+    /* loop while keys can fill more than half of total size */
+    for (i = 0, twotoi = 1;
+         twotoi > 0 && *pna > twotoi / 2;
+         i++, twotoi *= 2) {
+        a += nums[i];
+        if (a > twotoi / 2) { /* more than half elements present? */
+            optimal = twotoi; /* optimal size (till now) */
+            na = a; /* all elements up to 'optimal' will go to array part */
+        }
+    }
+    toku_assert((optimal == 0 || optimal / 2 < na) && na <= optimal);
+    *pna = na;
+    return optimal;
+}
+
+
+static uint32_t countint(toku_Integer key, uint32_t *nums) {
+    if (t_castS2U(key) < MAXASIZE) { /* is 'key' an array index? */
+        nums[tokuO_ceillog2(cast_u32(key) + 1)]++; /* count as such */
+        return 1;
+    } else
+        return 0;
+}
+
+
+/*
+** Count keys in array part of table 't': Fill 'nums[i]' with number
+** of keys that will go into corresponding slice and return total
+** number of non-nil keys.
+*/
+static uint32_t numusearray(const Table *t, uint32_t *nums) {
+    int32_t lg;
+    uint32_t ttlg; /* 2^lg */
+    uint32_t ause = 0; /* summation of 'nums' */
+    uint32_t i = 1; /* count to traverse all array keys (plus one) */
+    uint32_t asize = t->asize;
+    /* traverse each slice */
+    for (lg = 0, ttlg = 1; lg <= MAXABITS; lg++, ttlg *= 2) {
+        uint32_t lc = 0; /* counter */
+        uint32_t lim = ttlg;
+        if (lim > asize) {
+            lim = asize; /* adjust upper limit */
+            if (i > lim)
+                break; /* no more elements to count */
+        }
+        /* count elements in range (2^(lg - 1), 2^lg] */
+        for (; i <= lim; i++) {
+            if (!isempty(&t->array[i - 1]))
+                lc++;
+        }
+        nums[lg] += lc;
+        ause += lc;
+    }
+    return ause;
+}
+
+
+static uint32_t numusehash(const Table *t, uint32_t *nums, uint32_t *pna) {
+    uint32_t totaluse = 0; /* total number of elements */
+    uint32_t ause = 0; /* elements added to 'nums' (can go to array part) */
+    uint32_t i = htsize(t);
+    while (i--) {
+        const Node *n = htnode(t, i);
+        if (!isempty(nodeval(n))) {
+            if (keyisint(n))
+                ause += countint(keyival(n), nums);
+            totaluse++;
+        }
+    }
+    *pna += ause;
+    return totaluse;
+}
+
+
+/*
+** Resize table 't' for the extra key 'ek' by computing the new sizes
+** of both its parts, such that more than half of the slots in the
+** array part are in use.
+*/
+static void rehash(toku_State *T, Table *t, const TValue *ek) {
+    uint32_t asize; /* optimal size for array part */
+    uint32_t na; /* number of keys in the array part */
+    uint32_t nums[MAXABITS + 1];
+    uint32_t totaluse;
+    for (int32_t i = 0; i <= MAXABITS; i++) nums[i] = 0; /* reset counts */
+    na = numusearray(t, nums); /* count keys in array part */
+    totaluse = na; /* all those keys are integer keys */
+    totaluse += numusehash(t, nums, &na); /* count keys in hash part */
+    if (ttisint(ek)) /* extra key is integer? */
+        na += countint(ival(ek), nums);
+    totaluse++; /* count extra key */
+    asize = computesizes(nums, &na); /* compute new size for array part */
+    tokuH_resizeall(T, t, asize, totaluse - na);
+}
+
+/* }============================================================= */
+
+
 /*
 ** Insert a key in a table where there is space for that key, the
 ** key is valid, and the value is not nil.
@@ -333,9 +906,13 @@ static void newkey(toku_State *T, Table *t, const TValue *key,
     if (!ttisnil(value)) { /* do not insert nil values */
         int32_t done = insertkey(t, key, value);
         if (!done) { /* could not find a free place? */
-            rehash(T, t); /* grow table */
-            newcheckedkey(t, key, value); /* insert key in grown table */
+            rehash(T, t, key); /* grow table */
+            if (ttisint(key) && arraykey(t, ival(key))) { /* in array? */
+                setobj(T, arrayslot(t, ival(key)), value);
+            } else /* insert key in grown hash part */
+                newcheckedkey(t, key, value);
         }
+        t->nfields++;
         tokuG_barrierback(T, obj2gco(t), key);
         /* for debugging only: any new key may force an emergency collection */
         condchangemem(T, (void)0, (void)0, 1);
@@ -355,51 +932,79 @@ t_sinline uint8_t finishget(const TValue *slot, TValue *res) {
 ** Returns the index of a 'key' for table traversals.
 ** The beginning of a traversal is signaled by 0.
 */
-static uint32_t getindex(toku_State *T, Table *t, const TValue *k) {
+static uint32_t getindex(toku_State *T, Table *t, const TValue *k,
+                                                 uint32_t asize) {
     const TValue *slot;
     if (ttisnil(k)) return 0; /* first iteration */
+    if (ttisint(k) && arraykey(t, ival(k))) /* is 'k' inside array part? */
+        return cast_u32(ival(k)) + 1; /* next value after 'k' */
     slot = getgeneric(t, k, 1);
     if (t_unlikely(isabstkey(slot)))
         tokuD_runerror(T, "invalid key passed to 'nextfield'"); /* not found */
-     /* return next slot index */
-    return cast_u32(cast(Node *, slot) - htnode(t, 0) + 1);
+     /* return next slot index (hash part comes after the array part) */
+    return cast_u32(cast(Node *, slot) - htnode(t, 0)) + 1 + asize;
 }
 
 
-int32_t tokuH_next(toku_State *T, Table *t, SPtr key) {
+/*
+** Check if 'c' is the traversal index that follows 'k' (the entry
+** just before it holds 'k'), so that 'getindex' can be skipped.
+*/
+t_sinline int32_t validcursor(Table *t, const TValue *k, uint32_t c,
+                                                         uint32_t asize) {
+    if (c == 0) /* no cursor? */
+        return 0;
+    else if (c <= asize) /* 'k' in array part? */
+        return (ttisint(k) && ival(k) == cast_Integer(c) - 1);
+    else if (c - asize <= htsize(t)) /* 'k' in hash part? */
+        return eqkey(k, htnode(t, c - asize - 1), 1);
+    else /* table shrunk */
+        return 0;
+}
+
+
+/*
+** Traverse 't' from 'key', storing the next key and its value in 'key'
+** and 'key + 1'. Cursor 'c' is the traversal index returned by the
+** previous step (0 if unknown); if it still matches 'key' the lookup
+** of 'key' is avoided. Returns the cursor for the next step, or 0 if
+** there are no more fields.
+*/
+uint32_t tokuH_step(toku_State *T, Table *t, SPtr key, uint32_t c) {
+    uint32_t asize = t->asize;
     uint32_t size = htsize(t);
-    uint32_t i = getindex(T, t, s2v(key));
-    for (; i < size; i++) {
+    uint32_t i = validcursor(t, s2v(key), c, asize)
+               ? c : getindex(T, t, s2v(key), asize);
+    for (; i < asize; i++) { /* try first array part */
+        if (!isempty(&t->array[i])) { /* a non-empty entry? */
+            setival(s2v(key), cast_Integer(i));
+            setobj2s(T, key + 1, &t->array[i]);
+            return i + 1;
+        }
+    }
+    for (i -= asize; i < size; i++) { /* hash part */
         Node *slot = htnode(t, i);
         if (!isempty(nodeval(slot))) {
             getnodekey(T, s2v(key), slot);
             setobj2s(T, key + 1, nodeval(slot));
-            return 1;
+            return i + 1 + asize;
         }
     }
     return 0;
 }
 
 
+int32_t tokuH_next(toku_State *T, Table *t, SPtr key) {
+    return (tokuH_step(T, t, key, 0) != 0);
+}
+
+
 /*
 ** Length of a table is the number of key-(non-nil)value fields.
 */
 int32_t tokuH_len(Table *t) {
-    int32_t len = 0;
-    if (!isdummy(t)) {
-        uint32_t size = check_exp(htsize(t) <= INT_MAX, htsize(t));
-        const Node *n = htnode(t, 0);
-        uint32_t i;
-        toku_assert(tablesize_invariant(t, size));
-        for (i = 0; i < size; i += 4) { /* unroll */
-            len += !isempty(nodeval(n)); n++;
-            len += !isempty(nodeval(n)); n++;
-            len += !isempty(nodeval(n)); n++;
-            len += !isempty(nodeval(n)); n++;
-        }
-        toku_assert(i == size);
-    }
-    return len;
+    toku_assert(t->nfields >= 0);
+    return t->nfields;
 }
 
 
@@ -420,6 +1025,13 @@ t_sinline void copynode(toku_State *T, const Node *n, Table *t) {
 ** invalidate the TM cache. (This function takes care of GC barrier.)
 */
 void tokuH_copy(toku_State *T, Table *dest, Table *src) {
+    for (uint32_t i = 0; i < src->asize; i++) {
+        const TValue *v = &src->array[i];
+        if (!isempty(v)) {
+            tokuH_setint(T, dest, cast_Integer(i), v);
+            tokuG_barrierback(T, obj2gco(dest), v);
+        }
+    }
     if  (!isdummy(src)) {
         const Node *n = htnode(src, 0);
         uint32_t size = htsize(src);
@@ -440,19 +1052,15 @@ void tokuH_copy(toku_State *T, Table *dest, Table *src) {
 }
 
 
-const TValue *tokuH_Hgetshortstr(Table *t, OString *key) {
-    Node *n = hashstr(t, key);
-    toku_assert(strisshr(key));
-    for (;;) {
-        if (keyisshrstr(n) && eqshrstr(key, keystrval(n)))
-            return nodeval(n);
-        else {
-            int32_t next = nodenext(n);
-            if (next == 0) break;
-            n += next;
-        }
-    }
-    return &absentkey; /* not found */
+/*
+** Return the node index of short string 'key' in 't', or -1 if
+** the key has no value in 't'.
+*/
+int32_t tokuH_shortstrslot(Table *t, OString *key) {
+    const TValue *slot = tokuH_Hgetshortstr(t, key);
+    if (isempty(slot)) /* absent (or without value)? */
+        return -1;
+    return cast_i32(cast(Node *, slot) - htnode(t, 0));
 }
 
 
@@ -478,17 +1086,10 @@ uint8_t tokuH_getstr(Table *t, OString *key, TValue *res) {
 
 
 const TValue *Hgetint(Table *t, toku_Integer key) {
-    Node *n = hashint(t, key);
-    for (;;) {
-        if (keyisint(n) && keyival(n) == key)
-            return nodeval(n);
-        else {
-            int32_t next = nodenext(n);
-            if (next == 0)
-                return &absentkey;
-            n += next;
-        }
-    }
+    if (arraykey(t, key)) /* in array part? */
+        return arrayslot(t, key);
+    else
+        return hashgetint(t, key);
 }
 
 
@@ -542,7 +1143,7 @@ static int32_t retpsetcode (Table *t, const TValue *slot) {
 
 t_sinline int32_t finishset(Table *t, const TValue *slot, const TValue *value) {
     if (!ttisnil(slot)) {
-        setobj(cast(toku_State *, NULL), cast(TValue *, slot), value);
+        htsetslot(t, cast(TValue *, slot), value);
         return HOK;  /* success */
     } else
         return retpsetcode(t, slot);
@@ -550,7 +1151,11 @@ t_sinline int32_t finishset(Table *t, const TValue *slot, const TValue *value) {
 
 
 int32_t tokuH_psetint(Table *t, toku_Integer key, const TValue *value) {
-    return finishset(t, Hgetint(t, key), value);
+    if (arraykey(t, key)) { /* in array part? */
+        htsetslot(t, arrayslot(t, key), value); /* (slot always exists) */
+        return HOK;
+    } else
+        return finishset(t, hashgetint(t, key), value);
 }
 
 
@@ -612,7 +1217,7 @@ void tokuH_finishset(toku_State *T, Table *t, const TValue *key,
         }
         newkey(T, t, key, value);
     } else /* otherwise node index */
-        setobj(T, nodeval(htnode(t, hres - HFIRSTNODE)), value);
+        htsetslot(t, nodeval(htnode(t, hres - HFIRSTNODE)), value);
 }
 
 
@@ -628,11 +1233,12 @@ void tokuH_set(toku_State *T, Table *t, const TValue *key,
 }
 
 
-static int32_t rawfinishset(const TValue *slot, const TValue *value) {
+static int32_t rawfinishset(Table *t, const TValue *slot,
+                                      const TValue *value) {
     if (isabstkey(slot))
         return 0;  /* no slot with that key */
     else {
-        setobj(((toku_State*)NULL), cast(TValue *, slot), value);
+        htsetslot(t, cast(TValue *, slot), value);
         return 1; /* success */
     }
 }
@@ -643,7 +1249,7 @@ static int32_t rawfinishset(const TValue *slot, const TValue *value) {
 ** check a GC barrier and invalidate the TM cache.
 */
 void tokuH_setstr(toku_State *T, Table *t, OString *key, const TValue *value) {
-    if (!rawfinishset(Hgetstr(t, key), value)) {
+    if (!rawfinishset(t, Hgetstr(t, key), value)) {
         TValue k;
         setstrval(T, &k, key);
         newkey(T, t, &k, value);
@@ -658,7 +1264,7 @@ void tokuH_setstr(toku_State *T, Table *t, OString *key, const TValue *value) {
 */
 void tokuH_setint(toku_State *T, Table *t, toku_Integer key,
                                            const TValue *value) {
-    if (!rawfinishset(Hgetint(t, key), value)) {
+    if (!rawfinishset(t, Hgetint(t, key), value)) {
         TValue k;
         setival(&k, key);
         newkey(T, t, &k, value);
@@ -666,24 +1272,12 @@ void tokuH_setint(toku_State *T, Table *t, toku_Integer key,
 }
 
 
-/*
-** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
-** dummy bit must be exchanged: The metamethod bits do not change
-** during a resize, so the "real" table can keep their values.)
-*/
-static void exchangehashes(Table *t1, Table *t2) {
-    uint8_t sz = t1->size;
-    Node *node = t1->node;
-    Node *lastfree = t1->lastfree;
-    uint8_t bitdummy1 = t1->flags & BITDUMMY;
-    t1->size = t2->size;
-    t1->node = t2->node;
-    t1->lastfree = t2->lastfree;
-    t1->flags = cast_u8((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
-    t2->size = sz;
-    t2->node = node;
-    t2->lastfree = lastfree;
-    t2->flags = cast_u8((t2->flags & NOTBITDUMMY) | bitdummy1);
+/* insert existing field into resized 't' (count of fields is unchanged) */
+static void reinsertkey(Table *t, const TValue *key, const TValue *value) {
+    if (ttisint(key) && arraykey(t, ival(key))) { /* in array part? */
+        setobj(cast(toku_State *, NULL), arrayslot(t, ival(key)), value);
+    } else
+        newcheckedkey(t, key, value);
 }
 
 
@@ -691,7 +1285,7 @@ t_sinline void reinsertnode(toku_State *T, const Node *oldn, Table *t) {
     if (!isempty(nodeval(oldn))) {
         TValue key;
         getnodekey(T, &key, oldn);
-        newcheckedkey(t, &key, nodeval(oldn));
+        reinsertkey(t, &key, nodeval(oldn));
     }
 }
 
@@ -713,74 +1307,81 @@ static void reinserthash(toku_State *T, Table *ot, Table *t) {
 }
 
 
-t_sinline void initnode(Node *n) {
-    nodenext(n) = 0;
-    setnilkey(n);
-    setemptyval(nodeval(n));
-}
-
-
-/* allocate hash array */
-static void newhasharray(toku_State *cr, Table *t, uint32_t size) {
-    if (size == 0) { /* no elements? */
-        t->node = cast(Node *, dummynode); /* use common 'dummynode' */
-        t->size = 0;
-        t->lastfree = NULL;
-        setdummy(t); /* signal that it is using dummy node */
-    } else {
-        Node *n;
-        int32_t nbits;
-        size = (MINHSIZE <= size) ? size : MINHSIZE;
-        nbits = tokuO_ceillog2(size);
-        if (t_unlikely(MAXHBITS < nbits || cast_u32(MAXHSIZE) < twoto(nbits)))
-            tokuD_runerror(cr, "table overflow");
-        size = twoto(nbits);
-        t->node = tokuM_newarray(cr, size, Node);
-        t->size = cast_u8(nbits);
-        t->lastfree = htnode(t, size);
-        setnodummy(t);
-        toku_assert(tablesize_invariant(t, size));
-        n = htnode(t, 0);
-        for (uint32_t i = 0; i < size; i += 4) { /* unroll */
-            initnode(n++);
-            initnode(n++);
-            initnode(n++);
-            initnode(n++);
-        }
-    }
-}
-
-
 Table *tokuH_new(toku_State *T) {
     GCObject *o = tokuG_new(T, sizeof(Table), TOKU_VTABLE);
     Table *t = gco2ht(o);
     t->flags = maskflags;  /* table has no metamethod fields */
+    t->asize = 0;
+    t->nfields = 0;
+    t->array = NULL;
     t->gclist = NULL;
     newhasharray(T, t, 0);
     return t;
 }
 
 
-static inline void freehash(toku_State *T, Table *t) {
-    if (!isdummy(t))
-        tokuM_freearray(T, t->node, htsize(t));
-}
-
-
 /*
-** (Re)insert all elements from the hash part of 'ot' into table 't'.
+** Resize table 't' for the new given sizes. Both allocations (for
+** the hash part and for the array part) can fail, which creates some
+** subtleties. If the first allocation, for the hash part, fails, an
+** error is raised and that is it. Otherwise, it copies the elements
+** from the shrinking part of the array (if it is shrinking) into the
+** new hash. Then it reallocates the array part. If that fails, the
+** table is in its original state; the function frees the new hash
+** part and then raises the allocation error. Otherwise, it sets the
+** new hash part into the table, initializes the new part of the array
+** (if any) with nils and reinserts the elements of the old hash back
+** into the new parts of the table.
 */
-void tokuH_resize(toku_State *T, Table *t, uint32_t newsize) {
+void tokuH_resizeall(toku_State *T, Table *t, uint32_t nasize,
+                                              uint32_t nhsize) {
+    uint32_t oasize = t->asize;
+    TValue *newarray;
     Table newt = {0};
-    newhasharray(T, &newt, newsize);
-    exchangehashes(t, &newt);
-    reinserthash(T, &newt, t);
+    if (t_unlikely(nasize > MAXASIZE))
+        tokuD_runerror(T, "table overflow");
+    newhasharray(T, &newt, nhsize); /* new hash part into 'newt' */
+    if (nasize < oasize) { /* will array shrink? */
+        t->asize = nasize; /* pretend array has new size... */
+        exchangehashes(t, &newt); /* ...and new hash */
+        /* re-insert into the new hash the elements of vanishing slice */
+        for (uint32_t i = nasize; i < oasize; i++) {
+            if (!isempty(&t->array[i])) {
+                TValue key;
+                setival(&key, cast_Integer(i));
+                newcheckedkey(t, &key, &t->array[i]);
+            }
+        }
+        t->asize = oasize; /* restore current size... */
+        exchangehashes(t, &newt); /* ...and hash (in case of errors) */
+    }
+    /* allocate new array */
+    newarray = tokuM_reallocarray(T, t->array, oasize, nasize, TValue);
+    if (t_unlikely(newarray == NULL && nasize > 0)) { /* allocation failed? */
+        freehash(T, &newt); /* release new hash part */
+        tokuM_error(T); /* raise error (with array unchanged) */
+    }
+    /* allocation ok; initialize new part of the array */
+    exchangehashes(t, &newt); /* 't' has the new hash part */
+    t->array = newarray; /* set new array part */
+    t->asize = nasize;
+    for (uint32_t i = oasize; i < nasize; i++) /* clear new slice */
+        setemptyval(&t->array[i]);
+    /* re-insert elements from old hash part into new parts */
+    reinserthash(T, &newt, t); /* 'newt' now has the old hash part */
     freehash(T, &newt);
     toku_assert(tablesize_invariant(t, htsize(t)));
 }
 
 
+/* resize hash part of 't' (keeping its array part) */
+void tokuH_resize(toku_State *T, Table *t, uint32_t newsize) {
+    tokuH_resizeall(T, t, t->asize, newsize);
+}
+
+
 void tokuH_free(toku_State *T, Table *t) {
     freehash(T, t);
+    tokuM_freearray(T, t->array, t->asize);
     tokuM_free(T, t);
 }
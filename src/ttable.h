@@ -28,6 +28,23 @@
 #define htsize(t)           (twoto((t)->size))
 
 
+/* test if integer 'k' is an index into the array part of 't' */
+#define arraykey(t,k)       (t_castS2U(k) < cast_Unsigned((t)->asize))
+
+/* slot of (array) key 'k' in the array part of 't' */
+#define arrayslot(t,k)      (&(t)->array[t_castS2U(k)])
+
+
+/*
+** Set 'slot' (array slot or node value) of 't' to 'v', keeping the
+** number of fields in 't' up to date.
+*/
+#define htsetslot(t,slot,v) \
+    { Table *t_=(t); TValue *s_=(slot); const TValue *v_=(v); \
+      t_->nfields += cast_i32(!isempty(v_)) - cast_i32(!isempty(s_)); \
+      setobj(cast(toku_State *, NULL), s_, v_); }
+
+
 /*
 ** Bit BITDUMMY set in 'flags' means the table is using the dummy node
 ** for its hash.
@@ -74,6 +91,9 @@ TOKUI_FUNC uint8_t tokuH_getint(Table *t, toku_Integer key, TValue *res);
 /* special get for metamethods */
 TOKUI_FUNC const TValue *tokuH_Hgetshortstr(Table *t, OString *key);
 
+/* node index of a key (for inline caches) */
+TOKUI_FUNC int32_t tokuH_shortstrslot(Table *t, OString *key);
+
 TOKUI_FUNC int tokuH_psetint(Table *t, toku_Integer key, const TValue *val);
 TOKUI_FUNC int tokuH_psetshortstr(Table *t, OString *key, const TValue *val);
 TOKUI_FUNC int tokuH_psetstr(Table *t, OString *key, const TValue *val);
@@ -91,9 +111,13 @@ TOKUI_FUNC void tokuH_finishset(toku_State *T, Table *t, const TValue *key,
 
 TOKUI_FUNC Table *tokuH_new(toku_State *T);
 TOKUI_FUNC void tokuH_resize(toku_State *T, Table *t, uint32_t newsize);
+TOKUI_FUNC void tokuH_resizeall(toku_State *T, Table *t, uint32_t nasize,
+                                                         uint32_t nhsize);
 TOKUI_FUNC void tokuH_copy(toku_State *T, Table *dest, Table *src);
 TOKUI_FUNC void tokuH_free(toku_State *T, Table *t);
 TOKUI_FUNC int tokuH_len(Table *t);
 TOKUI_FUNC int tokuH_next(toku_State *T, Table *t, SPtr key);
+TOKUI_FUNC uint32_t tokuH_step(toku_State *T, Table *t, SPtr key,
+                                                     uint32_t c);
 
 #endif
@@ -16,6 +16,7 @@
 #include "tokudaeconf.h"
 #include "tfunction.h"
 #include "tgc.h"
+#include "tjit.h"
 #include "ttable.h"
 #include "tokudae.h"
 #include "tokudaelimits.h"
@@ -26,6 +27,7 @@
 #include "tcode.h"
 #include "tvm.h"
 #include "tmeta.h"
+#include "tshape.h"
 #include "tstring.h"
 #include "tprotected.h"
 
@@ -235,7 +237,8 @@ t_sinline int32_t LEnum(const TValue *v1, const TValue *v2) {
 /* less equal ordering on non-number values */
 t_sinline int32_t LEother(toku_State *T, const TValue *v1, const TValue *v2) {
     if (ttisstring(v1) && ttisstring(v2))
-        return (tokuS_cmp(strval(v1), strval(v2)) <= 0);
+        return (tokuS_cmp(tokuS_flat(T, strval(v1)),
+                          tokuS_flat(T, strval(v2))) <= 0);
     else
         return tokuTM_order(T, v1, v2, TM_LE);
 }
@@ -297,7 +300,8 @@ t_sinline int32_t LTnum(const TValue *v1, const TValue *v2) {
 /* 'less than' ordering '<' on non-number values */
 t_sinline int32_t LTother(toku_State *T, const TValue *v1, const TValue *v2) {
     if (ttisstring(v1) && ttisstring(v2))
-        return tokuS_cmp(strval(v1), strval(v2)) < 0;
+        return tokuS_cmp(tokuS_flat(T, strval(v1)),
+                         tokuS_flat(T, strval(v2))) < 0;
     else
         return tokuTM_order(T, v1, v2, TM_LT);
 }
@@ -311,15 +315,35 @@ int32_t tokuV_orderlt(toku_State *T, const TValue *v1, const TValue *v2) {
 }
 
 
+/*
+** Equality of strings where at least one is a rope. Contents are
+** compared (flattening the ropes) only if both strings are long and of
+** equal length.
+*/
+t_sinline int32_t eqrope(toku_State *T, OString *s1, OString *s2) {
+    if (s1 == s2)
+        return 1;
+    else if (strisshr(s1) || strisshr(s2) || s1->u.lnglen != s2->u.lnglen)
+        return 0;
+    else
+        return tokuS_eqlngstr(tokuS_flat(T, s1), tokuS_flat(T, s2));
+}
+
+
 /* 
 ** Equality ordering '=='.
-** In case 'T' is NULL perform raw equality (without invoking '__eq').
+** In case 'T' is NULL perform raw equality (without invoking '__eq'),
+** ropes must then be already flattened.
 */
 int32_t tokuV_ordereq(toku_State *T, const TValue *v1, const TValue *v2) {
     toku_Integer i1, i2;
     const TValue *tm;
     if (ttypetag(v1) != ttypetag(v2)) {
-        if (ttype(v1) != ttype(v2) || ttype(v1) != TOKU_T_NUMBER)
+        if (ttype(v1) != ttype(v2))
+            return 0;
+        else if (ttype(v1) == TOKU_T_STRING) /* rope and other string? */
+            return eqrope(T, strval(v1), strval(v2));
+        else if (ttype(v1) != TOKU_T_NUMBER)
             return 0;
         return (tokuO_tointeger(v1, &i1, N2IEQ) &&
                 tokuO_tointeger(v2, &i2, N2IEQ) && i1 == i2);
@@ -332,6 +356,7 @@ int32_t tokuV_ordereq(toku_State *T, const TValue *v1, const TValue *v2) {
         case TOKU_VLIGHTUSERDATA: return pval(v1) == pval(v2);
         case TOKU_VSHRSTR: return eqshrstr(strval(v1), strval(v2));
         case TOKU_VLNGSTR: return tokuS_eqlngstr(strval(v1), strval(v2));
+        case TOKU_VROPESTR: return eqrope(T, strval(v1), strval(v2));
         case TOKU_VIMETHOD: return tokuTM_eqim(imval(v1), imval(v2));
         case TOKU_VUMETHOD: return tokuTM_equm(umval(v1), umval(v2));
         case TOKU_VUSERDATA: {
@@ -365,19 +390,17 @@ int32_t tokuV_ordereq(toku_State *T, const TValue *v1, const TValue *v2) {
 
 void tokuV_rawsetstr(toku_State *T, const TValue *o, const TValue *k,
                                                      const TValue *v) {
-    Table *t;
     switch (ttypetag(o)) {
         case TOKU_VLIST: {
             List *l = listval(o);
             tokuV_setlist(T, l, k, v, tokuA_setstr);
             break;
         }
-        case TOKU_VTABLE:
-            t = tval(o);
-            goto set_table;
         case TOKU_VINSTANCE:
-            t = insval(o)->fields;
-        set_table: {
+            tokuSH_setstr(T, insval(o), strval(k), v);
+            break;
+        case TOKU_VTABLE: {
+            Table *t = tval(o);
             int32_t hres;
             tokuV_fastset(t, strval(k), v, hres, tokuH_psetstr);
             if (hres == HOK)
@@ -402,19 +425,17 @@ void tokuV_setstr(toku_State *T, const TValue *o, const TValue *k,
 
 void tokuV_rawsetint(toku_State *T, const TValue *o, const TValue *k,
                                                      const TValue *v) {
-    Table *t;
     switch (ttypetag(o)) {
         case TOKU_VLIST: {
             List *l = listval(o);
             tokuV_setlist(T, l, k, v, tokuA_setindex);
             break;
         }
-        case TOKU_VTABLE:
-            t = tval(o);
-            goto set_table;
         case TOKU_VINSTANCE:
-            t = insval(o)->fields;
-        set_table: {
+            tokuSH_setint(T, insval(o), ival(k), v);
+            break;
+        case TOKU_VTABLE: {
+            Table *t = tval(o);
             int32_t hres;
             tokuV_fastset(t, ival(k), v, hres, tokuH_psetint);
             if (hres == HOK)
@@ -436,21 +457,28 @@ void tokuV_setint(toku_State *T, const TValue *o, const TValue *k,
 }
 
 
+/* ropes are never keys, use flattened string of rope key 'k' */
+#define flatkey(T,k,aux) \
+    { if (t_unlikely(ttisropestring(k))) { \
+          setstrval(T, aux, tokuS_flatten(T, strval(k))); \
+          k = (aux); }}
+
+
 void tokuV_rawset(toku_State *T, const TValue *o, const TValue *k,
                                                   const TValue *v) {
-    Table *t;
+    TValue aux;
+    flatkey(T, k, &aux);
     switch (ttypetag(o)) {
         case TOKU_VLIST: {
             List *l = listval(o);
             tokuV_setlist(T, l, k, v, tokuA_set);
             break;
         }
-        case TOKU_VTABLE:
-            t = tval(o);
-            goto set_table;
         case TOKU_VINSTANCE:
-            t = insval(o)->fields;
-        set_table: {
+            tokuSH_set(T, insval(o), k, v);
+            break;
+        case TOKU_VTABLE: {
+            Table *t = tval(o);
             int32_t hres;
             tokuV_fastset(t, k, v, hres, tokuH_pset);
             if (hres == HOK)
@@ -484,6 +512,20 @@ void tokuV_set(toku_State *T, const TValue *o, const TValue *k,
       else setnilval(s2v(res)); }
 
 
+/* get value of integer key 'k' from the array part of table 't' */
+#define getarrayslot(T,t,k,res) \
+    { const TValue *slot_ = arrayslot(t, k); \
+      if (!isempty(slot_)) { setobj2s(T, res, slot_); } \
+      else setnilval(s2v(res)); }
+
+
+/* set value of integer key 'k' in the array part of table 't' */
+#define setarrayslot(T,t,k,v) \
+    { Table *at_ = (t); \
+      htsetslot(at_, arrayslot(at_, k), v); \
+      tokuV_finishfastset(T, at_, v); }
+
+
 #define newboundmethod(T,inst,method,res) \
         setimval2s(T, res, tokuTM_newinsmethod(T, inst, method))
 
@@ -509,7 +551,7 @@ void tokuV_rawgetstr(toku_State *T, const TValue *o, const TValue *k,
         case TOKU_VINSTANCE: {
             TValue ret;
             Instance *inst = insval(o);
-            uint8_t tag = tokuH_getstr(inst->fields, strval(k), &ret);
+            uint8_t tag = tokuSH_getstr(inst, strval(k), &ret);
             if (tagisempty(tag)) { /* field not found? */
                 if (inst->oclass->methods) { /* have methods table? */
                     tag = tokuH_getstr(inst->oclass->methods, strval(k), &ret);
@@ -549,7 +591,7 @@ void tokuV_rawgetint(toku_State *T, const TValue *o, const TValue *k,
         case TOKU_VINSTANCE: {
             TValue ret;
             Instance *inst = insval(o);
-            uint8_t tag = tokuH_getint(inst->fields, ival(k), &ret);
+            uint8_t tag = tokuSH_getint(inst, ival(k), &ret);
             if (tagisempty(tag)) {
                 if (inst->oclass->methods) {
                     tag = tokuH_getint(inst->oclass->methods, ival(k), &ret);
@@ -575,6 +617,8 @@ void tokuV_getint(toku_State *T, const TValue *o, const TValue *k, SPtr res) {
 
 
 void tokuV_rawget(toku_State *T, const TValue *o, const TValue *k, SPtr res) {
+    TValue aux;
+    flatkey(T, k, &aux);
     switch (ttypetag(o)) {
         case TOKU_VLIST:
             tokuA_get(T, listval(o), k, s2v(res));
@@ -588,7 +632,7 @@ void tokuV_rawget(toku_State *T, const TValue *o, const TValue *k, SPtr res) {
         case TOKU_VINSTANCE: {
             Instance *inst = insval(o);
             TValue value;
-            uint8_t tag = tokuH_get(inst->fields, k, &value);
+            uint8_t tag = tokuSH_get(inst, k, &value);
             if (tagisempty(tag)) {
                 if (inst->oclass->methods) {
                     tag = tokuH_get(inst->oclass->methods, k, &value);
@@ -649,6 +693,311 @@ t_sinline int32_t checksuper(toku_State *T, TValue *o, int32_t get, SPtr res) {
     } else tokuD_runerror(T, "class instance has no superclass"); }
 
 
+/* {======================================================================
+** Inline caches
+** ======================================================================= */
+
+/*
+** Instructions that index a value with a constant short string key
+** keep the node (or instance slot) indices where the key was last
+** found in their own 'InlineCache'. A hint is used only after checking
+** that the node (or the shape of the instance) at that index (still)
+** holds the key with a value, so table resizes, removed fields and
+** different receivers need no invalidation: the check fails and the
+** hint is refreshed by a full lookup. Instances of the same class
+** that got their fields in the same order share the shape, so they
+** also share the hints.
+*/
+
+#define ichit(T)        (G(T)->ichits++)
+#define icmiss(T)       (G(T)->icmisses++)
+
+
+/* check hint 'i' for short string key 'k' in table 't' */
+t_sinline const TValue *ichint(Table *t, int32_t i, OString *k) {
+    if (cast_u32(i) < htsize(t)) {
+        Node *n = htnode(t, i);
+        if (keyisshrstr(n) && keystrval(n) == k && !isempty(nodeval(n)))
+            return nodeval(n);
+    }
+    return NULL;
+}
+
+
+/* check both table hints of 'ic' */
+t_sinline const TValue *icprobe(InlineCache *ic, Table *t, OString *k) {
+    const TValue *slot = ichint(t, ic->slot[0], k);
+    return (slot != NULL) ? slot : ichint(t, ic->slot[1], k);
+}
+
+
+/* do a full lookup of 'k' in 't' and refresh the table hints of 'ic' */
+static const TValue *icrefill(InlineCache *ic, Table *t, OString *k) {
+    int32_t i = tokuH_shortstrslot(t, k);
+    if (i < 0) /* absent? */
+        return NULL;
+    ic->slot[1] = ic->slot[0]; /* keep previous hint */
+    ic->slot[0] = i;
+    return nodeval(htnode(t, i));
+}
+
+
+/* check hint 'i' for short string key 'k' in the slots of 'ins' */
+t_sinline const TValue *icslot(const Instance *ins, int32_t i, OString *k) {
+    const Shape *s = ins->shape;
+    if (cast_u32(i) < cast_u32(s->nkeys) && s->keys[i] == k &&
+            !isempty(&ins->slots[i]))
+        return &ins->slots[i];
+    return NULL;
+}
+
+
+/* check both hints of 'ic' in the fields of 'ins' */
+t_sinline const TValue *icprobefields(InlineCache *ic, const Instance *ins,
+                                                       OString *k) {
+    if (isdict(ins))
+        return icprobe(ic, ins->fields, k);
+    else {
+        const TValue *slot = icslot(ins, ic->slot[0], k);
+        return (slot != NULL) ? slot : icslot(ins, ic->slot[1], k);
+    }
+}
+
+
+/* do a full lookup of 'k' in the fields of 'ins' and refresh 'ic' */
+static const TValue *icrefillfields(InlineCache *ic, const Instance *ins,
+                                                     OString *k) {
+    if (isdict(ins))
+        return icrefill(ic, ins->fields, k);
+    else {
+        int32_t i = tokuSH_find(ins->shape, k);
+        if (i < 0 || isempty(&ins->slots[i])) /* absent? */
+            return NULL;
+        ic->slot[1] = ic->slot[0]; /* keep previous hint */
+        ic->slot[0] = i;
+        return &ins->slots[i];
+    }
+}
+
+
+/*
+** Get slot of short string key 'k' from table 't'. Returns NULL if
+** the key was not found.
+*/
+static const TValue *icget(toku_State *T, InlineCache *ic, Table *t,
+                                                           OString *k) {
+    const TValue *slot = icprobe(ic, t, k);
+    if (slot != NULL) {
+        ichit(T);
+        return slot;
+    }
+    icmiss(T);
+    return icrefill(ic, t, k);
+}
+
+
+/*
+** Get slot of short string key 'k' from the fields of 'ins' or, if it
+** is absent there, from its class methods table (if any); '*inm' is
+** set if the slot is a method. Returns NULL if the key was not found.
+*/
+static const TValue *icgetfield(toku_State *T, InlineCache *ic,
+                                Instance *ins, OString *k, int32_t *inm) {
+    Table *m = ins->oclass->methods;
+    const TValue *slot;
+    *inm = 0;
+    if ((slot = icprobefields(ic, ins, k)) != NULL)
+        goto hit;
+    else if ((slot = icrefillfields(ic, ins, k)) != NULL || m == NULL)
+        goto miss;
+    *inm = 1; /* try class methods */
+    if ((slot = ichint(m, ic->mslot, k)) != NULL)
+        goto hit;
+    else {
+        int32_t i = tokuH_shortstrslot(m, k);
+        if (i >= 0) { /* found? */
+            ic->mslot = i;
+            slot = nodeval(htnode(m, i));
+        }
+    }
+miss:
+    icmiss(T);
+    return slot;
+hit:
+    ichit(T);
+    return slot;
+}
+
+
+/*
+** Get 'o[k]' using inline cache 'ic'. Tables and instances without
+** '__getidx' take the cached path, everything else is done by
+** 'tokuV_getstr'.
+*/
+static void icgetstr(toku_State *T, InlineCache *ic, const TValue *o,
+                                    const TValue *k, SPtr res) {
+    if (strisshr(strval(k))) {
+        const TValue *slot;
+        if (ttistable(o)) {
+            slot = icget(T, ic, tval(o), strval(k));
+            if (slot != NULL) {
+                setobj2s(T, res, slot);
+            } else /* no such field */
+                setnilval(s2v(res));
+            return;
+        } else if (ttisinstance(o)) {
+            Instance *inst = insval(o);
+            if (fasttm(T, inst->oclass->metatable, TM_GETIDX) == NULL) {
+                int32_t inm;
+                slot = icgetfield(T, ic, inst, strval(k), &inm);
+                if (slot == NULL) /* no such field or method? */
+                    setnilval(s2v(res));
+                else if (inm) { /* method? */
+                    TValue f;
+                    setobj(T, &f, slot);
+                    newboundmethod(T, inst, &f, res);
+                } else /* field */
+                    setobj2s(T, res, slot);
+                return;
+            }
+        }
+    }
+    tokuV_getstr(T, o, k, res);
+}
+
+
+/*
+** Set 'o[k] = v' using inline cache 'ic'. Existing fields of tables
+** and instances without '__setidx' are set in place, new fields are
+** set by 'tokuV_rawsetstr' and everything else is done by
+** 'tokuV_setstr'.
+*/
+static void icsetstr(toku_State *T, InlineCache *ic, const TValue *o,
+                                    const TValue *k, const TValue *v) {
+    if (strisshr(strval(k))) {
+        if (ttistable(o)) {
+            Table *t = tval(o);
+            const TValue *slot = icget(T, ic, t, strval(k));
+            if (slot != NULL) { /* existing field? */
+                htsetslot(t, cast(TValue *, slot), v);
+                tokuV_finishfastset(T, t, v);
+            } else /* new key */
+                tokuV_rawsetstr(T, o, k, v);
+            return;
+        } else if (ttisinstance(o) &&
+                fasttm(T, insval(o)->oclass->metatable, TM_SETIDX) == NULL) {
+            Instance *inst = insval(o);
+            const TValue *slot = icprobefields(ic, inst, strval(k));
+            if (slot != NULL)
+                ichit(T);
+            else {
+                icmiss(T);
+                slot = icrefillfields(ic, inst, strval(k));
+            }
+            if (slot != NULL) { /* existing field? */
+                if (isdict(inst)) {
+                    htsetslot(inst->fields, cast(TValue *, slot), v);
+                    tokuV_finishfastset(T, inst->fields, v);
+                } else {
+                    setobj(T, cast(TValue *, slot), v);
+                    tokuG_barrierback(T, obj2gco(inst), v);
+                }
+            } else /* new field */
+                tokuSH_setstr(T, inst, strval(k), v);
+            return;
+        }
+    }
+    tokuV_setstr(T, o, k, v);
+}
+
+
+/* get method 'k' of the superclass of 'inst' using inline cache 'ic' */
+static void icgetsuper(toku_State *T, InlineCache *ic, Instance *inst,
+                                      OString *k, SPtr res) {
+    Table *m = inst->oclass->sclass->methods;
+    const TValue *slot = NULL;
+    TValue f;
+    if (m != NULL) {
+        if (strisshr(k)) {
+            slot = icget(T, ic, m, k);
+        } else if (!tagisempty(tokuH_getstr(m, k, &f)))
+            slot = &f;
+    }
+    if (slot != NULL) {
+        setobj(T, &f, slot);
+        newboundmethod(T, inst, &f, res);
+    } else
+        setnilval(s2v(res));
+}
+
+/* }====================================================================== */
+
+
+/*
+** OP_GETMETHOD stores nil in place of the function when the value it
+** got is not a method of the receiver (methods are never nil); the
+** value itself goes into the slot of 'self'. Calls flagged with CALLSELF
+** then call the function one slot higher, and the call frame marked
+** with CFST_NOSELF returns its results into the slot of the nil.
+*/
+#define setnoself(T,res,o) \
+        { setobj2s(T, (res) + 1, o); setnilval(s2v(res)); }
+
+
+/*
+** Get 'o[k]' for a self call. If the value is a method of 'o', then
+** the method is stored in 'res' and 'o' in 'res + 1', without creating
+** the bound method (values obtained via '__getidx' that are methods
+** bound to 'o' are unwrapped instead). Otherwise the value is stored
+** in 'res + 1' and 'res' is nil (see 'setnoself').
+** WARNING: 'o' might be the value at 'res'.
+*/
+static void getmethod(toku_State *T, InlineCache *ic, const TValue *o,
+                                      const TValue *k, SPtr res) {
+    TValue self;
+    ptrdiff_t result;
+    setobj(T, &self, o);
+    switch (ttypetag(o)) {
+        case TOKU_VINSTANCE: {
+            Instance *inst = insval(o);
+            if (strisshr(strval(k)) &&
+                    fasttm(T, inst->oclass->metatable, TM_GETIDX) == NULL) {
+                int32_t inm;
+                const TValue *slot = icgetfield(T, ic, inst, strval(k), &inm);
+                if (slot == NULL) { /* no such field or method? */
+                    setnilval(s2v(res));
+                    setnilval(s2v(res + 1));
+                } else if (inm) { /* method? */
+                    setobj2s(T, res, slot);
+                    setinsval2s(T, res + 1, inst);
+                } else /* field */
+                    setnoself(T, res, slot);
+                return; /* done */
+            }
+            break; /* otherwise call '__getidx' (or get the bound method) */
+        }
+        case TOKU_VUSERDATA: break;
+        default: /* no receiver */
+            result = savestack(T, res);
+            icgetstr(T, ic, o, k, res + 1);
+            setnilval(s2v(restorestack(T, result)));
+            return; /* done */
+    }
+    result = savestack(T, res);
+    tokuV_getstr(T, o, k, res);
+    res = restorestack(T, result);
+    o = s2v(res);
+    if (ttisinstancemethod(o) && obj2gco(imval(o)->ins) == gcoval(&self)) {
+        setobj2s(T, res, &imval(o)->method);
+        setobj2s(T, res + 1, &self);
+    } else if (ttisusermethod(o) && obj2gco(umval(o)->ud) == gcoval(&self)) {
+        setobj2s(T, res, &umval(o)->method);
+        setobj2s(T, res + 1, &self);
+    } else
+        setnoself(T, res, o);
+}
+
+
 /*
 ** Executes a return hook for Tokudae and C functions and sets/corrects
 ** 'oldpc'. (Note that this correction is needed by the line hook, so it
@@ -754,19 +1103,36 @@ t_sinline CallFrame *prepcallframe(toku_State *T, SPtr func,
 }
 
 
+/* slot where the results of a call to 'func' go */
+#define resultslot(st,func)     ((func) - ((st) & CFST_NOSELF ? 1 : 0))
+
+
 /* move the results into correct place and return to caller */
 t_sinline void poscall(toku_State *T, CallFrame *cf, int32_t nres) {
     int32_t wanted = cf->nresults;
     if (t_unlikely(T->hookmask) && !hastocloseCfunc(wanted))
         rethook(T, cf, nres);
     /* move results to proper place */
-    moveresults(T, cf->func.p, nres, wanted);
+    moveresults(T, resultslot(cf->status, cf->func.p), nres, wanted);
     /* function cannot be in any of these cases when returning */
     toku_assert(!(cf->status & (CFST_HOOKED | CFST_FIN)));
     T->cf = cf->prev; /* back to caller (after closing variables) */
 }
 
 
+/*
+** Compile the body of 'f' that was skipped when its chunk was loaded in
+** lazy mode (see 'tokuP_compile'). Errors are raised as runtime errors
+** of the call. Returns 'func', as the stack might get reallocated.
+*/
+static SPtr compilebody(toku_State *T, SPtr func, Proto *f) {
+    ptrdiff_t funcr = savestack(T, func);
+    if (tokuPR_compile(T, f) != TOKU_STATUS_OK)
+        tokuD_errormsg(T);
+    return restorestack(T, funcr);
+}
+
+
 t_sinline int32_t precallC(toku_State *T, SPtr func,
                            uint32_t extra, int32_t nres, toku_CFunction f) {
     int32_t n;
@@ -841,8 +1207,11 @@ t_sinline uint32_t trymetacall(toku_State *T, SPtr func, uint32_t extra) {
     return incccall(extra);
 }
 
-CallFrame *precall(toku_State *T, SPtr func, int32_t nres) {
-    uint32_t extra = 0; /* extraargs + status */
+/*
+** Prepare a call to 'func'. 'extra' holds the initial status of the call
+** frame (CFST_NOSELF or 0).
+*/
+CallFrame *precall(toku_State *T, SPtr func, int32_t nres, uint32_t extra) {
 retry:
     switch (ttypetag(s2v(func))) {
         case TOKU_VCCL: /* C closure */
@@ -854,9 +1223,12 @@ retry:
         case TOKU_VTCL: { /* Tokudae closure */
             CallFrame *cf;
             Proto *f = clTval(s2v(func))->p;
-            int32_t narg = cast_i32(T->sp.p - func - 1); /* num. arguments */
-            int32_t nparams = f->arity; /* number of fixed parameters */
-            int32_t fsize = f->maxstack; /* frame size */
+            int32_t narg, nparams, fsize;
+            if (t_unlikely(f->lazy != NULL)) /* body not compiled yet? */
+                func = compilebody(T, func, f);
+            narg = cast_i32(T->sp.p - func - 1); /* num. arguments */
+            nparams = f->arity; /* number of fixed parameters */
+            fsize = f->maxstack; /* frame size */
             checkstackGCp(T, fsize, func);
             T->cf = cf = prepcallframe(T, func, extra, nres, func+1+fsize);
             cf->t.pc = cf->t.pcret = f->code; /* set starting point */
@@ -878,7 +1250,8 @@ retry:
         case TOKU_VCLASS: { /* Class object */
             if (!callclass(T, &func, extra)) { /* no __init? */
                 toku_assert(!hastocloseCfunc(nres));
-                moveresults(T, func, 1, nres); /* only instance is returned */
+                /* only instance is returned */
+                moveresults(T, resultslot(extra, func), 1, nres);
                 return NULL; /* done */
             }
             extra = inccinit(extra);
@@ -909,8 +1282,11 @@ retry:
             return precallC(T, func, extra, TOKU_MULTRET, lcfval(s2v(func)));
         case TOKU_VTCL: { /* Tokudae function */
             Proto *f = clTval(s2v(func))->p;
-            int32_t nparams = f->arity; /* number of fixed parameters */
-            int32_t fsize = f->maxstack; /* frame size */
+            int32_t nparams, fsize;
+            if (t_unlikely(f->lazy != NULL)) /* body not compiled yet? */
+                func = compilebody(T, func, f);
+            nparams = f->arity; /* number of fixed parameters */
+            fsize = f->maxstack; /* frame size */
             checkstackGCp(T, fsize - delta, func);
             cf->func.p -= delta; /* restore 'func' (if vararg) */
             /* move down function and arguments */
@@ -965,7 +1341,7 @@ t_sinline void ccall(toku_State *T, SPtr func, int32_t nres, uint32_t inc) {
         checkstackp(T, 0, func); /* free any use of EXTRA_STACK */
         tokuT_checkCstack(T);
     }
-    if ((cf = precall(T, func, nres)) != NULL) { /* Tokudae function? */
+    if ((cf = precall(T, func, nres, 0)) != NULL) { /* Tokudae function? */
         cf->status = CFST_FRESH; /* mark it as a "fresh" execute */
         tokuV_execute(T, cf); /* call it */
     }
@@ -993,6 +1369,74 @@ static void copy2buff(SPtr top, int32_t n, char *buff) {
 }
 
 
+/* create a string of length 'l' from the 'n' strings below 'top' */
+static OString *copystrings(toku_State *T, SPtr top, int32_t n, size_t l) {
+    OString *s;
+    if (l <= TOKUI_MAXSHORTLEN) { /* fits in a short string? */
+        char buff[TOKUI_MAXSHORTLEN];
+        copy2buff(top, n, buff);
+        s = tokuS_newl(T, buff, l);
+    } else { /* otherwise long string */
+        s = tokuS_newlngstrobj(T, l);
+        copy2buff(top, n, getstr(s));
+    }
+    return s;
+}
+
+
+/* strings that are parts of ropes by themselves */
+#define isropepart(s)   (strisrope(s) || getstrlen(s) >= TOKUI_MINROPELEN)
+
+
+/*
+** Concatenate the 'n' strings below 'top' into a rope, the result goes
+** in the place of the first string (where it is also kept while making
+** the rope). Runs of shorter strings are copied into a single part,
+** together with the short right part of the rope made so far if the
+** result is still short, so concatenating short strings to a rope one
+** at a time does not make a part for each of them.
+*/
+static void concatrope(toku_State *T, SPtr top, int32_t n) {
+    SPtr first = top - n;
+    OString *res = NULL;
+    int32_t i = 0;
+    do {
+        OString *s = strval(s2v(first + i));
+        if (isropepart(s)) {
+            res = (res == NULL) ? s : tokuS_newrope(T, res, s);
+            i++;
+        } else { /* run of short strings in [i, j) */
+            OString *tail = NULL;
+            size_t l = 0;
+            int32_t j = i;
+            do {
+                l += getstrlen(strval(s2v(first + j)));
+            } while (++j < n && !isropepart(strval(s2v(first + j))));
+            if (res != NULL && strisrope(res) && getrope(res)->left != NULL) {
+                tail = getrope(res)->right;
+                if (getstrlen(tail) + l >= TOKUI_MINROPELEN)
+                    tail = NULL; /* too long to merge */
+            }
+            if (tail != NULL) { /* merge 'tail' with the run? */
+                char buff[TOKUI_MINROPELEN];
+                size_t lt = getstrlen(tail);
+                memcpy(buff, getstr(tail), lt * sizeof(char));
+                copy2buff(first + j, j - i, buff + lt);
+                s = tokuS_newl(T, buff, lt + l);
+                setstrval2s(T, first + j - 1, s); /* anchor it */
+                res = tokuS_newrope(T, getrope(res)->left, s);
+            } else {
+                s = copystrings(T, first + j, j - i, l);
+                setstrval2s(T, first + j - 1, s); /* anchor it */
+                res = (res == NULL) ? s : tokuS_newrope(T, res, s);
+            }
+            i = j;
+        }
+        setstrval2s(T, first, res); /* anchor result */
+    } while (i < n);
+}
+
+
 void tokuV_concat(toku_State *T, int32_t total) {
     if (total == 1)
         return; /* done */
@@ -1016,16 +1460,11 @@ void tokuV_concat(toku_State *T, int32_t total) {
                 }
                 ltotal += len;
             }
-            OString *s;
-            if (ltotal <= TOKUI_MAXSHORTLEN) { /* fits in a short string? */
-                char buff[TOKUI_MAXSHORTLEN];
-                copy2buff(top, n, buff);
-                s = tokuS_newl(T, buff, ltotal);
-            } else { /* otherwise long string */
-                s = tokuS_newlngstrobj(T, ltotal);
-                copy2buff(top, n, getstr(s));
-            }
-            setstrval2s(T, top - n, s);
+            if (ltotal < TOKUI_MINROPELEN) { /* short result? */
+                OString *s = copystrings(T, top, n, ltotal);
+                setstrval2s(T, top - n, s);
+            } else /* otherwise make a rope */
+                concatrope(T, top, n);
         }
         total -= n - 1; /* got 'n' strings to create one new */
         T->sp.p -= n - 1; /* popped 'n' strings and pushed one */
@@ -1094,6 +1533,27 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
 }
 
 
+/* push new list with the elements of constant list 'k' */
+t_sinline void pushlistK(toku_State *T, const List *k) {
+    List *l = tokuA_new(T);
+    setlistval2s(T, T->sp.p++, l);
+    tokuA_fill(T, l, k->arr, k->len);
+}
+
+
+/* push new table with the keys and values in constant list 'k' */
+t_sinline void pushtableK(toku_State *T, const List *k) {
+    Table *t = tokuH_new(T);
+    settval2s(T, T->sp.p++, t);
+    tokuH_resize(T, t, cast_u32(k->len / 2));
+    for (int32_t i = 0; i < k->len; i += 2) {
+        tokuH_set(T, t, &k->arr[i], &k->arr[i + 1]);
+        tokuG_barrierback(T, obj2gco(t), &k->arr[i + 1]);
+    }
+    invalidateTMcache(t);
+}
+
+
 /* {======================================================================
 ** Macros for arithmetic/bitwise/comparison operations on numbers.
 ** ======================================================================= */
@@ -1225,6 +1685,54 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
 
 
 
+/*
+** Quicken binary opcode into 'qi' if both stack operands are integers
+** or into 'qf' if both are floats.
+*/
+#define quickbin(qi,qf) { \
+    const TValue *v1_ = peek(1); \
+    const TValue *v2_ = peek(0); \
+    if (ttisint(v1_) && ttisint(v2_)) setop(pc, qi); \
+    else if (ttisflt(v1_) && ttisflt(v2_)) setop(pc, qf); }
+
+
+/*
+** Quickened arithmetic operations with integer stack operands; if
+** operands are not integers anymore, rewrite the opcode back into
+** 'op' and continue at label 'l' (the original opcode).
+*/
+#define op_arithII(T,iop,op,l) { \
+    TValue *v1 = peek(1); \
+    TValue *v2 = peek(0); \
+    toku_Integer i1, i2; \
+    if (t_unlikely(!(ttisint(v1) && ttisint(v2)))) { \
+        setop(pc, op); \
+        goto l; \
+    } \
+    if (fetch_s()) t_swap(v1, v2); \
+    i1 = ival(v1); i2 = ival(v2); \
+    setival(peek(1), iop(T, i1, i2)); \
+    sp--; /* v2 */ \
+    pc += getopSize(OP_MBIN); }
+
+
+/* idem for float stack operands */
+#define op_arithFF(T,fop,op,l) { \
+    TValue *v1 = peek(1); \
+    TValue *v2 = peek(0); \
+    toku_Number n1, n2; \
+    if (t_unlikely(!(ttisflt(v1) && ttisflt(v2)))) { \
+        setop(pc, op); \
+        goto l; \
+    } \
+    if (fetch_s()) t_swap(v1, v2); \
+    n1 = fval(v1); n2 = fval(v2); \
+    setfval(peek(1), fop(T, n1, n2)); \
+    sp--; /* v2 */ \
+    pc += getopSize(OP_MBIN); }
+
+
+
 /*
 ** Bitwise operations
 */
@@ -1304,6 +1812,20 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
     setorderres(peek(1), cond, 1); sp--; }
 
 
+/* quickened order operations (see 'op_arithII') */
+#define op_orderQ(T,tt,val,cmp,op,l) { \
+    TValue *v1 = peek(1); \
+    TValue *v2 = peek(0); \
+    int32_t cond; \
+    if (t_unlikely(!(tt(v1) && tt(v2)))) { \
+        setop(pc, op); \
+        goto l; \
+    } \
+    if (fetch_s()) t_swap(v1, v2); \
+    cond = cmp(val(v1), val(v2)); \
+    setorderres(peek(1), cond, 1); sp--; }
+
+
 /* order operation error with immediate operand */
 #define op_orderI_error(T,v,imm) \
     { TValue v2; setival(&v2, imm); tokuD_ordererror(T, v, &v2); }
@@ -1336,6 +1858,9 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
 /* get reference to constant value from 'k' at index 'idx' */
 #define K(idx)          (k + (idx))
 
+/* get reference to inline cache at index 'idx' */
+#define IC(idx)         (cl->p->ic + (idx))
+
 /* get stack slot at index 'i_' */
 #define STK(i_)         (base+(i_))
 
@@ -1382,8 +1907,37 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
 #define checkGC(T)      tokuG_condGC(T, (void)0, updatetrap(cf))
 
 
+#if TOKU_JIT
+
+/*
+** Run native code of the running function from the opcode at 'pc' (if
+** it has native code for it); 'pc' is then the opcode where native
+** code stopped, which the interpreter executes next.
+*/
+#define jitenter() \
+    if (jitentry != NULL && jitentry[pc - cl->p->code] >= 0 && \
+            !trap && !G(T)->jitstop) { \
+        pc = tokuJ_execute(T, cf, pc, &sp); \
+        updatetrap(cf); }
+
+/* load entry map of the running function (see 'tokuJ_entry') */
+#define jitload()       (jitentry = tokuJ_entry(T, cl->p))
+
+/* count a loop iteration (see 'tokuJ_entry') */
+#define jitcount()      if (jitentry == NULL) jitload()
+
+#else
+
+#define jitenter()      ((void)0)
+#define jitload()       ((void)0)
+#define jitcount()      ((void)0)
+
+#endif
+
+
 /* fetch opcode */
 #define fetch() { \
+    jitenter(); \
     if (t_unlikely(trap)) { /* stack reallocation or hooks? */ \
         ptrdiff_t sizestack = sp - base; \
         trap = tokuD_traceexec(T, pc, sizestack); /* handle hooks */ \
@@ -1421,6 +1975,131 @@ t_sinline void pushtable(toku_State *T, int32_t b) {
 #define docondjump()    docondjumppre(((void)0))
 
 
+/* rewrite opcode of the current instruction ('pc' is past the opcode) */
+#define setop(pc,op)    (cast(uint8_t *, pc)[-1] = cast_u8(op))
+
+
+/* {======================================================================
+** Builtin iterators in 'foreach' loops
+** ======================================================================= */
+
+/* test if 'o' is the builtin iterator 'what' */
+#define isiterf(T,o,what)   (ttislcf(o) && lcfval(o) == G(T)->iterf[what])
+
+
+/* test if loop at 'stk' iterates over a list with 'indices' iterator */
+#define canforlist(T,stk) \
+        (isiterf(T, s2v((stk) + VAR_ITER), ITER_INDICES) && \
+         ttislist(s2v((stk) + VAR_STATE)) && ttisint(s2v((stk) + VAR_CNTL)))
+
+
+/*
+** Test if loop at 'stk' iterates over a table or an instance with
+** 'fields' iterator; the cursor is kept in the to-be-closed variable
+** slot, so that slot must be free.
+*/
+#define canfortable(T,stk) \
+        (isiterf(T, s2v((stk) + VAR_ITER), ITER_FIELDS) && \
+         (ttistable(s2v((stk) + VAR_STATE)) || \
+          ttisinstance(s2v((stk) + VAR_STATE))) && \
+         (ttisnil(s2v((stk) + VAR_TBC)) || ttisint(s2v((stk) + VAR_TBC))))
+
+
+/*
+** Loop step for 'canforlist', gets the same results as calling
+** 'auxindices' from tbaselib.c would. Returns new stack top.
+*/
+static SPtr forlist(SPtr stk, int32_t nvars) {
+    SPtr res = stk + VAR_N;
+    toku_Integer i = intop(+, ival(s2v(stk + VAR_CNTL)), 1);
+    int32_t n = 1;
+    tokuA_getindex(listval(s2v(stk + VAR_STATE)), i, s2v(res + 1));
+    if (ttisnil(s2v(res + 1))) /* end of list? */
+        setnilval(s2v(res));
+    else { /* otherwise index + value */
+        setival(s2v(res), i);
+        n = 2;
+    }
+    for (; n < nvars; n++) setnilval(s2v(res + n));
+    return res + nvars;
+}
+
+
+/*
+** Loop step for 'canfortable', gets the same results as calling
+** 'b_nextfield' from tbaselib.c would. Returns new stack top.
+*/
+static SPtr fortable(toku_State *T, SPtr stk, int32_t nvars) {
+    SPtr res = stk + VAR_N;
+    const TValue *o = s2v(stk + VAR_STATE);
+    TValue *cursor = s2v(stk + VAR_TBC);
+    uint32_t c = ttisint(cursor) ? cast_u32(ival(cursor)) : 0;
+    int32_t n = 1;
+    setobjs2s(T, res, stk + VAR_CNTL); /* previous key */
+    if (ttisinstance(o))
+        c = tokuSH_step(T, insval(o), res, c);
+    else
+        c = tokuH_step(T, tval(o), res, c);
+    if (c == 0) { /* no more fields? */
+        setnilval(s2v(res));
+        setnilval(cursor);
+    } else { /* otherwise key + value */
+        setival(cursor, cast_Integer(c));
+        n = 2;
+    }
+    for (; n < nvars; n++) setnilval(s2v(res + n));
+    return res + nvars;
+}
+
+
+/*
+** Prepare integer loop over 'range(start, stop, step)' at 'stk', where
+** the function and its arguments are (see 'b_range' in tbaselib.c).
+** The number of remaining iterations goes into the to-be-closed
+** variable slot (which can never hold an integer otherwise), followed
+** by the index and the step. Returns 0 if 'stk' does not hold builtin
+** 'range' or the arguments are not integers (or 'step' is 0); the loop
+** then calls the function as any other 'foreach' loop.
+*/
+static int32_t forprepi(toku_State *T, SPtr stk) {
+    const TValue *pstart = s2v(stk + 1);
+    const TValue *pstop = s2v(stk + 2);
+    const TValue *pstep = s2v(stk + 3);
+    toku_Integer start, stop, step;
+    toku_Unsigned count;
+    if (!isiterf(T, s2v(stk), ITER_RANGE) || !ttisint(pstart))
+        return 0;
+    else if (ttisnil(pstop)) { /* no stop? */
+        start = 0;
+        stop = ival(pstart);
+    } else if (ttisint(pstop)) {
+        start = ival(pstart);
+        stop = ival(pstop);
+    } else
+        return 0;
+    if (ttisnil(pstep)) /* no step? */
+        step = 1;
+    else if (ttisint(pstep) && ival(pstep) != 0)
+        step = ival(pstep);
+    else
+        return 0;
+    if (step > 0 ? start >= stop : start <= stop) /* empty range? */
+        count = 0;
+    else if (step > 0) /* (no overflows, as 'stop - start' fits unsigned) */
+        count = (t_castS2U(stop) - t_castS2U(start) - 1u) /
+                t_castS2U(step) + 1u;
+    else /* ('-(step + 1) + 1' avoids negating minimum integer) */
+        count = (t_castS2U(start) - t_castS2U(stop) - 1u) /
+                (t_castS2U(-(step + 1)) + 1u) + 1u;
+    setival(s2v(stk + 1), intop(-, start, step)); /* index before start */
+    setival(s2v(stk + 2), step);
+    setival(s2v(stk + VAR_TBC), t_castU2S(count));
+    return 1;
+}
+
+/* }====================================================================== */
+
+
 void tokuV_execute(toku_State *T, CallFrame *cf) {
     TClosure *cl;              /* active Tokudae function (closure) */
     TValue *k;                  /* constants */
@@ -1428,6 +2107,9 @@ void tokuV_execute(toku_State *T, CallFrame *cf) {
     SPtr sp;                    /* local stack pointer (for performance) */
     const uint8_t *pc;      /* program counter */
     int32_t trap;                   /* true if 'base' reallocated */
+#if TOKU_JIT
+    const int32_t *jitentry;        /* entry map of native code (or NULL) */
+#endif
 #if TOKU_USE_JUMPTABLE
 #include "tjmptable.h"
 #endif
@@ -1442,6 +2124,7 @@ returning: /* trap already set */
         trap = tokuD_tracecall(T, hookdelta());
     base = cf->func.p + 1;
     sp = T->sp.p;
+    jitload();
     /* main loop of interpreter */
     for (;;) {
         uint8_t I; /* opcode being executed */
@@ -1560,6 +2243,20 @@ returning: /* trap already set */
                 sp++;
                 vm_break;
             }
+            vm_case(OP_NEWLISTK) {
+                savestate(T);
+                pushlistK(T, listval(K(fetch_l())));
+                checkGC(T);
+                sp++;
+                vm_break;
+            }
+            vm_case(OP_NEWTABLEK) {
+                savestate(T);
+                pushtableK(T, listval(K(fetch_l())));
+                checkGC(T);
+                sp++;
+                vm_break;
+            }
             vm_case(OP_METHOD) {
                 int32_t hres;
                 Table *t = classval(peek(1))->methods;
@@ -1731,17 +2428,47 @@ returning: /* trap already set */
                 vm_break;
             }
             vm_case(OP_ADD) {
+            l_add:
+                quickbin(OP_ADDII, OP_ADDFF);
                 op_arith(T, iadd, tokui_numadd);
                 vm_break;
             }
             vm_case(OP_SUB) {
+            l_sub:
+                quickbin(OP_SUBII, OP_SUBFF);
                 op_arith(T, isub, tokui_numsub);
                 vm_break;
             }
             vm_case(OP_MUL) {
+            l_mul:
+                quickbin(OP_MULII, OP_MULFF);
                 op_arith(T, imul, tokui_nummul);
                 vm_break;
             }
+            vm_case(OP_ADDII) {
+                op_arithII(T, iadd, OP_ADD, l_add);
+                vm_break;
+            }
+            vm_case(OP_ADDFF) {
+                op_arithFF(T, tokui_numadd, OP_ADD, l_add);
+                vm_break;
+            }
+            vm_case(OP_SUBII) {
+                op_arithII(T, isub, OP_SUB, l_sub);
+                vm_break;
+            }
+            vm_case(OP_SUBFF) {
+                op_arithFF(T, tokui_numsub, OP_SUB, l_sub);
+                vm_break;
+            }
+            vm_case(OP_MULII) {
+                op_arithII(T, imul, OP_MUL, l_mul);
+                vm_break;
+            }
+            vm_case(OP_MULFF) {
+                op_arithFF(T, tokui_nummul, OP_MUL, l_mul);
+                vm_break;
+            }
             vm_case(OP_DIV) {
                 op_arithf(T, tokui_numdiv);
                 vm_break;
@@ -1794,7 +2521,12 @@ returning: /* trap already set */
                 TValue *v1 = peek(0);
                 const TValue *vk = K(fetch_l());
                 int32_t eq = fetch_s();
-                int32_t cond = tokuV_raweq(v1, vk);
+                int32_t cond;
+                if (t_unlikely(ttisropestring(v1))) {
+                    savestate(T);
+                    tokuS_flatvalue(T, v1);
+                }
+                cond = tokuV_raweq(v1, vk);
                 setorderres(v1, cond, eq);
                 vm_break;
             }
@@ -1840,13 +2572,33 @@ returning: /* trap already set */
                 vm_break;
             }
             vm_case(OP_LT) {
+            l_lt:
+                quickbin(OP_LTII, OP_LTFF);
                 op_order(T, ilt, LTnum, LTother);
                 vm_break;
             }
             vm_case(OP_LE) {
+            l_le:
+                quickbin(OP_LEII, OP_LEFF);
                 op_order(T, ile, LEnum, LEother);
                 vm_break;
             }
+            vm_case(OP_LTII) {
+                op_orderQ(T, ttisint, ival, ilt, OP_LT, l_lt);
+                vm_break;
+            }
+            vm_case(OP_LTFF) {
+                op_orderQ(T, ttisflt, fval, tokui_numlt, OP_LT, l_lt);
+                vm_break;
+            }
+            vm_case(OP_LEII) {
+                op_orderQ(T, ttisint, ival, ile, OP_LE, l_le);
+                vm_break;
+            }
+            vm_case(OP_LEFF) {
+                op_orderQ(T, ttisflt, fval, tokui_numle, OP_LE, l_le);
+                vm_break;
+            }
             vm_case(OP_EQPRESERVE) {
                 int32_t cond;
                 savestate(T);
@@ -1901,6 +2653,7 @@ returning: /* trap already set */
                 int32_t offset = fetch_l();
                 pc -= offset;
                 updatetrap(cf); /* for interrupt in tight loops */
+                jitcount();
                 vm_break;
             }
             vm_case(OP_TEST) {
@@ -1909,15 +2662,34 @@ returning: /* trap already set */
             vm_case(OP_TESTPOP) {
                 docondjumppre(sp--);
             }
+            vm_case(OP_SWITCH) {
+                TValue *sk = K(fetch_l());
+                int32_t miss = fetch_l();
+                Table *t = tval(sk);
+                TValue off;
+                if (t_unlikely(ttisropestring(peek(0)))) { /* (not a key) */
+                    savestate(T);
+                    tokuS_flatvalue(T, peek(0));
+                }
+                if (!tagisempty(tokuH_get(t, peek(0), &off)))
+                    pc += ival(&off); /* jump to the case body */
+                else
+                    pc += miss;
+                vm_break;
+            }
             vm_case(OP_CALL) {
                 CallFrame *newcf;
                 SPtr func;
                 int32_t nres;
+                uint32_t status = 0;
                 savestate(T);
                 func = STK(fetch_l());
                 nres = fetch_l() - 1;
-                UNUSED(fetch_s());
-                if ((newcf = precall(T, func, nres)) == NULL) /* C call? */
+                if ((fetch_s() & CALLSELF) && ttisnil(s2v(func))) {
+                    func++; /* not a method; function is in slot of 'self' */
+                    status = CFST_NOSELF;
+                }
+                if ((newcf = precall(T, func, nres, status)) == NULL) /* C? */
                     updatetrap(cf); /* done (C function already returned) */
                 else { /* Tokudae call */
                     cf->t.pcret = pc; /* after return, continue at 'pc' */
@@ -1930,13 +2702,16 @@ returning: /* trap already set */
             }
             vm_case(OP_TAILCALL) {
                 Proto *p = cl->p;
-                int32_t nres, delta;
+                int32_t nres, delta, flags;
                 SPtr func;
                 savestate(T);
                 func = STK(fetch_l());
                 nres = fetch_l() - 1;
                 delta = (p->isvararg) ? cf->t.nvarargs + p->arity + 1 : 0;
-                if (fetch_s()) { /* close upvalues? */
+                flags = fetch_s();
+                if ((flags & CALLSELF) && ttisnil(s2v(func)))
+                    func++; /* not a method; function is in slot of 'self' */
+                if (flags & CALLCLOSE) { /* close upvalues? */
                     tokuF_closeupval(T, base);
                     toku_assert(T->tbclist.p < base); /* no tbc variables */
                     toku_assert(base == cf->func.p + 1);
@@ -1979,6 +2754,33 @@ returning: /* trap already set */
                 sp--;
                 vm_break;
             }
+            vm_case(OP_ARITHLL) {
+                /* 'ia' is the arithmetic opcode after the second local */
+                const uint8_t *ia = pc + SIZE_ARG_L + getopSize(OP_GETLOCAL);
+                TValue *v1 = s2v(STK(get3bytes(pc)));
+                TValue *v2 = s2v(STK(get3bytes(ia - SIZE_ARG_L)));
+                int32_t op = getopOrig(*ia);
+                toku_assert(op == OP_ADD || op == OP_SUB || op == OP_MUL);
+                if (GET_ARG_S(ia, 0)) t_swap(v1, v2);
+                if (ttisint(v1) && ttisint(v2)) {
+                    toku_Integer i1 = ival(v1), i2 = ival(v2);
+                    setival(s2v(sp), (op == OP_ADD) ? iadd(T, i1, i2)
+                                   : (op == OP_SUB) ? isub(T, i1, i2)
+                                   : imul(T, i1, i2));
+                } else if (ttisflt(v1) && ttisflt(v2)) {
+                    toku_Number n1 = fval(v1), n2 = fval(v2);
+                    setfval(s2v(sp), (op == OP_ADD) ? tokui_numadd(T, n1, n2)
+                                   : (op == OP_SUB) ? tokui_numsub(T, n1, n2)
+                                   : tokui_nummul(T, n1, n2));
+                } else { /* otherwise work as OP_GETLOCAL */
+                    setobjs2s(T, sp, STK(fetch_l()));
+                    sp++;
+                    vm_break;
+                }
+                sp++;
+                pc = ia + getopSize(OP_ADD) + getopSize(OP_MBIN);
+                vm_break;
+            }
             vm_case(OP_GETUVAL) {
                 setobj2s(T, sp, cl->upvals[fetch_l()]->v.p);
                 sp++;
@@ -2019,113 +2821,244 @@ returning: /* trap already set */
             vm_case(OP_SETPROPERTY) {
                 TValue *o;
                 TValue *prop;
+                InlineCache *ic;
                 savestate(T);
                 o = peek(fetch_l());
                 prop = K(fetch_l());
+                ic = IC(fetch_l());
                 toku_assert(ttisstring(prop));
-                tokuV_setstr(T, o, prop, peek(0));
+                icsetstr(T, ic, o, prop, peek(0));
                 updatetrap(cf);
                 sp--;
                 vm_break;
             }
             vm_case(OP_GETPROPERTY) {
                 TValue *prop;
+                InlineCache *ic;
                 savestate(T);
                 prop = K(fetch_l());
+                ic = IC(fetch_l());
                 toku_assert(ttisstring(prop));
-                tokuV_getstr(T, peek(0), prop, sp - 1);
+                icgetstr(T, ic, peek(0), prop, sp - 1);
                 updatetrap(cf);
                 vm_break;
             }
-            vm_case(OP_GETINDEX) {
+            vm_case(OP_GETMETHOD) {
+                TValue *prop;
+                InlineCache *ic;
                 savestate(T);
-                tokuV_get(T, peek(1), peek(0), sp - 2);
+                prop = K(fetch_l());
+                ic = IC(fetch_l());
+                toku_assert(ttisstring(prop));
+                getmethod(T, ic, peek(0), prop, sp - 1);
                 updatetrap(cf);
+                sp++;
+                vm_break;
+            }
+            vm_case(OP_GETINDEX) {
+            l_getindex: {
+                TValue *o;
+                TValue *k;
+                savestate(T);
+                o = peek(1);
+                k = peek(0);
+                if (ttislist(o) && ttisint(k)) /* list index? */
+                    setop(pc, OP_GETINDEXLIST);
+                if (ttistable(o) && ttisint(k) && arraykey(tval(o), ival(k))) {
+                    getarrayslot(T, tval(o), ival(k), sp - 2);
+                } else {
+                    tokuV_get(T, o, k, sp - 2);
+                    updatetrap(cf);
+                }
+                sp--;
+                vm_break;
+            }}
+            vm_case(OP_GETINDEXLIST) {
+                TValue *o = peek(1);
+                TValue *k = peek(0);
+                if (t_unlikely(!(ttislist(o) && ttisint(k)))) {
+                    setop(pc, OP_GETINDEX);
+                    goto l_getindex;
+                }
+                tokuA_getindex(listval(o), ival(k), o);
                 sp--;
                 vm_break;
             }
             vm_case(OP_SETINDEX) {
                 SPtr os;
+                TValue *o;
+                TValue *k;
                 savestate(T);
                 os = stkpeek(fetch_l());
-                tokuV_set(T, s2v(os), s2v(os+1), peek(0));
-                updatetrap(cf);
+                o = s2v(os);
+                k = s2v(os + 1);
+                if (ttistable(o) && ttisint(k) && arraykey(tval(o), ival(k))) {
+                    setarrayslot(T, tval(o), ival(k), peek(0));
+                } else {
+                    tokuV_set(T, o, k, peek(0));
+                    updatetrap(cf);
+                }
                 sp--;
                 vm_break;
             }
             vm_case(OP_GETINDEXSTR) {
                 TValue *i;
+                InlineCache *ic;
                 savestate(T);
                 i = K(fetch_l());
+                ic = IC(fetch_l());
                 toku_assert(ttisstring(i));
-                tokuV_getstr(T, peek(0), i, sp - 1);
+                icgetstr(T, ic, peek(0), i, sp - 1);
                 updatetrap(cf);
                 vm_break;
             }
             vm_case(OP_SETINDEXSTR) {
                 TValue *o;
                 TValue *idx;
+                InlineCache *ic;
                 savestate(T);
                 o = peek(fetch_l());
                 idx = K(fetch_l());
+                ic = IC(fetch_l());
                 toku_assert(ttisstring(idx));
-                tokuV_setstr(T, o, idx, peek(0));
+                icsetstr(T, ic, o, idx, peek(0));
+                updatetrap(cf);
+                sp--;
+                vm_break;
+            }
+            vm_case(OP_GETINDEXUP) {
+                const TValue *o;
+                const TValue *slot;
+                TValue *key;
+                InlineCache *ic;
+                o = cl->upvals[fetch_l()]->v.p;
+                key = K(fetch_l());
+                ic = IC(fetch_l());
+                toku_assert(ttisstring(key));
+                if (ttistable(o) &&
+                        (slot = icprobe(ic, tval(o), strval(key))) != NULL) {
+                    ichit(T); /* fast path (cached global) */
+                    setobj2s(T, sp, slot);
+                    sp++;
+                } else {
+                    setnilval(s2v(sp)); /* slot for the result */
+                    sp++;
+                    savestate(T);
+                    icgetstr(T, ic, o, key, sp - 1);
+                    updatetrap(cf);
+                }
+                vm_break;
+            }
+            vm_case(OP_SETINDEXUP) {
+                TValue *o;
+                TValue *key;
+                InlineCache *ic;
+                savestate(T);
+                o = cl->upvals[fetch_l()]->v.p;
+                key = K(fetch_l());
+                ic = IC(fetch_l());
+                toku_assert(ttisstring(key));
+                icsetstr(T, ic, o, key, peek(0));
                 updatetrap(cf);
                 sp--;
                 vm_break;
             }
             vm_case(OP_GETINDEXINT) {
-                TValue i;
+            l_getindexint: {
+                TValue *o;
                 int32_t imm;
                 savestate(T);
+                o = peek(0);
+                if (ttislist(o)) /* list index? */
+                    setop(pc, OP_GETINDEXINTLIST);
                 imm = fetch_s();
-                setival(&i, IMM(imm));
-                tokuV_getint(T, peek(0), &i, sp - 1);
-                updatetrap(cf);
+                imm = IMM(imm);
+                if (ttistable(o) && arraykey(tval(o), imm)) {
+                    getarrayslot(T, tval(o), imm, sp - 1);
+                } else {
+                    TValue i;
+                    setival(&i, imm);
+                    tokuV_getint(T, o, &i, sp - 1);
+                    updatetrap(cf);
+                }
+                vm_break;
+            }}
+            vm_case(OP_GETINDEXINTLIST) {
+                TValue *o = peek(0);
+                int32_t imm;
+                if (t_unlikely(!ttislist(o))) {
+                    setop(pc, OP_GETINDEXINT);
+                    goto l_getindexint;
+                }
+                imm = fetch_s();
+                imm = IMM(imm);
+                tokuA_getindex(listval(o), imm, o);
                 vm_break;
             }
             vm_case(OP_GETINDEXINTL) {
-                TValue i;
+                TValue *o;
                 int32_t imm;
                 savestate(T);
+                o = peek(0);
                 imm = fetch_l();
-                setival(&i, IMML(imm));
-                tokuV_getint(T, peek(0), &i, sp - 1);
-                updatetrap(cf);
+                imm = IMML(imm);
+                if (ttistable(o) && arraykey(tval(o), imm)) {
+                    getarrayslot(T, tval(o), imm, sp - 1);
+                } else {
+                    TValue i;
+                    setival(&i, imm);
+                    tokuV_getint(T, o, &i, sp - 1);
+                    updatetrap(cf);
+                }
                 vm_break;
             }
             vm_case(OP_SETINDEXINT) {
                 TValue *o;
-                toku_Integer imm;
-                TValue index;
+                int32_t imm;
                 savestate(T);
                 o = peek(fetch_l());
                 imm = fetch_s();
-                setival(&index, IMM(imm));
-                tokuV_setint(T, o, &index, peek(0));
-                updatetrap(cf);
+                imm = IMM(imm);
+                if (ttistable(o) && arraykey(tval(o), imm)) {
+                    setarrayslot(T, tval(o), imm, peek(0));
+                } else {
+                    TValue index;
+                    setival(&index, imm);
+                    tokuV_setint(T, o, &index, peek(0));
+                    updatetrap(cf);
+                }
                 sp--;
                 vm_break;
             }
             vm_case(OP_SETINDEXINTL) {
                 TValue *o;
-                toku_Integer imm;
-                TValue index;
+                int32_t imm;
                 savestate(T);
                 o = peek(fetch_l());
                 imm = fetch_l();
-                setival(&index, IMML(imm));
-                tokuV_setint(T, o, &index, peek(0));
-                updatetrap(cf);
+                imm = IMML(imm);
+                if (ttistable(o) && arraykey(tval(o), imm)) {
+                    setarrayslot(T, tval(o), imm, peek(0));
+                } else {
+                    TValue index;
+                    setival(&index, imm);
+                    tokuV_setint(T, o, &index, peek(0));
+                    updatetrap(cf);
+                }
                 sp--;
                 vm_break;
             }
             vm_case(OP_GETSUP) {
                 TValue *key;
+                InlineCache *ic;
                 savestate(T);
                 key = K(fetch_l());
+                ic = IC(fetch_l());
                 toku_assert(ttisstring(key));
-                checksuperprop(T, peek(0), strval(key), sp-1, tokuH_getstr);
+                if (t_likely(checksuper(T, peek(0), 0, sp-1)))
+                    icgetsuper(T, ic, insval(peek(0)), strval(key), sp-1);
+                else
+                    tokuD_runerror(T, "class instance has no superclass");
                 vm_break;
             }
             vm_case(OP_GETSUPIDX) {
@@ -2154,7 +3087,11 @@ returning: /* trap already set */
                 pc += offset;
                 /* go to the next opcode */
                 I = *(pc++);
-                toku_assert(I == OP_FORCALL);
+                toku_assert(isforcall(I));
+                if (I == OP_FORLIST)
+                    goto l_forlist;
+                else if (I == OP_FORTABLE)
+                    goto l_fortable;
                 goto l_forcall;
             }
             vm_case(OP_FORCALL) {
@@ -2163,9 +3100,16 @@ returning: /* trap already set */
                  * invariant state 'stk + 2' is the control variable, and
                  * 'stk + 3' is the to-be-closed variable. Call uses stack
                  * after these values (starting at 'stk + 4'). */
-                SPtr stk;
+                SPtr stk = STK(get3bytes(pc));
+                if (canforlist(T, stk)) { /* builtin list iterator? */
+                    setop(pc, OP_FORLIST);
+                    goto l_forlist;
+                } else if (canfortable(T, stk)) { /* builtin fields iter.? */
+                    setop(pc, OP_FORTABLE);
+                    goto l_fortable;
+                }
                 savestate(T);
-                stk = STK(fetch_l());
+                pc += SIZE_ARG_L; /* skip 'stk' */
                 /* copy function, state and control variable */
                 setobjs2s(T, stk + VAR_N + VAR_ITER, stk + VAR_ITER);
                 setobjs2s(T, stk + VAR_N + VAR_STATE, stk + VAR_STATE);
@@ -2181,6 +3125,35 @@ returning: /* trap already set */
                 toku_assert(I == OP_FORLOOP);
                 goto l_forloop;
             }}
+            vm_case(OP_FORLIST) {
+            l_forlist: {
+                SPtr stk = STK(get3bytes(pc));
+                if (t_unlikely(!canforlist(T, stk))) { /* not anymore? */
+                    setop(pc, OP_FORCALL); /* back to generic call */
+                    goto l_forcall;
+                }
+                pc += SIZE_ARG_L; /* skip 'stk' */
+                sp = forlist(stk, fetch_l());
+                /* go to the next opcode */
+                I = *(pc++);
+                toku_assert(I == OP_FORLOOP);
+                goto l_forloop;
+            }}
+            vm_case(OP_FORTABLE) {
+            l_fortable: {
+                SPtr stk = STK(get3bytes(pc));
+                if (t_unlikely(!canfortable(T, stk))) { /* not anymore? */
+                    setop(pc, OP_FORCALL); /* back to generic call */
+                    goto l_forcall;
+                }
+                savestate(T);
+                pc += SIZE_ARG_L; /* skip 'stk' */
+                sp = fortable(T, stk, fetch_l());
+                /* go to the next opcode */
+                I = *(pc++);
+                toku_assert(I == OP_FORLOOP);
+                goto l_forloop;
+            }}
             vm_case(OP_FORLOOP) {
             l_forloop: {
                 SPtr stk = STK(fetch_l());
@@ -2190,10 +3163,78 @@ returning: /* trap already set */
                     /* save control variable (first iterator result) */
                     setobjs2s(T, stk + VAR_CNTL, stk + VAR_N + VAR_ITER);
                     pc -= offset; /* jump back to loop body */
+                    jitcount();
                 } else /* otherwise leave the loop (fall through) */
                     sp -= nvars; /* remove leftover vars from previous call */
                 vm_break;
             }}
+            vm_case(OP_FORPREPI) {
+                int32_t nstk, offset, nargs;
+                savestate(T);
+                nstk = fetch_l();
+                offset = fetch_l();
+                nargs = fetch_l();
+                if (!forprepi(T, STK(nstk))) { /* not builtin 'range'? */
+                    T->sp.p = STK(nstk) + nargs + 1;
+                    tokuV_call(T, STK(nstk), VAR_N); /* do the call */
+                    updatetrap(cf);
+                    updatestack(cf); /* stack may have changed */
+                    sp = T->sp.p; /* correct sp for next opcode */
+                    /* create to-be-closed upvalue (if any) */
+                    tokuF_newtbcvar(T, STK(nstk) + VAR_TBC);
+                }
+                pc += offset;
+                /* go to the next opcode */
+                I = *(pc++);
+                toku_assert(I == OP_FORLOOPI);
+                goto l_forloopi;
+            }
+            vm_case(OP_FORLOOPI) {
+            l_forloopi: {
+                SPtr stk = STK(get3bytes(pc));
+                int32_t offset, nvars;
+                if (ttisint(s2v(stk + VAR_TBC))) { /* integer loop? */
+                    toku_Unsigned count = t_castS2U(ival(s2v(stk + VAR_TBC)));
+                    pc += SIZE_ARG_L; /* skip 'stk' */
+                    offset = fetch_l();
+                    nvars = fetch_l();
+                    if (count > 0) { /* more iterations? */
+                        toku_Integer i = intop(+, ival(s2v(stk + 1)),
+                                                  ival(s2v(stk + 2)));
+                        setival(s2v(stk + VAR_TBC), t_castU2S(count - 1));
+                        setival(s2v(stk + 1), i); /* update index */
+                        setival(s2v(stk + VAR_N), i); /* and loop variable */
+                        sp = stk + VAR_N + 1;
+                        while (--nvars > 0) setnilval(s2v(sp++));
+                        pc -= offset; /* jump back to loop body */
+                        jitcount();
+                    } else /* otherwise leave the loop */
+                        sp = stk + VAR_N;
+                } else { /* otherwise 'range' is not builtin */
+                    int32_t nstk;
+                    savestate(T);
+                    nstk = fetch_l();
+                    offset = fetch_l();
+                    nvars = fetch_l();
+                    /* copy function, state and control variable */
+                    setobjs2s(T, stk + VAR_N + VAR_ITER, stk + VAR_ITER);
+                    setobjs2s(T, stk + VAR_N + VAR_STATE, stk + VAR_STATE);
+                    setobjs2s(T, stk + VAR_N + VAR_CNTL, stk + VAR_CNTL);
+                    T->sp.p = stk + VAR_N + VAR_CNTL + 1;
+                    tokuV_call(T, stk + VAR_N + VAR_ITER, nvars);
+                    updatetrap(cf);
+                    updatestack(cf); /* stack may have changed */
+                    sp = T->sp.p; /* correct sp for next opcode */
+                    stk = STK(nstk);
+                    if (!ttisnil(s2v(stk + VAR_N))) { /* continue loop? */
+                        /* save control variable (first iterator result) */
+                        setobjs2s(T, stk + VAR_CNTL, stk + VAR_N + VAR_ITER);
+                        pc -= offset; /* jump back to loop body */
+                    } else /* otherwise leave the loop */
+                        sp -= nvars; /* remove leftover vars */
+                }
+                vm_break;
+            }}
             vm_case(OP_RETURN) {
                 SPtr stk;
                 int32_t nres; /* number of results */
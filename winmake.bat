@@ -8,6 +8,9 @@ setlocal enabledelayedexpansion
 :: -DTOKUI_HARDMEMTESTS => Forces a full collection at all points where the collector can run.
 :: -DTOKUI_HARDSTACKTESTS => Forces a reallocation of the stack at every point where the stack can be reallocated.
 
+:: Alternative implementations:
+:: -DTOKUI_SWISSTABLE => Use open addressing (Swiss table) for the hash part of tables instead of the chained scatter table.
+
 :: Recommended macro to define for debug builds
 :: -TOKU_USE_APICHECK => enables asserts in the API (consistency checks)
 
@@ -54,7 +57,7 @@ set CMCFLAGS=
 set CORE_O=src\tapi.obj src\tlist.obj src\tcode.obj src\tdebug.obj src\tfunction.obj
 set CORE_O=!CORE_O! src\tgc.obj src\ttable.obj src\tlexer.obj src\tmem.obj src\tmeta.obj
 set CORE_O=!CORE_O! src\tobject.obj src\tparser.obj src\tvm.obj src\tprotected.obj
-set CORE_O=!CORE_O! src\treader.obj src\tstate.obj src\tstring.obj src\tmarshal.obj
+set CORE_O=!CORE_O! src\treader.obj src\tstate.obj src\tstring.obj src\tmarshal.obj src\tshape.obj src\tjit.obj
 set LIB_O=src\tokudaeaux.obj src\tbaselib.obj src\tloadlib.obj src\tokudaelib.obj src\tstrlib.obj
 :: Standard library object files
 set LIB_O=!LIB_O! src\tmathlib.obj src\tiolib.obj src\toslib.obj src\treglib.obj src\tdblib.obj